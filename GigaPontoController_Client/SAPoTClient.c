@@ -1,6 +1,6 @@
 
 /*
-* SAPoTClient.c define as funções e subrotinas do protocolo SAPoT
+* SAPoTClient.c define as funções e subrotinas do protocolo SAPoT (libsapotclient)
 *
 *
 *   
@@ -15,35 +15,59 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <MQTTClient.h>
 #include "SAPoTClient.h"
 
-/* Global Objects */
-SAPoTClient* handle;
-SAPoTClient_create_options* opts;
-
 /* Function's prototype */
+static uint64_t SAPoTClient_now();
+static void SAPoTClient_complete(SAPoTClient* handle);
+static void SAPoTClient_finish(SAPoTClient* handle, bool all, int status);
+static void* SAPoTClient_timer(void* context);
+static void SAPoTClient_future_done(SAPoTClient* handle, const SAPoTClient_request* request, int status, const uint8_t* message, int messageLen);
 
 
 /**
 * [Principal] SAPoTClient_begin
 *
 */
-int SAPoTClient_begin(SAPoTClient* clientHandle, SAPoTClient_create_options* optsHandle, const char* clientId){
+int SAPoTClient_begin(SAPoTClient* handle, SAPoTClient_create_options* opts, const char* clientId){
 
   //puts(" Starting a SAPoT Client ...");
-  
-  /* Atribuição aos objetos globais */
-  opts = (SAPoTClient_create_options*) optsHandle;
-  handle = (SAPoTClient*) clientHandle;
 
   /*Inicializa o objeto do tipo SAPoTClient*/
   handle->id = clientId;
   handle->error = SAPOTCLIENT_SUCCESS;
-  handle->inLoop = true;
+  handle->inLoop = false;
+  handle->opts = *opts;
   handle->inMessage = NULL;
-  handle->outMessage = NULL;
   handle->header = NULL;
+  handle->MQTTclient = NULL;
+  handle->watchTopic[0] = '\0';
+  handle->watch = NULL;
+  handle->watchContext = NULL;
+
+  /*Requisições pendentes*/
+  handle->serial = 0;
+  handle->timeout = SAPOTCLIENT_TIMEOUT;
+  handle->window = SAPOTCLIENT_PENDING;
+  memset(handle->pending, 0, sizeof(handle->pending));
+  handle->inFlight = 0;
+  handle->publishing = 0;
+  handle->answered = 0;
+  handle->expired = 0;
+  handle->latencySum = 0;
+  handle->latencyMin = UINT64_MAX;
+  handle->latencyMax = 0;
+  pthread_mutex_init(&handle->lock, NULL);
+  pthread_condattr_t condAttr;
+  pthread_condattr_init(&condAttr);
+  pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+  pthread_cond_init(&handle->done, &condAttr);
+  pthread_condattr_destroy(&condAttr);
   
   /*puts("SAPoT Client create options: ");
   printf("\t Central ID = %s\n", opts->centralId);
@@ -55,10 +79,12 @@ int SAPoTClient_begin(SAPoTClient* clientHandle, SAPoTClient_create_options* opt
   
   //Iniciando protocolo de transmissão
   if(opts->transmissionProtocol == UNDEFINED){
-    puts("Undefined Transmission Protocol. The function SAPoTClient_loop() cannot be used.");
+    puts("Undefined Transmission Protocol. Messages must be delivered with SAPoTClient_unpack_message().");
   }
   else if(opts->transmissionProtocol == MQTT){ 
-    if(MQTTconnect() != SAPOTCLIENT_SUCCESS){
+    if(MQTTconnect(handle) != SAPOTCLIENT_SUCCESS){
+      //MQTTconnect() mantém o cliente criado para as reconexões, mas sem a thread de expiração SAPoTClient_end() não o destrói
+      if(handle->MQTTclient != NULL) MQTTClient_destroy(&handle->MQTTclient);
       handle->error = ERROR_STARTING_TRANSMISSION_PROTOCOL;
       return SAPOTCLIENT_FAILURE;
     }
@@ -68,7 +94,18 @@ int SAPoTClient_begin(SAPoTClient* clientHandle, SAPoTClient_create_options* opt
     handle->error = ERROR_SETTING_TRANSMISSION_PROTOCOL;
     return SAPOTCLIENT_FAILURE;
   } 
-  
+
+  //Iniciando a thread de expiração das requisições e de reconexão
+  handle->inLoop = true;
+  if(pthread_create(&handle->timer, NULL, SAPoTClient_timer, handle) != 0){
+    handle->inLoop = false;
+    if(handle->MQTTclient != NULL){
+      MQTTClient_disconnect(handle->MQTTclient, 1000);
+      MQTTClient_destroy(&handle->MQTTclient);
+    }
+    handle->error = ERROR_STARTING_TRANSMISSION_PROTOCOL;
+    return SAPOTCLIENT_FAILURE;
+  }
     
   return SAPOTCLIENT_SUCCESS;
 
@@ -78,31 +115,223 @@ int SAPoTClient_begin(SAPoTClient* clientHandle, SAPoTClient_create_options* opt
 * [Principal] SAPoTClient_end
 *
 */
-void SAPoTClient_end(){
+void SAPoTClient_end(SAPoTClient* handle){
 
-  //Fechando conexão com o server MQTT
+  //Encerrando a thread de expiração
+  pthread_mutex_lock(&handle->lock);
+  bool running = handle->inLoop;
   handle->inLoop = false;
-  MQTTClient_disconnect(handle->MQTTclient, 10000);
-  //MQTTClient_destroy(handle->MQTTclient);
-  sleep(1);
-  exit(1);
+  pthread_mutex_unlock(&handle->lock);
+  if(running == false) return;
+
+  pthread_join(handle->timer, NULL);
+
+  //Concluindo as requisições que não serão mais respondidas (o sinal também libera as threads que aguardam a janela)
+  SAPoTClient_finish(handle, true, SAPOTCLIENT_FAILURE);
+
+  //Aguardando as publicações em andamento, que ainda utilizam o cliente MQTT
+  pthread_mutex_lock(&handle->lock);
+  while(handle->publishing > 0) pthread_cond_wait(&handle->done, &handle->lock);
+  pthread_mutex_unlock(&handle->lock);
+
+  //Fechando conexão com o server MQTT
+  if(handle->MQTTclient != NULL){
+    MQTTClient_disconnect(handle->MQTTclient, 1000);
+    MQTTClient_destroy(&handle->MQTTclient);
+  }
 
 }
 
 /**
-* [Principal] SAPoTClient_loop
+* [Principal] SAPoTClient_request_async
 *
 */
+int SAPoTClient_request_async(SAPoTClient* handle, void* message, int messageLen, const char* command,
+  void (*callback)(SAPoTClient* handle, const SAPoTClient_request* request, int status, const uint8_t* message, int messageLen), void* context){
+
+  SAPoTMessage_header* header = (SAPoTMessage_header*) message;
 
-int SAPoTClient_loop(){
+  pthread_mutex_lock(&handle->lock);
 
-  //printf("SAPoTClient_loop \n");
-  while(handle->inLoop == true){
-    MQTTconnect();
-    usleep(500000);
+  if(handle->inLoop == false){
+    pthread_mutex_unlock(&handle->lock);
+    return SAPOTCLIENT_FAILURE;
   }
 
-  return 1;
+  //Limitando as requisições em trânsito à janela (e à capacidade da tabela de pendentes)
+  int window = (handle->window < 1 || handle->window > SAPOTCLIENT_PENDING) ? SAPOTCLIENT_PENDING : handle->window;
+  while(handle->inLoop && handle->inFlight >= window) pthread_cond_wait(&handle->done, &handle->lock);
+
+  //SAPoTClient_end() pode ter sido evocado durante a espera
+  if(handle->inLoop == false){
+    pthread_mutex_unlock(&handle->lock);
+    return SAPOTCLIENT_FAILURE;
+  }
+
+  //Atribuindo o próximo serial cuja posição na tabela esteja livre (o serial 0 não é utilizado)
+  do{
+    handle->serial++;
+  }while(handle->serial == 0 || handle->pending[handle->serial & (SAPOTCLIENT_PENDING-1)].active);
+
+  uint16_t serial = handle->serial;
+  SAPoTClient_request* request = &handle->pending[serial & (SAPOTCLIENT_PENDING-1)];
+  request->active = true;
+  request->serial = serial;
+  request->instruction = header->instruction;
+  request->latency = 0;
+  snprintf(request->command, sizeof(request->command), "%s", command != NULL ? command : "");
+  request->callback = callback;
+  request->context = context;
+  header->serial = serial;
+  handle->inFlight++;
+
+  //O registro precede a publicação: a resposta pode chegar antes do retorno de MQTTpublish()
+  request->sent = SAPoTClient_now();
+  handle->publishing++;
+
+  pthread_mutex_unlock(&handle->lock);
+
+  int published = MQTTpublish(handle, handle->opts.centralId, message, messageLen);
+
+  pthread_mutex_lock(&handle->lock);
+  handle->publishing--;
+  if(published != SAPOTCLIENT_SUCCESS && request->active && request->serial == serial){
+    request->active = false;
+    handle->inFlight--;
+  }
+  pthread_cond_broadcast(&handle->done);
+  pthread_mutex_unlock(&handle->lock);
+
+  return (published == SAPOTCLIENT_SUCCESS) ? serial : SAPOTCLIENT_FAILURE;
+
+}
+
+/**
+* [Principal] SAPoTClient_request_future
+*
+*/
+int SAPoTClient_request_future(SAPoTClient* handle, void* message, int messageLen, const char* command, SAPoTClient_future* future){
+
+  memset(future, 0, sizeof(SAPoTClient_future));
+
+  int serial = SAPoTClient_request_async(handle, message, messageLen, command, SAPoTClient_future_done, future);
+  if(serial == SAPOTCLIENT_FAILURE){
+    future->done = true;
+    future->status = SAPOTCLIENT_FAILURE;
+  }
+  else future->serial = serial;
+
+  return serial;
+
+}
+
+/**
+* [Principal] SAPoTClient_future_wait
+*
+*/
+int SAPoTClient_future_wait(SAPoTClient* handle, SAPoTClient_future* future){
+
+  pthread_mutex_lock(&handle->lock);
+  while(future->done == false) pthread_cond_wait(&handle->done, &handle->lock);
+  pthread_mutex_unlock(&handle->lock);
+
+  return future->status;
+
+}
+
+/**
+* [Principal] SAPoTClient_future_release
+*
+*/
+void SAPoTClient_future_release(SAPoTClient_future* future){
+
+  free(future->reply);
+  future->reply = NULL;
+  future->replyLen = 0;
+
+}
+
+/**
+* [Principal] SAPoTClient_wait
+*
+*/
+void SAPoTClient_wait(SAPoTClient* handle, int maxInFlight){
+
+  pthread_mutex_lock(&handle->lock);
+  while(handle->inFlight > maxInFlight) pthread_cond_wait(&handle->done, &handle->lock);
+  pthread_mutex_unlock(&handle->lock);
+
+}
+
+/**
+* [Principal] SAPoTClient_watch
+*
+*/
+int SAPoTClient_watch(SAPoTClient* handle, const char* topic,
+  void (*callback)(SAPoTClient* handle, const char* topic, const uint8_t* message, int messageLen, void* context), void* context){
+
+  if(strlen(topic) >= sizeof(handle->watchTopic)){
+    handle->error = SAPOTCLIENT_FAILURE;
+    return SAPOTCLIENT_FAILURE;
+  }
+
+  //A rotina é definida antes da assinatura: a primeira mensagem pode chegar antes do retorno de MQTTClient_subscribe()
+  handle->watch = callback;
+  handle->watchContext = context;
+  snprintf(handle->watchTopic, sizeof(handle->watchTopic), "%s", topic);
+
+  if(handle->opts.transmissionProtocol == MQTT && MQTTClient_subscribe(handle->MQTTclient, handle->watchTopic, 0) != MQTTCLIENT_SUCCESS){
+    handle->error = ERROR_STARTING_TRANSMISSION_PROTOCOL;
+    return SAPOTCLIENT_FAILURE;
+  }
+
+  return SAPOTCLIENT_SUCCESS;
+
+}
+
+/**
+* [Principal] SAPoTClient_forward
+*
+*/
+int SAPoTClient_forward(const char* socketPath, void* message, int messageLen, uint8_t** reply, int* replyLen){
+
+  //Conectando ao gpcd: se o socket não existir ou ninguém o atender, o solicitante se conecta diretamente ao broker
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0){
+    if(fd >= 0) close(fd);
+    return ERROR_STARTING_TRANSMISSION_PROTOCOL;
+  }
+
+  //Enviando a requisição e bloqueando até a resposta (o gpcd responde mesmo quando a requisição expira)
+  SAPoTClient_frame frame = {SAPOTCLIENT_SUCCESS, (uint16_t) messageLen};
+  if(SAPoTClient_transfer(fd, &frame, sizeof(frame), false) != SAPOTCLIENT_SUCCESS || 
+     SAPoTClient_transfer(fd, message, messageLen, false) != SAPOTCLIENT_SUCCESS ||
+     SAPoTClient_transfer(fd, &frame, sizeof(frame), true) != SAPOTCLIENT_SUCCESS){
+    close(fd);
+    return ERROR_MQTT_PUBLISH;
+  }
+
+  if(frame.status != SAPOTCLIENT_SUCCESS || frame.length < sizeof(SAPoTMessage_header)){
+    close(fd);
+    return frame.status != SAPOTCLIENT_SUCCESS ? frame.status : SAPOTCLIENT_FAILURE;
+  }
+
+  *reply = malloc(frame.length);
+  if(*reply == NULL || SAPoTClient_transfer(fd, *reply, frame.length, true) != SAPOTCLIENT_SUCCESS){
+    free(*reply);
+    *reply = NULL;
+    close(fd);
+    return SAPOTCLIENT_FAILURE;
+  }
+  *replyLen = frame.length;
+
+  close(fd);
+  return SAPOTCLIENT_SUCCESS;
 
 }
 
@@ -110,7 +339,7 @@ int SAPoTClient_loop(){
 * [Principal] SAPoTClient_unpack_message
 *
 */
-int SAPoTClient_unpack_message(void* message, int messageLen){
+int SAPoTClient_unpack_message(SAPoTClient* handle, void* message, int messageLen){
 
   //printf("SAPoTClient_unpack_message: \n");  
   
@@ -119,27 +348,15 @@ int SAPoTClient_unpack_message(void* message, int messageLen){
   //Estruturando o cabeçalho da mensagem recebida
   handle->header = (SAPoTMessage_header*) handle->inMessage;
   
-  //Verificando a versão do pacote recebido
+  //Verificando a versão e o comprimento do pacote recebido
+  if(messageLen < sizeof(SAPoTMessage_header) || handle->header->length > messageLen){
+      handle->error = SAPOTCLIENT_FAILURE;
+      return SAPOTCLIENT_FAILURE;
+  }
   if(handle->header->version != SAPOT_PROTOCOL_VERSION){
       handle->error = SAPOT_VERSION_ERROR;
       return SAPOTCLIENT_FAILURE;
   }
-  else{
-
-    /*int i;
-    for(i=0; i<messageLen; i++) printf("\t %x\n", handle->inMessage[i]);
-    */
-
-    /*
-    printf("\t Version: %d \n", handle->header->version);
-    if(handle->header->ack == true) printf("\t ACK true \n");
-    printf("\t Instruction: %d \n", handle->header->instruction);
-    printf("\t Serial: %d \n", handle->header->serial);
-    printf("\t length: %d \n", handle->header->length);
-    printf("\t Version: %d \n", handle->header->version);
-    printf("\t emitterId: %02x:%02x:%02x:%02x:%02x:%02x \n", handle->header->emitterId[0], handle->header->emitterId[1], handle->header->emitterId[2], handle->header->emitterId[3], handle->header->emitterId[4], handle->header->emitterId[5]);
-    */
-  }
   
   return SAPOTCLIENT_SUCCESS;
 }
@@ -148,8 +365,7 @@ int SAPoTClient_unpack_message(void* message, int messageLen){
 * [Principal] SAPoTClient_set_operation 
 *
 */
-int SAPoTClient_set_operation(int (*publish) (char*, void*, int)){
-
+int SAPoTClient_set_operation(SAPoTClient* handle){
 
   //Registration
   if(handle->header->instruction == 0x00){
@@ -166,20 +382,15 @@ int SAPoTClient_set_operation(int (*publish) (char*, void*, int)){
   //Solicitation 0x03
   else if(handle->header->instruction == 0x03){
 
-    if(handle->header->ack == true){
-      SAPoTClient_end();
-    }
+    if(handle->header->ack == true) SAPoTClient_complete(handle);
   
   }
   //Acess
   else if(handle->header->instruction == 0x04){
 
-    if(handle->header->ack == true){
-      SAPoTClient_printAcess();
-      SAPoTClient_end();
-    }
+    //A tabela é entregue ao solicitante (callback), que decide como apresentá-la
+    if(handle->header->ack == true) SAPoTClient_complete(handle);
     
-  
   }
   //Record
   else if(handle->header->instruction == 0x05){
@@ -187,26 +398,35 @@ int SAPoTClient_set_operation(int (*publish) (char*, void*, int)){
   }
   //Modification
   else if(handle->header->instruction == 0x06){
-    if(handle->header->ack == true){
-      //printf("Modification confirmed !\n");
-      SAPoTClient_end();
-    }
+
+    if(handle->header->ack == true) SAPoTClient_complete(handle);
+
+  }
+  //Echo
+  else if(handle->header->instruction == 0x0A){
+
+    //O eco devolvido pelo Cliente chega com o serial da solicitação
+    if(handle->header->ack == true) SAPoTClient_complete(handle);
 
   }
+  //Report
+  else if(handle->header->instruction == 0x0B){
+
+    if(handle->header->ack == true) SAPoTClient_complete(handle);
+
+  }
+  
   
   //Verifica a existência de erro na operação realizada 
   if(handle->error != SAPOTCLIENT_SUCCESS) return SAPOTCLIENT_FAILURE; 
   else return SAPOTCLIENT_SUCCESS;  
-  
-  
-  return SAPOTCLIENT_SUCCESS;
 }
 
 /**
 * [Principal] SAPoTClient_error
 *
 */
-int SAPoTClient_error(){
+int SAPoTClient_error(SAPoTClient* handle){
 
   return handle->error;
 }
@@ -215,50 +435,60 @@ int SAPoTClient_error(){
 * [Subrotina] MQTTconnect
 *
 */
-int MQTTconnect(){
+int MQTTconnect(SAPoTClient* handle){
+
+  //Criando o cliente MQTT apenas na primeira conexão: as reconexões reutilizam o mesmo cliente, que pode estar em uso por outras threads
+  bool created = false;
+  if(handle->MQTTclient == NULL){
 
-  if(MQTTClient_isConnected(handle->MQTTclient) != true){
+    /* tcp://10.10.40.84:1883 */
+    char serverURI[128];
+    snprintf(serverURI, sizeof(serverURI), "tcp://%s:%s", handle->opts.transmission.host, handle->opts.transmission.port);
+    //printf("\t serverURI: %s\n", serverURI);
+
+    if(MQTTClient_create(&handle->MQTTclient, serverURI, handle->id, MQTTCLIENT_PERSISTENCE_NONE, NULL) != MQTTCLIENT_SUCCESS){
+      puts("MQTTconnect error: unable to create client\n");
+      handle->MQTTclient = NULL;
+      return SAPOTCLIENT_FAILURE;
+    }
+
+    //puts("\t MQTTClient_create ready.");
+
+    if(MQTTClient_setCallbacks(handle->MQTTclient, handle, NULL, MQTTmessageArrived, NULL) != MQTTCLIENT_SUCCESS){
+      printf("MQTTconnect error: unable to set call back message\n");
+      MQTTClient_destroy(&handle->MQTTclient);
+      handle->MQTTclient = NULL;
+      return SAPOTCLIENT_FAILURE;
+    }
+
+    //puts("\t MQTTClient_setCallbacks ready.");
+    created = true;
+  }
+
+  if(created || MQTTClient_isConnected(handle->MQTTclient) != true){
   
     //printf("MQTTconnect: \n");
   
-    MQTTClient_connectOptions MQTTopts = { {'M', 'Q', 'T', 'C'}, 6, 60, 1, 1, NULL, opts->transmission.user, opts->transmission.pass, 30, 0, NULL, 0, NULL, MQTTVERSION_DEFAULT, {NULL, 0, 0}, {0, NULL}, -1, 0}; //MQTTClient_connectOptions_initializer;
-      
-      /* tcp://10.10.40.84:1883 */
-      char* serverURI = malloc(50);
-      sprintf(serverURI, "tcp://%s:%s",opts->transmission.host, opts->transmission.port);
-      //printf("\t serverURI: %s\n", serverURI);
-      
-      if(MQTTClient_create(&handle->MQTTclient, serverURI, handle->id, MQTTCLIENT_PERSISTENCE_NONE, NULL) != MQTTCLIENT_SUCCESS){
-        puts("MQTTconnect error: unable to create client\n");
-        free(serverURI);
-        return 0;
-      }
-        
-      free(serverURI);
-      
-      //puts("\t MQTTClient_create ready.");
-      
-      if(MQTTClient_setCallbacks(handle->MQTTclient, NULL, NULL, MQTTmessageArrived, NULL) != MQTTCLIENT_SUCCESS){
-      printf("MQTTconnect error: unable to set call back message\n");
-      return 0;
-      }
-    
-      //puts("\t MQTTClient_setCallbacks ready.");
+    MQTTClient_connectOptions MQTTopts = { {'M', 'Q', 'T', 'C'}, 6, 60, 1, 1, NULL, handle->opts.transmission.user, handle->opts.transmission.pass, 30, 0, NULL, 0, NULL, MQTTVERSION_DEFAULT, {NULL, 0, 0}, {0, NULL}, -1, 0}; //MQTTClient_connectOptions_initializer;
    
-      if(MQTTClient_connect(handle->MQTTclient, &MQTTopts) != MQTTCLIENT_SUCCESS){
-        printf("MQTTconnect error: unable to connect with broker\n");
-        return 0;
-      }
+    if(MQTTClient_connect(handle->MQTTclient, &MQTTopts) != MQTTCLIENT_SUCCESS){
+      printf("MQTTconnect error: unable to connect with broker\n");
+      return SAPOTCLIENT_FAILURE;
+    }
       
-      //puts("\t MQTTClient_connect ready.");
+    //puts("\t MQTTClient_connect ready.");
       
-      if(MQTTClient_subscribe(handle->MQTTclient, handle->id, 0) != MQTTCLIENT_SUCCESS){
+    if(MQTTClient_subscribe(handle->MQTTclient, handle->id, 0) != MQTTCLIENT_SUCCESS){
       printf("MQTTconnect error: unable to subscribe on topic %s\n", handle->id);
-      return 0;
+      return SAPOTCLIENT_FAILURE;
+    }
+
+    if(handle->watchTopic[0] != '\0' && MQTTClient_subscribe(handle->MQTTclient, handle->watchTopic, 0) != MQTTCLIENT_SUCCESS){
+      printf("MQTTconnect error: unable to subscribe on topic %s\n", handle->watchTopic);
+      return SAPOTCLIENT_FAILURE;
     }
     
     //puts("\t MQTTClient_subscribe ready.");
-    
    
   }  
   
@@ -271,17 +501,27 @@ int MQTTconnect(){
 *
 */
 int MQTTmessageArrived(void *context, char *topicName, int topicLen, MQTTClient_message *MQTTmsg){
+
+  SAPoTClient* handle = (SAPoTClient*) context;
+
+  //Mensagens do tópico de observação são entregues à rotina de observação sem cópia
+  if(handle->watch != NULL && strcmp(topicName, handle->id) != 0){
+    handle->watch(handle, topicName, MQTTmsg->payload, MQTTmsg->payloadlen, handle->watchContext);
+    MQTTClient_freeMessage(&MQTTmsg);
+    MQTTClient_free(topicName);
+    return 1;
+  }
   
-  if(SAPoTClient_unpack_message(MQTTmsg->payload, MQTTmsg->payloadlen) != SAPOTCLIENT_SUCCESS){
+  if(SAPoTClient_unpack_message(handle, MQTTmsg->payload, MQTTmsg->payloadlen) != SAPOTCLIENT_SUCCESS){
     printf("MQTTmessageArrived error: unable to unpack SAPoT's message (%d)\n", handle->error);
   }
   else{
-    if(SAPoTClient_set_operation(MQTTpublish) != SAPOTCLIENT_SUCCESS){
+    if(SAPoTClient_set_operation(handle) != SAPOTCLIENT_SUCCESS){
       printf("MQTTmessageArrived error: unable to set SAPoT's operation (%d)\n", handle->error);
     }
   } 
 
-  //free(handle->outMessage);
+  handle->error = SAPOTCLIENT_SUCCESS;
 
   MQTTClient_freeMessage(&MQTTmsg);
   
@@ -294,7 +534,7 @@ int MQTTmessageArrived(void *context, char *topicName, int topicLen, MQTTClient_
 * [Subrotina] MQTTpublish
 *
 */
-int MQTTpublish(char* topic, void* payload, int payloadLen){
+int MQTTpublish(SAPoTClient* handle, char* topic, void* payload, int payloadLen){
 
   //printf("MQTTPublish on topic: %s\n", topic);
     MQTTClient_message pubmsg = MQTTClient_message_initializer;
@@ -321,11 +561,13 @@ int MQTTpublish(char* topic, void* payload, int payloadLen){
 * [Subrotina] printAcess
 *
 */
-void SAPoTClient_printAcess(){
+void SAPoTClient_printAcess(const uint8_t* message){
+
+    const SAPoTMessage_header* header = (const SAPoTMessage_header*) message;
 
     //printf("SAPoTClient_printAcess: \n\n");
 
-    int accessPackLen = (handle->header->length - sizeof(SAPoTMessage_header)) / sizeof(SAPoTMessage_access);
+    int accessPackLen = (header->length - sizeof(SAPoTMessage_header)) / sizeof(SAPoTMessage_access);
 
     //printf("accessPackLen = %d\n", accessPackLen);
 
@@ -334,7 +576,7 @@ void SAPoTClient_printAcess(){
     int i, j;
     for(i=0; i<accessPackLen; i++){
 
-      SAPoTMessage_access* access = (SAPoTMessage_access*) (handle->inMessage + sizeof(SAPoTMessage_header) + (i*sizeof(SAPoTMessage_access)));
+      const SAPoTMessage_access* access = (const SAPoTMessage_access*) (message + sizeof(SAPoTMessage_header) + (i*sizeof(SAPoTMessage_access)));
       printf("\t");
       for(j=0; j<10; j++) printf("%c", access->label[j]);
       printf("\t");
@@ -347,6 +589,262 @@ void SAPoTClient_printAcess(){
     
 }
 
+/**
+* [Subrotina] printAccessCompact
+*
+*/
+void SAPoTClient_printAccessCompact(const uint8_t* message){
+
+    const SAPoTMessage_header* header = (const SAPoTMessage_header*) message;
+    const uint8_t* payload = message + sizeof(SAPoTMessage_header);
+    const uint8_t* end = message + header->length;
+    SAPoTClient_accessEntry entry;
+    uint8_t previous[6] = {};
+    uint32_t quantity;
+    int len;
+
+    if((len = getVarint(payload, end, &quantity)) == 0) return;
+    payload += len;
+
+    printf("\t  Label\t\t   Macaddr\t\tType\tSensors\tActuators\n");
+
+    uint32_t i;
+    for(i=0; i<quantity; i++){
+
+      if((len = SAPoTClient_decodeAccessEntry(payload, end, header->rsv2, previous, &entry)) == 0){
+        printf("Truncated access table !\n");
+        return;
+      }
+      payload += len;
+
+      printf("\t%-10s", entry.label);
+      printf("\t%02X:%02X:%02X:%02X:%02X:%02X", entry.mac[0], entry.mac[1], entry.mac[2], entry.mac[3], entry.mac[4], entry.mac[5]);
+      printf("\t %d", (int)entry.type);
+      printf("\t %d", (int)entry.sensor);
+      printf("\t %d\n",(int)entry.actuator);
+
+    }
+
+}
+
+/**
+* [Subrotina] SAPoTClient_complete
+*
+* Conclui a requisição pendente com o serial da mensagem recebida. Respostas sem requisição pendente 
+* (ex.: chegadas após a expiração) são descartadas.
+*
+*/
+static void SAPoTClient_complete(SAPoTClient* handle){
+
+  uint64_t now = SAPoTClient_now();
+  SAPoTClient_request request;
+
+  pthread_mutex_lock(&handle->lock);
+
+  SAPoTClient_request* pending = &handle->pending[handle->header->serial & (SAPOTCLIENT_PENDING-1)];
+  if(!pending->active || pending->serial != handle->header->serial || pending->instruction != handle->header->instruction){
+    pthread_mutex_unlock(&handle->lock);
+    return;
+  }
+
+  pending->latency = now - pending->sent;
+  handle->answered++;
+  handle->latencySum += pending->latency;
+  if(pending->latency < handle->latencyMin) handle->latencyMin = pending->latency;
+  if(pending->latency > handle->latencyMax) handle->latencyMax = pending->latency;
+
+  //Liberando a posição antes da rotina de conclusão, que é evocada sem o bloqueio
+  request = *pending;
+  pending->active = false;
+
+  pthread_mutex_unlock(&handle->lock);
+
+  if(request.callback != NULL) request.callback(handle, &request, SAPOTCLIENT_SUCCESS, handle->inMessage, handle->header->length);
+
+  //A requisição deixa de estar em trânsito somente após a rotina de conclusão: SAPoTClient_wait() retorna com as conclusões já feitas
+  pthread_mutex_lock(&handle->lock);
+  handle->inFlight--;
+  pthread_cond_broadcast(&handle->done);
+  pthread_mutex_unlock(&handle->lock);
+
+}
+
+/**
+* [Subrotina] SAPoTClient_finish
+*
+* Conclui com status as requisições expiradas (ou todas, se all for verdadeiro).
+*
+*/
+static void SAPoTClient_finish(SAPoTClient* handle, bool all, int status){
+
+  SAPoTClient_request* finished = malloc(SAPOTCLIENT_PENDING * sizeof(SAPoTClient_request));
+  if(finished == NULL) return;
+  int quantity = 0;
+  uint64_t now = SAPoTClient_now();
+
+  pthread_mutex_lock(&handle->lock);
+
+  int i;
+  for(i=0; i<SAPOTCLIENT_PENDING; i++){
+
+    SAPoTClient_request* pending = &handle->pending[i];
+    if(!pending->active || (!all && now - pending->sent < (uint64_t) handle->timeout * 1000)) continue;
+
+    finished[quantity++] = *pending;
+    if(status == ERROR_REQUEST_TIMEOUT) handle->expired++;
+    pending->active = false;
+  }
+
+  pthread_mutex_unlock(&handle->lock);
+
+  for(i=0; i<quantity; i++){
+    if(finished[i].callback != NULL) finished[i].callback(handle, &finished[i], status, NULL, 0);
+  }
+
+  if(quantity > 0){
+    pthread_mutex_lock(&handle->lock);
+    handle->inFlight -= quantity;
+    pthread_cond_broadcast(&handle->done);
+    pthread_mutex_unlock(&handle->lock);
+  }
+
+  free(finished);
+
+}
+
+/**
+* [Subrotina] SAPoTClient_timer
+*
+* Thread de expiração: a cada 100 ms conclui as requisições sem resposta e, a cada segundo, restabelece a conexão MQTT perdida.
+*
+*/
+static void* SAPoTClient_timer(void* context){
+
+  SAPoTClient* handle = (SAPoTClient*) context;
+  int ticks = 0;
+  bool running = true;
+
+  while(running){
+
+    usleep(100000);
+    SAPoTClient_finish(handle, false, ERROR_REQUEST_TIMEOUT);
+
+    if(++ticks % 10 == 0 && handle->opts.transmissionProtocol == MQTT && MQTTClient_isConnected(handle->MQTTclient) != true){
+      MQTTconnect(handle);
+    }
+
+    pthread_mutex_lock(&handle->lock);
+    running = handle->inLoop;
+    pthread_mutex_unlock(&handle->lock);
+  }
+
+  return NULL;
+
+}
+
+/**
+* [Subrotina] SAPoTClient_future_done
+*
+*/
+static void SAPoTClient_future_done(SAPoTClient* handle, const SAPoTClient_request* request, int status, const uint8_t* message, int messageLen){
+
+  SAPoTClient_future* future = (SAPoTClient_future*) request->context;
+
+  //Copiando o ACK, válido apenas durante a evocação
+  uint8_t* reply = NULL;
+  if(message != NULL && (reply = malloc(messageLen)) != NULL) memcpy(reply, message, messageLen);
+
+  pthread_mutex_lock(&handle->lock);
+  future->status = (message != NULL && reply == NULL) ? SAPOTCLIENT_FAILURE : status;
+  future->reply = reply;
+  future->replyLen = reply != NULL ? messageLen : 0;
+  future->latency = request->latency;
+  future->done = true;
+  pthread_cond_broadcast(&handle->done);
+  pthread_mutex_unlock(&handle->lock);
+
+}
+
+/**
+* [Utilitário] SAPoTClient_transfer
+*
+*/
+int SAPoTClient_transfer(int fd, void* buffer, int length, bool receive){
+
+  int done = 0;
+  while(done < length){
+    ssize_t n = receive ? recv(fd, (uint8_t*) buffer + done, length - done, 0) : send(fd, (uint8_t*) buffer + done, length - done, MSG_NOSIGNAL);
+    if(n <= 0) return SAPOTCLIENT_FAILURE;
+    done += n;
+  }
+  return SAPOTCLIENT_SUCCESS;
+
+}
+
+/**
+* [Utilitário] SAPoTClient_now
+*
+*/
+static uint64_t SAPoTClient_now(){
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+}
+
+/**
+* [Utilitário] decodeAccessEntry
+*
+*/
+int SAPoTClient_decodeAccessEntry(const uint8_t* buffer, const uint8_t* end, bool delta, uint8_t previous[6], SAPoTClient_accessEntry* entry){
+
+  const uint8_t* p = buffer;
+  int shared = 0, len;
+
+  //Endereço MAC (completo ou delta em relação ao anterior)
+  if(delta){
+    if(p >= end || (shared = *p++) > 6) return 0;
+    memcpy(entry->mac, previous, shared);
+  }
+  if(end - p < 6 - shared) return 0;
+  memcpy(&entry->mac[shared], p, 6 - shared);
+  p += 6 - shared;
+  memcpy(previous, entry->mac, 6);
+
+  //Etiqueta com prefixo de comprimento
+  if(p >= end || (len = *p++) > 10 || end - p < len) return 0;
+  memcpy(entry->label, p, len);
+  entry->label[len] = '\0';
+  p += len;
+
+  //Tipo, sensores e atuadores
+  if((len = getVarint(p, end, &entry->type)) == 0) return 0;
+  p += len;
+  if(end - p < 2) return 0;
+  entry->sensor = *p++;
+  entry->actuator = *p++;
+
+  return p - buffer;
+}
+
+/**
+* [Utilitário] getVarint
+*
+*/
+int getVarint(const uint8_t* buffer, const uint8_t* end, uint32_t* value){
+
+  int i = 0;
+  *value = 0;
+
+  while(&buffer[i] < end && i < 5){
+    *value |= (uint32_t) (buffer[i] & 0x7f) << (7*i);
+    if((buffer[i++] & 0x80) == 0) return i;
+  }
+
+  return 0;
+}
+
 /**
 * [Utilitário] upper_string
 *
@@ -6,6 +6,8 @@
 								
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <MQTTClient.h>
 
 
@@ -60,6 +62,44 @@
 *
 */
 #define ERROR_MQTT_PUBLISH -8
+/**
+* Código de Retorno: Indica que a requisição não foi respondida pela central dentro do tempo limite (SAPoTClient.timeout)
+*
+*/
+#define ERROR_REQUEST_TIMEOUT -9
+
+/**
+* Quantidade máxima de requisições em trânsito por cliente (potência de 2). As requisições pendentes são 
+* indexadas por (serial & (SAPOTCLIENT_PENDING-1)).
+*
+*/
+#define SAPOTCLIENT_PENDING 256
+
+/**
+* Tempo limite padrão, em milissegundos, para a resposta da central a uma requisição.
+*
+*/
+#define SAPOTCLIENT_TIMEOUT 5000
+
+/**
+* Caminho padrão do socket UNIX do daemon gpcd (pode ser alterado pela variável de ambiente GPCD_SOCKET).
+*
+*/
+#define SAPOTCLIENT_DAEMON_SOCKET "/tmp/gpcd.sock"
+
+/**
+* Modos de relato dos sensores (veja SAPoTMessage_deadband): todas as leituras, variação absoluta ou variação percentual
+*
+*/
+#define SAPOT_REPORT_PERIODIC 0
+#define SAPOT_REPORT_ABSOLUTE 1
+#define SAPOT_REPORT_PERCENT 2
+
+/**
+* Identificador de sensor que aplica a configuração de relato (0x0B) a todos os sensores do Cliente
+*
+*/
+#define SAPOT_REPORT_ALL_SENSORS 0xFFFF
 
 
 /**
@@ -84,7 +124,11 @@
 */
 typedef struct{
 	
-	/** Flags de definição da mensagem */
+	/** Flags de definição da mensagem 
+	* rsv1: codificação compacta da tabela de acesso (0x04)
+	* rsv2: codificação delta dos endereços MAC na tabela de acesso (0x04, requer rsv1)
+	* rsv3: solicitação de acesso versionada, com um SAPoTMessage_directory no início do payload (0x04, requer rsv1)
+	**/
 	uint8_t rsv3:1, rsv2:1, rsv1:1, ack:1, version:4;
 
   	/** Instrução de operação 
@@ -95,6 +139,8 @@ typedef struct{
   	* 0x04: Acesso à informação dos clientes cadastrados (Acess)
   	* 0x05: Registro de informação proveniente de sensores e atuadores (Record)
   	* 0x06: Etiquetagem de um cliente ja cadastrado (Modification)  
+  	* 0x08: Registro em lote de amostras dos sensores (Batch)
+  	* 0x0A: Medição do tempo de ida e volta até um Cliente (Echo)
   	**/
   	uint8_t instruction;
   	
@@ -173,6 +219,42 @@ typedef struct{
   	 
 }SAPoTMessage_access;
 
+/**
+* Estrutura: Cliente decodificado da tabela de acesso no formato compacto (rsv1)
+* Formato: varint quantidade; para cada cliente: MAC binário (6 bytes, ou com rsv2: 1 byte de prefixo comum + bytes restantes), 
+* 1 byte de comprimento + etiqueta, varint tipo, 1 byte sensores, 1 byte atuadores.
+*
+*/
+typedef struct{
+	/** Etiqueta referente ao cadastrado (terminada em nulo) */
+	char label[11];
+	/** Identificador Macaddr binário */
+	uint8_t mac[6];
+	/** Tipo de Cliente */
+	uint32_t type;
+	/** Quantidade de sensores */ 
+  	uint8_t sensor;
+  	/** Quantidade atuadores */ 
+  	uint8_t actuator;
+}SAPoTClient_accessEntry;
+
+/**
+* Estrutura: Versão do diretório de clientes nas solicitações de acesso versionadas (rsv3)
+* Na solicitação, informa a versão da cópia em cache (nula se não houver cópia). Na resposta, informa a nova versão e precede
+* a tabela compacta, que é completa (full) ou contém apenas os clientes alterados desde a versão informada.
+*
+*/
+typedef struct{
+	/** Identificador do processo da central que atribuiu a versão (0 sem cópia) */
+	uint32_t epoch;
+	/** Quantidade de alterações da tabela de clientes registradas pela central até a cópia */
+	uint32_t version;
+	/** Na resposta, indica que a tabela é completa */
+	uint8_t full;
+	/** Reservado */
+	uint8_t rsv[3];
+}SAPoTMessage_directory;
+
 /**
 * Estrutura: Payload para registro de informação dos clientes (informação dos Sensores, status dos Atuadores e possiveis erros)
 *
@@ -208,8 +290,194 @@ typedef struct{
   	 
 }SAPoTMessage_modification;
 
+/**
+* Estrutura: Cabeçalho do payload de registro em lote (0x08), seguido por sampleQuantity amostras SAPoTMessage_sample
+*
+*/
+typedef struct{
+
+	/** Quantidade de amostras */
+	uint8_t sampleQuantity;
+
+	/** Escala de tempo das idades das amostras (0: ms, 1: s, 2: min, 3: horas, 4: dias) */
+	uint8_t timeScale;
+
+	/** Reservado */
+	uint16_t rsv;
+
+}SAPoTMessage_batch;
+
+/**
+* Estrutura: Amostra de um sensor contida em um lote
+*
+*/
+typedef struct{
+
+	/** Identificador do sensor */
+	uint16_t sensorId;
+
+	/** Idade da amostra no momento do envio do lote */
+	uint16_t age;
+
+	/** Valor lido pelo sensor */
+	float value;
+
+}SAPoTMessage_sample;
+
+/**
+* Estrutura: Payload de eco (0x0A). A central preenche origin e serial, marca centralIn, encaminha o eco ao Cliente de etiqueta
+* label e, quando o Cliente o devolve, marca centralOut e o devolve ao Usuário como ACK da solicitação
+*
+*/
+typedef struct{
+
+	/** Etiqueta do Cliente */
+	uint8_t label[11];
+
+	/** Reservado */
+	uint8_t rsv;
+
+	/** Usuário que solicitou o eco (preenchido pela central) */
+	uint8_t origin[6];
+
+	/** Serial da solicitação (preenchido pela central) */
+	uint16_t serial;
+
+	/** Número de sequência atribuído pelo Usuário */
+	uint32_t sequence;
+
+	/** Instantes, em microssegundos do relógio da central, da chegada da solicitação e do eco do Cliente à central */
+	uint32_t centralIn;
+	uint32_t centralOut;
+
+}SAPoTMessage_echo;
+
+/**
+* Estrutura: Configuração do relato por variação de um sensor. O Cliente publica uma leitura apenas quando ela difere do último
+* valor publicado em mais que o limiar (absoluto ou percentual), ou após heartbeat sem publicar
+*
+*/
+typedef struct{
+
+	/** Modo de relato (SAPOT_REPORT_*) */
+	uint8_t mode;
+
+	/** Reservado */
+	uint8_t rsv;
+
+	/** Intervalo máximo de silêncio, no formato de tempo SAPoT (4 bits de escala e 12 bits de quantidade); 0 desativa */
+	uint16_t heartbeat;
+
+	/** Limiar absoluto ou percentual */
+	float threshold;
+
+}SAPoTMessage_deadband;
+
+/**
+* Estrutura: Payload de configuração do relato por variação (0x0B), encaminhado pela central ao Cliente de etiqueta label
+*
+*/
+typedef struct{
+
+	/** Etiqueta do Cliente */
+	uint8_t label[11];
+
+	/** Reservado */
+	uint8_t rsv;
+
+	/** Identificador do sensor, ou SAPOT_REPORT_ALL_SENSORS */
+	uint16_t sensorId;
+
+	/** Reservado */
+	uint16_t rsv2;
+
+	/** Configuração de relato */
+	SAPoTMessage_deadband deadband;
+
+}SAPoTMessage_report;
+
 							/************************* Structs for SAPoTClient *************************/
 
+struct SAPoTClient;
+
+/**
+* Estrutura: Requisição enviada à central e ainda não respondida.
+* A resposta é associada à requisição pelo serial, que a central repete no cabeçalho do ACK.
+*
+*/
+typedef struct SAPoTClient_request{
+
+	/** Indica se a posição está ocupada por uma requisição em trânsito */
+	bool active;
+
+	/** Serial da requisição */
+	uint16_t serial;
+
+	/** Instrução da requisição */
+	uint8_t instruction;
+
+	/** Instante de envio, em microssegundos (CLOCK_MONOTONIC) */
+	uint64_t sent;
+
+	/** Latência da resposta, em microssegundos (preenchida na conclusão) */
+	uint64_t latency;
+
+	/** Comando que originou a requisição (ex.: "solicitation sala07 ON"), para o registro do resultado */
+	char command[64];
+
+	/** Rotina evocada na conclusão da requisição, fora de SAPoTClient.lock e pela thread que a concluiu (a thread de 
+	* recebimento do cliente MQTT, a thread de expiração ou a que evocou SAPoTClient_end()). Recebe status 
+	* SAPOTCLIENT_SUCCESS e o ACK da central, ERROR_REQUEST_TIMEOUT ou SAPOTCLIENT_FAILURE (cliente encerrado), 
+	* estes com message = NULL. A mensagem só é válida durante a evocação. */
+	void (*callback)(struct SAPoTClient* handle, const struct SAPoTClient_request* request, int status, const uint8_t* message, int messageLen);
+
+	/** Contexto do solicitante, repassado à rotina de conclusão (ex.: a conexão do gpc com o gpcd) */
+	void* context;
+
+}SAPoTClient_request;
+
+/**
+* Estrutura: Resultado futuro de uma requisição enviada por SAPoTClient_request_future() e aguardado por SAPoTClient_future_wait().
+*
+*/
+typedef struct{
+
+	/** Indica se a requisição foi concluída */
+	bool done;
+
+	/** Código de retorno: SAPOTCLIENT_SUCCESS, ERROR_REQUEST_TIMEOUT ou SAPOTCLIENT_FAILURE */
+	int status;
+
+	/** Serial atribuído à requisição */
+	uint16_t serial;
+
+	/** Cópia do ACK da central (liberada por SAPoTClient_future_release()) */
+	uint8_t* reply;
+
+	/** Comprimento do ACK */
+	int replyLen;
+
+	/** Latência da resposta, em microssegundos */
+	uint64_t latency;
+
+}SAPoTClient_future;
+
+/**
+* Estrutura: Cabeçalho dos quadros trocados entre o gpc e o gpcd pelo socket UNIX, seguido por length bytes de mensagem SAPoT.
+* Na requisição, status é SAPOTCLIENT_SUCCESS e a mensagem é a requisição a ser publicada (o serial é atribuído pelo gpcd).
+* Na resposta, a mensagem é o ACK da central, ou status indica o erro (ex.: ERROR_REQUEST_TIMEOUT) e length é 0.
+*
+*/
+typedef struct __attribute__((packed)){
+
+	/** Código de retorno */
+	int16_t status;
+
+	/** Comprimento da mensagem que segue o cabeçalho */
+	uint16_t length;
+
+}SAPoTClient_frame;
+
 /**
 * Estrutura: Classe de um objeto para definir as opções de criação de um cliente SAPoT
 *
@@ -241,8 +509,14 @@ typedef struct{
 /**
 * Estrutura: Classe de um objeto SAPoTClient. É o principal objeto para manipulação de um cliente SAPoT.
 *
+* Todo o estado do cliente está contido nessa estrutura, que é passada a todas as funções da biblioteca (libsapotclient):
+* um processo pode operar vários clientes, e cada cliente pode ser utilizado por várias threads simultaneamente. As requisições
+* recebem seriais próprios e ficam pendentes até o ACK correspondente, entregue à rotina de conclusão de cada requisição
+* (SAPoTClient_request_async()) ou a um resultado futuro (SAPoTClient_request_future()). Uma thread de expiração conclui as
+* requisições sem resposta após SAPoTClient.timeout e restabelece a conexão MQTT perdida.
+*
 */
-typedef struct{
+typedef struct SAPoTClient{
 
 	/** identificador do Client no formato macaddr (xx:xx:xx:xx:xx:xx) */
 	const char* id;
@@ -250,21 +524,67 @@ typedef struct{
 	/** Indicador de Erro */
 	int error;
 
-	/** Flag que permite a execução da SAPoTClient_loop() */
+	/** Indica se o cliente está em operação (entre SAPoTClient_begin() e SAPoTClient_end()) */
 	bool inLoop;
+
+	/** Opções de criação do cliente */
+	SAPoTClient_create_options opts;
 		
-	/** Ponteiro indicador da mensagem recebida */
+	/** Ponteiro indicador da mensagem recebida (utilizado apenas pela thread de recebimento) */
 	uint8_t* inMessage;
 	
-	/** Ponteiro indicador da mensagem a ser enviada */
-	void* outMessage;
-	
 	/** Cabeçalho da mensagem recebida */
 	SAPoTMessage_header* header;
 	
 	/** Objeto referente ao cliente MQTT*/
 	MQTTClient MQTTclient;
-	
+
+	/** Serial da última requisição enviada (o serial 0 não é utilizado) */
+	uint16_t serial;
+
+	/** Tempo limite, em milissegundos, para a resposta a uma requisição */
+	int timeout;
+
+	/** Quantidade máxima de requisições em trânsito (até SAPOTCLIENT_PENDING); as novas requisições aguardam abaixo dela */
+	int window;
+
+	/** Requisições em trânsito, indexadas por (serial & (SAPOTCLIENT_PENDING-1)) */
+	SAPoTClient_request pending[SAPOTCLIENT_PENDING];
+
+	/** Quantidade de requisições em trânsito (incluindo as que estão sendo concluídas pela callback) */
+	int inFlight;
+
+	/** Quantidade de threads publicando uma requisição fora da exclusão mútua: SAPoTClient_end() aguarda que todas retornem antes 
+	* de destruir o cliente MQTT */
+	int publishing;
+
+	/** Requisições respondidas */
+	unsigned long answered;
+
+	/** Requisições expiradas sem resposta */
+	unsigned long expired;
+
+	/** Soma, menor e maior latência das requisições respondidas, em microssegundos */
+	uint64_t latencySum, latencyMin, latencyMax;
+
+	/** Exclusão mútua das requisições pendentes, dos resultados futuros e das estatísticas */
+	pthread_mutex_t lock;
+
+	/** Sinaliza a conclusão (resposta ou expiração) de uma requisição */
+	pthread_cond_t done;
+
+	/** Thread de expiração das requisições e de reconexão */
+	pthread_t timer;
+
+	/** Tópico de observação assinado por SAPoTClient_watch() (vazio se nenhum), assinado novamente a cada reconexão */
+	char watchTopic[128];
+
+	/** Rotina que recebe as mensagens do tópico de observação, pela thread de recebimento do cliente MQTT. A mensagem só é 
+	* válida durante a evocação */
+	void (*watch)(struct SAPoTClient* handle, const char* topic, const uint8_t* message, int messageLen, void* context);
+
+	/** Contexto repassado à rotina de observação */
+	void* watchContext;
 	
 }SAPoTClient;
 
@@ -272,59 +592,112 @@ typedef struct{
 /************************* Functions for SAPoTClient *************************/
 
 /** 
-* Função: Inicia o cliente SAPoT preenchendo as informações no objeto SAPoTClient
+* Função: Inicia o cliente SAPoT preenchendo as informações no objeto SAPoTClient, conecta ao broker e inicia a thread de expiração
+*
+*/
+int SAPoTClient_begin(SAPoTClient* handle, SAPoTClient_create_options* opts, const char* clientId);
+
+/** 
+* Função: Finaliza o cliente SAPoT: conclui as requisições pendentes com SAPOTCLIENT_FAILURE, encerra a thread de expiração
+* e a conexão MQTT. Não finaliza o processo.
 *
 */
-int SAPoTClient_begin(SAPoTClient* userPointer , SAPoTClient_create_options* opts, const char* clientId);
+void SAPoTClient_end(SAPoTClient* handle);
 
 /** 
-* Função: Finaliza o client SAPoT encerrando o serviço de transmissão de dados MQTT 
+* Função: Envia uma requisição assíncrona. Atribui um serial à mensagem, aguarda enquanto houver SAPoTClient.window requisições
+* em trânsito e a registra como pendente antes de publicá-la. callback (opcional) é evocada na conclusão da requisição.
+* Retorna o serial atribuído ou SAPOTCLIENT_FAILURE. Pode ser evocada por várias threads simultaneamente, mas não pela 
+* rotina de conclusão de outra requisição (a janela poderia nunca ser liberada).
 *
 */
-void SAPoTClient_end();
+int SAPoTClient_request_async(SAPoTClient* handle, void* message, int messageLen, const char* command,
+	void (*callback)(SAPoTClient* handle, const SAPoTClient_request* request, int status, const uint8_t* message, int messageLen), void* context);
 
 /** 
-* Função: Coordena a rotina de execução de uma UCCSAPoT de acordo com as opções definidas no 
-* objeto SAPoTClient_create_options. É o meio mais fácil e simples de se implementar uma UCCSAPoT. 
+* Função: Envia uma requisição cujo resultado é entregue em future. Retorna o serial atribuído ou SAPOTCLIENT_FAILURE
 *
 */
-int SAPoTClient_loop(); 
+int SAPoTClient_request_future(SAPoTClient* handle, void* message, int messageLen, const char* command, SAPoTClient_future* future);
+
+/** 
+* Função: Bloqueia até a conclusão da requisição de future e retorna o seu código (SAPOTCLIENT_SUCCESS, ERROR_REQUEST_TIMEOUT
+* ou SAPOTCLIENT_FAILURE)
+*
+*/
+int SAPoTClient_future_wait(SAPoTClient* handle, SAPoTClient_future* future);
+
+/** 
+* Função: Libera a cópia do ACK mantida por future
+*
+*/
+void SAPoTClient_future_release(SAPoTClient_future* future);
+
+/** 
+* Função: Aguarda até que no máximo maxInFlight requisições estejam em trânsito (com maxInFlight = 0, até a conclusão de todas)
+*
+*/
+void SAPoTClient_wait(SAPoTClient* handle, int maxInFlight);
+
+/** 
+* Função: Assina o tópico de observação topic (ex.: centralId/watch/# ou centralId/watch/+/macaddr, veja o gpc watch), cujas 
+* mensagens, republicadas pela central com o cabeçalho v1, são entregues a callback em vez de tratadas como respostas.
+* Deve ser evocada após SAPoTClient_begin(), uma única vez. Retorna SAPOTCLIENT_SUCCESS ou SAPOTCLIENT_FAILURE
+*
+*/
+int SAPoTClient_watch(SAPoTClient* handle, const char* topic,
+	void (*callback)(SAPoTClient* handle, const char* topic, const uint8_t* message, int messageLen, void* context), void* context);
 
 /**
 * Função: Traduz uma mensagem SAPoT e a armazena no espaço de memoria do objeto SAPoTClient
 *
 */
-int SAPoTClient_unpack_message(void* message, int messageLen);
+int SAPoTClient_unpack_message(SAPoTClient* handle, void* message, int messageLen);
 
 /**
 * Função: A partir da mensagem traduzida em SAPoTClient_unpack_message() a função SAPoTClient_set_operation()
-* realiza as operações indicadas pela instrução recebida
+* realiza as operações indicadas pela instrução recebida: um ACK conclui a requisição pendente com o mesmo serial
 *
 */
-int SAPoTClient_set_operation(int (*publish) (char*, void*, int));
+int SAPoTClient_set_operation(SAPoTClient* handle);
 
 /**
 * Função: Retorna o numero do erro referente a alguma operação mal sucedida sobre o objeto SAPoTClient. 
 *
 */
-int SAPoTClient_error();
+int SAPoTClient_error(SAPoTClient* handle);
 
 /**
 * Função: Printa para o usuário a mensagem de resposta da central referente a solicitação de acesso ao banco de dados 
 *
 */
-void SAPoTClient_printAcess();
+void SAPoTClient_printAcess(const uint8_t* message);
+
+/**
+* Função: Printa para o usuário a tabela de acesso recebida no formato compacto (flag rsv1) 
+*
+*/
+void SAPoTClient_printAccessCompact(const uint8_t* message);
+
+/** 
+* Função: Encaminha uma requisição ao daemon gpcd pelo socket UNIX socketPath e bloqueia até a resposta da central. Não requer
+* um objeto SAPoTClient. Em caso de sucesso, *reply recebe uma cópia do ACK (liberada com free()). Retorna SAPOTCLIENT_SUCCESS,
+* o código de erro informado pelo gpcd (ex.: ERROR_REQUEST_TIMEOUT) ou ERROR_STARTING_TRANSMISSION_PROTOCOL se o gpcd não estiver
+* em execução (o solicitante pode então se conectar diretamente ao broker).
+*
+*/
+int SAPoTClient_forward(const char* socketPath, void* message, int messageLen, uint8_t** reply, int* replyLen);
 
 
 /************************* Functions for MQTT **************************/
 /**
-* Função: Conecta o cliente ao servidor MQTT 
+* Função: Conecta o cliente ao servidor MQTT (criando o cliente MQTT na primeira conexão)
 *
 */
-int MQTTconnect();
+int MQTTconnect(SAPoTClient* handle);
 
 /**
-* Função: Define a rotina de recebimento de mensagens via MQTT 
+* Função: Define a rotina de recebimento de mensagens via MQTT (context é o objeto SAPoTClient)
 *
 */
 int MQTTmessageArrived(void *context, char *topicName, int topicLen, MQTTClient_message *MQTTmsg);
@@ -333,7 +706,7 @@ int MQTTmessageArrived(void *context, char *topicName, int topicLen, MQTTClient_
 * Função: Publica a mensagem em um topico especifico no broker MQTT
 *
 */
-int MQTTpublish(char* topic, void* payload, int payloadLen);
+int MQTTpublish(SAPoTClient* handle, char* topic, void* payload, int payloadLen);
 					
 
 /************************* Utility Functions **************************/
@@ -349,5 +722,25 @@ void upper_string(char s[]);
 */
 void getmacID(const char* MAC, uint8_t ID[6]);
 
+/**
+* Função: Lê um inteiro sem sinal no formato varint entre buffer e end. Retorna a quantidade de bytes lidos, ou 0 se o varint estiver truncado
+*
+*/
+int getVarint(const uint8_t* buffer, const uint8_t* end, uint32_t* value);
+
+/**
+* Função: Decodifica o próximo cliente da tabela de acesso compacta. Atualiza previous (último MAC, para a codificação delta) 
+* e retorna a quantidade de bytes lidos, ou 0 se a carga útil estiver truncada
+*
+*/
+int SAPoTClient_decodeAccessEntry(const uint8_t* buffer, const uint8_t* end, bool delta, uint8_t previous[6], SAPoTClient_accessEntry* entry);
+
+/**
+* Função: Envia (receive = false) ou recebe (receive = true) exatamente length bytes pelo socket fd. Retorna SAPOTCLIENT_SUCCESS,
+* ou SAPOTCLIENT_FAILURE se a conexão for encerrada ou falhar
+*
+*/
+int SAPoTClient_transfer(int fd, void* buffer, int length, bool receive);
+
 
 #endif
@@ -0,0 +1,371 @@
+
+/*
+* SAPoTDirectory.c define a cópia em cache da tabela de acesso da central (libsapotclient)
+*
+*
+*
+*/
+
+
+      /************************* Headers ******************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SAPoTClient.h"
+#include "SAPoTDirectory.h"
+
+/* Function's prototype */
+static int SAPoTDirectory_compare_label(const void* a, const void* b);
+static int SAPoTDirectory_compare_mac(const void* a, const void* b);
+static int SAPoTDirectory_decode(const uint8_t* message, int messageLen, SAPoTMessage_directory* version, SAPoTDirectory_entry** received);
+static int SAPoTDirectory_write(const char* path, const SAPoTMessage_directory* version, const SAPoTDirectory_entry* entries, uint32_t quantity);
+
+
+/**
+* [Principal] SAPoTDirectory_path
+*
+*/
+int SAPoTDirectory_path(const char* host, const char* centralId, char* path, int size){
+
+	char base[400];
+	const char* cache = getenv("XDG_CACHE_HOME");
+
+	if(cache != NULL && cache[0] != '\0') snprintf(base, sizeof(base), "%s", cache);
+	else if(getenv("HOME") != NULL) snprintf(base, sizeof(base), "%s/.cache", getenv("HOME"));
+	else return SAPOTCLIENT_FAILURE;
+	mkdir(base, 0700);
+	strncat(base, "/gpc", sizeof(base) - strlen(base) - 1);
+	mkdir(base, 0700);
+
+	//Um arquivo por central: o centralId padrão (00:00:00:00:00:00) se repete entre brokers
+	char name[128];
+	int i, j = 0;
+	for(i=0; host[i] != '\0' && j < 64; i++) name[j++] = (host[i] == '/' || host[i] == ':') ? '_' : host[i];
+	name[j++] = '-';
+	for(i=0; centralId[i] != '\0' && j < (int) sizeof(name) - 1; i++) if(centralId[i] != ':') name[j++] = centralId[i];
+	name[j] = '\0';
+
+	if(snprintf(path, size, "%s/directory-%s.sapd", base, name) >= size) return SAPOTCLIENT_FAILURE;
+
+	return SAPOTCLIENT_SUCCESS;
+}
+
+/**
+* [Principal] SAPoTDirectory_open
+*
+*/
+int SAPoTDirectory_open(SAPoTDirectory* directory, const char* path){
+
+	memset(directory, 0, sizeof(SAPoTDirectory));
+	snprintf(directory->path, sizeof(directory->path), "%s", path);
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) return SAPOTCLIENT_FAILURE;
+
+	struct stat status;
+	if(fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(SAPoTDirectory_fileHeader)){
+		close(fd);
+		return SAPOTCLIENT_FAILURE;
+	}
+
+	//O mapeamento permanece válido após o close() e após a substituição do arquivo por outro gpc
+	void* map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) return SAPOTCLIENT_FAILURE;
+
+	const SAPoTDirectory_fileHeader* header = (const SAPoTDirectory_fileHeader*) map;
+	if(memcmp(header->magic, SAPOT_DIRECTORY_MAGIC, 4) != 0 || header->format != SAPOT_DIRECTORY_FORMAT_VERSION ||
+	   (uint64_t) status.st_size < sizeof(SAPoTDirectory_fileHeader) + (uint64_t) header->quantity * sizeof(SAPoTDirectory_entry)){
+		munmap(map, status.st_size);
+		return SAPOTCLIENT_FAILURE;
+	}
+
+	directory->map = map;
+	directory->mapSize = status.st_size;
+	directory->header = header;
+	directory->entries = (const SAPoTDirectory_entry*) ((const uint8_t*) map + sizeof(SAPoTDirectory_fileHeader));
+	directory->quantity = header->quantity;
+
+	return SAPOTCLIENT_SUCCESS;
+}
+
+/**
+* [Principal] SAPoTDirectory_close
+*
+*/
+void SAPoTDirectory_close(SAPoTDirectory* directory){
+
+	if(directory->map != NULL) munmap(directory->map, directory->mapSize);
+	directory->map = NULL;
+	directory->mapSize = 0;
+	directory->header = NULL;
+	directory->entries = NULL;
+	directory->quantity = 0;
+}
+
+/**
+* [Principal] SAPoTDirectory_version
+*
+*/
+void SAPoTDirectory_version(const SAPoTDirectory* directory, SAPoTMessage_directory* version){
+
+	memset(version, 0, sizeof(SAPoTMessage_directory));
+	if(directory->header == NULL) return;
+
+	version->epoch = directory->header->epoch;
+	version->version = directory->header->version;
+}
+
+/**
+* [Principal] SAPoTDirectory_update
+*
+*/
+int SAPoTDirectory_update(SAPoTDirectory* directory, const uint8_t* message, int messageLen){
+
+	SAPoTMessage_directory version;
+	SAPoTDirectory_entry* received = NULL;
+	int quantity = SAPoTDirectory_decode(message, messageLen, &version, &received);
+	if(quantity == SAPOTCLIENT_FAILURE) return SAPOTCLIENT_FAILURE;
+
+	//Tabela completa: substitui a cópia. Alterações: substituem os clientes de mesmo endereço MAC ou são acrescentadas
+	uint32_t total = version.full ? quantity : directory->quantity + quantity;
+	SAPoTDirectory_entry* entries = malloc((total + 1) * sizeof(SAPoTDirectory_entry));
+	if(entries == NULL){
+		free(received);
+		return SAPOTCLIENT_FAILURE;
+	}
+
+	if(version.full){
+		memcpy(entries, received, quantity * sizeof(SAPoTDirectory_entry));
+	}
+	else{
+		uint32_t previous = directory->quantity;
+		memcpy(entries, directory->entries, previous * sizeof(SAPoTDirectory_entry));
+		qsort(entries, previous, sizeof(SAPoTDirectory_entry), SAPoTDirectory_compare_mac);
+
+		total = previous;
+		int i;
+		for(i=0; i<quantity; i++){
+			SAPoTDirectory_entry* entry = bsearch(&received[i], entries, previous, sizeof(SAPoTDirectory_entry), SAPoTDirectory_compare_mac);
+			if(entry != NULL) *entry = received[i];
+			else entries[total++] = received[i];
+		}
+	}
+	free(received);
+
+	qsort(entries, total, sizeof(SAPoTDirectory_entry), SAPoTDirectory_compare_label);
+
+	int result = SAPoTDirectory_write(directory->path, &version, entries, total);
+	free(entries);
+	if(result != SAPOTCLIENT_SUCCESS) return SAPOTCLIENT_FAILURE;
+
+	//Mapeando o novo arquivo
+	char path[sizeof(directory->path)];
+	strcpy(path, directory->path);
+	SAPoTDirectory_close(directory);
+	if(SAPoTDirectory_open(directory, path) != SAPOTCLIENT_SUCCESS) return SAPOTCLIENT_FAILURE;
+
+	return quantity;
+}
+
+/**
+* [Principal] SAPoTDirectory_find
+*
+*/
+const SAPoTDirectory_entry* SAPoTDirectory_find(const SAPoTDirectory* directory, const char* label){
+
+	int first;
+	if(SAPoTDirectory_prefix(directory, label, &first) == 0) return NULL;
+	if(strcmp(directory->entries[first].label, label) != 0) return NULL;
+
+	return &directory->entries[first];
+}
+
+/**
+* [Principal] SAPoTDirectory_prefix
+*
+*/
+int SAPoTDirectory_prefix(const SAPoTDirectory* directory, const char* prefix, int* first){
+
+	size_t length = strlen(prefix);
+	int low = 0, high = directory->quantity;
+
+	//Primeiro cliente com etiqueta maior ou igual ao prefixo
+	while(low < high){
+		int middle = (low + high) / 2;
+		if(strcmp(directory->entries[middle].label, prefix) < 0) low = middle + 1;
+		else high = middle;
+	}
+
+	*first = low;
+	int quantity = 0;
+	while(low + quantity < (int) directory->quantity && strncmp(directory->entries[low + quantity].label, prefix, length) == 0) quantity++;
+
+	return quantity;
+}
+
+/**
+* [Principal] SAPoTDirectory_print
+*
+*/
+void SAPoTDirectory_print(const SAPoTDirectory* directory, const char* prefix){
+
+	int first = 0;
+	int quantity = (prefix != NULL) ? SAPoTDirectory_prefix(directory, prefix, &first) : (int) directory->quantity;
+
+	printf("\t  Label\t\t   Macaddr\t\tType\tSensors\tActuators\n");
+
+	int i;
+	for(i=first; i<first+quantity; i++){
+
+		const SAPoTDirectory_entry* entry = &directory->entries[i];
+		printf("\t%-10s", entry->label);
+		printf("\t%02X:%02X:%02X:%02X:%02X:%02X", entry->mac[0], entry->mac[1], entry->mac[2], entry->mac[3], entry->mac[4], entry->mac[5]);
+		printf("\t %d", (int)entry->type);
+		printf("\t %d", (int)entry->sensor);
+		printf("\t %d\n",(int)entry->actuator);
+
+	}
+
+}
+
+/**
+* [Subrotina] SAPoTDirectory_decode
+*
+* Decodifica os clientes de uma resposta de acesso nos formatos fixo, compacto ou versionado. Sem versão (central sem suporte
+* ao acesso versionado), a tabela é completa e a versão nula.
+*
+*/
+static int SAPoTDirectory_decode(const uint8_t* message, int messageLen, SAPoTMessage_directory* version, SAPoTDirectory_entry** received){
+
+	const SAPoTMessage_header* header = (const SAPoTMessage_header*) message;
+	memset(version, 0, sizeof(SAPoTMessage_directory));
+	version->full = 1;
+	*received = NULL;
+
+	if(messageLen < (int) sizeof(SAPoTMessage_header) || header->instruction != 0x04 || header->ack == false) return SAPOTCLIENT_FAILURE;
+
+	const uint8_t* payload = message + sizeof(SAPoTMessage_header);
+	const uint8_t* end = message + (header->length < messageLen ? header->length : messageLen);
+	if(end < payload) return SAPOTCLIENT_FAILURE;
+
+	if(header->rsv1 == true && header->rsv3 == true){
+		if(end - payload < (int) sizeof(SAPoTMessage_directory)) return SAPOTCLIENT_FAILURE;
+		memcpy(version, payload, sizeof(SAPoTMessage_directory));
+		payload += sizeof(SAPoTMessage_directory);
+	}
+
+	uint32_t quantity, i;
+	int len;
+
+	//Formato fixo: uma seção SAPoTMessage_access por cliente
+	if(header->rsv1 == false){
+
+		quantity = (end - payload) / sizeof(SAPoTMessage_access);
+		if((*received = calloc(quantity + 1, sizeof(SAPoTDirectory_entry))) == NULL) return SAPOTCLIENT_FAILURE;
+
+		for(i=0; i<quantity; i++){
+			const SAPoTMessage_access* access = (const SAPoTMessage_access*) (payload + i*sizeof(SAPoTMessage_access));
+			char id[18];
+			memcpy((*received)[i].label, access->label, 10);
+			memcpy(id, access->id, 17);
+			id[17] = '\0';
+			upper_string(id);
+			getmacID(id, (*received)[i].mac);
+			(*received)[i].type = access->type;
+			(*received)[i].sensor = access->sensor;
+			(*received)[i].actuator = access->actuator;
+		}
+		return quantity;
+	}
+
+	//Codificação compacta: cada cliente ocupa ao menos 5 bytes
+	if((len = getVarint(payload, end, &quantity)) == 0 || quantity > (uint32_t) (end - payload)) return SAPOTCLIENT_FAILURE;
+	payload += len;
+	if((*received = calloc(quantity + 1, sizeof(SAPoTDirectory_entry))) == NULL) return SAPOTCLIENT_FAILURE;
+
+	SAPoTClient_accessEntry entry;
+	uint8_t previous[6] = {};
+	for(i=0; i<quantity; i++){
+
+		if((len = SAPoTClient_decodeAccessEntry(payload, end, header->rsv2, previous, &entry)) == 0){
+			free(*received);
+			*received = NULL;
+			return SAPOTCLIENT_FAILURE;
+		}
+		payload += len;
+
+		strcpy((*received)[i].label, entry.label);
+		memcpy((*received)[i].mac, entry.mac, 6);
+		(*received)[i].type = entry.type;
+		(*received)[i].sensor = entry.sensor;
+		(*received)[i].actuator = entry.actuator;
+	}
+
+	return quantity;
+}
+
+/**
+* [Subrotina] SAPoTDirectory_write
+*
+* Escreve a cópia em um arquivo temporário e o renomeia sobre o arquivo de cache.
+*
+*/
+static int SAPoTDirectory_write(const char* path, const SAPoTMessage_directory* version, const SAPoTDirectory_entry* entries, uint32_t quantity){
+
+	char temporary[sizeof(((SAPoTDirectory*) 0)->path) + 16];
+	snprintf(temporary, sizeof(temporary), "%s.%d", path, (int) getpid());
+
+	FILE* file = fopen(temporary, "wb");
+	if(file == NULL) return SAPOTCLIENT_FAILURE;
+
+	SAPoTDirectory_fileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SAPOT_DIRECTORY_MAGIC, 4);
+	header.format = SAPOT_DIRECTORY_FORMAT_VERSION;
+	header.epoch = version->epoch;
+	header.version = version->version;
+	header.quantity = quantity;
+	header.updated = (uint64_t) time(NULL);
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		(quantity == 0 || fwrite(entries, sizeof(SAPoTDirectory_entry), quantity, file) == quantity);
+	if(fclose(file) != 0) written = false;
+
+	if(!written || rename(temporary, path) != 0){
+		unlink(temporary);
+		return SAPOTCLIENT_FAILURE;
+	}
+
+	return SAPOTCLIENT_SUCCESS;
+}
+
+/**
+* [Subrotina] SAPoTDirectory_compare_label
+*
+*/
+static int SAPoTDirectory_compare_label(const void* a, const void* b){
+
+	const SAPoTDirectory_entry* first = (const SAPoTDirectory_entry*) a;
+	const SAPoTDirectory_entry* second = (const SAPoTDirectory_entry*) b;
+
+	int result = strcmp(first->label, second->label);
+	return (result != 0) ? result : memcmp(first->mac, second->mac, 6);
+}
+
+/**
+* [Subrotina] SAPoTDirectory_compare_mac
+*
+*/
+static int SAPoTDirectory_compare_mac(const void* a, const void* b){
+
+	return memcmp(((const SAPoTDirectory_entry*) a)->mac, ((const SAPoTDirectory_entry*) b)->mac, 6);
+}
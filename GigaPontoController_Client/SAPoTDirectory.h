@@ -0,0 +1,162 @@
+#ifndef SAPOTDIRECTORY_H
+#define SAPOTDIRECTORY_H
+
+/*
+* SAPoTDirectory: cópia em cache da tabela de acesso (0x04) da central, mantida pelo gpc em disco.
+*
+*	O arquivo (<cache>/gpc/directory-<host>-<centralId>.sapd, com <cache> = $XDG_CACHE_HOME ou ~/.cache) inicia com um
+*	SAPoTDirectory_fileHeader, seguido pelos clientes (SAPoTDirectory_entry) ordenados por etiqueta e endereço MAC. O arquivo
+*	é mapeado em memória somente para leitura: a listagem, o autocompletar e a validação de etiquetas não consultam a central
+*	e não dependem do tamanho da tabela para abrir. As atualizações escrevem um novo arquivo e o renomeiam sobre o anterior,
+*	de forma que outro gpc nunca mapeia um arquivo incompleto.
+*
+*	A cópia é atualizada pelas respostas às solicitações de acesso versionadas (rsv3, veja SAPoTMessage_directory): a central
+*	envia apenas os clientes alterados desde a versão da cópia, ou a tabela completa quando a cópia é de outro processo da
+*	central ou está defasada demais.
+*
+*/
+
+								/************************* Headers ******************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "SAPoTClient.h"
+
+
+								/************************* Defines ******************************/
+
+/**
+* Identificador dos arquivos de cache do diretório
+*
+*/
+#define SAPOT_DIRECTORY_MAGIC "SAPD"
+
+/**
+* Versão do formato dos arquivos de cache do diretório
+*
+*/
+#define SAPOT_DIRECTORY_FORMAT_VERSION 1
+
+
+					/************************* Structs for SAPoTDirectory *************************/
+
+/**
+* Estrutura: Cabeçalho do arquivo de cache (32 bytes), seguido por quantity clientes
+*
+*/
+typedef struct{
+	/** Identificador SAPOT_DIRECTORY_MAGIC (sem terminador nulo) */
+	char magic[4];
+	/** Versão do formato (SAPOT_DIRECTORY_FORMAT_VERSION) */
+	uint16_t format;
+	/** Reservado */
+	uint16_t rsv;
+	/** Versão do diretório da central (veja SAPoTMessage_directory); epoch 0 se a central não suporta o acesso versionado */
+	uint32_t epoch;
+	uint32_t version;
+	/** Quantidade de clientes */
+	uint32_t quantity;
+	/** Reservado */
+	uint32_t rsv2;
+	/** Instante da última atualização, em segundos desde 1970 */
+	uint64_t updated;
+}SAPoTDirectory_fileHeader;
+
+/**
+* Estrutura: Cliente da cópia em cache (24 bytes)
+*
+*/
+typedef struct{
+	/** Etiqueta (terminada em nulo) */
+	char label[11];
+	/** Endereço MAC binário */
+	uint8_t mac[6];
+	/** Quantidade de sensores */
+	uint8_t sensor;
+	/** Quantidade de atuadores */
+	uint8_t actuator;
+	/** Reservado */
+	uint8_t rsv[3];
+	/** Tipo de Cliente */
+	uint16_t type;
+}SAPoTDirectory_entry;
+
+/**
+* Estrutura: Cópia mapeada do diretório. Sem arquivo de cache válido, a cópia é vazia (quantity 0, header NULL)
+*
+*/
+typedef struct{
+	/** Caminho do arquivo de cache */
+	char path[512];
+	/** Mapeamento do arquivo */
+	void* map;
+	/** Tamanho do mapeamento */
+	size_t mapSize;
+	/** Cabeçalho do arquivo mapeado */
+	const SAPoTDirectory_fileHeader* header;
+	/** Clientes, ordenados por etiqueta e endereço MAC */
+	const SAPoTDirectory_entry* entries;
+	/** Quantidade de clientes */
+	uint32_t quantity;
+}SAPoTDirectory;
+
+
+					/************************* Functions for SAPoTDirectory *************************/
+
+/**
+* Função: Monta em path o caminho do arquivo de cache do diretório da central centralId no broker host, criando os diretórios
+* de cache se necessário. Retorna SAPOTCLIENT_SUCCESS, ou SAPOTCLIENT_FAILURE se não houver diretório de cache ($HOME)
+*
+*/
+int SAPoTDirectory_path(const char* host, const char* centralId, char* path, int size);
+
+/**
+* Função: Mapeia o arquivo de cache path. Retorna SAPOTCLIENT_SUCCESS, ou SAPOTCLIENT_FAILURE se o arquivo não existir ou
+* for inválido; em ambos os casos directory pode ser utilizado (vazio no segundo) e atualizado por SAPoTDirectory_update()
+*
+*/
+int SAPoTDirectory_open(SAPoTDirectory* directory, const char* path);
+
+/**
+* Função: Desfaz o mapeamento do arquivo de cache
+*
+*/
+void SAPoTDirectory_close(SAPoTDirectory* directory);
+
+/**
+* Função: Preenche version com a versão da cópia, a ser enviada na solicitação de acesso versionada (nula sem cópia)
+*
+*/
+void SAPoTDirectory_version(const SAPoTDirectory* directory, SAPoTMessage_directory* version);
+
+/**
+* Função: Atualiza a cópia com a resposta (ACK) a uma solicitação de acesso, versionada ou não, e remapeia o arquivo. Retorna
+* a quantidade de clientes recebidos, ou SAPOTCLIENT_FAILURE se a resposta for inválida ou o arquivo não puder ser escrito
+*
+*/
+int SAPoTDirectory_update(SAPoTDirectory* directory, const uint8_t* message, int messageLen);
+
+/**
+* Função: Procura o primeiro cliente de etiqueta label. Retorna NULL se a etiqueta não estiver na cópia
+*
+*/
+const SAPoTDirectory_entry* SAPoTDirectory_find(const SAPoTDirectory* directory, const char* label);
+
+/**
+* Função: Procura os clientes cuja etiqueta inicia com prefix, que são consecutivos na cópia. Retorna a quantidade de clientes
+* e, em first, a posição do primeiro
+*
+*/
+int SAPoTDirectory_prefix(const SAPoTDirectory* directory, const char* prefix, int* first);
+
+/**
+* Função: Imprime os clientes da cópia cuja etiqueta inicia com prefix (todos, se prefix for NULL), no formato de
+* SAPoTClient_printAcess()
+*
+*/
+void SAPoTDirectory_print(const SAPoTDirectory* directory, const char* prefix);
+
+
+#endif
@@ -0,0 +1,185 @@
+/*
+* gpcd: daemon que mantém a sessão MQTT do cliente SAPoT com a central e atende as requisições do gpc por um socket UNIX.
+*
+*	Uso: ./gpcd [-s socket] [-H host] [-P porta] [-c centralId] [-i clientId] [-w janela] [-T timeout (ms)]
+*
+*	Cada conexão ao socket (padrão SAPOTCLIENT_DAEMON_SOCKET ou a variável de ambiente GPCD_SOCKET) transporta uma única
+*	requisição: um SAPoTClient_frame seguido pela mensagem SAPoT construída pelo gpc. O gpcd substitui o emissor da mensagem
+*	pelo seu clientId, atribui um serial, publica a mensagem na central e, quando o ACK com o mesmo serial chega, o devolve
+*	pela mesma conexão e a encerra. Requisições sem resposta dentro do tempo limite são respondidas com ERROR_REQUEST_TIMEOUT.
+*	Com o gpcd em execução, uma chamada avulsa do gpc custa uma ida e volta ao broker, sem o TCP connect, o CONNECT e o
+*	SUBSCRIBE MQTT.
+*
+*	O clientId do gpcd deve ser diferente do utilizado pelo gpc nos modos direto, batch e shell: o broker desconecta uma das
+*	sessões quando dois clientes utilizam o mesmo identificador.
+*
+*/
+
+/* Bibliotecas */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <MQTTClient.h>
+#include "SAPoTClient.h"
+
+/* Declaração de Objetos */
+SAPoTClient SAPoTclient;
+static const char* socketPath;
+static int listener = -1;
+
+void signalHandling(int signum){
+
+	printf("Finalizando o gpcd...\n");
+	if(listener >= 0) close(listener);
+	unlink(socketPath);
+	SAPoTClient_end(&SAPoTclient);
+	exit(0);
+
+}
+
+/* Devolve o ACK da central (ou o erro de expiração) ao gpc que enviou a requisição */
+static void daemonReply(SAPoTClient* handle, const SAPoTClient_request* request, int status, const uint8_t* message, int messageLen){
+
+	int fd = (int) (intptr_t) request->context;
+	SAPoTClient_frame frame = {status, message != NULL ? messageLen : 0};
+
+	if(SAPoTClient_transfer(fd, &frame, sizeof(frame), false) == SAPOTCLIENT_SUCCESS && message != NULL){
+		SAPoTClient_transfer(fd, (void*) message, messageLen, false);
+	}
+	close(fd);
+
+	if(status == SAPOTCLIENT_SUCCESS) printf("[%5u] %-40s OK %10.3f ms\n", request->serial, request->command, request->latency / 1000.0);
+	else if(status == ERROR_REQUEST_TIMEOUT) printf("[%5u] %-40s TIMEOUT\n", request->serial, request->command);
+	else printf("[%5u] %-40s FAILURE (%d)\n", request->serial, request->command, status);
+	fflush(stdout);
+}
+
+/* Descreve uma requisição para o registro do daemon (ex.: "solicitation sala07") */
+static void describeRequest(const uint8_t* message, int messageLen, char* command, int size){
+
+	const SAPoTMessage_header* header = (const SAPoTMessage_header*) message;
+	const uint8_t* payload = message + sizeof(SAPoTMessage_header);
+
+	if(header->instruction == 0x04) snprintf(command, size, "access");
+	else if(header->instruction == 0x06 && messageLen >= sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_modification)){
+		const SAPoTMessage_modification* modification = (const SAPoTMessage_modification*) payload;
+		snprintf(command, size, "modification %.17s %.10s", modification->macaddr, modification->label);
+	}
+	else if(header->instruction == 0x03 && messageLen >= sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_solicitation)){
+		const SAPoTMessage_solicitation* solicitation = (const SAPoTMessage_solicitation*) payload;
+		snprintf(command, size, "solicitation %.10s 0x%04X", (const char*) solicitation->label, solicitation->timeSet);
+	}
+	else if(header->instruction == 0x0B && messageLen >= sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_report)){
+		const SAPoTMessage_report* report = (const SAPoTMessage_report*) payload;
+		snprintf(command, size, "report %.10s %u", (const char*) report->label, report->sensorId);
+	}
+	else snprintf(command, size, "instruction 0x%02X", header->instruction);
+}
+
+/* Recebe a requisição de uma conexão aceita e a publica; a conexão é encerrada por daemonReply() */
+static void serveConnection(int fd){
+
+	//Limitando a espera por um gpc que conectou e não enviou a requisição
+	struct timeval timeout = {1, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	SAPoTClient_frame frame;
+	uint8_t message[65535];
+	if(SAPoTClient_transfer(fd, &frame, sizeof(frame), true) != SAPOTCLIENT_SUCCESS || frame.length < sizeof(SAPoTMessage_header) ||
+	   SAPoTClient_transfer(fd, message, frame.length, true) != SAPOTCLIENT_SUCCESS){
+		close(fd);
+		return;
+	}
+
+	//As respostas da central são publicadas no tópico do emissor: o do gpcd
+	SAPoTMessage_header* header = (SAPoTMessage_header*) message;
+	getmacID(SAPoTclient.id, header->emitterId);
+	header->length = frame.length;
+
+	char command[64];
+	describeRequest(message, frame.length, command, sizeof(command));
+
+	if(SAPoTClient_request_async(&SAPoTclient, message, frame.length, command, daemonReply, (void*) (intptr_t) fd) == SAPOTCLIENT_FAILURE){
+		frame.status = ERROR_MQTT_PUBLISH;
+		frame.length = 0;
+		SAPoTClient_transfer(fd, &frame, sizeof(frame), false);
+		close(fd);
+	}
+}
+
+/* Função Principal */
+int main(int argc, char *argv[]){
+
+	//Padrões iguais aos do gpc (main.c), exceto o clientId
+	SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"10.10.20.205", "1883", NULL, NULL}};
+	const char* clientId = "78:E4:00:8C:65:78";
+	int window = SAPOTCLIENT_PENDING;
+	int timeout = SAPOTCLIENT_TIMEOUT;
+	socketPath = getenv("GPCD_SOCKET") != NULL ? getenv("GPCD_SOCKET") : SAPOTCLIENT_DAEMON_SOCKET;
+
+	int opt;
+	while((opt = getopt(argc, argv, "s:H:P:c:i:w:T:")) != -1){
+		if(opt == 's') socketPath = optarg;
+		else if(opt == 'H') SAPoTopts.transmission.host = optarg;
+		else if(opt == 'P') SAPoTopts.transmission.port = optarg;
+		else if(opt == 'c') SAPoTopts.centralId = optarg;
+		else if(opt == 'i') clientId = optarg;
+		else if(opt == 'w') window = atoi(optarg);
+		else if(opt == 'T') timeout = atoi(optarg);
+		else{
+			printf("Uso: %s [-s socket] [-H host] [-P porta] [-c centralId] [-i clientId] [-w janela] [-T timeout (ms)]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	//Criando o socket antes da sessão MQTT: um segundo gpcd no mesmo caminho é recusado
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener < 0) return 1;
+	if(connect(listener, (struct sockaddr*) &address, sizeof(address)) == 0){
+		printf("gpcd já em execução em %s\n", socketPath);
+		return 1;
+	}
+	unlink(socketPath);
+	if(bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 64) != 0){
+		printf("Erro ao criar o socket %s\n", socketPath);
+		return 1;
+	}
+	chmod(socketPath, 0660);
+
+	signal(SIGINT, signalHandling);
+	signal(SIGTERM, signalHandling);
+	signal(SIGPIPE, SIG_IGN);
+
+	//Iniciando a sessão MQTT persistente
+	if(SAPoTClient_begin(&SAPoTclient, &SAPoTopts, clientId) == SAPOTCLIENT_FAILURE){
+		printf("Erro (%d) ao iniciar o cliente SAPoT\n", SAPoTClient_error(&SAPoTclient));
+		unlink(socketPath);
+		return 1;
+	}
+	SAPoTclient.window = window;
+	SAPoTclient.timeout = timeout;
+
+	printf("gpcd atendendo em %s (central %s, cliente %s)\n", socketPath, SAPoTopts.centralId, clientId);
+	fflush(stdout);
+
+	//A expiração das requisições e a reconexão ao broker são feitas pela thread de expiração do cliente
+	while(true){
+		int fd = accept(listener, NULL, NULL);
+		if(fd >= 0) serveConnection(fd);
+	}
+
+	return 0;
+}
@@ -6,88 +6,81 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <math.h>
 #include <MQTTClient.h>
 #include "SAPoTClient.h"
+#include "SAPoTDirectory.h"
 
 /* Declaração de Objetos */
 SAPoTClient SAPoTclient;
+SAPoTDirectory SAPoTdirectory;
+static pthread_mutex_t directoryLock = PTHREAD_MUTEX_INITIALIZER;
 
 void signalHandling(int signum){
 
 	printf("Finalizando o cliente SAPoT...\n");
-	SAPoTClient_end();
+	SAPoTClient_end(&SAPoTclient);
 	exit(1);
 
 }
 
-int main(int argc, char *argv[]){
+/* Verifica se a etiqueta está na cópia em cache do diretório (sem cópia, a etiqueta é verificada apenas pela central) */
+static bool knownLabel(const char* label){
 
-	//Tratando o sinal SIGINT
-	signal(SIGINT, signalHandling);
-
-	if(argc<2){
+	pthread_mutex_lock(&directoryLock);
+	bool known = SAPoTdirectory.header == NULL || SAPoTDirectory_find(&SAPoTdirectory, label) != NULL;
+	pthread_mutex_unlock(&directoryLock);
 
-		printf("Argumento de execução invalido. Tente:\n");
-		printf("./gpc access\n");
-		printf("./gpc modification \"$macaddr\" \"$label\" \n");
-		printf("./gpc solicitation \"$label\" \"$operation\"\n");
-		printf("\t $operation: ON, OFF, RST \n");
-		exit(1);	
-
-	}
-
-	//Definindo o id para cliente 
-	const char* clientId = "78:E4:00:8C:65:77";
-
-	//Configurando as opções de inicialização do cliente
-	//SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"10.10.40.84", "1883", "LDAP", NULL}};
-	//SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"localhost", "1883", NULL, NULL}};
-	//SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"192.168.4.1", "1883", NULL, NULL}};
-	SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"10.10.20.205", "1883", NULL, NULL}};
-
-
-	//Iniciando o cliente
-	if(SAPoTClient_begin(&SAPoTclient, &SAPoTopts, clientId) == SAPOTCLIENT_FAILURE){
-		printf("Erro (%d) ao iniciar o cliente SAPoT", SAPoTClient_error());
-		exit(1);
-	}
+	return known;
+}
 
-	//printf("Cliente iniciado\n");
+/* Constrói a mensagem de um comando ("access", "modification $macaddr $label", "solicitation $label $operation" ou
+   "report $label $sensor $modo [limiar] [heartbeat]") */
+static int buildMessage(const char* clientId, int argc, char* argv[], bool verbose, void** message, int* messageLen){
 
-	void* message;
-	int messageLen;
+	if(!strcmp(argv[0], "access") && argc == 1){
 
-	if(!strcmp(argv[1], "access")){
+		if(verbose) printf("Requested Access \n");
 
-		printf("Requested Access \n");
+		//Com a cópia em cache, a solicitação é versionada e a central envia apenas as alterações desde a cópia
+		bool versioned = SAPoTdirectory.path[0] != '\0';
 		
 		//Alocando espaço de memória para a mensagem
-		messageLen = sizeof(SAPoTMessage_header);
-		message = malloc(messageLen);
+		*messageLen = sizeof(SAPoTMessage_header) + (versioned ? sizeof(SAPoTMessage_directory) : 0);
+		*message = malloc(*messageLen);
 
 		//Preenchendo cabeçalho da mensagem
-		SAPoTMessage_header* header = (SAPoTMessage_header*) message;
+		SAPoTMessage_header* header = (SAPoTMessage_header*) *message;
 		header->version = SAPOT_PROTOCOL_VERSION;
 		header->ack = 0;
-		header->rsv1 = 0;
-		header->rsv2 = 0;
-		header->rsv3 = 0;
+		header->rsv1 = 1; //Aceita a tabela no formato compacto
+		header->rsv2 = 1; //Aceita a codificação delta dos endereços MAC
+		header->rsv3 = versioned;
 		header->instruction = 4;
 		header->serial = 0;
-		header->length = messageLen;
+		header->length = *messageLen;
 		getmacID(clientId, header->emitterId);
 
+		//Preenchendo payload com a versão da cópia
+		if(versioned){
+			pthread_mutex_lock(&directoryLock);
+			SAPoTDirectory_version(&SAPoTdirectory, (SAPoTMessage_directory*) (*message + sizeof(SAPoTMessage_header)));
+			pthread_mutex_unlock(&directoryLock);
+		}
+
 	}
-	else if(!strcmp(argv[1], "modification")){
+	else if(!strcmp(argv[0], "modification") && argc == 3){
 
-		printf("Requested Modification \n");
+		if(verbose) printf("Requested Modification \n");
 
 		//Alocando espaço de memória para a mensagem
-		messageLen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_modification);
-		message = malloc(messageLen);
+		*messageLen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_modification);
+		*message = calloc(1, *messageLen);
 
 		//Preenchendo cabeçalho da mensagem
-		SAPoTMessage_header* header = (SAPoTMessage_header*) message;
+		SAPoTMessage_header* header = (SAPoTMessage_header*) *message;
 		header->version = SAPOT_PROTOCOL_VERSION;
 		header->ack = 0;
 		header->rsv1 = 0;
@@ -95,25 +88,31 @@ int main(int argc, char *argv[]){
 		header->rsv3 = 0;
 		header->instruction = 6;
 		header->serial = 0;
-		header->length = messageLen;
+		header->length = *messageLen;
 		getmacID(clientId, header->emitterId);
 
 		//Preenchendo payload
-		SAPoTMessage_modification* modification = (SAPoTMessage_modification*) (message + sizeof(SAPoTMessage_header));
-		strncpy(modification->macaddr, argv[2], 17);
-		strncpy(modification->label, argv[3], 10);
+		SAPoTMessage_modification* modification = (SAPoTMessage_modification*) (*message + sizeof(SAPoTMessage_header));
+		strncpy(modification->macaddr, argv[1], 17);
+		strncpy(modification->label, argv[2], 10);
 
 	}
-	else if(!strcmp(argv[1], "solicitation")){
+	else if(!strcmp(argv[0], "solicitation") && argc == 3){
+
+		if(verbose) printf("Requested Solicitation \n");
 
-		printf("Requested Solicitation \n");
+		//Recusando etiquetas ausentes da cópia em cache antes de enviar a solicitação
+		if(!knownLabel(argv[1])){
+			printf("Unknown label: %s\n", argv[1]);
+			return SAPOTCLIENT_FAILURE;
+		}
 
 		//Alocando espaço de memória para a mensagem
-		messageLen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_solicitation);
-		message = malloc(messageLen);
+		*messageLen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_solicitation);
+		*message = calloc(1, *messageLen);
 
 		//Preenchendo cabeçalho da mensagem
-		SAPoTMessage_header* header = (SAPoTMessage_header*) message;
+		SAPoTMessage_header* header = (SAPoTMessage_header*) *message;
 		header->version = SAPOT_PROTOCOL_VERSION;
 		header->ack = 0;
 		header->rsv1 = 0;
@@ -121,48 +120,815 @@ int main(int argc, char *argv[]){
 		header->rsv3 = 0;
 		header->instruction = 3;
 		header->serial = 0;
-		header->length = messageLen;
+		header->length = *messageLen;
 		getmacID(clientId, header->emitterId);
 
 		//Preenchendo payload
-		SAPoTMessage_solicitation* solicitation = (SAPoTMessage_solicitation*) (message + sizeof(SAPoTMessage_header));
-		strncpy((char*) solicitation->label, argv[2], 10);
+		SAPoTMessage_solicitation* solicitation = (SAPoTMessage_solicitation*) (*message + sizeof(SAPoTMessage_header));
+		strncpy((char*) solicitation->label, argv[1], 10);
 		solicitation->degreeOfPerformance = 0xffff;
-		if(!strcmp(argv[3], "ON")){
+		if(!strcmp(argv[2], "ON")){
 			solicitation->sensorOrActuatorId = 1;
 			solicitation->timeSet = 0x1001;
 
 		}
-		else if(!strcmp(argv[3], "OFF")){
+		else if(!strcmp(argv[2], "OFF")){
 			solicitation->sensorOrActuatorId = 1;
 			solicitation->timeSet = 0x1003;
 
 		}
-		else if(!strcmp(argv[3], "RST")){
+		else if(!strcmp(argv[2], "RST")){
 			solicitation->sensorOrActuatorId = 2;
 			solicitation->timeSet = 0x1001;
 			
 		}
 		else{ 
 			printf("Invalid operation !\n");
-			SAPoTClient_end();
-			exit(1);
+			free(*message);
+			return SAPOTCLIENT_FAILURE;
 		}	
 
 	}
+	else if(!strcmp(argv[0], "report") && argc >= 4 && argc <= 6){
+
+		if(verbose) printf("Requested Report \n");
+
+		//Recusando etiquetas ausentes da cópia em cache antes de enviar a configuração
+		if(!knownLabel(argv[1])){
+			printf("Unknown label: %s\n", argv[1]);
+			return SAPOTCLIENT_FAILURE;
+		}
+
+		//Modo de relato: periódico (off), por variação absoluta (abs) ou percentual (pct) em relação ao último valor relatado
+		uint8_t mode;
+		if(!strcmp(argv[3], "off")) mode = SAPOT_REPORT_PERIODIC;
+		else if(!strcmp(argv[3], "abs")) mode = SAPOT_REPORT_ABSOLUTE;
+		else if(!strcmp(argv[3], "pct")) mode = SAPOT_REPORT_PERCENT;
+		else{
+			printf("Invalid mode !\n");
+			return SAPOTCLIENT_FAILURE;
+		}
+
+		//Heartbeat em segundos (sufixos s, m e h), convertido para a menor escala de tempo SAPoT que o comporta (padrão: 10 minutos)
+		uint16_t heartbeat = 0x200A;
+		if(argc == 6){
+			char* unit;
+			long seconds = strtol(argv[5], &unit, 10);
+			if(*unit == 'm') seconds *= 60;
+			else if(*unit == 'h') seconds *= 3600;
+			else if(*unit != 's' && *unit != '\0') seconds = -1;
+			if(seconds <= 0 || seconds > 0x0FFF * 3600L){
+				printf("Invalid heartbeat !\n");
+				return SAPOTCLIENT_FAILURE;
+			}
+			if(seconds <= 0x0FFF) heartbeat = 0x1000 | seconds;
+			else if(seconds / 60 <= 0x0FFF) heartbeat = 0x2000 | (seconds / 60);
+			else heartbeat = 0x3000 | (seconds / 3600);
+		}
+
+		//Alocando espaço de memória para a mensagem
+		*messageLen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_report);
+		*message = calloc(1, *messageLen);
+
+		//Preenchendo cabeçalho da mensagem
+		SAPoTMessage_header* header = (SAPoTMessage_header*) *message;
+		header->version = SAPOT_PROTOCOL_VERSION;
+		header->ack = 0;
+		header->rsv1 = 0;
+		header->rsv2 = 0;
+		header->rsv3 = 0;
+		header->instruction = 0x0B;
+		header->serial = 0;
+		header->length = *messageLen;
+		getmacID(clientId, header->emitterId);
+
+		//Preenchendo payload
+		SAPoTMessage_report* report = (SAPoTMessage_report*) (*message + sizeof(SAPoTMessage_header));
+		strncpy((char*) report->label, argv[1], 10);
+		report->sensorId = !strcmp(argv[2], "all") ? SAPOT_REPORT_ALL_SENSORS : atoi(argv[2]);
+		report->deadband.mode = mode;
+		report->deadband.heartbeat = heartbeat;
+		report->deadband.threshold = (argc >= 5) ? atof(argv[4]) : 0;
+
+	}
+	else return SAPOTCLIENT_FAILURE;
+
+	return SAPOTCLIENT_SUCCESS;
+}
+
+/* Atualiza a cópia em cache com um ACK de Access e imprime a tabela pela cópia (sem cópia, diretamente pelo ACK) */
+static void printAccess(const uint8_t* message, int messageLen, bool print){
+
+	pthread_mutex_lock(&directoryLock);
+	if(SAPoTdirectory.path[0] != '\0' && SAPoTDirectory_update(&SAPoTdirectory, message, messageLen) != SAPOTCLIENT_FAILURE){
+		if(print) SAPoTDirectory_print(&SAPoTdirectory, NULL);
+	}
+	else if(((const SAPoTMessage_header*) message)->rsv3 == true) printf("Erro ao atualizar a cópia em cache %s\n", SAPoTdirectory.path);
+	else if(!print);
+	else if(((const SAPoTMessage_header*) message)->rsv1 == true) SAPoTClient_printAccessCompact(message);
+	else SAPoTClient_printAcess(message);
+	pthread_mutex_unlock(&directoryLock);
+}
+
+/* Comandos locais, atendidos pela cópia em cache sem consultar a central: "list [prefixo]" e "labels [prefixo]" */
+static int localCommand(int argc, char* argv[]){
+
+	const char* prefix = (argc > 1) ? argv[1] : "";
+	int first, quantity, i;
+
+	pthread_mutex_lock(&directoryLock);
+
+	if(SAPoTdirectory.header == NULL){
+		pthread_mutex_unlock(&directoryLock);
+		printf("Sem cópia em cache do diretório (execute ./gpc access)\n");
+		return 1;
+	}
+
+	if(!strcmp(argv[0], "list")){
+		SAPoTDirectory_print(&SAPoTdirectory, prefix);
+		time_t updated = (time_t) SAPoTdirectory.header->updated;
+		printf("%u clientes em cache, atualizado em %s", SAPoTdirectory.quantity, ctime(&updated));
+	}
 	else{
-		SAPoTClient_end();
+		//Etiquetas distintas, uma por linha (autocompletar)
+		quantity = SAPoTDirectory_prefix(&SAPoTdirectory, prefix, &first);
+		for(i=first; i<first+quantity; i++){
+			if(i == first || strcmp(SAPoTdirectory.entries[i].label, SAPoTdirectory.entries[i-1].label)) printf("%s\n", SAPoTdirectory.entries[i].label);
+		}
+	}
+
+	pthread_mutex_unlock(&directoryLock);
+	return 0;
+}
+
+/* Imprime o resultado de uma requisição dos modos batch e shell (evocada pela thread do cliente MQTT ou pela de expiração) */
+static void printResult(SAPoTClient* handle, const SAPoTClient_request* request, int status, const uint8_t* message, int messageLen){
+
+	if(status == SAPOTCLIENT_SUCCESS){
+		if(request->instruction == 0x04) printAccess(message, messageLen, true);
+		printf("[%5u] %-40s OK %10.3f ms\n", request->serial, request->command, request->latency / 1000.0);
+	}
+	else if(status == ERROR_REQUEST_TIMEOUT) printf("[%5u] %-40s TIMEOUT\n", request->serial, request->command);
+	else printf("[%5u] %-40s FAILURE (%d)\n", request->serial, request->command, status);
+	fflush(stdout);
+}
+
+/* Separa uma linha de comando em argumentos (separados por espaços; aspas agrupam um argumento) */
+static int splitLine(char* line, char* args[], int maxArgs){
+
+	int argc = 0;
+	char* p = line;
+
+	while(argc < maxArgs){
+		while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+		if(*p == '\0') break;
+
+		if(*p == '"'){
+			args[argc++] = ++p;
+			while(*p != '\0' && *p != '"') p++;
+		}
+		else{
+			args[argc++] = p;
+			while(*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+		}
+		if(*p == '\0') break;
+		*p++ = '\0';
+	}
+
+	return argc;
+}
+
+/* Modos batch e shell: executa os comandos lidos de input sobre uma única conexão, com até window requisições em trânsito */
+static int runBatch(const char* clientId, FILE* input, bool interactive, int window){
+
+	char line[256];
+	char* args[8];
+	int failures = 0;
+
+	SAPoTclient.window = window;
+	if(interactive) printf("Comandos: access | modification $macaddr $label | solicitation $label $operation | report $label $sensor $modo [limiar] [heartbeat] | list [prefixo] | labels [prefixo] | wait | quit\n");
+
+	while(true){
+
+		if(interactive){
+			printf("gpc> ");
+			fflush(stdout);
+		}
+		if(fgets(line, sizeof(line), input) == NULL) break;
+
+		int argc = splitLine(line, args, 8);
+		if(argc == 0 || args[0][0] == '#') continue;
+		if(!strcmp(args[0], "quit") || !strcmp(args[0], "exit")) break;
+		if(!strcmp(args[0], "wait")){
+			SAPoTClient_wait(&SAPoTclient, 0);
+			continue;
+		}
+		if(!strcmp(args[0], "list") || !strcmp(args[0], "labels")){
+			localCommand(argc, args);
+			continue;
+		}
+
+		void* message;
+		int messageLen;
+		if(buildMessage(clientId, argc, args, false, &message, &messageLen) != SAPOTCLIENT_SUCCESS){
+			printf("Invalid command: %s\n", args[0]);
+			failures++;
+			continue;
+		}
+
+		//O comando é impresso com o resultado da requisição
+		char command[64] = "";
+		int i;
+		for(i=0; i<argc; i++){
+			if(i > 0) strncat(command, " ", sizeof(command) - strlen(command) - 1);
+			strncat(command, args[i], sizeof(command) - strlen(command) - 1);
+		}
+
+		if(SAPoTClient_request_async(&SAPoTclient, message, messageLen, command, printResult, NULL) == SAPOTCLIENT_FAILURE) failures++;
+		free(message);
+	}
+
+	//Aguardando as respostas das requisições em trânsito
+	SAPoTClient_wait(&SAPoTclient, 0);
+
+	printf("Requisições: %lu respondidas, %lu expiradas, %d falhas", SAPoTclient.answered, SAPoTclient.expired, failures);
+	if(SAPoTclient.answered > 0){
+		printf("; latência média %.3f ms (mín. %.3f ms, máx. %.3f ms)", SAPoTclient.latencySum / 1000.0 / SAPoTclient.answered, 
+			SAPoTclient.latencyMin / 1000.0, SAPoTclient.latencyMax / 1000.0);
+	}
+	printf("\n");
+
+	SAPoTClient_end(&SAPoTclient);
+
+	return (SAPoTclient.expired > 0 || failures > 0) ? 1 : 0;
+}
+
+/* Envia uma requisição avulsa pelo gpcd, se em execução, ou por uma conexão própria ao broker, mantida para as requisições
+seguintes; em caso de sucesso, reply recebe o ACK da central (liberado com free()) */
+static int transact(SAPoTClient_create_options* SAPoTopts, const char* clientId, void* message, int messageLen, uint8_t** reply, int* replyLen){
+
+	//Encaminhando a requisição ao gpcd (GPCD_SOCKET vazio desativa o encaminhamento)
+	const char* socketPath = getenv("GPCD_SOCKET") != NULL ? getenv("GPCD_SOCKET") : SAPOTCLIENT_DAEMON_SOCKET;
+	if(!SAPoTclient.inLoop && socketPath[0] != '\0'){
+		int status = SAPoTClient_forward(socketPath, message, messageLen, reply, replyLen);
+		if(status != ERROR_STARTING_TRANSMISSION_PROTOCOL) return status;
+	}
+
+	//Sem o gpcd: iniciando o cliente com uma conexão própria ao broker
+	if(!SAPoTclient.inLoop && SAPoTClient_begin(&SAPoTclient, SAPoTopts, clientId) == SAPOTCLIENT_FAILURE){
+		printf("Erro (%d) ao iniciar o cliente SAPoT\n", SAPoTClient_error(&SAPoTclient));
+		exit(1);
+	}
+
+	SAPoTClient_future future;
+	SAPoTClient_request_future(&SAPoTclient, message, messageLen, ((SAPoTMessage_header*) message)->instruction == 0x04 ? "access" : "request", &future);
+	int status = SAPoTClient_future_wait(&SAPoTclient, &future);
+
+	//A cópia do ACK passa a pertencer a quem evocou
+	*reply = future.reply;
+	*replyLen = future.replyLen;
+
+	return status;
+}
+
+/* Atualiza a cópia em cache com uma solicitação de acesso (ex.: antes de recusar uma etiqueta ausente da cópia) */
+static void refreshDirectory(SAPoTClient_create_options* SAPoTopts, const char* clientId){
+
+	void* message;
+	int messageLen;
+	uint8_t* reply;
+	int replyLen;
+	char* refresh[] = {"access"};
+
+	buildMessage(clientId, 1, refresh, false, &message, &messageLen);
+	if(transact(SAPoTopts, clientId, message, messageLen, &reply, &replyLen) == SAPOTCLIENT_SUCCESS){
+		printAccess(reply, replyLen, false);
+		free(reply);
+	}
+	free(message);
+}
+
+/* Estado da observação do tráfego (gpc watch), acessado pela thread de recebimento do cliente MQTT */
+typedef struct{
+
+	//Endereços MAC observados, ordenados (filtro no cliente); sem endereços, todos os emissores do tópico são impressos
+	uint8_t (*macs)[6];
+	int quantity;
+
+	//Clientes da cópia em cache ordenados por endereço MAC, para imprimir a etiqueta do emissor
+	const SAPoTDirectory_entry** byMac;
+	int labels;
+
+	//Segundo da última mensagem e seu horário formatado (localtime_r() apenas uma vez por segundo)
+	time_t second;
+	char clock[16];
+
+	//Mensagens impressas e descartadas pelo filtro
+	unsigned long printed, filtered;
+
+}WatchState;
+
+static volatile sig_atomic_t watching = 1;
+static const char* clientTypes[] = {"USR", "SMCAI", "SMCAE", "SMRE", "SMRH", "SRF"};
+
+void watchSignalHandling(int signum){
+
+	watching = 0;
+}
+
+/* Ordena e compara endereços MAC binários (6 bytes) */
+static int compareMac(const void* a, const void* b){
+
+	return memcmp(a, b, 6);
+}
+
+static int compareEntryMac(const void* a, const void* b){
+
+	return memcmp((*(const SAPoTDirectory_entry* const*) a)->mac, (*(const SAPoTDirectory_entry* const*) b)->mac, 6);
+}
+
+static int findEntryMac(const void* key, const void* element){
+
+	return memcmp(key, (*(const SAPoTDirectory_entry* const*) element)->mac, 6);
+}
+
+/* Interpreta o filtro como tipo de Cliente: nome (ex.: SMCAI) ou número (ex.: 1 ou 0x01) */
+static bool parseType(const char* filter, uint16_t* type){
+
+	int i;
+	for(i=0; i<(int) (sizeof(clientTypes)/sizeof(clientTypes[0])); i++){
+		if(!strcasecmp(filter, clientTypes[i])){
+			*type = i;
+			return true;
+		}
+	}
+
+	char* end;
+	long value = strtol(filter, &end, 0);
+	if(end == filter || *end != '\0' || value < 0 || value > 0xFFFF) return false;
+	*type = value;
+	return true;
+}
+
+/* Imprime uma mensagem republicada pela central, decodificada sem cópia: instante, etiqueta e MAC do emissor, evento e dados */
+static void watchMessage(SAPoTClient* handle, const char* topic, const uint8_t* message, int messageLen, void* context){
+
+	WatchState* state = (WatchState*) context;
+	if(messageLen < (int) sizeof(SAPoTMessage_header)) return;
+
+	const SAPoTMessage_header* header = (const SAPoTMessage_header*) message;
+	const uint8_t* payload = message + sizeof(SAPoTMessage_header);
+	int payloadLen = messageLen - sizeof(SAPoTMessage_header);
+	const uint8_t* mac = header->emitterId;
+
+	//Filtro no cliente: emissores fora do conjunto de etiquetas observadas
+	if(state->quantity > 0 && bsearch(mac, state->macs, state->quantity, 6, compareMac) == NULL){
+		state->filtered++;
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if(now.tv_sec != state->second){
+		struct tm date;
+		localtime_r(&now.tv_sec, &date);
+		strftime(state->clock, sizeof(state->clock), "%H:%M:%S", &date);
+		state->second = now.tv_sec;
+	}
+
+	const SAPoTDirectory_entry** entry = (state->labels > 0) ? bsearch(mac, state->byMac, state->labels, sizeof(*state->byMac), findEntryMac) : NULL;
+
+	char line[512];
+	int size = sizeof(line) - 1;
+	int n = snprintf(line, size, "%s.%03ld %-10s %02X:%02X:%02X:%02X:%02X:%02X ", state->clock, now.tv_nsec / 1000000, entry != NULL ? (*entry)->label : "-",
+		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	int i;
+
+	if(header->instruction == 0x00 && header->ack == false && payloadLen >= 4){
+		uint16_t type = payload[0] | (payload[1] << 8);
+		if(type < sizeof(clientTypes)/sizeof(clientTypes[0])) n += snprintf(line + n, size - n, "registration %s", clientTypes[type]);
+		else n += snprintf(line + n, size - n, "registration 0x%04X", type);
+		n += snprintf(line + n, size - n, " sensors %u actuators %u", payload[2], payload[3]);
+	}
+	else if(header->instruction == 0x01 && header->ack == true){
+		const float* values = (const float*) payload;
+		n += snprintf(line + n, size - n, "sensors");
+		for(i=0; i<payloadLen/(int) sizeof(float) && n < size; i++) n += snprintf(line + n, size - n, " %.2f", values[i]);
+	}
+	else if(header->instruction == 0x02 && header->ack == true && payloadLen >= (int) sizeof(float)){
+		n += snprintf(line + n, size - n, "sensor %.2f", *(const float*) payload);
+	}
+	else if(header->instruction == 0x03 && header->ack == true){
+		n += snprintf(line + n, size - n, "actuator ack");
+	}
+	else if(header->instruction <= 0x03 && header->ack == false && payloadLen >= (int) sizeof(SAPoTMessage_solicitation)){
+		const SAPoTMessage_solicitation* solicitation = (const SAPoTMessage_solicitation*) payload;
+		n += snprintf(line + n, size - n, "solicitation 0x%02X %.10s id %u time 0x%04X degree %u", header->instruction, (const char*) solicitation->label,
+			solicitation->sensorOrActuatorId, solicitation->timeSet, solicitation->degreeOfPerformance);
+	}
+	else if(header->instruction == 0x06 && header->ack == false && payloadLen >= (int) sizeof(SAPoTMessage_modification)){
+		const SAPoTMessage_modification* modification = (const SAPoTMessage_modification*) payload;
+		n += snprintf(line + n, size - n, "modification %.17s %.10s", modification->macaddr, modification->label);
+	}
+	else if(header->instruction == 0x08 && header->ack == false && payloadLen >= (int) sizeof(SAPoTMessage_batch)){
+		const SAPoTMessage_batch* batch = (const SAPoTMessage_batch*) payload;
+		const SAPoTMessage_sample* samples = (const SAPoTMessage_sample*) (payload + sizeof(SAPoTMessage_batch));
+		int quantity = (payloadLen - sizeof(SAPoTMessage_batch)) / sizeof(SAPoTMessage_sample);
+		if(quantity > batch->sampleQuantity) quantity = batch->sampleQuantity;
+		n += snprintf(line + n, size - n, "batch %u", batch->sampleQuantity);
+		for(i=0; i<quantity && n < size; i++) n += snprintf(line + n, size - n, " %u=%.2f", samples[i].sensorId, samples[i].value);
+	}
+	else if(header->instruction == 0x0B && header->ack == false && payloadLen >= (int) sizeof(SAPoTMessage_report)){
+		const SAPoTMessage_report* report = (const SAPoTMessage_report*) payload;
+		n += snprintf(line + n, size - n, "report %.10s sensor 0x%04X mode %u threshold %.2f heartbeat 0x%04X", (const char*) report->label,
+			report->sensorId, report->deadband.mode, report->deadband.threshold, report->deadband.heartbeat);
+	}
+	else n += snprintf(line + n, size - n, "instruction 0x%02X%s %d bytes", header->instruction, header->ack ? " ack" : "", payloadLen);
+
+	//Linhas truncadas terminam na capacidade do buffer
+	if(n > size) n = size;
+	line[n++] = '\n';
+	fwrite(line, 1, n, stdout);
+	state->printed++;
+}
+
+/* Observa o tráfego dos clientes republicado pela central (ucc -w): todos, de uma etiqueta (ou prefixo) ou de um tipo */
+static int runWatch(SAPoTClient_create_options* SAPoTopts, const char* clientId, const char* filter){
+
+	WatchState state;
+	memset(&state, 0, sizeof(state));
+	char topic[128];
+	uint16_t type;
+	int first, i;
+
+	//Etiqueta ausente da cópia em cache: atualizando a cópia antes de interpretar o filtro como tipo ou recusá-lo
+	bool known = filter == NULL || SAPoTDirectory_find(&SAPoTdirectory, filter) != NULL;
+	if(!known && !parseType(filter, &type) && SAPoTDirectory_prefix(&SAPoTdirectory, filter, &first) == 0){
+		refreshDirectory(SAPoTopts, clientId);
+		SAPoTClient_end(&SAPoTclient);
+	}
+
+	//Etiqueta exata, tipo ou prefixo de etiqueta, nessa ordem
+	int quantity = 0;
+	if(filter != NULL && (SAPoTDirectory_find(&SAPoTdirectory, filter) != NULL || !parseType(filter, &type))){
+		quantity = SAPoTDirectory_prefix(&SAPoTdirectory, filter, &first);
+		if(SAPoTDirectory_find(&SAPoTdirectory, filter) != NULL){
+			for(quantity=0; first+quantity < (int) SAPoTdirectory.quantity && !strcmp(SAPoTdirectory.entries[first+quantity].label, filter); quantity++);
+		}
+		if(quantity == 0){
+			printf("Etiqueta ou tipo desconhecido: %s\n", filter);
+			return 1;
+		}
+		state.macs = malloc(quantity * 6);
+		for(i=0; i<quantity; i++) memcpy(state.macs[i], SAPoTdirectory.entries[first+i].mac, 6);
+		qsort(state.macs, quantity, 6, compareMac);
+		state.quantity = quantity;
+	}
+
+	//Um único cliente é filtrado pelo broker; vários clientes, pelo filtro no cliente sobre o tópico de todos os tipos
+	if(filter == NULL || quantity > 1) snprintf(topic, sizeof(topic), "%s/watch/#", SAPoTopts->centralId);
+	else if(quantity == 1){
+		snprintf(topic, sizeof(topic), "%s/watch/+/%02X:%02X:%02X:%02X:%02X:%02X", SAPoTopts->centralId, state.macs[0][0], state.macs[0][1],
+			state.macs[0][2], state.macs[0][3], state.macs[0][4], state.macs[0][5]);
+	}
+	else snprintf(topic, sizeof(topic), "%s/watch/%04X/#", SAPoTopts->centralId, type);
+
+	//Índice das etiquetas por endereço MAC (a cópia não é atualizada durante a observação)
+	if(SAPoTdirectory.quantity > 0 && (state.byMac = malloc(SAPoTdirectory.quantity * sizeof(*state.byMac))) != NULL){
+		for(i=0; i<(int) SAPoTdirectory.quantity; i++) state.byMac[i] = &SAPoTdirectory.entries[i];
+		qsort(state.byMac, SAPoTdirectory.quantity, sizeof(*state.byMac), compareEntryMac);
+		state.labels = SAPoTdirectory.quantity;
+	}
+
+	//Identificador próprio por processo: o broker desconectaria outro gpc com o mesmo clientId durante a observação
+	char watchId[18];
+	snprintf(watchId, sizeof(watchId), "02:57:%02X:%02X:%02X:%02X", (getpid() >> 24) & 0xFF, (getpid() >> 16) & 0xFF, (getpid() >> 8) & 0xFF, getpid() & 0xFF);
+
+	if(SAPoTClient_begin(&SAPoTclient, SAPoTopts, watchId) == SAPOTCLIENT_FAILURE){
+		printf("Erro (%d) ao iniciar o cliente SAPoT\n", SAPoTClient_error(&SAPoTclient));
+		return 1;
+	}
+
+	//Saída em blocos, esvaziada a cada 200 ms: uma escrita por bloco mesmo com milhares de mensagens por segundo
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+	signal(SIGINT, watchSignalHandling);
+	signal(SIGTERM, watchSignalHandling);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if(SAPoTClient_watch(&SAPoTclient, topic, watchMessage, &state) != SAPOTCLIENT_SUCCESS){
+		printf("Erro (%d) ao assinar o tópico %s\n", SAPoTClient_error(&SAPoTclient), topic);
+		SAPoTClient_end(&SAPoTclient);
+		return 1;
+	}
+	fprintf(stderr, "Observando %s (Ctrl+C encerra)\n", topic);
+
+	while(watching){
+		usleep(200000);
+		fflush(stdout);
+	}
+
+	SAPoTClient_end(&SAPoTclient);
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "%lu mensagens em %.1f s (%.0f msg/s)", state.printed, elapsed, elapsed > 0 ? state.printed / elapsed : 0.0);
+	if(state.filtered > 0) fprintf(stderr, ", %lu descartadas pelo filtro", state.filtered);
+	fprintf(stderr, "\n");
+
+	free(state.macs);
+	free(state.byMac);
+	return 0;
+}
+
+/* Resultados da medição do tempo de ida e volta (gpc probe), preenchidos pelas rotinas de conclusão das requisições */
+typedef struct{
+
+	const char* label;
+
+	//Tempos de ida e volta e do trecho Central → Cliente → Central das respostas, em microssegundos
+	uint64_t* rtt;
+	uint64_t* device;
+	int received;
+
+	//Ecos sem resposta dentro do tempo limite (ou não enviados)
+	int lost;
+
+	pthread_mutex_t lock;
+
+}ProbeState;
+
+static volatile sig_atomic_t probing = 1;
+
+void probeSignalHandling(int signum){
+
+	probing = 0;
+}
+
+static int compareLatency(const void* a, const void* b){
+
+	uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+	return (x > y) - (x < y);
+}
+
+/* Percentil p (0 a 100) de um vetor ordenado de latências, em milissegundos */
+static double percentile(const uint64_t* sorted, int quantity, double p){
+
+	int position = (int) (p / 100.0 * quantity + 0.5) - 1;
+	if(position < 0) position = 0;
+	if(position >= quantity) position = quantity - 1;
+	return sorted[position] / 1000.0;
+}
+
+/* Registra e imprime o resultado de um eco (evocada pela thread do cliente MQTT ou pela de expiração) */
+static void probeResult(SAPoTClient* handle, const SAPoTClient_request* request, int status, const uint8_t* message, int messageLen){
+
+	ProbeState* state = (ProbeState*) request->context;
+
+	if(status != SAPOTCLIENT_SUCCESS || messageLen < (int) (sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_echo))){
+		pthread_mutex_lock(&state->lock);
+		state->lost++;
+		pthread_mutex_unlock(&state->lock);
+		printf("%s: %s\n", request->command, status == ERROR_REQUEST_TIMEOUT ? "sem resposta" : "falha");
+		fflush(stdout);
+		return;
+	}
+
+	//Os instantes da Central são do seu relógio: apenas a diferença entre eles é significativa
+	const SAPoTMessage_echo* echo = (const SAPoTMessage_echo*) (message + sizeof(SAPoTMessage_header));
+	uint64_t device = (uint32_t) (echo->centralOut - echo->centralIn);
+	if(device > request->latency) device = request->latency;
+
+	pthread_mutex_lock(&state->lock);
+	state->rtt[state->received] = request->latency;
+	state->device[state->received] = device;
+	state->received++;
+	pthread_mutex_unlock(&state->lock);
+
+	printf("%s: %.3f ms (Central ↔ %s %.3f ms, Usuário ↔ Central %.3f ms)\n", request->command, request->latency / 1000.0, state->label,
+		device / 1000.0, (request->latency - device) / 1000.0);
+	fflush(stdout);
+}
+
+/* Mede o tempo de ida e volta até o Cliente de etiqueta label, com count ecos (0x0A) a cada interval milissegundos */
+static int runProbe(SAPoTClient_create_options* SAPoTopts, const char* clientId, int argc, char* argv[]){
+
+	int count = 10;
+	int interval = 1000;
+	int timeout = SAPOTCLIENT_TIMEOUT;
+	int opt, i;
+
+	while((opt = getopt(argc, argv, "n:i:T:")) != -1){
+		if(opt == 'n') count = atoi(optarg);
+		else if(opt == 'i') interval = atoi(optarg);
+		else if(opt == 'T') timeout = atoi(optarg);
+		else return 1;
+	}
+	if(optind + 1 != argc || count < 1 || interval < 0 || timeout < 1){
+		printf("Uso: ./gpc probe $label [-n ecos] [-i intervalo (ms)] [-T timeout (ms)]\n");
+		return 1;
+	}
+
+	ProbeState state;
+	memset(&state, 0, sizeof(state));
+	state.label = argv[optind];
+	state.rtt = malloc(count * sizeof(uint64_t));
+	state.device = malloc(count * sizeof(uint64_t));
+	pthread_mutex_init(&state.lock, NULL);
+
+	//Sem cópia em cache ou com a etiqueta ausente da cópia: atualizando a cópia antes de recusar a etiqueta
+	if(SAPoTdirectory.header == NULL || !knownLabel(state.label)) refreshDirectory(SAPoTopts, clientId);
+	if(!knownLabel(state.label)){
+		printf("Unknown label: %s\n", state.label);
+		SAPoTClient_end(&SAPoTclient);
+		free(state.rtt);
+		free(state.device);
+		return 1;
+	}
+
+	//Os ecos utilizam uma conexão própria ao broker: a latência do gpcd não faz parte da medição
+	if(!SAPoTclient.inLoop && SAPoTClient_begin(&SAPoTclient, SAPoTopts, clientId) == SAPOTCLIENT_FAILURE){
+		printf("Erro (%d) ao iniciar o cliente SAPoT\n", SAPoTClient_error(&SAPoTclient));
+		return 1;
+	}
+	SAPoTclient.timeout = timeout;
+
+	//Mensagem de eco, reutilizada por todos os envios (o serial é atribuído a cada requisição)
+	int messageLen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_echo);
+	uint8_t* message = calloc(1, messageLen);
+	SAPoTMessage_header* header = (SAPoTMessage_header*) message;
+	header->version = SAPOT_PROTOCOL_VERSION;
+	header->instruction = 0x0A;
+	header->length = messageLen;
+	getmacID(clientId, header->emitterId);
+	SAPoTMessage_echo* echo = (SAPoTMessage_echo*) (message + sizeof(SAPoTMessage_header));
+	strncpy((char*) echo->label, state.label, 10);
+
+	signal(SIGINT, probeSignalHandling);
+	printf("Eco %s: %d envios a cada %d ms\n", state.label, count, interval);
+
+	//Envios em instantes absolutos: a duração de cada envio não acumula atraso no intervalo
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	int sent;
+	for(sent=0; sent<count && probing; sent++){
+		if(sent > 0){
+			next.tv_sec += (next.tv_nsec + interval * 1000000L) / 1000000000L;
+			next.tv_nsec = (next.tv_nsec + interval * 1000000L) % 1000000000L;
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0 && probing);
+			if(!probing) break;
+		}
+
+		char command[32];
+		echo->sequence = sent + 1;
+		snprintf(command, sizeof(command), "seq=%d", sent + 1);
+		if(SAPoTClient_request_async(&SAPoTclient, message, messageLen, command, probeResult, &state) == SAPOTCLIENT_FAILURE){
+			pthread_mutex_lock(&state.lock);
+			state.lost++;
+			pthread_mutex_unlock(&state.lock);
+		}
+	}
+
+	//Aguardando as respostas (ou a expiração) dos ecos em trânsito
+	SAPoTClient_wait(&SAPoTclient, 0);
+	SAPoTClient_end(&SAPoTclient);
+	free(message);
+
+	printf("--- %s: %d ecos enviados, %d recebidos, %.1f%% de perda ---\n", state.label, sent, state.received, 
+		sent > 0 ? 100.0 * (sent - state.received) / sent : 0.0);
+
+	if(state.received > 0){
+		double sum = 0, sumSquares = 0, deviceSum = 0;
+		for(i=0; i<state.received; i++){
+			sum += state.rtt[i] / 1000.0;
+			sumSquares += (state.rtt[i] / 1000.0) * (state.rtt[i] / 1000.0);
+			deviceSum += state.device[i] / 1000.0;
+		}
+		double mean = sum / state.received;
+		double variance = sumSquares / state.received - mean * mean;
+
+		qsort(state.rtt, state.received, sizeof(uint64_t), compareLatency);
+		printf("ida e volta mín/méd/máx/desvio = %.3f/%.3f/%.3f/%.3f ms\n", state.rtt[0] / 1000.0, mean, state.rtt[state.received - 1] / 1000.0,
+			variance > 0 ? sqrt(variance) : 0.0);
+		printf("percentis p50/p90/p99 = %.3f/%.3f/%.3f ms\n", percentile(state.rtt, state.received, 50), percentile(state.rtt, state.received, 90),
+			percentile(state.rtt, state.received, 99));
+		printf("média por trecho: Central ↔ %s %.3f ms, Usuário ↔ Central %.3f ms\n", state.label, deviceSum / state.received, mean - deviceSum / state.received);
+	}
+
+	free(state.rtt);
+	free(state.device);
+	pthread_mutex_destroy(&state.lock);
+
+	return (state.received == sent && sent == count) ? 0 : 1;
+}
+
+int main(int argc, char *argv[]){
+
+	//Tratando o sinal SIGINT
+	signal(SIGINT, signalHandling);
+
+	if(argc<2){
+
+		printf("Argumento de execução invalido. Tente:\n");
+		printf("./gpc access\n");
+		printf("./gpc modification \"$macaddr\" \"$label\" \n");
+		printf("./gpc solicitation \"$label\" \"$operation\"\n");
+		printf("\t $operation: ON, OFF, RST \n");
+		printf("./gpc report \"$label\" \"$sensor|all\" \"off|abs|pct\" [limiar] [heartbeat (s, m, h)]\n");
+		printf("./gpc batch [-w janela] [-T timeout (ms)] [arquivo]\n");
+		printf("./gpc shell [-w janela] [-T timeout (ms)]\n");
+		printf("./gpc list [prefixo]\n");
+		printf("./gpc labels [prefixo]\n");
+		printf("./gpc watch [etiqueta | prefixo | tipo]\n");
+		printf("./gpc probe \"$label\" [-n ecos] [-i intervalo (ms)] [-T timeout (ms)]\n");
+		exit(1);	
+
+	}
+
+	//Definindo o id para cliente 
+	const char* clientId = "78:E4:00:8C:65:77";
+
+	//Configurando as opções de inicialização do cliente
+	//SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"10.10.40.84", "1883", "LDAP", NULL}};
+	//SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"localhost", "1883", NULL, NULL}};
+	//SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"192.168.4.1", "1883", NULL, NULL}};
+	SAPoTClient_create_options SAPoTopts = {"00:00:00:00:00:00", MQTT, {"10.10.20.205", "1883", NULL, NULL}};
+
+	//Modos batch (comandos de um arquivo ou da entrada padrão) e shell (interativo): uma única conexão para todos os comandos
+	bool batch = !strcmp(argv[1], "batch");
+	bool shell = !strcmp(argv[1], "shell");
+	int window = SAPOTCLIENT_PENDING;
+	int timeout = SAPOTCLIENT_TIMEOUT;
+	FILE* input = stdin;
+	if(batch || shell){
+		int opt;
+		while((opt = getopt(argc - 1, argv + 1, "w:T:")) != -1){
+			if(opt == 'w') window = atoi(optarg);
+			else if(opt == 'T') timeout = atoi(optarg);
+			else exit(1);
+		}
+		if(batch && optind + 1 < argc && strcmp(argv[optind + 1], "-")){
+			if((input = fopen(argv[optind + 1], "r")) == NULL){
+				printf("Erro ao abrir %s\n", argv[optind + 1]);
+				exit(1);
+			}
+		}
+	}
+
+	//Abrindo a cópia em cache do diretório da central (sem diretório de cache, o acesso não é versionado)
+	char directoryPath[512];
+	if(SAPoTDirectory_path(SAPoTopts.transmission.host, SAPoTopts.centralId, directoryPath, sizeof(directoryPath)) == SAPOTCLIENT_SUCCESS){
+		SAPoTDirectory_open(&SAPoTdirectory, directoryPath);
+	}
+
+	if(batch || shell){
+		if(SAPoTClient_begin(&SAPoTclient, &SAPoTopts, clientId) == SAPOTCLIENT_FAILURE){
+			printf("Erro (%d) ao iniciar o cliente SAPoT\n", SAPoTClient_error(&SAPoTclient));
+			exit(1);
+		}
+		SAPoTclient.timeout = timeout;
+		return runBatch(clientId, input, shell, window);
+	}
+
+	//Comandos locais: respondidos pela cópia em cache, sem conexão
+	if(!strcmp(argv[1], "list") || !strcmp(argv[1], "labels")) return localCommand(argc - 1, argv + 1);
+
+	//Medição do tempo de ida e volta até um Cliente, com uma conexão própria (não é encaminhada ao gpcd)
+	if(!strcmp(argv[1], "probe")) return runProbe(&SAPoTopts, clientId, argc - 1, argv + 1);
+
+	//Observação contínua do tráfego, com uma conexão própria (não é encaminhada ao gpcd)
+	if(!strcmp(argv[1], "watch") && argc <= 3) return runWatch(&SAPoTopts, clientId, argc == 3 ? argv[2] : NULL);
+
+	void* message;
+	int messageLen;
+	uint8_t* reply;
+	int replyLen;
+	int status;
+
+	//Etiqueta ausente da cópia em cache: atualizando a cópia antes de recusar a solicitação (o cliente pode ser novo)
+	if(((!strcmp(argv[1], "solicitation") && argc == 4) || (!strcmp(argv[1], "report") && argc >= 5)) && !knownLabel(argv[2])) refreshDirectory(&SAPoTopts, clientId);
+
+	if(buildMessage(clientId, argc - 1, argv + 1, true, &message, &messageLen) != SAPOTCLIENT_SUCCESS){
+		SAPoTClient_end(&SAPoTclient);
 		exit(1);
 	} 
 
-	//Publicando mensagem via MQTT
-	MQTTpublish(SAPoTopts.centralId, message, messageLen);
+	//Publicando a mensagem e aguardando a resposta da central (ou a expiração da requisição)
+	status = transact(&SAPoTopts, clientId, message, messageLen, &reply, &replyLen);
 
 	//Limpando espaço de memória da mensagem enviada
 	free(message);
 
-	//Entrando em modo de loop para esperar a resposta da central
-	SAPoTClient_loop();	
+	if(status == SAPOTCLIENT_SUCCESS){
+		if(((SAPoTMessage_header*) reply)->instruction == 0x04) printAccess(reply, replyLen, true);
+		free(reply);
+	}
+	else printf("Erro (%d) na requisição\n", status);
+
+	SAPoTClient_end(&SAPoTclient);
+	SAPoTDirectory_close(&SAPoTdirectory);
 
-	return 0;
+	return status == SAPOTCLIENT_SUCCESS ? 0 : 1;
 }
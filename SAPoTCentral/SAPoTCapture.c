@@ -0,0 +1,321 @@
+
+/*
+*	SAPoTCapture.c define a captura do tráfego recebido pela Central SAPoT e a leitura dos arquivos de captura
+*
+*
+*
+*/
+
+			/************************* Headers ******************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "SAPoTCapture.h"
+
+/* Function's prototype */
+static uint64_t SAPoTCapture_now(void);
+static int SAPoTCapture_put_varint(uint8_t* buffer, uint64_t value);
+static int SAPoTCapture_get_varint(FILE* file, uint64_t* value);
+static void SAPoTCapture_close_file(SAPoTCapture* capture);
+
+/**
+* [Principal] SAPoTCapture_init
+*
+*/
+void SAPoTCapture_init(SAPoTCapture* capture){
+
+	memset(capture, 0, sizeof(SAPoTCapture));
+	pthread_mutex_init(&capture->lock, NULL);
+}
+
+/**
+* [Principal] SAPoTCapture_begin
+*
+*/
+int SAPoTCapture_begin(SAPoTCapture* capture, const char* path, off_t maxSize){
+
+	SAPoTCapture_end(capture);
+
+	pthread_mutex_lock(&capture->lock);
+
+	capture->file = fopen(path, "wb");
+	if(capture->file == NULL){
+		pthread_mutex_unlock(&capture->lock);
+		return -1;
+	}
+	setvbuf(capture->file, NULL, _IOFBF, SAPOT_CAPTURE_BUFFER_SIZE);
+
+	SAPoTCapture_fileHeader header;
+	memcpy(header.magic, SAPOT_CAPTURE_MAGIC, 4);
+	header.version = SAPOT_CAPTURE_FORMAT_VERSION;
+	header.rsv = 0;
+	header.created = SAPoTCapture_now();
+
+	if(fwrite(&header, sizeof(header), 1, capture->file) != 1){
+		SAPoTCapture_close_file(capture);
+		pthread_mutex_unlock(&capture->lock);
+		return -1;
+	}
+
+	capture->maxSize = maxSize > 0 ? maxSize : SAPOT_CAPTURE_MAX_SIZE;
+	capture->written = sizeof(header);
+	capture->last = header.created;
+	capture->flushed = header.created;
+	capture->messages = 0;
+	capture->stopped = 0;
+	atomic_store(&capture->active, 1);
+
+	pthread_mutex_unlock(&capture->lock);
+	return 0;
+}
+
+/**
+* [Principal] SAPoTCapture_end
+*
+*/
+void SAPoTCapture_end(SAPoTCapture* capture){
+
+	pthread_mutex_lock(&capture->lock);
+	SAPoTCapture_close_file(capture);
+	pthread_mutex_unlock(&capture->lock);
+}
+
+/**
+* [Principal] SAPoTCapture_write
+*
+*/
+void SAPoTCapture_write(SAPoTCapture* capture, const char* topic, int topicLen, const void* payload, int payloadLen){
+
+	if(!atomic_load_explicit(&capture->active, memory_order_relaxed)) return;
+
+	if(topicLen <= 0) topicLen = strlen(topic);
+	if(topicLen > SAPOT_CAPTURE_TOPIC_SIZE) topicLen = SAPOT_CAPTURE_TOPIC_SIZE;
+	if(payloadLen < 0) payloadLen = 0;
+
+	pthread_mutex_lock(&capture->lock);
+
+	//A captura pode ter sido encerrada entre o teste e o bloqueio
+	if(capture->file == NULL){
+		pthread_mutex_unlock(&capture->lock);
+		return;
+	}
+
+	//O instante é obtido sob o bloqueio para que os registros do arquivo fiquem em ordem cronológica
+	uint64_t now = SAPoTCapture_now();
+	uint64_t delta = now > capture->last ? now - capture->last : 0;
+
+	//Procurando o tópico na tabela do arquivo (em geral um único tópico por Central)
+	int index;
+	for(index = 0; index < capture->topicQuantity; index++){
+		if(strncmp(capture->topics[index], topic, topicLen) == 0 && capture->topics[index][topicLen] == '\0') break;
+	}
+	int newTopic = index == capture->topicQuantity;
+	if(newTopic && capture->topicQuantity < SAPOT_CAPTURE_TOPICS){
+		capture->topics[index] = strndup(topic, topicLen);
+		if(capture->topics[index] != NULL) capture->topicQuantity++;
+		else index = SAPOT_CAPTURE_TOPICS;
+	}
+
+	uint8_t head[2*10 + 2];
+	int headLen = SAPoTCapture_put_varint(head, delta);
+	head[headLen++] = (uint8_t) index;
+	headLen += SAPoTCapture_put_varint(&head[headLen], (uint64_t) payloadLen);
+	if(newTopic) head[headLen++] = (uint8_t) topicLen;
+
+	off_t recordLen = headLen + (newTopic ? topicLen : 0) + payloadLen;
+	if(capture->written + recordLen > capture->maxSize){
+		//Tamanho máximo atingido: a captura é encerrada preservando o arquivo até o último registro completo
+		SAPoTCapture_close_file(capture);
+		capture->stopped = SAPOT_CAPTURE_STOPPED_SIZE;
+		pthread_mutex_unlock(&capture->lock);
+		return;
+	}
+
+	if(fwrite(head, 1, headLen, capture->file) != (size_t) headLen ||
+	   (newTopic && fwrite(topic, 1, topicLen, capture->file) != (size_t) topicLen) ||
+	   (payloadLen > 0 && fwrite(payload, 1, payloadLen, capture->file) != (size_t) payloadLen)){
+		SAPoTCapture_close_file(capture);
+		capture->stopped = SAPOT_CAPTURE_STOPPED_ERROR;
+		pthread_mutex_unlock(&capture->lock);
+		return;
+	}
+
+	capture->written += recordLen;
+	capture->last = now;
+	capture->messages++;
+
+	//Limitando o atraso entre a chegada e a escrita, para que a captura sobreviva a uma queda da UCC
+	if(now - capture->flushed >= SAPOT_CAPTURE_FLUSH_INTERVAL){
+		fflush(capture->file);
+		capture->flushed = now;
+	}
+
+	pthread_mutex_unlock(&capture->lock);
+}
+
+/**
+* [Principal] SAPoTCapture_flush
+*
+*/
+int SAPoTCapture_flush(SAPoTCapture* capture, unsigned long* messages){
+
+	pthread_mutex_lock(&capture->lock);
+
+	//Descarregando os registros escritos após a última descarga, mesmo sem a chegada de novas mensagens
+	if(capture->file != NULL && capture->last > capture->flushed){
+		uint64_t now = SAPoTCapture_now();
+		if(now - capture->flushed >= SAPOT_CAPTURE_FLUSH_INTERVAL){
+			fflush(capture->file);
+			capture->flushed = now;
+		}
+	}
+
+	int stopped = capture->stopped;
+	capture->stopped = 0;
+	if(stopped != 0 && messages != NULL) *messages = capture->messages;
+
+	pthread_mutex_unlock(&capture->lock);
+	return stopped;
+}
+
+/**
+* [Principal] SAPoTCapture_open
+*
+*/
+int SAPoTCapture_open(SAPoTCapture_reader* reader, const char* path){
+
+	memset(reader, 0, sizeof(SAPoTCapture_reader));
+
+	reader->file = fopen(path, "rb");
+	if(reader->file == NULL) return -1;
+
+	if(fread(&reader->header, sizeof(reader->header), 1, reader->file) != 1 ||
+	   memcmp(reader->header.magic, SAPOT_CAPTURE_MAGIC, 4) != 0 || reader->header.version != SAPOT_CAPTURE_FORMAT_VERSION){
+		SAPoTCapture_close(reader);
+		return -1;
+	}
+
+	reader->last = reader->header.created;
+	return 0;
+}
+
+/**
+* [Principal] SAPoTCapture_read
+*
+*/
+int SAPoTCapture_read(SAPoTCapture_reader* reader, SAPoTCapture_entry* entry){
+
+	uint64_t delta, payloadLen;
+
+	int status = SAPoTCapture_get_varint(reader->file, &delta);
+	if(status <= 0) return status;
+
+	int index = fgetc(reader->file);
+	if(index == EOF || SAPoTCapture_get_varint(reader->file, &payloadLen) <= 0 || payloadLen > UINT32_MAX) return -1;
+	if(index > reader->topicQuantity && index != SAPOT_CAPTURE_TOPICS) return -1;
+
+	if(index == reader->topicQuantity || index == SAPOT_CAPTURE_TOPICS){
+		//Tópico novo (acrescentado à tabela) ou tópico além da capacidade da tabela
+		int topicLen = fgetc(reader->file);
+		if(topicLen == EOF || fread(entry->topic, 1, topicLen, reader->file) != (size_t) topicLen) return -1;
+		entry->topic[topicLen] = '\0';
+		if(index < SAPOT_CAPTURE_TOPICS){
+			reader->topics[index] = strdup(entry->topic);
+			if(reader->topics[index] == NULL) return -1;
+			reader->topicQuantity++;
+		}
+	}
+	else strcpy(entry->topic, reader->topics[index]);
+
+	if(payloadLen > reader->bufferSize){
+		uint8_t* buffer = realloc(reader->buffer, payloadLen);
+		if(buffer == NULL) return -1;
+		reader->buffer = buffer;
+		reader->bufferSize = payloadLen;
+	}
+	if(payloadLen > 0 && fread(reader->buffer, 1, payloadLen, reader->file) != payloadLen) return -1;
+
+	reader->last += delta;
+	entry->time = reader->last;
+	entry->payload = reader->buffer;
+	entry->payloadLen = (uint32_t) payloadLen;
+
+	return 1;
+}
+
+/**
+* [Principal] SAPoTCapture_close
+*
+*/
+void SAPoTCapture_close(SAPoTCapture_reader* reader){
+
+	if(reader->file != NULL) fclose(reader->file);
+	int i;
+	for(i=0; i<reader->topicQuantity; i++) free(reader->topics[i]);
+	free(reader->buffer);
+	memset(reader, 0, sizeof(SAPoTCapture_reader));
+}
+
+/**
+* [Subrotina] SAPoTCapture_now
+*
+*/
+static uint64_t SAPoTCapture_now(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+* [Subrotina] SAPoTCapture_put_varint
+*
+*/
+static int SAPoTCapture_put_varint(uint8_t* buffer, uint64_t value){
+
+	int length = 0;
+	while(value >= 0x80){
+		buffer[length++] = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	buffer[length++] = (uint8_t) value;
+	return length;
+}
+
+/**
+* [Subrotina] SAPoTCapture_get_varint
+*
+* Retorna 1 se o varint foi lido, 0 se o arquivo terminou antes do primeiro byte ou -1 se o varint estiver truncado.
+*
+*/
+static int SAPoTCapture_get_varint(FILE* file, uint64_t* value){
+
+	*value = 0;
+	int shift, byte;
+	for(shift = 0; shift < 64; shift += 7){
+		if((byte = fgetc(file)) == EOF) return shift == 0 ? 0 : -1;
+		*value |= (uint64_t) (byte & 0x7F) << shift;
+		if(!(byte & 0x80)) return 1;
+	}
+	return -1;
+}
+
+/**
+* [Subrotina] SAPoTCapture_close_file
+*
+* Deve ser evocada com SAPoTCapture.lock bloqueado.
+*
+*/
+static void SAPoTCapture_close_file(SAPoTCapture* capture){
+
+	atomic_store(&capture->active, 0);
+	if(capture->file != NULL) fclose(capture->file);
+	capture->file = NULL;
+
+	int i;
+	for(i=0; i<capture->topicQuantity; i++) free(capture->topics[i]);
+	capture->topicQuantity = 0;
+}
@@ -0,0 +1,272 @@
+/**
+ * @file SAPoTCapture.h
+ * @brief Captura do tráfego recebido pela Central SAPoT e leitura das capturas pela ferramenta ucc-replay.
+ *
+ * Com a captura ativa, cada mensagem recebida pelas Centrais do processo é copiada, antes de qualquer tratamento, para um
+ * arquivo de captura: o instante de chegada, o tópico e o payload bruto. A ferramenta ucc-replay publica uma captura de volta
+ * em um broker na velocidade original, N vezes mais rápido ou na velocidade máxima, reproduzindo incidentes e cargas reais
+ * (ex.: tempestades de cadastro após uma queda de energia) que a carga sintética do ucc-bench não representa.
+ *
+ * Os arquivos (<tt>.sapc</tt>) iniciam com um SAPoTCapture_fileHeader, seguido pelos registros, cada um composto por:
+ * <ul>
+ * <li> Microssegundos desde o registro anterior (ou desde SAPoTCapture_fileHeader.created, no primeiro registro) (varint) </li>
+ * <li> Índice do tópico na tabela de tópicos do arquivo (1 byte) </li>
+ * <li> Comprimento do payload (varint) </li>
+ * <li> Se o índice for igual à quantidade de tópicos da tabela (tópico novo) ou #SAPOT_CAPTURE_TOPICS (tabela cheia): comprimento
+ *      do tópico (1 byte) e o tópico, sem terminador nulo </li>
+ * <li> Payload </li>
+ * </ul>
+ * Os campos varint utilizam 7 bits por byte, do menos para o mais significativo, com o bit 8 indicando a continuação do número.
+ * Como as Centrais recebem quase sempre no próprio centralId, cada mensagem acrescenta em geral apenas 3 a 5 bytes ao payload.
+ *
+ * As Centrais de um processo compartilham a mesma captura (veja SAPoTCentral_shared), e a escrita é serializada por um mutex.
+ * Com a captura desativada, o custo no caminho das mensagens é um único teste de SAPoTCapture.active.
+ *
+ */
+
+#ifndef SAPOTCAPTURE_H
+#define SAPOTCAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/**
+* Identificador dos arquivos de captura.
+*
+*/
+#define SAPOT_CAPTURE_MAGIC "SAPC"
+
+/**
+* Versão do formato dos arquivos de captura.
+*
+*/
+#define SAPOT_CAPTURE_FORMAT_VERSION 1
+
+/**
+* Quantidade máxima de tópicos da tabela de um arquivo de captura. Os tópicos excedentes são escritos em todos os seus registros.
+*
+*/
+#define SAPOT_CAPTURE_TOPICS 255
+
+/**
+* Comprimento máximo dos tópicos capturados. Tópicos mais longos são truncados.
+*
+*/
+#define SAPOT_CAPTURE_TOPIC_SIZE 255
+
+/**
+* Tamanho máximo padrão de um arquivo de captura, em bytes. Ao atingi-lo, a captura é encerrada.
+*
+*/
+#define SAPOT_CAPTURE_MAX_SIZE (1024L*1024*1024)
+
+/**
+* Tamanho do buffer de escrita do arquivo de captura.
+*
+*/
+#define SAPOT_CAPTURE_BUFFER_SIZE (64*1024)
+
+/**
+* Intervalo máximo, em microssegundos, entre a chegada de uma mensagem e a sua escrita no arquivo.
+*
+*/
+#define SAPOT_CAPTURE_FLUSH_INTERVAL 1000000
+
+/**
+* Motivo do encerramento automático da captura: tamanho máximo do arquivo atingido.
+*
+*/
+#define SAPOT_CAPTURE_STOPPED_SIZE 1
+
+/**
+* Motivo do encerramento automático da captura: fracasso na escrita do arquivo.
+*
+*/
+#define SAPOT_CAPTURE_STOPPED_ERROR 2
+
+/**
+* @brief Cabeçalho dos arquivos de captura (16 bytes), seguido pelos registros.
+*
+*/
+typedef struct __attribute__((packed)){
+
+	/** Identificador #SAPOT_CAPTURE_MAGIC (sem terminador nulo) */
+	char magic[4];
+
+	/** Versão do formato (#SAPOT_CAPTURE_FORMAT_VERSION) */
+	uint16_t version;
+
+	/** Reservado */
+	uint16_t rsv;
+
+	/** Instante de criação do arquivo, em microssegundos desde 1970 (CLOCK_REALTIME) */
+	uint64_t created;
+
+}SAPoTCapture_fileHeader;
+
+/**
+* @brief Captura do tráfego recebido (escrita).
+*
+*/
+typedef struct{
+
+	/** Indica se a captura está ativa (lido sem bloqueio no caminho das mensagens) */
+	atomic_int active;
+
+	/** Exclusão mútua da escrita dos registros */
+	pthread_mutex_t lock;
+
+	/** Arquivo de captura */
+	FILE* file;
+
+	/** Tamanho máximo do arquivo, em bytes */
+	off_t maxSize;
+
+	/** Bytes escritos no arquivo */
+	off_t written;
+
+	/** Instante do último registro, em microssegundos desde 1970 */
+	uint64_t last;
+
+	/** Instante da última descarga do buffer de escrita, em microssegundos desde 1970 */
+	uint64_t flushed;
+
+	/** Mensagens capturadas */
+	unsigned long messages;
+
+	/** Tabela de tópicos do arquivo */
+	char* topics[SAPOT_CAPTURE_TOPICS];
+
+	/** Quantidade de tópicos da tabela */
+	int topicQuantity;
+
+	/** Motivo do encerramento automático ainda não informado por SAPoTCapture_flush() (SAPOT_CAPTURE_STOPPED_*, 0 se nenhum) */
+	int stopped;
+
+}SAPoTCapture;
+
+/**
+* @brief Registro lido de um arquivo de captura.
+*
+*/
+typedef struct{
+
+	/** Instante de chegada, em microssegundos desde 1970 */
+	uint64_t time;
+
+	/** Tópico de publicação, terminado em nulo */
+	char topic[SAPOT_CAPTURE_TOPIC_SIZE + 1];
+
+	/** Payload bruto (válido até a próxima leitura) */
+	uint8_t* payload;
+
+	/** Comprimento do payload */
+	uint32_t payloadLen;
+
+}SAPoTCapture_entry;
+
+/**
+* @brief Leitor de um arquivo de captura.
+*
+*/
+typedef struct{
+
+	/** Arquivo de captura */
+	FILE* file;
+
+	/** Cabeçalho do arquivo */
+	SAPoTCapture_fileHeader header;
+
+	/** Instante do último registro lido */
+	uint64_t last;
+
+	/** Tabela de tópicos lidos */
+	char* topics[SAPOT_CAPTURE_TOPICS];
+
+	/** Quantidade de tópicos da tabela */
+	int topicQuantity;
+
+	/** Buffer dos payloads */
+	uint8_t* buffer;
+
+	/** Tamanho do buffer dos payloads */
+	uint32_t bufferSize;
+
+}SAPoTCapture_reader;
+
+/**
+* Inicia uma captura desativada. Deve ser evocada antes de qualquer outra função da captura.
+*
+*/
+void SAPoTCapture_init(SAPoTCapture* capture);
+
+/**
+* Cria o arquivo de captura e ativa a captura. Uma captura já ativa é encerrada antes.
+*
+* @param capture Captura a ser ativada.
+* @param path Caminho do arquivo de captura.
+* @param maxSize Tamanho máximo do arquivo, em bytes; ao atingi-lo a captura é encerrada (0 utiliza #SAPOT_CAPTURE_MAX_SIZE).
+*
+* @return 0 em caso de sucesso ou -1 se o arquivo não puder ser criado.
+*
+*/
+int SAPoTCapture_begin(SAPoTCapture* capture, const char* path, off_t maxSize);
+
+/**
+* Escreve os registros pendentes, fecha o arquivo e desativa a captura.
+*
+*/
+void SAPoTCapture_end(SAPoTCapture* capture);
+
+/**
+* Captura uma mensagem recebida. Deve ser evocada antes do tratamento da mensagem, que pode alterar o payload.
+*
+* @param capture Captura de destino.
+* @param topic Tópico de recebimento.
+* @param topicLen Comprimento do tópico (0 se o tópico for terminado em nulo, como informado pelo cliente MQTT).
+* @param payload Payload bruto.
+* @param payloadLen Comprimento do payload.
+*
+*/
+void SAPoTCapture_write(SAPoTCapture* capture, const char* topic, int topicLen, const void* payload, int payloadLen);
+
+/**
+* Escreve os registros pendentes no buffer de escrita. SAPoTCapture_write() só descarrega o buffer na chegada de uma mensagem: 
+* esta função deve ser evocada periodicamente (a cada segundo por SAPoTCentral_loop()) para que #SAPOT_CAPTURE_FLUSH_INTERVAL 
+* também seja respeitado quando o tráfego cessa.
+*
+* @param capture Captura a ser descarregada.
+* @param messages Recebe a quantidade de mensagens capturadas, se a captura tiver sido encerrada automaticamente (pode ser NULL).
+*
+* @return O motivo do encerramento automático da captura desde a evocação anterior (SAPOT_CAPTURE_STOPPED_*), informado uma 
+* única vez, ou 0.
+*
+*/
+int SAPoTCapture_flush(SAPoTCapture* capture, unsigned long* messages);
+
+/**
+* Abre um arquivo de captura para leitura, validando o seu cabeçalho.
+*
+* @return 0 em caso de sucesso ou -1 se o arquivo não puder ser aberto ou não for uma captura válida.
+*
+*/
+int SAPoTCapture_open(SAPoTCapture_reader* reader, const char* path);
+
+/**
+* Lê o próximo registro de um arquivo de captura.
+*
+* @return 1 se um registro foi lido, 0 no fim do arquivo ou -1 se o registro estiver truncado ou corrompido.
+*
+*/
+int SAPoTCapture_read(SAPoTCapture_reader* reader, SAPoTCapture_entry* entry);
+
+/**
+* Fecha um arquivo de captura e libera o leitor.
+*
+*/
+void SAPoTCapture_close(SAPoTCapture_reader* reader);
+
+#endif /* SAPOTCAPTURE_H */
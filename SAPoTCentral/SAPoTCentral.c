@@ -17,42 +17,102 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <stddef.h>
+#include <dlfcn.h>
+#include <pthread.h>
 #include <MQTTClient.h>
 #include <mysql/mysql.h>
 #include "SAPoTCentral.h"
+#include "SAPoTLog.h"
 
-/* Global Objects */
-SAPoTCentral* handle;
-SAPoTCentral_create_options* opts;
-volatile MQTTClient_deliveryToken MQTTdeliveredtoken;
-int fd; //File Descriptor
-void* bff_log; //bufer para mensagens de log
-int MQTTstatus = -1; 
+/**
+* [Principal] SAPoTCentral_shared_init
+*
+*/
+int SAPoTCentral_shared_init(SAPoTCentral_shared* shared, const char* logPrefix){
+
+	/* Inicializa o log assíncrono */
+	if(SAPoTLog_begin(&shared->log, logPrefix, SAPOT_LOG_INFO, SAPOT_LOG_MAX_SIZE, SAPOT_LOG_MAX_AGE) != 0) return SAPOTCENTRAL_FAILURE;
+
+	pthread_mutex_init(&shared->lock, NULL);
+
+	/* Os pools de buffers são de cada thread (veja SAPoTCentral_alloc()); aqui são zeradas apenas as estatísticas */
+	memset(&shared->stats, 0, sizeof(shared->stats));
+	memset(shared->devices, 0, sizeof(shared->devices));
+	memset(shared->types, 0, sizeof(shared->types));
+	memset(shared->readings, 0, sizeof(shared->readings));
+	memset(shared->echoes, 0, sizeof(shared->echoes));
+
+	/* Métricas servidas com as informações do pool e do log (veja SAPoTCentral_metrics_listen()) */
+	SAPoTMetrics_init(&shared->metrics);
+	shared->metrics.render = SAPoTCentral_metrics_render;
+	shared->metrics.context = shared;
+
+	/* Rastreamento desativado até SAPoTTrace_enable() */
+	SAPoTTrace_init(&shared->trace);
 
-/* Function's prototype */
+	/* Captura desativada até SAPoTCapture_begin() */
+	SAPoTCapture_init(&shared->capture);
+
+	/* Armazenamento em memória vazio, utilizado apenas pelas Centrais configuradas com MEMORY */
+	MEMinit(&shared->memory);
+
+	/* Diretório sem alterações, identificado pelo instante de início e pelo pid do processo */
+	memset(&shared->directory, 0, sizeof(shared->directory));
+	shared->directory.epoch = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+	if(shared->directory.epoch == 0) shared->directory.epoch = 1;
+
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Principal] SAPoTCentral_shared_destroy
+*
+*/
+void SAPoTCentral_shared_destroy(SAPoTCentral_shared* shared){
+
+	//Registrando as estatísticas de alocação
+	SAPoTLog_record record = {0};
+	record.event = SAPOT_EVENT_ALLOC_STATS;
+	record.level = SAPOT_LOG_INFO;
+	record.value = atomic_load(&shared->stats.heapAllocations);
+	record.aux = atomic_load(&shared->stats.poolPeak);
+	SAPoTLog_write(&shared->log, &record);
+
+	SAPoTMetrics_end(&shared->metrics);
+	SAPoTTrace_end(&shared->trace);
+	SAPoTCapture_end(&shared->capture);
+	MEMend(&shared->memory);
+
+	//Escrevendo os registros pendentes e fechando o arquivo de log
+	SAPoTLog_end(&shared->log);
+	pthread_mutex_destroy(&shared->lock);
+}
 
 /**
 * [Principal] SAPoTCentral_begin
 *
 */
-int SAPoTCentral_begin(SAPoTCentral* centralHandle, SAPoTCentral_create_options* optsHandle, const char* centralId){
+int SAPoTCentral_begin(SAPoTCentral* handle, SAPoTCentral_create_options* opts, const char* centralId, SAPoTCentral_shared* shared){
 
 	puts(" Starting a UCC ...");
 
-	/* Inicializa o descritor de arquivo que receberá os LOGs*/
-	fd = open("ucc_log.txt", O_WRONLY | O_APPEND | O_CREAT);
-	if(fd < 0){
-		handle->error = ERROR_LOG_OPERATION;
-		return SAPOTCENTRAL_FAILURE;
-	} 
-
-	system("chmod 777 ucc_log.txt");
-	
-	/* Atribuição aos objetos globais */
-	opts = (SAPoTCentral_create_options*) optsHandle;
-	handle = (SAPoTCentral*) centralHandle;
+	/* Sem contexto compartilhado, a Central utiliza seu próprio arquivo de log, pool e tabela de apelidos */
+	if(shared == NULL){
+		shared = &handle->ownShared;
+		if(SAPoTCentral_shared_init(shared, "ucc_log") != SAPOTCENTRAL_SUCCESS){
+			handle->error = ERROR_LOG_OPERATION;
+			return SAPOTCENTRAL_FAILURE;
+		}
+	}
 
 	/*Inicializa o objeto do tipo SAPoTCentral*/
+	handle->shared = shared;
+	handle->opts = opts;
+	handle->MQTTstatus = -1;
+	handle->MQTTdeliveredtoken = 0;
 	handle->id = centralId;
 	handle->error = SAPOTCENTRAL_SUCCESS;
 	handle->inLoop = 1;
@@ -65,42 +125,85 @@ int SAPoTCentral_begin(SAPoTCentral* centralHandle, SAPoTCentral_create_options*
 	//handle->acess = NULL;
 	handle->record = NULL;
 	handle->modification = NULL;
+	handle->batch = NULL;
+	handle->samples = NULL;
+	handle->echo = NULL;
+	handle->report = NULL;
+	handle->metricsText = NULL;
+	handle->payload = NULL;
+	handle->payloadLen = 0;
+	handle->publish = NULL;
+	handle->transmit = (handle->opts->transmissionProtocol == LOOPBACK) ? LOOPpublish : MQTTpublish;
+	handle->loopback = NULL;
+	handle->loopbackContext = NULL;
+
+	/* Registrando as instruções padrão do protocolo (com o armazenamento em memória, as operações MEM* substituem as MYSQL*) */
+	bool memory = (handle->opts->databaseProtocol == MEMORY);
+	SAPoTCentral_instruction registration = {"Registration", offsetof(SAPoTMessage_registration, actuatorQuantity) + sizeof(uint8_t), SAPoTCentral_validate_registration, memory ? MEMregistration : MYSQLregistration, NULL, true};
+	SAPoTCentral_instruction sensorSolicitation = {"SensorSolicitation", sizeof(SAPoTMessage_solicitation), SAPoTCentral_validate_solicitation, NULL, NULL, true};
+	SAPoTCentral_instruction actuatorSolicitation = {"ActuatorSolicitation", sizeof(SAPoTMessage_solicitation), SAPoTCentral_validate_solicitation, memory ? MEMactuator : CTRLactuator, NULL, true};
+	SAPoTCentral_instruction access = {"Access", 0, SAPoTCentral_validate_access, memory ? MEMaccess : MYSQLaccess, NULL, false};
+	SAPoTCentral_instruction record = {"Record", sizeof(SAPoTMessage_record), SAPoTCentral_validate_record, NULL, NULL, true};
+	SAPoTCentral_instruction modification = {"Modification", sizeof(SAPoTMessage_modification), SAPoTCentral_validate_modification, memory ? MEMmodification : MYSQLmodification, NULL, true};
+	SAPoTCentral_instruction batch = {"Batch", sizeof(SAPoTMessage_batch), SAPoTCentral_validate_batch, memory ? MEMbatch : MYSQLbatch, NULL, true};
+	SAPoTCentral_instruction statistics = {"Statistics", sizeof(SAPoTMessage_statistics), NULL, CTRLstatistics, NULL, false};
+	SAPoTCentral_instruction echo = {"Echo", sizeof(SAPoTMessage_echo), SAPoTCentral_validate_echo, CTRLecho, NULL, false, true};
+	SAPoTCentral_instruction report = {"Report", sizeof(SAPoTMessage_report), SAPoTCentral_validate_report, CTRLreport, NULL, true};
+
+	memset(handle->instructions, 0, sizeof(handle->instructions));
+	SAPoTCentral_register_instruction(handle, 0x00, &registration);
+	SAPoTCentral_register_instruction(handle, 0x01, &sensorSolicitation);
+	SAPoTCentral_register_instruction(handle, 0x02, &sensorSolicitation);
+	SAPoTCentral_register_instruction(handle, 0x03, &actuatorSolicitation);
+	SAPoTCentral_register_instruction(handle, 0x04, &access);
+	SAPoTCentral_register_instruction(handle, 0x05, &record);
+	SAPoTCentral_register_instruction(handle, 0x06, &modification);
+	SAPoTCentral_register_instruction(handle, 0x08, &batch);
+	SAPoTCentral_register_instruction(handle, 0x09, &statistics);
+	SAPoTCentral_register_instruction(handle, 0x0A, &echo);
+	SAPoTCentral_register_instruction(handle, 0x0B, &report);
+
+	/* Carregando os plugins de instrução */
+	if(handle->opts->plugins != NULL && SAPoTCentral_load_plugins(handle, handle->opts->plugins) != SAPOTCENTRAL_SUCCESS) return SAPOTCENTRAL_FAILURE;
 	
 	puts("UCC create options: ");
-	printf("Transmission Protocol = %d\n", opts->transmissionProtocol);
-	printf("\t host = %s\n", opts->transmission.host);
-	printf("\t port = %s\n", opts->transmission.port);
-	printf("\t user = %s\n", opts->transmission.user);
-	printf("\t pass = %s\n", opts->transmission.pass);
-	printf("Database Protocol = %d\n", opts->databaseProtocol);
-	printf("\t host = %s\n", opts->database.host);
-	printf("\t port = %s\n", opts->database.port);
-	printf("\t user = %s\n", opts->database.user);
-	printf("\t pass = %s\n", opts->database.pass);
-	printf("\t dirr = %s\n", opts->database.dir);	
+	printf("Transmission Protocol = %d\n", handle->opts->transmissionProtocol);
+	printf("\t host = %s\n", handle->opts->transmission.host);
+	printf("\t port = %s\n", handle->opts->transmission.port);
+	printf("\t user = %s\n", handle->opts->transmission.user);
+	printf("\t pass = %s\n", handle->opts->transmission.pass);
+	printf("Database Protocol = %d\n", handle->opts->databaseProtocol);
+	printf("\t host = %s\n", handle->opts->database.host);
+	printf("\t port = %s\n", handle->opts->database.port);
+	printf("\t user = %s\n", handle->opts->database.user);
+	printf("\t pass = %s\n", handle->opts->database.pass);
+	printf("\t dirr = %s\n", handle->opts->database.dir);	
 	
 	//Iniciando protocolo de transmissão
-	if(opts->transmissionProtocol == UNDEFINED){
+	if(handle->opts->transmissionProtocol == UNDEFINED){
 		puts("Undefined Transmission Protocol. The function SAPoTCentral_loop() cannot be used.");
 	}
-	else if(opts->transmissionProtocol == MQTT){ 
-		if(MQTTconnect() != SAPOTCENTRAL_SUCCESS){
+	else if(handle->opts->transmissionProtocol == MQTT){ 
+		if(MQTTconnect(handle) != SAPOTCENTRAL_SUCCESS){
 			handle->error = ERROR_STARTING_TRANSMISSION_PROTOCOL;
 			return SAPOTCENTRAL_FAILURE;
 		}
 		else puts("\t Connected with MQTT's Broker.");
 	}	
+	else if(handle->opts->transmissionProtocol == LOOPBACK){
+		puts("\t Loopback transmission: messages delivered by SAPoTCentral_receive().");
+	}
 	else{
 		handle->error = ERROR_SETTING_TRANSMISSION_PROTOCOL;
 		return SAPOTCENTRAL_FAILURE;
 	} 
 	
 	/*//Iniciando banco de dados
-	if(opts->databaseProtocol == UNDEFINED){
+	if(handle->opts->databaseProtocol == UNDEFINED){
 		puts("Undefined Data Base Protocol. The function SAPoTCentral_loop() cannot be used.");
 	}
-	else if(opts->databaseProtocol == SQL){ 
-		if(MYSQLconnect() != SAPOTCENTRAL_SUCCESS){
+	else if(handle->opts->databaseProtocol == SQL){ 
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
 			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
 			return SAPOTCENTRAL_FAILURE; 
 		}
@@ -119,34 +222,50 @@ int SAPoTCentral_begin(SAPoTCentral* centralHandle, SAPoTCentral_create_options*
 * [Principal] SAPoTCentral_end
 *
 */
-void SAPoTCentral_end(){
+void SAPoTCentral_end(SAPoTCentral* handle){
 
 	//Fechando conexão com o server MQTT
-	if(opts->transmissionProtocol) MQTTClient_disconnect(handle->MQTTclient, 10000);	
+	if(handle->opts->transmissionProtocol == MQTT) MQTTClient_disconnect(handle->MQTTclient, 10000);	
 
 	//Fechando conexão com o server MYSQL
-	if(opts->databaseProtocol) mysql_close(&handle->MYSQLclient);
+	if(handle->opts->databaseProtocol == SQL) mysql_close(&handle->MYSQLclient);
 
-	//Fechando o descritor de arquivos
-	close(fd);
+	free(handle->metricsText);
+	handle->metricsText = NULL;
+
+	//O contexto compartilhado é finalizado pela aplicação que o criou
+	if(handle->shared == &handle->ownShared) SAPoTCentral_shared_destroy(handle->shared);
 }
 
 /**
 * [Principal] SAPoTCentral_loop
 *
 */
-void SAPoTCentral_loop(){
+void SAPoTCentral_loop(SAPoTCentral* handle){
 
 	int i=0;
+	unsigned long seconds = 0;
 	while(handle->inLoop == true){
 		if(i==30){ 
-			MQTTClient_yield();
+			if(handle->opts->transmissionProtocol == MQTT) MQTTClient_yield();
 			i=0;
 		}
 
-		//MQTTconnect();
+		//Publicando as métricas no tópico de estatísticas
+		if(handle->opts->statsInterval > 0 && seconds % handle->opts->statsInterval == 0) SAPoTCentral_publish_metrics(handle);
+
+		//Atendendo a solicitação de exportação do rastreamento (apenas uma das Centrais que compartilham o contexto a atende)
+		if(atomic_load(&handle->shared->trace.dumpRequested) && atomic_exchange(&handle->shared->trace.dumpRequested, 0)) SAPoTCentral_trace_dump(handle->shared, NULL);
+
+		//Descarregando a captura quando o tráfego cessa e registrando o seu encerramento automático (informado a uma única Central)
+		unsigned long captured = 0;
+		int stopped = SAPoTCapture_flush(&handle->shared->capture, &captured);
+		if(stopped != 0) SAPoTCentral_log(handle, SAPOT_LOG_WARN, SAPOT_EVENT_CAPTURE_STOPPED, (uint32_t) captured, stopped);
+
+		//MQTTconnect(handle);
 		sleep(1);
 		i++;
+		seconds++;
 	}
 }
 
@@ -154,696 +273,2557 @@ void SAPoTCentral_loop(){
 * [Principal] SAPoTCentral_unpack_message
 *
 */
-int SAPoTCentral_unpack_message(void* message, int messageLen){
+int SAPoTCentral_unpack_message(SAPoTCentral* handle, void* message, int messageLen){
 
-	printf("SAPoTCentral_unpack_message: \n");	
+	SAPOT_DEBUG("SAPoTCentral_unpack_message: \n");	
 	
 	//Apontando para o espaço de memoria
 	handle->inMessage = (uint8_t*) message;
-	//Estruturando o cabeçalho da mensagem recebida
-	handle->header = (SAPoTMessage_header*) handle->inMessage;
+	handle->inVersion = (messageLen > 0) ? (handle->inMessage[0] >> 4) : 0;
+	handle->inFlags = 0;
+	//Estruturando o cabeçalho da mensagem recebida no formato da versão 1
+	handle->header = &handle->headerData;
+	memset(&handle->headerData, 0, sizeof(SAPoTMessage_header));
 
-	//Alocando e Preenchendo o bufer de log
-	bff_log = malloc(100);
-	sprintf((char*) bff_log, "ReceivedMsg(V=%d, I=%d, A=%d, S=%d, L=%d, EID=%02x:%02x:%02x:%02x:%02x:%02x)\n", handle->header->version, handle->header->instruction, handle->header->ack, handle->header->serial, handle->header->length, handle->header->emitterId[0], handle->header->emitterId[1], handle->header->emitterId[2], handle->header->emitterId[3], handle->header->emitterId[4], handle->header->emitterId[5]);
-	//Escrevendo no arquivo de log
-	write(fd, bff_log, strlen(bff_log));
-	free(bff_log);
-	
 	//Verificando a versão do pacote recebido
-	if(handle->header->version != SAPOT_PROTOCOL_VERSION){
-			handle->error = SAPOT_VERSION_ERROR;
+	if(handle->inVersion == SAPOT_PROTOCOL_VERSION){
+		if(messageLen < (int) sizeof(SAPoTMessage_header)){
+			handle->error = ERROR_MALFORMED_MESSAGE;
 			return SAPOTCENTRAL_FAILURE;
+		}
+		memcpy(&handle->headerData, handle->inMessage, sizeof(SAPoTMessage_header));
+		handle->payload = &handle->inMessage[sizeof(SAPoTMessage_header)];
+		handle->payloadLen = messageLen - sizeof(SAPoTMessage_header);
+	}
+	else if(handle->inVersion == SAPOT_PROTOCOL_VERSION_2){
+		if(SAPoTCentral_unpack_v2(handle, messageLen) != SAPOTCENTRAL_SUCCESS) return SAPOTCENTRAL_FAILURE;
 	}
 	else{
+		handle->error = SAPOT_VERSION_ERROR;
+		return SAPOTCENTRAL_FAILURE;
+	}
 
-		printf("\t Version: %d \n", handle->header->version);
-		if(handle->header->ack == true) printf("\t ACK true \n");
-		printf("\t Instruction: %d \n", handle->header->instruction);
-		printf("\t Serial: %d \n", handle->header->serial);
-		printf("\t length: %d \n", handle->header->length);
-		printf("\t ClientId: %02x:%02x:%02x:%02x:%02x:%02x \n", handle->header->emitterId[0], handle->header->emitterId[1], handle->header->emitterId[2], handle->header->emitterId[3], handle->header->emitterId[4], handle->header->emitterId[5]);
-	
-		//Registration
-		if(handle->header->instruction == 0x00){
-		
-			handle->registration = (SAPoTMessage_registration*) &handle->inMessage[sizeof(SAPoTMessage_header)];
-	
-		}
-		//Solicitation
-		else if(handle->header->instruction >= 0x01 && handle->header->instruction <= 0x03){
-	
-			handle->solicitation = (SAPoTMessage_solicitation*) &handle->inMessage[sizeof(SAPoTMessage_header)];
-	
-		}
-		//Acess
-		else if(handle->header->instruction == 0x04){
-	
-		}
-		//Record
-		else if(handle->header->instruction == 0x05){
-	
-			handle->record = (SAPoTMessage_record*) &handle->inMessage[sizeof(SAPoTMessage_header)];
-	
-		}
-		//Modification
-		else if(handle->header->instruction == 0x06){
+	SAPoTCentral_log(handle, SAPOT_LOG_INFO, SAPOT_EVENT_RECEIVED, handle->header->length, (handle->header->version << 8) | handle->header->ack);
 	
-			handle->modification = (SAPoTMessage_modification*) &handle->inMessage[sizeof(SAPoTMessage_header)]; 
-			handle->modification->macaddr[17] = '\0';
-			handle->modification->label[10] = '\0';
+	{
+
+		SAPOT_DEBUG("\t Version: %d \n", handle->header->version);
+		if(handle->header->ack == true) SAPOT_DEBUG("\t ACK true \n");
+		SAPOT_DEBUG("\t Instruction: %d \n", handle->header->instruction);
+		SAPOT_DEBUG("\t Serial: %d \n", handle->header->serial);
+		SAPOT_DEBUG("\t length: %d \n", handle->header->length);
+		SAPOT_DEBUG("\t ClientId: %02x:%02x:%02x:%02x:%02x:%02x \n", handle->header->emitterId[0], handle->header->emitterId[1], handle->header->emitterId[2], handle->header->emitterId[3], handle->header->emitterId[4], handle->header->emitterId[5]);
 	
-		}
 	}
+
+	//Buscando o manipulador da instrução recebida
+	SAPoTCentral_instruction* instruction = &handle->instructions[handle->header->instruction];
+	if(instruction->name == NULL){
+		handle->error = ERROR_UNKNOWN_INSTRUCTION;
+		return SAPOTCENTRAL_FAILURE;
+	}
+	SAPOT_DEBUG("\t Handler: %s \n", instruction->name);
+
+	//Verificando se o payload de uma requisição comporta a estrutura da instrução
+	if(handle->header->ack == false && handle->payloadLen < instruction->payloadSize){
+		handle->error = ERROR_MALFORMED_MESSAGE;
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	//Estruturando o payload
+	if(instruction->validate != NULL) return instruction->validate(handle);
 	
 	return SAPOTCENTRAL_SUCCESS;
 }
 
 /**
-* [Principal] SAPoTCentral_set_operation 
+* [Instrução] SAPoTCentral_validate_registration
 *
 */
-int SAPoTCentral_set_operation(int (*publish)(char*, void*, unsigned int)){
+int SAPoTCentral_validate_registration(SAPoTCentral* handle){
 
-	printf("SAPoTCentral_set_operation:\n");
+	handle->registration = (SAPoTMessage_registration*) handle->payload;
 
-	unsigned int outMessageLength;
+	return SAPOTCENTRAL_SUCCESS;
+}
 
-	//Registration
-	if(handle->header->instruction == 0x00){
-	
-		outMessageLength = MYSQLregistration();
-		
-	}
-	//Solicitation 0x01
-	else if(handle->header->instruction == 0x01){
-	
-	}
-	//Solicitation 0x02
-	else if(handle->header->instruction == 0x02){
-	
-	}
-	//Solicitation 0x03
-	else if(handle->header->instruction == 0x03){
+/**
+* [Instrução] SAPoTCentral_validate_solicitation
+*
+*/
+int SAPoTCentral_validate_solicitation(SAPoTCentral* handle){
 
-		outMessageLength = CTRLactuator(publish);
-	
-	}
-	//Access
-	else if(handle->header->instruction == 0x04){
-	
-		outMessageLength = MYSQLaccess();
+	handle->solicitation = (SAPoTMessage_solicitation*) handle->payload;
 
-	}
-	//Record
-	else if(handle->header->instruction == 0x05){
-	
-	}
-	//Modification
-	else if(handle->header->instruction == 0x06){
+	return SAPOTCENTRAL_SUCCESS;
+}
 
-		outMessageLength = MYSQLmodification();
+/**
+* [Instrução] SAPoTCentral_validate_access
+*
+*/
+int SAPoTCentral_validate_access(SAPoTCentral* handle){
 
-	}
-	
-	//Verifica a existencia de erro na operação realizada	
-	if(outMessageLength == SAPOTCENTRAL_FAILURE){
-		//Alocando e Preenchendo o bufer de log
-		bff_log = malloc(25);
-		sprintf((char*) bff_log, "SetOperationError=%d\n", handle->error);
-		//Escrevendo no arquivo de log
-		write(fd, bff_log, strlen(bff_log));
-		free(bff_log); 
-		return SAPOTCENTRAL_FAILURE;
-	}	
-	//Se não houver erro envia a mensagem de resposta (ACK) outMessage para ocliente que solicitou a operação 
-	else{
-		char topicName[18]; 
-		sprintf(topicName, "%02x:%02x:%02x:%02x:%02x:%02x", handle->header->emitterId[0], handle->header->emitterId[1], handle->header->emitterId[2], handle->header->emitterId[3], handle->header->emitterId[4], handle->header->emitterId[5]);
-		upper_string(topicName);
-		if(publish(topicName, handle->outMessage, outMessageLength) != SAPOTCENTRAL_SUCCESS){
-			free(handle->outMessage);
+	//A versão do diretório acompanha apenas as solicitações versionadas, que utilizam a codificação compacta
+	handle->directory = NULL;
+	if(handle->header->ack == false && handle->header->rsv1 == true && handle->header->rsv3 == true){
+		if(handle->payloadLen < (int) sizeof(SAPoTMessage_directory)){
+			handle->error = ERROR_MALFORMED_MESSAGE;
 			return SAPOTCENTRAL_FAILURE;
 		}
+		handle->directory = (SAPoTMessage_directory*) handle->payload;
 	}
 
-	free(handle->outMessage);
 	return SAPOTCENTRAL_SUCCESS;
 }
 
 /**
-* [Principal] SAPoTCentral_error
+* [Instrução] SAPoTCentral_validate_record
 *
 */
-int SAPoTCentral_error(){
+int SAPoTCentral_validate_record(SAPoTCentral* handle){
 
-	return handle->error;
+	handle->record = (SAPoTMessage_record*) handle->payload;
+
+	return SAPOTCENTRAL_SUCCESS;
 }
 
 /**
-* [Subrotina] MQTTconnect
+* [Instrução] SAPoTCentral_validate_modification
 *
 */
-int MQTTconnect(){
-
-	if(MQTTClient_isConnected(handle->MQTTclient) != true){
+int SAPoTCentral_validate_modification(SAPoTCentral* handle){
 
-		//Caso a conexão entre a central e servidor MQTT seja encerrada, o MQTTclient é destruido e o MQTTConnect é totalmente refeito
-		if(MQTTstatus == MQTTCLIENT_SUCCESS){ 
-			MQTTClient_destroy(handle->MQTTclient);
-			write(fd, "MQTTClient isn't connected, rebuild a MQTTclient and creating this connection\n", strlen("MQTTClient isn't connected, rebuild a MQTTclient and creating this connection\n"));
-		}
+	//O reconhecimento da etiquetagem não possui payload
+	if(handle->header->ack == true) return SAPOTCENTRAL_SUCCESS;
 
-		printf("MQTTconnect: \n");
-	
-		//MQTTClient_connectOptions MQTTopts = { {'M', 'Q', 'T', 'C'}, 6, 60, 0, 1, NULL, opts->transmission.user, opts->transmission.pass, 30, 0, NULL, 0, NULL, MQTTVERSION_DEFAULT, {NULL, 0, 0}, {0, NULL}, -1, 0}; //MQTTClient_connectOptions_initializer;
-	  	MQTTClient_connectOptions MQTTopts = MQTTClient_connectOptions_initializer;
-	  	MQTTopts.keepAliveInterval = 20;
-    	MQTTopts.cleansession = 1;
-    	MQTTopts.username = opts->transmission.user;
-    	MQTTopts.password = opts->transmission.pass;
+	handle->modification = (SAPoTMessage_modification*) handle->payload; 
+	handle->modification->macaddr[17] = '\0';
+	handle->modification->label[10] = '\0';
 
-	  	/* tcp://10.10.40.84:1883 */
-	  	char* serverURI = malloc(40);
-	  	sprintf(serverURI, "tcp://%s:%s",opts->transmission.host, opts->transmission.port);
-	  	printf("\t serverURI: %s\n", serverURI);
-	  	
-	  	if(MQTTClient_create(&handle->MQTTclient, serverURI, handle->id, MQTTCLIENT_PERSISTENCE_NONE, NULL) != MQTTCLIENT_SUCCESS){
-	  		puts("MQTTconnect error: unable to create client\n");
-			write(fd, "MQTTconnect error: unable to create the client\n", strlen("MQTTconnect error: unable to create the client\n"));
-	  		free(serverURI);
-	  		return 0;
-	  	}
-	  		
-	  	free(serverURI);
-	  	
-	  	puts("\t MQTTClient_create ready.");
-	  	
-	  	if(MQTTClient_setCallbacks(handle->MQTTclient, NULL, MQTTconnectionLost, MQTTmessageArrived, MQTTdeliveryComplete) != MQTTCLIENT_SUCCESS){
-			printf("MQTTconnect error: unable to set call back message\n");
-			write(fd, "MQTTconnect error: unable to set call back message\n", strlen("MQTTconnect error: unable to set call back message\n"));
-			return 0;
-		}
-		
-	 	puts("\t MQTTClient_setCallbacks ready.");
-	 
-	   	if((MQTTstatus = MQTTClient_connect(handle->MQTTclient, &MQTTopts)) != MQTTCLIENT_SUCCESS){
-		   	printf("MQTTconnect error: unable to connect with broker\n");
-		   	bff_log = malloc(70);
-		   	sprintf(bff_log, "MQTTconnect error (%d): unable to connect with broker\n", MQTTstatus);
-			write(fd, bff_log, strlen(bff_log));
-			free(bff_log);
-	  		return 0;
-	   	}
-	   	
-	   	puts("\t MQTTClient_connect ready.");
-	   	
-	   	if(MQTTClient_subscribe(handle->MQTTclient, handle->id, 0) != MQTTCLIENT_SUCCESS){
-			printf("MQTTconnect error: unable to subscribe on topic %s\n", handle->id);
-			bff_log = malloc(70);
-			sprintf(bff_log, "MQTTconnect error: unable to subscribe on topic %s\n", handle->id);
-			write(fd, bff_log, strlen(bff_log));
-			free(bff_log);
-			return 0;
-		}
-		
-		puts("\t MQTTClient_subscribe ready.");
-		
-	 
-	}  
-	
-	return SAPOTCENTRAL_SUCCESS; 	
+	return SAPOTCENTRAL_SUCCESS;
 }
 
 /**
-* [Subrotina] MQTTmessageArrived
+* [Instrução] SAPoTCentral_validate_batch
 *
 */
-int MQTTmessageArrived(void* context, char* topicName, int topicLen, MQTTClient_message* MQTTmsg){
+int SAPoTCentral_validate_batch(SAPoTCentral* handle){
 
+	//O reconhecimento do lote não possui payload
+	if(handle->header->ack == true) return SAPOTCENTRAL_SUCCESS;
 
-	if(SAPoTCentral_unpack_message(MQTTmsg->payload, MQTTmsg->payloadlen) != SAPOTCENTRAL_SUCCESS){
-		printf("MQTTmessageArrived error: unable to unpack SAPoT's message (%d)\n", handle->error);
+	//Verificando se a mensagem comporta as amostras declaradas
+	handle->batch = (SAPoTMessage_batch*) handle->payload;
+	if(handle->payloadLen < (int)(sizeof(SAPoTMessage_batch) + handle->batch->sampleQuantity*sizeof(SAPoTMessage_sample))){
+		handle->error = ERROR_MALFORMED_MESSAGE;
+		return SAPOTCENTRAL_FAILURE;
 	}
-	else{
-		
-		if(SAPoTCentral_set_operation(MQTTpublish) != SAPOTCENTRAL_SUCCESS){
-			printf("MQTTmessageArrived error: unable to set operation on SAPoTCentral (%d)\n", handle->error);
-		}	
-		
+
+	handle->samples = (SAPoTMessage_sample*) (handle->payload + sizeof(SAPoTMessage_batch));
+	SAPOT_DEBUG("\t Samples: %d \n", handle->batch->sampleQuantity);
+
+	//Valores NaN e infinitos não têm representação no banco de dados
+	int i;
+	for(i=0; i<handle->batch->sampleQuantity; i++){
+		if(!isfinite(handle->samples[i].value)){
+			handle->error = ERROR_MALFORMED_MESSAGE;
+			return SAPOTCENTRAL_FAILURE;
+		}
 	}
 
-	handle->error = SAPOTCENTRAL_SUCCESS;
-	MQTTClient_freeMessage(&MQTTmsg);
-    MQTTClient_free(topicName);
-	
-	return 1;
+	return SAPOTCENTRAL_SUCCESS;
 }
 
 /**
-* [Subrotina] MQTTdeliveryComplete
+* [Instrução] SAPoTCentral_validate_echo
 *
 */
-void MQTTdeliveryComplete(void* context, MQTTClient_deliveryToken dt){
+int SAPoTCentral_validate_echo(SAPoTCentral* handle){
+
+	//O reconhecimento do Cliente devolve o payload da solicitação, que não é verificado por SAPoTCentral_unpack_message()
+	if(handle->payloadLen < (int) sizeof(SAPoTMessage_echo)){
+		handle->error = ERROR_MALFORMED_MESSAGE;
+		return SAPOTCENTRAL_FAILURE;
+	}
 
-	printf("Message with token value %d delivery confirmed\n", dt);
-	MQTTdeliveredtoken = dt;
+	handle->echo = (SAPoTMessage_echo*) handle->payload;
+	handle->echo->label[10] = '\0';
 
-	//Escrevendo no arquivo de log
-	bff_log = malloc(55);
-	sprintf(bff_log, "Message with token value %d delivery confirmed\n", dt);
-	write(fd, bff_log, strlen(bff_log));
-	free(bff_log);
+	return SAPOTCENTRAL_SUCCESS;
 }
 
 /**
-* [Subrotina] MQTTconnectionLost
+* [Instrução] SAPoTCentral_validate_report
 *
 */
-void MQTTconnectionLost(void* context, char* cause){
+int SAPoTCentral_validate_report(SAPoTCentral* handle){
 
-	printf("\nConnection lost\n");
-    printf("     cause: %s\n", cause);
+	//O Cliente não reconhece a configuração: o reconhecimento não possui payload
+	if(handle->header->ack == true) return SAPOTCENTRAL_SUCCESS;
 
-    //Escrevendo no arquivo de log
-	bff_log = malloc(500);
-	sprintf(bff_log, "Connection lost: %s\n", cause);
-	write(fd, bff_log, strlen(bff_log));
-	free(bff_log);
+	handle->report = (SAPoTMessage_report*) handle->payload;
+	handle->report->label[10] = '\0';
+
+	return SAPOTCENTRAL_SUCCESS;
 }
 
 /**
-* [Subrotina] MQTTpublish
+* [Subrotina] SAPoTCentral_unpack_v2
 *
 */
-int MQTTpublish(char* topic, void* payload, unsigned int payloadLen){
+int SAPoTCentral_unpack_v2(SAPoTCentral* handle, int messageLen){
 
-	printf("MQTTPublish on topic: %s\n", topic);
-    MQTTClient_message pubmsg = MQTTClient_message_initializer;
-    pubmsg.payload = payload;
-    pubmsg.payloadlen = payloadLen;
-    pubmsg.qos = 0;
-    pubmsg.retained = 0;
-    MQTTClient_deliveryToken token;
-    
-   	if(MQTTClient_publishMessage(handle->MQTTclient, topic, &pubmsg, &token) != MQTTCLIENT_SUCCESS){
-   		printf("\t MQTTpublish error: unable to publish the message\n");
-   		handle->error = ERROR_MQTT_PUBLISH;
-   		return SAPOTCENTRAL_FAILURE;
-   	}
-   	else{ 
-    	MQTTClient_waitForCompletion(handle->MQTTclient, token, 1000L);
-    	printf("\t Published \n");
-    	return SAPOTCENTRAL_SUCCESS;
-    }	
-}
+	uint8_t* message = handle->inMessage;
+	const uint8_t* end = message + messageLen;
+	uint32_t serial, length;
+	int offset = 3;
+	int len;
 
-/**
-* [Subrotina] MYSQLconnect
-*
-*/
-int MYSQLconnect(){
+	if(messageLen < 7){
+		handle->error = ERROR_MALFORMED_MESSAGE;
+		return SAPOTCENTRAL_FAILURE;
+	}
 
-	printf("MYSQLconnect: \n");
-		
-	//Inicializa o cliente SQL
-	if(mysql_init(&handle->MYSQLclient) == NULL){
-		printf("MySQL Erro(%d): %s\n", mysql_errno(&handle->MYSQLclient), mysql_error(&handle->MYSQLclient));
-		mysql_close(&handle->MYSQLclient);
+	//Flags e versão possuem o mesmo formato da versão 1
+	handle->headerData.version = SAPOT_PROTOCOL_VERSION_2;
+	handle->headerData.ack = (message[0] >> 3) & 0x01;
+	handle->headerData.rsv1 = (message[0] >> 2) & 0x01;
+	handle->headerData.rsv2 = (message[0] >> 1) & 0x01;
+	handle->headerData.rsv3 = message[0] & 0x01;
+	handle->headerData.instruction = message[1];
+	handle->inFlags = message[2];
+
+	if(handle->inFlags & SAPOT_V2_FLAG_COMPRESSED){
+		handle->error = ERROR_UNSUPPORTED_FLAGS;
 		return SAPOTCENTRAL_FAILURE;
 	}
-	
-	puts("\t mysql_init ready.");
-	
-	//Conecta o cliente ao servidor SQL. 
-	if(mysql_real_connect(&handle->MYSQLclient, opts->database.host, opts->database.user, opts->database.pass, opts->database.dir, 0, NULL, 0 ) == NULL){
-		printf("MySQL Erro(%d): %s\n", mysql_errno(&handle->MYSQLclient), mysql_error(&handle->MYSQLclient));		
-		mysql_close(&handle->MYSQLclient);
-		return SAPOTCENTRAL_FAILURE; 
+
+	//Um registro (0x05) em formato de lote é tratado como a instrução 0x08
+	if((handle->inFlags & SAPOT_V2_FLAG_BATCH) && handle->headerData.instruction == 0x05) handle->headerData.instruction = 0x08;
+
+	//Serial e comprimento total (varint)
+	if((len = getVarint(&message[offset], end, &serial)) == 0){
+		handle->error = ERROR_MALFORMED_MESSAGE;
+		return SAPOTCENTRAL_FAILURE;
 	}
-	
-	puts("\t mysql_real_connect ready.");
-	
+	offset += len;
+
+	//O comprimento declarado deve ser o da mensagem recebida: bytes além dele não pertencem ao payload
+	if((len = getVarint(&message[offset], end, &length)) == 0 || length != (uint32_t) messageLen){
+		handle->error = ERROR_MALFORMED_MESSAGE;
+		return SAPOTCENTRAL_FAILURE;
+	}
+	offset += len;
+	handle->headerData.serial = serial;
+	handle->headerData.length = length;
+
+	//Identificador do emissor: apelido de 16 bits ou endereço MAC
+	if(handle->inFlags & SAPOT_V2_FLAG_ALIAS){
+
+		if(end - &message[offset] < 2){
+			handle->error = ERROR_MALFORMED_MESSAGE;
+			return SAPOTCENTRAL_FAILURE;
+		}
+		uint16_t alias = message[offset] | (message[offset+1] << 8);
+		offset += 2;
+
+		SAPoTCentral_device device;
+		int (*storage)(SAPoTCentral*, uint16_t, SAPoTCentral_device*) = (handle->opts->databaseProtocol == MEMORY) ? MEMalias : MYSQLalias;
+		if(alias == SAPOT_CENTRAL_ALIAS || (CTRLfind_alias(handle, alias, &device) != SAPOTCENTRAL_SUCCESS && storage(handle, alias, &device) != SAPOTCENTRAL_SUCCESS)){
+			handle->error = ERROR_UNKNOWN_ALIAS;
+			return SAPOTCENTRAL_FAILURE;
+		}
+		memcpy(handle->headerData.emitterId, device.emitterId, 6);
+	}
+	else{
+
+		if(end - &message[offset] < 6){
+			handle->error = ERROR_MALFORMED_MESSAGE;
+			return SAPOTCENTRAL_FAILURE;
+		}
+		memcpy(handle->headerData.emitterId, &message[offset], 6);
+		offset += 6;
+	}
+
+	//O cabeçalho v2 possui comprimento variável, então o payload é deslocado para o início do buffer para manter seu alinhamento
+	handle->payloadLen = messageLen - offset;
+	memmove(message, &message[offset], handle->payloadLen);
+	handle->payload = message;
+
 	return SAPOTCENTRAL_SUCCESS;
 }
 
 /**
-* [Subrotina] MYSQLregistration
+* [Principal] SAPoTCentral_pack_v2
 *
 */
-int MYSQLregistration(){
+int SAPoTCentral_pack_v2(uint8_t* message, int messageLen){
+
+	SAPoTMessage_header header;
+	uint8_t bff[15];
+	int headerLen, payloadLen;
+	uint32_t length;
+
+	memcpy(&header, message, sizeof(SAPoTMessage_header));
+	payloadLen = messageLen - sizeof(SAPoTMessage_header);
+
+	//O comprimento total depende do tamanho do próprio cabeçalho, então o varint do comprimento é estimado até convergir
+	length = payloadLen + 7;
+	while(true){
+		headerLen = 0;
+		bff[headerLen++] = (SAPOT_PROTOCOL_VERSION_2 << 4) | (header.ack << 3) | (header.rsv1 << 2) | (header.rsv2 << 1) | header.rsv3;
+		bff[headerLen++] = header.instruction;
+		bff[headerLen++] = SAPOT_V2_FLAG_ALIAS;
+		headerLen += putVarint(&bff[headerLen], header.serial);
+		headerLen += putVarint(&bff[headerLen], length);
+		bff[headerLen++] = SAPOT_CENTRAL_ALIAS & 0xff;
+		bff[headerLen++] = SAPOT_CENTRAL_ALIAS >> 8;
+
+		if((uint32_t)(headerLen + payloadLen) == length) break;
+		length = headerLen + payloadLen;
+	}
 
-	//Abrindo conexão com o banco de dados
-	if(opts->databaseProtocol == SQL){ 
-		if(MYSQLconnect() != SAPOTCENTRAL_SUCCESS){
-			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
-			return SAPOTCENTRAL_FAILURE; 
-		}
-	}	
+	//O cabeçalho v2 é sempre menor que os 12 bytes do cabeçalho v1, então a conversão pode ser feita no mesmo espaço de memória
+	memmove(&message[headerLen], &message[sizeof(SAPoTMessage_header)], payloadLen);
+	memcpy(message, bff, headerLen);
 
-	puts("MYSQLregistration: ");
+	return headerLen + payloadLen;
+}
 
-	char query[200] = {};
-	int querylen = 0;
-	char newId[18];
-	/** Estrutura que representa o resultado de uma query solicitada */
-  	MYSQL_RES* sqlResult;
-	/** Dá acesso a uma linha do resultado de uma query solicitada */
-	MYSQL_ROW sqlRow;	
-	
-	//Formatando o id do possível novo cliente
-	sprintf(newId, "%02x:%02x:%02x:%02x:%02x:%02x", handle->header->emitterId[0], handle->header->emitterId[1], handle->header->emitterId[2], handle->header->emitterId[3], handle->header->emitterId[4], handle->header->emitterId[5]);
-	upper_string(newId);
-	printf("\t newId = %s\n", newId);
-	
-	//Formatando a query para verificar se o novo cliente já está na tabela tb_cadastrados
-	querylen = sprintf(query, "SELECT id FROM tb_cadastrados WHERE macaddr like '%s';", newId);
-	printf("\t query = %s\n", query);
-	printf("\t querylen = %d\n", querylen);
-	
-    //Solicitando a query ao servidor 
-	if( mysql_real_query(&handle->MYSQLclient, (const char*) query, (unsigned int) querylen) != 0 ){
-		printf("MYSQL Erro(%d): %s\n", mysql_errno(&handle->MYSQLclient), mysql_error(&handle->MYSQLclient));
-		handle->error =  ERROR_DATABASE_INQUIRY;
-		mysql_close(&handle->MYSQLclient);
-		return SAPOTCENTRAL_FAILURE; 
-	}
-		
-	//sqlResult recebe o retorno da query solicitada ao banco de dados:
-	sqlResult = mysql_store_result(&handle->MYSQLclient);
-	//Se o cliente já está cadastrados o retorno da query diferente de null
-	//Então o sqlRow receberá o id em que ele foi cadastrado na tabela tb_cadastrados.
-	if((sqlRow = mysql_fetch_row(sqlResult)) != NULL){
-		//formatando uma query de update para o cliente que já está cadastrado.
-		querylen = sprintf(query, "UPDATE tb_cadastrados SET type='%d', sensor='%d', actuator='%d' WHERE id='%s';", handle->registration->clientType, handle->registration->sensorQuantity, handle->registration->actuatorQuantity, sqlRow[0]);
-	}
-	//Contudo, se o cliente não está cadastrados o retorno da query será falso 
-	else{
+/**
+* [Principal] SAPoTCentral_ack_header
+*
+*/
+void SAPoTCentral_ack_header(SAPoTCentral* handle, SAPoTMessage_header* header, int outMessageLength){
+
+	header->version = SAPOT_PROTOCOL_VERSION;
+	header->ack = 1;
+	header->rsv1 = 0;
+	header->rsv2 = 0;
+	header->rsv3 = 0;
+	header->instruction = handle->header->instruction;
+	header->serial = handle->header->serial;
+	header->length = outMessageLength;
+	getmacID((const char*) handle->id, header->emitterId);
+}
+
+/**
+* [Principal] SAPoTCentral_topic
+*
+*/
+void SAPoTCentral_topic(const uint8_t emitterId[6], char topic[18]){
+
+	sprintf(topic, "%02x:%02x:%02x:%02x:%02x:%02x", emitterId[0], emitterId[1], emitterId[2], emitterId[3], emitterId[4], emitterId[5]);
+	upper_string(topic);
+}
+
+/**
+* [Principal] SAPoTCentral_pack_access
+*
+*/
+int SAPoTCentral_pack_access(uint8_t* payload, const SAPoTCentral_client* client, bool compact, uint8_t previous[6]){
+
+	//Formato fixo: uma seção SAPoTMessage_access
+	if(compact == false){
+		SAPoTMessage_access* access = (SAPoTMessage_access*) payload;
+		strncpy((char*) access->label, client->label, (size_t) 10);
+		strncpy((char*) access->id, client->macaddr, (size_t) 17);
+		access->id[17] = 0;
+		access->type = client->type;
+		access->sensor = client->sensor;
+		access->actuator = client->actuator;
+		return sizeof(SAPoTMessage_access);
+	}
+
+	//Codificação compacta: MAC binário, etiqueta com prefixo de comprimento e contadores varint
+	uint8_t mac[6];
+	int offset = 0;
+	int labelLen, shared;
+
+	getmacID(client->macaddr, mac);
+
+	if(previous != NULL){
+		for(shared=0; shared<6 && mac[shared] == previous[shared]; shared++);
+		payload[offset++] = shared;
+		memcpy(&payload[offset], &mac[shared], 6 - shared);
+		offset += 6 - shared;
+		memcpy(previous, mac, 6);
+	}
+	else{
+		memcpy(&payload[offset], mac, 6);
+		offset += 6;
+	}
+
+	labelLen = strnlen(client->label, 10);
+	payload[offset++] = labelLen;
+	memcpy(&payload[offset], client->label, labelLen);
+	offset += labelLen;
+
+	offset += putVarint(&payload[offset], client->type);
+	payload[offset++] = client->sensor;
+	payload[offset++] = client->actuator;
+
+	return offset;
+}
+
+/**
+* [Principal] SAPoTCentral_set_operation 
+*
+*/
+int SAPoTCentral_set_operation(SAPoTCentral* handle, int (*publish)(SAPoTCentral*, char*, void*, unsigned int)){
+
+	SAPOT_DEBUG("SAPoTCentral_set_operation:\n");
+
+	uint8_t code = handle->header->instruction;
+	SAPoTCentral_instruction* instruction = &handle->instructions[code];
+	SAPoTMetrics* metrics = &handle->shared->metrics;
+
+	//Reconhecimentos (exceto os das instruções que os tratam) e instruções sem operação na Central não geram resposta
+	if((handle->header->ack == true && !instruction->acknowledged) || instruction->execute == NULL) return SAPOTCENTRAL_SUCCESS;
+
+	//O tempo das publicações é acumulado pela função de publicação e descontado da fase de banco de dados
+	handle->publish = publish;
+	handle->publishTime = 0;
+	uint64_t start = SAPoTMetrics_now();
+	uint64_t traceBegin = SAPOT_TRACE_BEGIN(handle);
+	int outMessageLength = instruction->execute(handle);
+	SAPOT_TRACE_END(handle, SAPOT_SPAN_EXECUTE, traceBegin);
+	SAPoTMetrics_observe(metrics, code, SAPOT_PHASE_DATABASE, SAPoTMetrics_now() - start - handle->publishTime);
+	
+	//Verifica a existencia de erro na operação realizada	
+	if(outMessageLength == SAPOTCENTRAL_FAILURE){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_OPERATION_ERROR, 0, 0);
+		SAPoTMetrics_error(metrics, code, handle->error);
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	//Se não houver erro envia a mensagem de resposta (ACK) outMessage para ocliente que solicitou a operação 
+	int result = SAPOTCENTRAL_SUCCESS;
+	if(outMessageLength > 0){
+		traceBegin = SAPOT_TRACE_BEGIN(handle);
+		if(instruction->respond != NULL) result = instruction->respond(handle, outMessageLength);
+		else result = SAPoTCentral_respond(handle, outMessageLength);
+		SAPOT_TRACE_END(handle, SAPOT_SPAN_RESPOND, traceBegin);
+	}
+
+	if(handle->publishTime > 0) SAPoTMetrics_observe(metrics, code, SAPOT_PHASE_PUBLISH, handle->publishTime);
+	if(result != SAPOTCENTRAL_SUCCESS) SAPoTMetrics_error(metrics, code, handle->error);
+
+	return result;
+}
+
+/**
+* [Principal] SAPoTCentral_respond
+*
+*/
+int SAPoTCentral_respond(SAPoTCentral* handle, int outMessageLength){
+
+	//A resposta utiliza a mesma versão de protocolo da mensagem recebida
+	if(handle->inVersion == SAPOT_PROTOCOL_VERSION_2) outMessageLength = SAPoTCentral_pack_v2(handle->outMessage, outMessageLength);
+
+	char topicName[18]; 
+	SAPoTCentral_topic(handle->header->emitterId, topicName);
+	if(handle->publish(handle, topicName, handle->outMessage, outMessageLength) != SAPOTCENTRAL_SUCCESS){
+		SAPoTCentral_release(handle, handle->outMessage);
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	SAPoTCentral_release(handle, handle->outMessage);
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Principal] SAPoTCentral_receive
+*
+*/
+int SAPoTCentral_receive(SAPoTCentral* handle, void* message, int messageLen){
+
+	SAPoTMetrics* metrics = &handle->shared->metrics;
+	atomic_fetch_add_explicit(&metrics->inFlight, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&metrics->bytesIn, messageLen, memory_order_relaxed);
+
+	//A amostragem é decidida uma única vez por mensagem; com o rastreamento desativado, cada etapa testa apenas handle->traced
+	handle->traced = handle->shared->trace.sampleRate != 0 && SAPoTTrace_sample(&handle->shared->trace);
+	uint64_t traceCallback = SAPOT_TRACE_BEGIN(handle);
+
+	//Os fracassos da operação e da publicação da resposta são registrados por SAPoTCentral_set_operation e pela função de publicação
+	uint64_t start = SAPoTMetrics_now();
+	uint64_t traceBegin = SAPOT_TRACE_BEGIN(handle);
+	int result = SAPOTCENTRAL_FAILURE;
+	int unpacked = SAPoTCentral_unpack_message(handle, message, messageLen);
+	SAPOT_TRACE_END(handle, SAPOT_SPAN_UNPACK, traceBegin);
+	SAPoTMetrics_observe(metrics, handle->header->instruction, SAPOT_PHASE_UNPACK, SAPoTMetrics_now() - start);
+	atomic_fetch_add_explicit(&metrics->instructions[handle->header->instruction].messages, 1, memory_order_relaxed);
+
+	if(unpacked != SAPOTCENTRAL_SUCCESS){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_UNPACK_ERROR, messageLen, 0);
+		SAPoTMetrics_error(metrics, handle->header->instruction, handle->error);
+	}
+	else result = SAPoTCentral_set_operation(handle, handle->transmit);
+
+	//Republicando a mensagem para os Usuários que observam o tráfego (gpc watch)
+	if(unpacked == SAPOTCENTRAL_SUCCESS && handle->opts->watch && handle->instructions[handle->header->instruction].watched) SAPoTCentral_watch(handle);
+
+	//Mensagens que não puderam ser estruturadas não possuem emissor confiável
+	if(unpacked == SAPOTCENTRAL_SUCCESS) SAPoTMetrics_device_update(metrics, handle->header->emitterId, handle->header->instruction, messageLen, handle->error);
+
+	atomic_fetch_sub_explicit(&metrics->inFlight, 1, memory_order_relaxed);
+	SAPOT_TRACE_END(handle, SAPOT_SPAN_CALLBACK, traceCallback);
+	handle->traced = false;
+
+	return result;
+}
+
+/**
+* [Principal] SAPoTCentral_watch
+*
+*/
+int SAPoTCentral_watch(SAPoTCentral* handle){
+
+	const uint8_t* emitterId = handle->header->emitterId;
+	uint16_t type;
+
+	//O tipo do Cliente é informado em seu cadastro; com o armazenamento em memória, o cadastro anterior ao início da observação é consultado
+	if(handle->header->instruction == 0x00 && handle->header->ack == false){
+		type = handle->registration->clientType;
+		CTRLset_type(handle, emitterId, type);
+	}
+	else if((type = CTRLfind_type(handle, emitterId)) == SAPOT_WATCH_UNKNOWN_TYPE && handle->opts->databaseProtocol == MEMORY){
+		char macaddr[18];
+		SAPoTCentral_topic(emitterId, macaddr);
+		pthread_mutex_lock(&handle->shared->memory.lock);
+		int id = MEMfind(&handle->shared->memory, macaddr);
+		if(id != 0) type = handle->shared->memory.clients[id-1].type;
+		pthread_mutex_unlock(&handle->shared->memory.lock);
+		if(id != 0) CTRLset_type(handle, emitterId, type);
+	}
+
+	char topic[64];
+	int topicLen = snprintf(topic, sizeof(topic), "%s/watch/%04X/", handle->id, type);
+	SAPoTCentral_topic(emitterId, &topic[topicLen]);
+
+	//Na versão 1 a mensagem recebida é republicada sem cópia; na versão 2 o cabeçalho é convertido para a versão 1
+	int messageLen = sizeof(SAPoTMessage_header) + handle->payloadLen;
+	if(handle->inVersion == SAPOT_PROTOCOL_VERSION) return handle->transmit(handle, topic, handle->inMessage, messageLen);
+
+	uint8_t* message = SAPoTCentral_alloc(handle, messageLen);
+	if(message == NULL) return SAPOTCENTRAL_FAILURE;
+	memcpy(message, handle->header, sizeof(SAPoTMessage_header));
+	((SAPoTMessage_header*) message)->length = messageLen;
+	memcpy(&message[sizeof(SAPoTMessage_header)], handle->payload, handle->payloadLen);
+
+	int result = handle->transmit(handle, topic, message, messageLen);
+	SAPoTCentral_release(handle, message);
+
+	return result;
+}
+
+/**
+* [Principal] SAPoTCentral_set_loopback
+*
+*/
+void SAPoTCentral_set_loopback(SAPoTCentral* handle, void (*loopback)(void*, const char*, const void*, unsigned int), void* context){
+
+	handle->loopback = loopback;
+	handle->loopbackContext = context;
+}
+
+/**
+* [Principal] SAPoTCentral_get_stats
+*
+*/
+const SAPoTCentral_stats* SAPoTCentral_get_stats(SAPoTCentral* handle){
+
+	return &handle->shared->stats;
+}
+
+/**
+* [Principal] SAPoTCentral_metrics_render
+*
+*/
+size_t SAPoTCentral_metrics_render(void* context, char* buffer, size_t size, int topDevices){
+
+	SAPoTCentral_shared* shared = (SAPoTCentral_shared*) context;
+
+	size_t used = SAPoTMetrics_render(&shared->metrics, buffer, size, topDevices);
+
+	//Registros ainda não escritos pela thread de log
+	unsigned long pending = 0;
+	SAPoTLog_ring* ring;
+	for(ring = atomic_load(&shared->log.rings); ring != NULL; ring = ring->next){
+		pending += atomic_load_explicit(&ring->head, memory_order_relaxed) - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	}
+
+	int len = snprintf(buffer + used, size - used,
+		"# TYPE sapot_pool_blocks_in_use gauge\nsapot_pool_blocks_in_use %d\n"
+		"# TYPE sapot_pool_blocks_peak gauge\nsapot_pool_blocks_peak %d\n"
+		"# TYPE sapot_heap_allocations_total counter\nsapot_heap_allocations_total %lu\n"
+		"# TYPE sapot_log_pending_records gauge\nsapot_log_pending_records %lu\n",
+		atomic_load(&shared->stats.poolInUse), atomic_load(&shared->stats.poolPeak), atomic_load(&shared->stats.heapAllocations), pending);
+	if(len > 0) used += ((size_t) len < size - used) ? (size_t) len : size - used - 1;
+
+	//Últimos valores dos sensores: o valor atual é omitido quando desatualizado, e a idade indica há quanto tempo ele não muda
+	static SAPoTCentral_reading readings[SAPOT_READINGS];
+	static pthread_mutex_t renderLock = PTHREAD_MUTEX_INITIALIZER;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t instant = (int64_t) now.tv_sec*1000 + now.tv_nsec/1000000;
+	char macaddr[18];
+	int i, stale = 0;
+
+	pthread_mutex_lock(&renderLock);
+	pthread_mutex_lock(&shared->lock);
+	memcpy(readings, shared->readings, sizeof(readings));
+	pthread_mutex_unlock(&shared->lock);
+
+	//Leituras desatualizadas: contadas sobre toda a tabela, mesmo que o texto seja truncado
+	static bool current[SAPOT_READINGS];
+	for(i=0; i<SAPOT_READINGS; i++){
+		current[i] = readings[i].heartbeat == 0 || instant - readings[i].instant <= (int64_t) readings[i].heartbeat * SAPOT_READING_MISSED;
+		if(readings[i].instant != 0 && !current[i]) stale++;
+	}
+
+	//O formato exige as amostras de cada métrica agrupadas após a sua linha TYPE
+	len = snprintf(buffer + used, size - used, "# TYPE sapot_sensor_value gauge\n");
+	if(len > 0) used += ((size_t) len < size - used) ? (size_t) len : size - used - 1;
+	for(i=0; i<SAPOT_READINGS && used < size - 1; i++){
+		if(readings[i].instant == 0 || !current[i]) continue;
+		SAPoTCentral_topic(readings[i].emitterId, macaddr);
+		len = snprintf(buffer + used, size - used, "sapot_sensor_value{macaddr=\"%s\",sensor=\"%u\"} %g\n", macaddr, readings[i].sensorId, readings[i].value);
+		if(len > 0) used += ((size_t) len < size - used) ? (size_t) len : size - used - 1;
+	}
+
+	len = snprintf(buffer + used, size - used, "# TYPE sapot_sensor_age_seconds gauge\n");
+	if(len > 0) used += ((size_t) len < size - used) ? (size_t) len : size - used - 1;
+	for(i=0; i<SAPOT_READINGS && used < size - 1; i++){
+		if(readings[i].instant == 0) continue;
+		SAPoTCentral_topic(readings[i].emitterId, macaddr);
+		len = snprintf(buffer + used, size - used, "sapot_sensor_age_seconds{macaddr=\"%s\",sensor=\"%u\"} %.3f\n", macaddr, readings[i].sensorId, (instant - readings[i].instant) / 1000.0);
+		if(len > 0) used += ((size_t) len < size - used) ? (size_t) len : size - used - 1;
+	}
+	pthread_mutex_unlock(&renderLock);
+
+	len = snprintf(buffer + used, size - used, "# TYPE sapot_sensor_stale gauge\nsapot_sensor_stale %d\n", stale);
+	if(len > 0) used += ((size_t) len < size - used) ? (size_t) len : size - used - 1;
+
+	return used;
+}
+
+/**
+* [Principal] SAPoTCentral_metrics_listen
+*
+*/
+int SAPoTCentral_metrics_listen(SAPoTCentral_shared* shared, const char* address){
+
+	return (SAPoTMetrics_listen(&shared->metrics, address) == 0) ? SAPOTCENTRAL_SUCCESS : SAPOTCENTRAL_FAILURE;
+}
+
+/**
+* [Principal] SAPoTCentral_trace_dump
+*
+*/
+int SAPoTCentral_trace_dump(SAPoTCentral_shared* shared, const char* path){
+
+	//Nome padrão: prefixo do log seguido do instante da exportação
+	char name[256];
+	if(path == NULL){
+		char date[32];
+		time_t now = time(NULL);
+		struct tm local;
+		localtime_r(&now, &local);
+		strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &local);
+		snprintf(name, sizeof(name), "%s-trace-%s.json", shared->log.prefix, date);
+		path = name;
+	}
+
+	FILE* file = fopen(path, "w");
+	if(file == NULL) return SAPOTCENTRAL_FAILURE;
+
+	int exported = SAPoTTrace_dump(&shared->trace, file);
+	if(fclose(file) != 0) return SAPOTCENTRAL_FAILURE;
+	return exported;
+}
+
+/**
+* [Principal] SAPoTCentral_publish_metrics
+*
+*/
+int SAPoTCentral_publish_metrics(SAPoTCentral* handle){
+
+	//O texto das métricas excede os blocos do pool: o buffer é alocado na primeira publicação e reutilizado até SAPoTCentral_end()
+	if(handle->metricsText == NULL && (handle->metricsText = malloc(SAPOT_METRICS_TEXT_SIZE)) == NULL) return SAPOTCENTRAL_FAILURE;
+
+	char topic[64];
+	snprintf(topic, sizeof(topic), "%s/stats", handle->id);
+	size_t length = SAPoTCentral_metrics_render(handle->shared, handle->metricsText, SAPOT_METRICS_TEXT_SIZE, SAPOT_METRICS_TOP_DEVICES);
+
+	return handle->transmit(handle, topic, handle->metricsText, length);
+}
+
+/* Pool de buffers da thread (veja SAPoTCentral_pool), cuja referência é liberada ao término da thread pelo destrutor da chave poolKey */
+static __thread SAPoTCentral_pool* threadPool = NULL;
+static pthread_key_t poolKey;
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+
+/**
+* [Utilitário] SAPoTCentral_pool_unref
+*
+*/
+static void SAPoTCentral_pool_unref(void* context){
+
+	SAPoTCentral_pool* pool = (SAPoTCentral_pool*) context;
+
+	//A última referência (da thread dona ou do último bloco em uso) libera o pool
+	if(atomic_fetch_sub_explicit(&pool->references, 1, memory_order_acq_rel) == 1) free(pool);
+}
+
+/**
+* [Utilitário] SAPoTCentral_pool_key
+*
+*/
+static void SAPoTCentral_pool_key(void){
+
+	pthread_key_create(&poolKey, SAPoTCentral_pool_unref);
+}
+
+/**
+* [Utilitário] SAPoTCentral_pool_get
+*
+*/
+static SAPoTCentral_pool* SAPoTCentral_pool_get(void){
+
+	//O pool é alocado uma única vez por thread, no primeiro buffer solicitado
+	if(threadPool == NULL){
+		pthread_once(&poolOnce, SAPoTCentral_pool_key);
+		threadPool = malloc(sizeof(SAPoTCentral_pool));
+		if(threadPool == NULL) return NULL;
+		int i;
+		for(i=0; i<SAPOT_POOL_BLOCKS; i++){
+			((SAPoTCentral_block*) threadPool->blocks[i])->pool = threadPool;
+			threadPool->freeBlocks[i] = threadPool->blocks[i];
+		}
+		threadPool->freeCount = SAPOT_POOL_BLOCKS;
+		atomic_init(&threadPool->returned, NULL);
+		atomic_init(&threadPool->references, 1);
+		pthread_setspecific(poolKey, threadPool);
+	}
+
+	return threadPool;
+}
+
+/**
+* [Principal] SAPoTCentral_alloc
+*
+*/
+void* SAPoTCentral_alloc(SAPoTCentral* handle, size_t size){
+
+	SAPoTCentral_stats* stats = &handle->shared->stats;
+	SAPoTCentral_pool* pool = SAPoTCentral_pool_get();
+	uint8_t* block;
+
+	//Blocos do pool da thread atendem mensagens de até SAPOT_POOL_BLOCK_SIZE bytes, sem exclusão mútua
+	if(pool != NULL && size <= SAPOT_POOL_BLOCK_SIZE){
+
+		//Pilha esgotada: recolhendo os blocos devolvidos por outras threads
+		if(pool->freeCount == 0){
+			block = atomic_exchange_explicit(&pool->returned, NULL, memory_order_acquire);
+			while(block != NULL){
+				pool->freeBlocks[pool->freeCount++] = block;
+				block = *(uint8_t**) (block + sizeof(SAPoTCentral_block));
+			}
+		}
+
+		if(pool->freeCount > 0){
+			atomic_fetch_add_explicit(&stats->poolAllocations, 1, memory_order_relaxed);
+			int inUse = atomic_fetch_add_explicit(&stats->poolInUse, 1, memory_order_relaxed) + 1;
+			int peak = atomic_load_explicit(&stats->poolPeak, memory_order_relaxed);
+			while(inUse > peak && !atomic_compare_exchange_weak_explicit(&stats->poolPeak, &peak, inUse, memory_order_relaxed, memory_order_relaxed));
+			atomic_fetch_add_explicit(&pool->references, 1, memory_order_relaxed);
+			return pool->freeBlocks[--pool->freeCount] + sizeof(SAPoTCentral_block);
+		}
+	}
+
+	atomic_fetch_add_explicit(&stats->heapAllocations, 1, memory_order_relaxed);
+	block = malloc(sizeof(SAPoTCentral_block) + size);
+	if(block == NULL) return NULL;
+	((SAPoTCentral_block*) block)->pool = NULL;
+	return block + sizeof(SAPoTCentral_block);
+}
+
+/**
+* [Principal] SAPoTCentral_release
+*
+*/
+void SAPoTCentral_release(SAPoTCentral* handle, void* buffer){
+
+	SAPoTCentral_stats* stats = &handle->shared->stats;
+	if(buffer == NULL) return;
+	uint8_t* block = (uint8_t*) buffer - sizeof(SAPoTCentral_block);
+	SAPoTCentral_pool* pool = ((SAPoTCentral_block*) block)->pool;
+
+	if(pool == NULL){
+		atomic_fetch_add_explicit(&stats->heapReleases, 1, memory_order_relaxed);
+		free(block);
+		return;
+	}
+	atomic_fetch_sub_explicit(&stats->poolInUse, 1, memory_order_relaxed);
+
+	//Blocos do pool da thread voltam para a pilha de blocos livres (a thread mantém a sua referência, então o pool não é liberado)
+	if(pool == threadPool){
+		pool->freeBlocks[pool->freeCount++] = block;
+		atomic_fetch_sub_explicit(&pool->references, 1, memory_order_relaxed);
+		return;
+	}
+
+	//Blocos de outra thread voltam para a pilha de devoluções do pool dono
+	uint8_t* head = atomic_load_explicit(&pool->returned, memory_order_relaxed);
+	do{
+		*(uint8_t**) (block + sizeof(SAPoTCentral_block)) = head;
+	}while(!atomic_compare_exchange_weak_explicit(&pool->returned, &head, block, memory_order_release, memory_order_relaxed));
+	SAPoTCentral_pool_unref(pool);
+}
+
+/**
+* [Principal] SAPoTCentral_register_instruction
+*
+*/
+int SAPoTCentral_register_instruction(SAPoTCentral* handle, uint8_t instruction, const SAPoTCentral_instruction* handler){
+
+	handle->instructions[instruction] = *handler;
+
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Principal] SAPoTCentral_load_plugins
+*
+*/
+int SAPoTCentral_load_plugins(SAPoTCentral* handle, const char* plugins){
+
+	char path[256];
+	const char* next;
+
+	while(*plugins != '\0'){
+
+		//Separando o próximo caminho da lista
+		next = strchr(plugins, ':');
+		size_t len = (next != NULL) ? (size_t)(next - plugins) : strlen(plugins);
+		if(len > 0){
+			if(len >= sizeof(path)){
+				handle->error = ERROR_LOADING_PLUGIN;
+				return SAPOTCENTRAL_FAILURE;
+			}
+			memcpy(path, plugins, len);
+			path[len] = '\0';
+
+			//Carregando o plugin e evocando sua função de inicialização
+			void* plugin = dlopen(path, RTLD_NOW);
+			if(plugin == NULL){
+				printf("Plugin Erro: %s\n", dlerror());
+				handle->error = ERROR_LOADING_PLUGIN;
+				return SAPOTCENTRAL_FAILURE;
+			}
+
+			int (*init)(SAPoTCentral*) = (int (*)(SAPoTCentral*)) dlsym(plugin, SAPOTCENTRAL_PLUGIN_INIT);
+			if(init == NULL || init(handle) != SAPOTCENTRAL_SUCCESS){
+				printf("Plugin Erro: falha ao inicializar %s\n", path);
+				dlclose(plugin);
+				handle->error = ERROR_LOADING_PLUGIN;
+				return SAPOTCENTRAL_FAILURE;
+			}
+			printf("\t Plugin loaded: %s\n", path);
+		}
+
+		if(next == NULL) break;
+		plugins = next + 1;
+	}
+
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Principal] SAPoTCentral_error
+*
+*/
+int SAPoTCentral_error(SAPoTCentral* handle){
+
+	return handle->error;
+}
+
+/**
+* [Subrotina] SAPoTCentral_log
+*
+*/
+void SAPoTCentral_log(SAPoTCentral* handle, int level, uint8_t event, uint32_t value, uint32_t aux){
+
+	if(level < handle->shared->log.level) return;
+
+	SAPoTLog_record record = {0};
+	record.event = event;
+	record.level = level;
+	record.error = handle->error;
+	record.value = value;
+	record.aux = aux;
+
+	//Eventos de mensagem carregam a identificação da mensagem em tratamento
+	if(event < SAPOT_EVENT_CENTRAL && handle->header != NULL){
+		record.instruction = handle->header->instruction;
+		record.serial = handle->header->serial;
+		memcpy(record.emitterId, handle->header->emitterId, sizeof(record.emitterId));
+	}
+
+	SAPoTLog_write(&handle->shared->log, &record);
+}
+
+/**
+* [Subrotina] MQTTconnect
+*
+*/
+int MQTTconnect(SAPoTCentral* handle){
+
+	if(MQTTClient_isConnected(handle->MQTTclient) != true){
+
+		//Caso a conexão entre a central e servidor MQTT seja encerrada, o MQTTclient é destruido e o MQTTConnect é totalmente refeito
+		if(handle->MQTTstatus == MQTTCLIENT_SUCCESS){ 
+			MQTTClient_destroy(handle->MQTTclient);
+			SAPoTCentral_log(handle, SAPOT_LOG_WARN, SAPOT_EVENT_MQTT_RECONNECT, 0, 0);
+			atomic_fetch_add_explicit(&handle->shared->metrics.mqttReconnects, 1, memory_order_relaxed);
+		}
+
+		printf("MQTTconnect: \n");
+	
+		//MQTTClient_connectOptions MQTTopts = { {'M', 'Q', 'T', 'C'}, 6, 60, 0, 1, NULL, handle->opts->transmission.user, handle->opts->transmission.pass, 30, 0, NULL, 0, NULL, MQTTVERSION_DEFAULT, {NULL, 0, 0}, {0, NULL}, -1, 0}; //MQTTClient_connectOptions_initializer;
+	  	MQTTClient_connectOptions MQTTopts = MQTTClient_connectOptions_initializer;
+	  	MQTTopts.keepAliveInterval = 20;
+    	MQTTopts.cleansession = 1;
+    	MQTTopts.username = handle->opts->transmission.user;
+    	MQTTopts.password = handle->opts->transmission.pass;
+
+	  	/* tcp://10.10.40.84:1883 */
+	  	char serverURI[128];
+	  	snprintf(serverURI, sizeof(serverURI), "tcp://%s:%s",handle->opts->transmission.host, handle->opts->transmission.port);
+	  	printf("\t serverURI: %s\n", serverURI);
+	  	
+	  	if(MQTTClient_create(&handle->MQTTclient, serverURI, handle->id, MQTTCLIENT_PERSISTENCE_NONE, NULL) != MQTTCLIENT_SUCCESS){
+	  		puts("MQTTconnect error: unable to create client\n");
+			SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_MQTT_ERROR, 0, 1);
+	  		return 0;
+	  	}
+	  	
+	  	puts("\t MQTTClient_create ready.");
+	  	
+	  	if(MQTTClient_setCallbacks(handle->MQTTclient, handle, MQTTconnectionLost, MQTTmessageArrived, MQTTdeliveryComplete) != MQTTCLIENT_SUCCESS){
+			printf("MQTTconnect error: unable to set call back message\n");
+			SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_MQTT_ERROR, 0, 2);
+			return 0;
+		}
+		
+	 	puts("\t MQTTClient_setCallbacks ready.");
+	 
+	   	if((handle->MQTTstatus = MQTTClient_connect(handle->MQTTclient, &MQTTopts)) != MQTTCLIENT_SUCCESS){
+		   	printf("MQTTconnect error: unable to connect with broker\n");
+		   	SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_MQTT_ERROR, handle->MQTTstatus, 3);
+	  		return 0;
+	   	}
+	   	
+	   	puts("\t MQTTClient_connect ready.");
+	   	
+	   	if(MQTTClient_subscribe(handle->MQTTclient, handle->id, 0) != MQTTCLIENT_SUCCESS){
+			printf("MQTTconnect error: unable to subscribe on topic %s\n", handle->id);
+			SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_MQTT_ERROR, 0, 4);
+			return 0;
+		}
+		
+		puts("\t MQTTClient_subscribe ready.");
+		
+	 
+	}  
+	
+	return SAPOTCENTRAL_SUCCESS; 	
+}
+
+/**
+* [Subrotina] MQTTmessageArrived
+*
+*/
+int MQTTmessageArrived(void* context, char* topicName, int topicLen, MQTTClient_message* MQTTmsg){
+
+	SAPoTCentral* handle = (SAPoTCentral*) context;
+
+	//Capturando o payload bruto antes do tratamento, que o reestrutura no próprio buffer
+	SAPoTCapture_write(&handle->shared->capture, topicName, topicLen, MQTTmsg->payload, MQTTmsg->payloadlen);
+
+	SAPoTCentral_receive(handle, MQTTmsg->payload, MQTTmsg->payloadlen);
+
+	handle->error = SAPOTCENTRAL_SUCCESS;
+	MQTTClient_freeMessage(&MQTTmsg);
+    MQTTClient_free(topicName);
+	
+	return 1;
+}
+
+/**
+* [Subrotina] MQTTdeliveryComplete
+*
+*/
+void MQTTdeliveryComplete(void* context, MQTTClient_deliveryToken dt){
+
+	SAPoTCentral* handle = (SAPoTCentral*) context;
+
+	SAPOT_DEBUG("Message with token value %d delivery confirmed\n", dt);
+	handle->MQTTdeliveredtoken = dt;
+
+	//Escrevendo no arquivo de log
+	SAPoTCentral_log(handle, SAPOT_LOG_DEBUG, SAPOT_EVENT_DELIVERED, dt, 0);
+}
+
+/**
+* [Subrotina] MQTTconnectionLost
+*
+*/
+void MQTTconnectionLost(void* context, char* cause){
+
+	SAPoTCentral* handle = (SAPoTCentral*) context;
+
+	SAPOT_DEBUG("\nConnection lost\n");
+    SAPOT_DEBUG("     cause: %s\n", cause);
+
+    //Escrevendo no arquivo de log
+	SAPoTCentral_log(handle, SAPOT_LOG_WARN, SAPOT_EVENT_CONNECTION_LOST, 0, 0);
+	atomic_fetch_add_explicit(&handle->shared->metrics.mqttConnectionsLost, 1, memory_order_relaxed);
+}
+
+/**
+* [Subrotina] MQTTpublish
+*
+*/
+int MQTTpublish(SAPoTCentral* handle, char* topic, void* payload, unsigned int payloadLen){
+
+	SAPOT_DEBUG("MQTTPublish on topic: %s\n", topic);
+    MQTTClient_message pubmsg = MQTTClient_message_initializer;
+    pubmsg.payload = payload;
+    pubmsg.payloadlen = payloadLen;
+    pubmsg.qos = 0;
+    pubmsg.retained = 0;
+    MQTTClient_deliveryToken token;
+    
+	int status;
+	uint64_t start = SAPoTMetrics_now();
+	uint64_t traceBegin = SAPOT_TRACE_BEGIN(handle);
+   	if((status = MQTTClient_publishMessage(handle->MQTTclient, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS){
+   		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_PUBLISH_ERROR, status, 0);
+   		atomic_fetch_add_explicit(&handle->shared->metrics.publishErrors, 1, memory_order_relaxed);
+   		handle->publishTime += SAPoTMetrics_now() - start;
+   		SAPOT_TRACE_END(handle, SAPOT_SPAN_PUBLISH, traceBegin);
+   		handle->error = ERROR_MQTT_PUBLISH;
+   		return SAPOTCENTRAL_FAILURE;
+   	}
+   	else{ 
+    	MQTTClient_waitForCompletion(handle->MQTTclient, token, 1000L);
+    	handle->publishTime += SAPoTMetrics_now() - start;
+    	SAPOT_TRACE_END(handle, SAPOT_SPAN_PUBLISH, traceBegin);
+    	atomic_fetch_add_explicit(&handle->shared->metrics.bytesOut, payloadLen, memory_order_relaxed);
+    	SAPOT_DEBUG("\t Published \n");
+    	return SAPOTCENTRAL_SUCCESS;
+    }	
+}
+
+/**
+* [Subrotina] LOOPpublish
+*
+*/
+int LOOPpublish(SAPoTCentral* handle, char* topic, void* payload, unsigned int payloadLen){
+
+	SAPOT_DEBUG("LOOPpublish on topic: %s\n", topic);
+
+	uint64_t start = SAPoTMetrics_now();
+	uint64_t traceBegin = SAPOT_TRACE_BEGIN(handle);
+	if(handle->loopback != NULL) handle->loopback(handle->loopbackContext, topic, payload, payloadLen);
+	handle->publishTime += SAPoTMetrics_now() - start;
+	SAPOT_TRACE_END(handle, SAPOT_SPAN_PUBLISH, traceBegin);
+	atomic_fetch_add_explicit(&handle->shared->metrics.bytesOut, payloadLen, memory_order_relaxed);
+
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Subrotina] MYSQLconnect
+*
+*/
+int MYSQLconnect(SAPoTCentral* handle){
+
+	SAPOT_DEBUG("MYSQLconnect: \n");
+	uint64_t traceBegin = SAPOT_TRACE_BEGIN(handle);
+		
+	//Inicializa o cliente SQL
+	if(mysql_init(&handle->MYSQLclient) == NULL){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
+		atomic_fetch_add_explicit(&handle->shared->metrics.databaseConnectErrors, 1, memory_order_relaxed);
+		mysql_close(&handle->MYSQLclient);
+		return SAPOTCENTRAL_FAILURE;
+	}
+	
+	SAPOT_DEBUG("\t mysql_init ready.\n");
+	
+	//Conecta o cliente ao servidor SQL. 
+	int connected = mysql_real_connect(&handle->MYSQLclient, handle->opts->database.host, handle->opts->database.user, handle->opts->database.pass, handle->opts->database.dir, 0, NULL, 0 ) != NULL;
+	SAPOT_TRACE_END(handle, SAPOT_SPAN_MYSQL_CONNECT, traceBegin);
+	if(!connected){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);		
+		atomic_fetch_add_explicit(&handle->shared->metrics.databaseConnectErrors, 1, memory_order_relaxed);
+		mysql_close(&handle->MYSQLclient);
+		return SAPOTCENTRAL_FAILURE; 
+	}
+	
+	SAPOT_DEBUG("\t mysql_real_connect ready.\n");
+
+	//Contabilizando a conexão aberta e o pico de conexões simultâneas
+	SAPoTMetrics* metrics = &handle->shared->metrics;
+	atomic_fetch_add_explicit(&metrics->databaseConnections, 1, memory_order_relaxed);
+	int active = atomic_fetch_add_explicit(&metrics->databaseActive, 1, memory_order_relaxed) + 1;
+	int peak = atomic_load_explicit(&metrics->databasePeak, memory_order_relaxed);
+	while(active > peak && !atomic_compare_exchange_weak_explicit(&metrics->databasePeak, &peak, active, memory_order_relaxed, memory_order_relaxed));
+	
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Subrotina] MYSQLclose
+*
+*/
+void MYSQLclose(SAPoTCentral* handle){
+
+	mysql_close(&handle->MYSQLclient);
+	atomic_fetch_sub_explicit(&handle->shared->metrics.databaseActive, 1, memory_order_relaxed);
+}
+
+/**
+* [Subrotina] MYSQLquery
+*
+*/
+int MYSQLquery(SAPoTCentral* handle, const char* query, unsigned long length){
+
+	uint64_t traceBegin = SAPOT_TRACE_BEGIN(handle);
+	int status = mysql_real_query(&handle->MYSQLclient, query, length);
+	SAPOT_TRACE_END(handle, SAPOT_SPAN_QUERY, traceBegin);
+	return status;
+}
+
+/**
+* [Subrotina] MYSQLregistration
+*
+*/
+int MYSQLregistration(SAPoTCentral* handle){
+
+	//Abrindo conexão com o banco de dados
+	if(handle->opts->databaseProtocol == SQL){ 
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
+			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
+			return SAPOTCENTRAL_FAILURE; 
+		}
+	}	
+
+	SAPOT_DEBUG("MYSQLregistration: \n");
+
+	char query[200] = {};
+	int querylen = 0;
+	char newId[18];
+	/** Estrutura que representa o resultado de uma query solicitada */
+  	MYSQL_RES* sqlResult;
+	/** Dá acesso a uma linha do resultado de uma query solicitada */
+	MYSQL_ROW sqlRow;	
+	
+	//Formatando o id do possível novo cliente
+	SAPoTCentral_topic(handle->header->emitterId, newId);
+	SAPOT_DEBUG("\t newId = %s\n", newId);
+	
+	//Formatando a query para verificar se o novo cliente já está na tabela tb_cadastrados
+	querylen = sprintf(query, "SELECT id FROM tb_cadastrados WHERE macaddr like '%s';", newId);
+	SAPOT_DEBUG("\t query = %s\n", query);
+	SAPOT_DEBUG("\t querylen = %d\n", querylen);
+	
+    //Solicitando a query ao servidor 
+	if( MYSQLquery(handle, (const char*) query, (unsigned int) querylen) != 0 ){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
+		handle->error =  ERROR_DATABASE_INQUIRY;
+		MYSQLclose(handle);
+		return SAPOTCENTRAL_FAILURE; 
+	}
+		
+	//sqlResult recebe o retorno da query solicitada ao banco de dados:
+	sqlResult = mysql_store_result(&handle->MYSQLclient);
+	//Se o cliente já está cadastrados o retorno da query diferente de null
+	//Então o sqlRow receberá o id em que ele foi cadastrado na tabela tb_cadastrados.
+	unsigned long id = 0;
+	if((sqlRow = mysql_fetch_row(sqlResult)) != NULL){
+		id = strtoul(sqlRow[0], NULL, 10);
+		//formatando uma query de update para o cliente que já está cadastrado.
+		querylen = sprintf(query, "UPDATE tb_cadastrados SET type='%d', sensor='%d', actuator='%d' WHERE id='%s';", handle->registration->clientType, handle->registration->sensorQuantity, handle->registration->actuatorQuantity, sqlRow[0]);
+	}
+	//Contudo, se o cliente não está cadastrados o retorno da query será falso 
+	else{
 		//formatando uma query para inserir o novo cliente
 		querylen = sprintf(query, "INSERT tb_cadastrados(label, macaddr, type, sensor, actuator) VALUES('xxxxxxxxxx', '%s', '%d', '%d', '%d');", newId, handle->registration->clientType, handle->registration->sensorQuantity, handle->registration->actuatorQuantity);
 	}
-	
-	printf("\t query = %s\n", query);
-	printf("\t querylen = %d\n", querylen);
-	
-	//Solicita ao servidor a query de atualização do cliente ja existente ou a inserção do novo cliente  
-	if(mysql_real_query(&handle->MYSQLclient, (const char*) query, querylen) != 0){
-		printf("MYSQL Erro(%d): %s\n", mysql_errno(&handle->MYSQLclient), mysql_error(&handle->MYSQLclient));
+	
+	SAPOT_DEBUG("\t query = %s\n", query);
+	SAPOT_DEBUG("\t querylen = %d\n", querylen);
+	
+	//Solicita ao servidor a query de atualização do cliente ja existente ou a inserção do novo cliente  
+	if(MYSQLquery(handle, (const char*) query, querylen) != 0){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
+		handle->error =  ERROR_DATABASE_INQUIRY;
+		MYSQLclose(handle);
+		return SAPOTCENTRAL_FAILURE; 
+	}
+
+	//Livrando o espaço de memória do resultado da query
+	mysql_free_result(sqlResult);
+	if(id == 0 || mysql_affected_rows(&handle->MYSQLclient) > 0) CTRLdirectory_change(handle, newId);
+	if(id == 0) id = mysql_insert_id(&handle->MYSQLclient);
+
+	//Fechando conexão com o banco de dados
+	MYSQLclose(handle);
+	
+	//Retornando o tamanho da mensagem a ser publicada
+	return CTRLregistration(handle, id);
+}
+
+/**
+* [Subrotina] MYSQLmodification
+*
+*/
+int MYSQLmodification(SAPoTCentral* handle){
+
+	//Abrindo conexão com o banco de dados
+	if(handle->opts->databaseProtocol == SQL){ 
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
+			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
+			return SAPOTCENTRAL_FAILURE; 
+		}
+	}
+
+	char query[100] = {};
+	int querylen = 0;
+	
+	SAPOT_DEBUG("MYSQLmodification: \n");
+	//Formatando o id do cliente a ser etiquetado
+	upper_string((char*)handle->modification->macaddr);
+	SAPOT_DEBUG("\t macaddr = %s\n", handle->modification->macaddr);
+	SAPOT_DEBUG("\t label = %s\n", handle->modification->label);
+
+	//formatando uma query de update para etiquetar o cliente que já está cadastrado.
+	querylen = sprintf(query, "UPDATE tb_cadastrados SET label='%s' WHERE macaddr='%s';", handle->modification->label, handle->modification->macaddr);
+	SAPOT_DEBUG("\t query = %s\n", query);
+	SAPOT_DEBUG("\t querylen = %d\n", querylen);
+	
+	//Solicita ao servidor a query de atualização do cliente ja existente ou a inserção do novo cliente  
+	if(MYSQLquery(handle, (const char*) query, querylen) != 0){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
+		handle->error =  ERROR_DATABASE_INQUIRY;
+		MYSQLclose(handle);
+		return SAPOTCENTRAL_FAILURE; 
+	}
+
+	//O UPDATE não altera linhas se o endereço não estiver cadastrado ou a etiqueta for a mesma
+	if(mysql_affected_rows(&handle->MYSQLclient) > 0) CTRLdirectory_change(handle, (const char*) handle->modification->macaddr);
+
+	//Alocando memória para a mensagem de retorno.
+	int outMessageLength = sizeof(SAPoTMessage_header); 
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
+
+	//Preenchendo o cabeçalho fixo
+	SAPoTMessage_header* header = (SAPoTMessage_header*) handle->outMessage;
+	SAPoTCentral_ack_header(handle, header, outMessageLength);
+
+	//Fechando conexão com o banco de dados
+	MYSQLclose(handle);
+
+	return outMessageLength;	
+}
+
+/**
+* [Subrotina] MYSQLacess
+*
+*/
+int MYSQLaccess(SAPoTCentral* handle){
+
+	bool compact = handle->header->rsv1;
+	bool delta = compact && handle->header->rsv2;
+	SAPoTMessage_directory answer;
+	char changed[SAPOT_DIRECTORY_JOURNAL][18];
+	int changes = SAPOTCENTRAL_FAILURE;
+	int i;
+
+	//Solicitação versionada: as alterações posteriores à cópia do Usuário são enumeradas pelo diário, sem consultar o banco de dados
+	if(handle->directory != NULL) changes = CTRLdirectory_since(handle, changed, &answer);
+	const SAPoTMessage_directory* version = (handle->directory != NULL) ? &answer : NULL;
+
+	//Cópia atualizada: a resposta contém apenas a versão e uma tabela vazia
+	if(changes == 0){
+		int outMessageLength = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_directory) + 1;
+		uint8_t* payload = CTRLaccess_header(handle, outMessageLength, compact, delta, version);
+		payload[0] = 0;
+		return outMessageLength;
+	}
+
+	//Abrindo conexão com o banco de dados
+	if(handle->opts->databaseProtocol == SQL){ 
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
+			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
+			return SAPOTCENTRAL_FAILURE; 
+		}
+	}
+
+	SAPOT_DEBUG("MYSQLaccess:\n");
+
+	//A codificação delta dos endereços MAC depende da tabela ordenada por endereço. Com alterações, apenas os Clientes alterados
+	//são consultados: o pior caso tem SAPOT_DIRECTORY_JOURNAL endereços de 17 caracteres entre aspas e separados por vírgulas
+	char query[sizeof("SELECT * FROM tb_cadastrados WHERE macaddr IN () ORDER BY macaddr;") + SAPOT_DIRECTORY_JOURNAL*20];
+	int querylen = snprintf(query, sizeof(query), "SELECT * FROM tb_cadastrados");
+	for(i=0; i<changes && querylen < (int) sizeof(query); i++){
+		querylen += snprintf(&query[querylen], sizeof(query) - querylen, "%s'%.17s'", (i == 0) ? " WHERE macaddr IN (" : ",", changed[i]);
+	}
+	if(changes > 0 && querylen < (int) sizeof(query)) querylen += snprintf(&query[querylen], sizeof(query) - querylen, ")");
+	if(querylen < (int) sizeof(query)) querylen += snprintf(&query[querylen], sizeof(query) - querylen, delta ? " ORDER BY macaddr;" : ";");
+	if(querylen >= (int) sizeof(query)){
+		handle->error = ERROR_DATABASE_INQUIRY;
+		MYSQLclose(handle);
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	//Estrutura que representa o resultado de uma query solicitada 
+  	MYSQL_RES* sqlResult;
+	//Dá acesso as linhas do resultado de uma query solicitada 
+	MYSQL_ROW sqlRow;
+	SAPoTCentral_client client;
+
+	SAPOT_DEBUG("\t query = %s\n", query);
+
+	//Solicita ao servidor uma query de consulta sobre as informações da tabela tb_cadastrados  
+	if(MYSQLquery(handle, (const char*) query, querylen) != 0){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
+		handle->error =  ERROR_DATABASE_INQUIRY;
+		MYSQLclose(handle);
+		return SAPOTCENTRAL_FAILURE; 
+	}
+
+	//sqlResult recebe o retorno da query solicitada ao banco de dados
+	sqlResult = mysql_store_result(&handle->MYSQLclient);
+	if(sqlResult == NULL){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
+		handle->error =  ERROR_DATABASE_INQUIRY;
+		MYSQLclose(handle);
+		return SAPOTCENTRAL_FAILURE; 		
+	}
+
+	//Conta a quantidade de linhas de registro existentes na tabela tb_cadastrados, para definir o tamanho do retorno desta operação.
+	int rowQuantity = 0;
+	while((sqlRow = mysql_fetch_row(sqlResult)) != NULL) rowQuantity++;
+
+	//Reinicia o ponteiro para o início do sqlResult
+	mysql_data_seek(sqlResult, 0);
+		
+	SAPOT_DEBUG("\t rowQuantity = %d\n", rowQuantity);
+
+	//Alocando memória para a mensagem de retorno. Na codificação compacta cada cliente ocupa no máximo 25 bytes
+	int outMessageLength;
+	if(compact) outMessageLength = sizeof(SAPoTMessage_header) + (version != NULL ? sizeof(SAPoTMessage_directory) : 0) + 5 + rowQuantity*25;
+	else outMessageLength = sizeof(SAPoTMessage_header) + (rowQuantity*sizeof(SAPoTMessage_access)); 
+	uint8_t* payload = CTRLaccess_header(handle, outMessageLength, compact, delta, version);
+
+	//Codificação compacta: MAC binário, etiqueta com prefixo de comprimento e contadores varint
+	if(compact){
+
+		SAPoTMessage_header* header = (SAPoTMessage_header*) handle->outMessage;
+		uint8_t previous[6] = {};
+		int offset = putVarint(payload, rowQuantity);
+
+		while((sqlRow = mysql_fetch_row(sqlResult)) != NULL){
+
+			MYSQLrow(sqlRow, &client);
+			offset += SAPoTCentral_pack_access(&payload[offset], &client, true, delta ? previous : NULL);
+		}
+
+		outMessageLength = (payload + offset) - (uint8_t*) handle->outMessage;
+		header->length = outMessageLength;
+		SAPOT_DEBUG("\t compact length = %d\n", outMessageLength);
+
+		mysql_free_result(sqlResult);
+		MYSQLclose(handle);
+		return outMessageLength;
+	}
+
+	//Retirando as informações do banco de dados, uma seção SAPoTMessage_access por cliente
+	while((sqlRow = mysql_fetch_row(sqlResult)) != NULL){
+		MYSQLrow(sqlRow, &client);
+		payload += SAPoTCentral_pack_access(payload, &client, false, NULL);
+	}
+
+	//Limpa os resultados da query anterior
+	mysql_free_result(sqlResult);
+
+	//Fechando conexão com banco de dados
+	MYSQLclose(handle);
+
+	SAPOT_DEBUG("antes do retorno de MYSQLaccess\n");
+
+	return outMessageLength;	
+}
+
+/**
+* [Subrotina] MYSQLrow
+*
+*/
+void MYSQLrow(MYSQL_ROW sqlRow, SAPoTCentral_client* client){
+
+	strncpy(client->label, sqlRow[1], 10);
+	client->label[10] = '\0';
+	strncpy(client->macaddr, sqlRow[2], 17);
+	client->macaddr[17] = '\0';
+	upper_string(client->macaddr);
+	client->type = atoi(sqlRow[3]);
+	client->sensor = atoi(sqlRow[4]);
+	client->actuator = atoi(sqlRow[5]);
+}
+
+/**
+* [Subrotina] MYSQLbatch
+*
+*/
+int MYSQLbatch(SAPoTCentral* handle){
+
+	//Abrindo conexão com o banco de dados
+	if(handle->opts->databaseProtocol == SQL){ 
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
+			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
+			return SAPOTCENTRAL_FAILURE; 
+		}
+	}
+
+	SAPOT_DEBUG("MYSQLbatch:\n");
+
+	char macaddr[18];
+	struct timespec now;
+	long long instant;
+	int i;
+
+	//Formatando o id do cliente emissor do lote
+	SAPoTCentral_topic(handle->header->emitterId, macaddr);
+
+	//Horário de recebimento do lote, em milisegundos, usado como referência para as idades das amostras
+	clock_gettime(CLOCK_REALTIME, &now);
+	long long arrival = (long long) now.tv_sec*1000 + now.tv_nsec/1000000;
+
+	//Um lote vazio não gera query, apenas o reconhecimento
+	if(handle->batch->sampleQuantity > 0){
+
+		//Cada linha do INSERT é limitada a SAPOT_BATCH_ROW_SIZE caracteres (veja SAPOT_BATCH_QUERY_SIZE)
+		char query[SAPOT_BATCH_QUERY_SIZE];
+		int querylen = sprintf(query, "INSERT tb_registros(macaddr, sensor, instant, value) VALUES");
+		int rowlen;
+
+		for(i=0; i<handle->batch->sampleQuantity; i++){
+			instant = arrival - (long long) getTime(handle->batch->timeScale, handle->samples[i].age);
+			rowlen = snprintf(query + querylen, SAPOT_BATCH_ROW_SIZE, "%s('%s', '%d', FROM_UNIXTIME(%lld.%03lld), '%.9g')", (i == 0) ? " " : ", ", macaddr, 
+				handle->samples[i].sensorId, instant/1000, instant%1000, handle->samples[i].value);
+			if(rowlen < 0 || rowlen >= SAPOT_BATCH_ROW_SIZE){
+				handle->error = ERROR_MALFORMED_MESSAGE;
+				MYSQLclose(handle);
+				return SAPOTCENTRAL_FAILURE;
+			}
+			querylen += rowlen;
+		}
+		querylen += sprintf(query + querylen, ";");
+		SAPOT_DEBUG("\t samples = %d\n", handle->batch->sampleQuantity);
+		SAPOT_DEBUG("\t querylen = %d\n", querylen);
+
+		//Solicita ao servidor a inserção de todas as amostras do lote
+		if(MYSQLquery(handle, (const char*) query, querylen) != 0){
+			SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
+			handle->error =  ERROR_DATABASE_INQUIRY;
+			MYSQLclose(handle);
+			return SAPOTCENTRAL_FAILURE; 
+		}
+	}
+
+	//Mantendo o último valor de cada sensor (com o relato por variação, o silêncio indica valor inalterado)
+	CTRLupdate_readings(handle);
+
+	//Alocando memória para a mensagem de retorno.
+	int outMessageLength = sizeof(SAPoTMessage_header); 
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
+
+	//Preenchendo o cabeçalho fixo
+	SAPoTMessage_header* header = (SAPoTMessage_header*) handle->outMessage;
+	SAPoTCentral_ack_header(handle, header, outMessageLength);
+
+	//Fechando conexão com banco de dados
+	MYSQLclose(handle);
+
+	return outMessageLength;
+}
+
+/**
+* [Subrotina] MYSQLlabel
+*
+*/
+int MYSQLlabel(SAPoTCentral* handle, const uint8_t* label, char macaddr[18]){
+
+	char query[100] = {};
+	int querylen = 0;
+	/** Estrutura que representa o resultado de uma query solicitada */
+  	MYSQL_RES* sqlResult;
+	/** Dá acesso a uma linha do resultado de uma query solicitada */
+	MYSQL_ROW sqlRow;
+
+	SAPOT_DEBUG("\t label = %s\n", label);
+	querylen = sprintf(query, "SELECT macaddr FROM tb_cadastrados WHERE label like '%.10s';", (const char*) label);
+	SAPOT_DEBUG("\t query = %s\n", query);
+	SAPOT_DEBUG("\t querylen = %d\n", querylen);
+
+	//Solicitando a query ao servidor 
+	if(MYSQLquery(handle, (const char*) query, (unsigned int) querylen) != 0 ){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
+		handle->error =  ERROR_DATABASE_INQUIRY;
+		return SAPOTCENTRAL_FAILURE; 
+	}
+
+	//sqlResult recebe o retorno da query solicitada ao banco de dados:
+	sqlResult = mysql_store_result(&handle->MYSQLclient);
+
+	//Se a label está cadastrada no banco de dados o retorno da query será verdadeiro (result == 1). 
+	//Então o sqlRow receberá o macaddr que refere-se a label.
+	if((sqlRow = mysql_fetch_row(sqlResult)) == NULL){
+		SAPOT_DEBUG("\t Label não cadastrada!\n");
+		mysql_free_result(sqlResult);
+		handle->error = ERROR_LABEL_NOT_REGISTERED;
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	//Insere o sqlRow em macaddr
+	strncpy(macaddr, sqlRow[0], 17);
+	macaddr[17] = '\0';
+	upper_string(macaddr);
+	SAPOT_DEBUG("\t macaddr = %s\n", macaddr); 
+
+	//Livrando o espaço de memória do resultado da query
+	mysql_free_result(sqlResult);
+
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Subrotina] MYSQLalias
+*
+*/
+int MYSQLalias(SAPoTCentral* handle, uint16_t alias, SAPoTCentral_device* device){
+
+	//Abrindo conexão com o banco de dados
+	if(handle->opts->databaseProtocol == SQL){ 
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
+			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
+			return SAPOTCENTRAL_FAILURE; 
+		}
+	}
+
+	SAPOT_DEBUG("MYSQLalias:\n");
+
+	char query[100] = {};
+	int querylen = 0;
+	char macaddr[18] = {};
+	MYSQL_RES* sqlResult;
+	MYSQL_ROW sqlRow;
+
+	querylen = sprintf(query, "SELECT macaddr FROM tb_cadastrados WHERE id='%d';", alias);
+	SAPOT_DEBUG("\t query = %s\n", query);
+
+	if(MYSQLquery(handle, (const char*) query, (unsigned int) querylen) != 0 || (sqlResult = mysql_store_result(&handle->MYSQLclient)) == NULL){
+		SAPoTCentral_log(handle, SAPOT_LOG_ERROR, SAPOT_EVENT_DATABASE_ERROR, mysql_errno(&handle->MYSQLclient), 0);
 		handle->error =  ERROR_DATABASE_INQUIRY;
-		mysql_close(&handle->MYSQLclient);
+		MYSQLclose(handle);
 		return SAPOTCENTRAL_FAILURE; 
 	}
 
-	//Livrando o espaço de memória do resultado da query
+	//Apelido não cadastrado
+	if((sqlRow = mysql_fetch_row(sqlResult)) == NULL){
+		mysql_free_result(sqlResult);
+		MYSQLclose(handle);
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	strncpy(macaddr, sqlRow[0], 17);
+	upper_string(macaddr);
+
+	//Apenas clientes v2 utilizam apelidos, então a posição é preenchida com a versão 2
+	device->alias = alias;
+	device->version = SAPOT_PROTOCOL_VERSION_2;
+	getmacID(macaddr, device->emitterId);
+	CTRLupdate_device(handle, device);
+
 	mysql_free_result(sqlResult);
+	MYSQLclose(handle);
 
-	//Definindo a mensagem de resposta
-	int outMessageLength = sizeof(SAPoTMessage_header);
-	handle->outMessage = malloc(outMessageLength);
-	SAPoTMessage_header* header = (SAPoTMessage_header*) handle->outMessage;
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Subrotina] MEMinit
+*
+*/
+void MEMinit(SAPoTCentral_memory* memory){
+
+	memset(memory, 0, sizeof(SAPoTCentral_memory));
+	pthread_mutex_init(&memory->lock, NULL);
+}
+
+/**
+* [Subrotina] MEMend
+*
+*/
+void MEMend(SAPoTCentral_memory* memory){
+
+	free(memory->clients);
+	free(memory->index);
+	pthread_mutex_destroy(&memory->lock);
+	memset(memory, 0, sizeof(SAPoTCentral_memory));
+}
+
+/**
+* [Subrotina] MEMhash
+*
+*/
+static unsigned int MEMhash(const char* macaddr){
+
+	//FNV-1a do endereço MAC textual
+	unsigned int hash = 2166136261u;
+	while(*macaddr != '\0') hash = (hash ^ (uint8_t) *macaddr++) * 16777619u;
+	return hash;
+}
+
+/**
+* [Subrotina] MEMfind
+*
+*/
+int MEMfind(SAPoTCentral_memory* memory, const char* macaddr){
+
+	if(memory->index == NULL) return 0;
+
+	unsigned int mask = 2*memory->capacity - 1;
+	unsigned int position = MEMhash(macaddr) & mask;
+	int id;
+
+	while((id = memory->index[position]) != 0){
+		if(strcmp(memory->clients[id-1].macaddr, macaddr) == 0) return id;
+		position = (position + 1) & mask;
+	}
+
+	return 0;
+}
+
+/**
+* [Subrotina] MEMinsert
+*
+*/
+int MEMinsert(SAPoTCentral_memory* memory, const char* macaddr){
+
+	int i;
+
+	//Dobrando a tabela de Clientes e reconstruindo o índice (ocupação máxima de 50%)
+	if(memory->quantity == memory->capacity){
+		int capacity = (memory->capacity == 0) ? SAPOT_MEMORY_CLIENTS : 2*memory->capacity;
+		SAPoTCentral_client* clients = realloc(memory->clients, capacity*sizeof(SAPoTCentral_client));
+		if(clients == NULL) return 0;
+		memory->clients = clients;
+		int* index = calloc(2*capacity, sizeof(int));
+		if(index == NULL) return 0;
+		free(memory->index);
+		memory->index = index;
+		memory->capacity = capacity;
+
+		for(i=0; i<memory->quantity; i++){
+			unsigned int position = MEMhash(clients[i].macaddr) & (2*capacity - 1);
+			while(index[position] != 0) position = (position + 1) & (2*capacity - 1);
+			index[position] = i + 1;
+		}
+	}
+
+	//Cliente com a etiqueta padrão de tb_cadastrados
+	SAPoTCentral_client* client = &memory->clients[memory->quantity];
+	memset(client, 0, sizeof(SAPoTCentral_client));
+	strcpy(client->label, "xxxxxxxxxx");
+	strncpy(client->macaddr, macaddr, 17);
+	int id = ++memory->quantity;
+
+	unsigned int mask = 2*memory->capacity - 1;
+	unsigned int position = MEMhash(client->macaddr) & mask;
+	while(memory->index[position] != 0) position = (position + 1) & mask;
+	memory->index[position] = id;
+
+	return id;
+}
+
+/**
+* [Subrotina] MEMregistration
+*
+*/
+int MEMregistration(SAPoTCentral* handle){
+
+	SAPOT_DEBUG("MEMregistration: \n");
+
+	SAPoTCentral_memory* memory = &handle->shared->memory;
+	char newId[18];
+
+	//Formatando o id do possível novo cliente
+	SAPoTCentral_topic(handle->header->emitterId, newId);
+
+	//Atualizando o cliente já cadastrado ou inserindo o novo cliente
+	pthread_mutex_lock(&memory->lock);
+	int id = MEMfind(memory, newId);
+	bool changed = (id == 0);
+	if(id == 0 && (id = MEMinsert(memory, newId)) == 0){
+		pthread_mutex_unlock(&memory->lock);
+		handle->error = ERROR_DATABASE_INQUIRY;
+		return SAPOTCENTRAL_FAILURE;
+	}
+	SAPoTCentral_client* client = &memory->clients[id-1];
+	changed |= client->type != handle->registration->clientType || client->sensor != handle->registration->sensorQuantity || 
+		client->actuator != handle->registration->actuatorQuantity;
+	client->type = handle->registration->clientType;
+	client->sensor = handle->registration->sensorQuantity;
+	client->actuator = handle->registration->actuatorQuantity;
+	pthread_mutex_unlock(&memory->lock);
+
+	if(changed) CTRLdirectory_change(handle, newId);
+
+	return CTRLregistration(handle, id);
+}
+
+/**
+* [Subrotina] MEMmodification
+*
+*/
+int MEMmodification(SAPoTCentral* handle){
+
+	SAPOT_DEBUG("MEMmodification: \n");
+
+	SAPoTCentral_memory* memory = &handle->shared->memory;
+
+	//Formatando o id do cliente a ser etiquetado
+	upper_string((char*)handle->modification->macaddr);
+
+	//Como o UPDATE de MYSQLmodification(), um endereço não cadastrado não altera a tabela
+	pthread_mutex_lock(&memory->lock);
+	int id = MEMfind(memory, (const char*) handle->modification->macaddr);
+	bool changed = (id != 0 && strcmp(memory->clients[id-1].label, (const char*) handle->modification->label) != 0);
+	if(changed) strcpy(memory->clients[id-1].label, (const char*) handle->modification->label);
+	pthread_mutex_unlock(&memory->lock);
+
+	if(changed) CTRLdirectory_change(handle, (const char*) handle->modification->macaddr);
+
+	//Alocando memória para a mensagem de retorno.
+	int outMessageLength = sizeof(SAPoTMessage_header); 
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
+	SAPoTCentral_ack_header(handle, (SAPoTMessage_header*) handle->outMessage, outMessageLength);
+
+	return outMessageLength;
+}
+
+/**
+* [Subrotina] MEMcompare
+*
+*/
+static int MEMcompare(const void* a, const void* b){
+
+	return strcmp((*(const SAPoTCentral_client* const*) a)->macaddr, (*(const SAPoTCentral_client* const*) b)->macaddr);
+}
+
+/**
+* [Subrotina] MEMaccess
+*
+*/
+int MEMaccess(SAPoTCentral* handle){
+
+	SAPOT_DEBUG("MEMaccess:\n");
+
+	SAPoTCentral_memory* memory = &handle->shared->memory;
+	bool compact = handle->header->rsv1;
+	bool delta = compact && handle->header->rsv2;
+	SAPoTMessage_directory answer;
+	char changed[SAPOT_DIRECTORY_JOURNAL][18];
+	int changes = SAPOTCENTRAL_FAILURE;
+	int i;
+
+	//Solicitação versionada: apenas os Clientes alterados desde a cópia do Usuário (veja MYSQLaccess())
+	if(handle->directory != NULL) changes = CTRLdirectory_since(handle, changed, &answer);
+	const SAPoTMessage_directory* version = (handle->directory != NULL) ? &answer : NULL;
+
+	pthread_mutex_lock(&memory->lock);
+
+	//A codificação delta dos endereços MAC depende da tabela ordenada por endereço
+	int rowQuantity = (changes >= 0) ? changes : memory->quantity;
+	//Até 511 Clientes o vetor de linhas ocupa um bloco do pool da thread
+	const SAPoTCentral_client** rows = SAPoTCentral_alloc(handle, (rowQuantity + 1) * sizeof(SAPoTCentral_client*));
+	if(rows == NULL){
+		pthread_mutex_unlock(&memory->lock);
+		handle->error = ERROR_DATABASE_INQUIRY;
+		return SAPOTCENTRAL_FAILURE;
+	}
+	if(changes >= 0){
+		int id;
+		for(i=0, rowQuantity=0; i<changes; i++) if((id = MEMfind(memory, changed[i])) != 0) rows[rowQuantity++] = &memory->clients[id-1];
+	}
+	else for(i=0; i<rowQuantity; i++) rows[i] = &memory->clients[i];
+	if(delta) qsort(rows, rowQuantity, sizeof(SAPoTCentral_client*), MEMcompare);
+
+	//Alocando memória para a mensagem de retorno. Na codificação compacta cada cliente ocupa no máximo 25 bytes
+	int outMessageLength;
+	if(compact) outMessageLength = sizeof(SAPoTMessage_header) + (version != NULL ? sizeof(SAPoTMessage_directory) : 0) + 5 + rowQuantity*25;
+	else outMessageLength = sizeof(SAPoTMessage_header) + (rowQuantity*sizeof(SAPoTMessage_access)); 
+	uint8_t* payload = CTRLaccess_header(handle, outMessageLength, compact, delta, version);
+
+	uint8_t previous[6] = {};
+	int offset = compact ? putVarint(payload, rowQuantity) : 0;
+	for(i=0; i<rowQuantity; i++) offset += SAPoTCentral_pack_access(&payload[offset], rows[i], compact, delta ? previous : NULL);
+
+	pthread_mutex_unlock(&memory->lock);
+	SAPoTCentral_release(handle, rows);
+
+	if(compact){
+		outMessageLength = (payload + offset) - (uint8_t*) handle->outMessage;
+		((SAPoTMessage_header*) handle->outMessage)->length = outMessageLength;
+	}
+
+	return outMessageLength;
+}
+
+/**
+* [Subrotina] MEMbatch
+*
+*/
+int MEMbatch(SAPoTCentral* handle){
+
+	SAPOT_DEBUG("MEMbatch:\n");
+
+	SAPoTCentral_memory* memory = &handle->shared->memory;
+
+	pthread_mutex_lock(&memory->lock);
+	memory->samples += handle->batch->sampleQuantity;
+	pthread_mutex_unlock(&memory->lock);
+
+	CTRLupdate_readings(handle);
+
+	//Alocando memória para a mensagem de retorno.
+	int outMessageLength = sizeof(SAPoTMessage_header); 
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
+	SAPoTCentral_ack_header(handle, (SAPoTMessage_header*) handle->outMessage, outMessageLength);
+
+	return outMessageLength;
+}
+
+/**
+* [Subrotina] MEMalias
+*
+*/
+int MEMalias(SAPoTCentral* handle, uint16_t alias, SAPoTCentral_device* device){
+
+	SAPOT_DEBUG("MEMalias:\n");
+
+	SAPoTCentral_memory* memory = &handle->shared->memory;
+
+	//Apelido não cadastrado
+	pthread_mutex_lock(&memory->lock);
+	if(alias == SAPOT_CENTRAL_ALIAS || alias > memory->quantity){
+		pthread_mutex_unlock(&memory->lock);
+		return SAPOTCENTRAL_FAILURE;
+	}
+	getmacID(memory->clients[alias-1].macaddr, device->emitterId);
+	pthread_mutex_unlock(&memory->lock);
+
+	//Apenas clientes v2 utilizam apelidos, então a posição é preenchida com a versão 2
+	device->alias = alias;
+	device->version = SAPOT_PROTOCOL_VERSION_2;
+	CTRLupdate_device(handle, device);
+
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Subrotina] MEMactuator
+*
+*/
+int MEMactuator(SAPoTCentral* handle){
+
+	SAPOT_DEBUG("MEMactuator: \n");
+
+	char macaddr[18] = {};
+
+	//Busca o macaddr referente à label recebida via SAPoTMessage_solicitation
+	if(MEMlabel(handle, handle->solicitation->label, macaddr) != SAPOTCENTRAL_SUCCESS) return SAPOTCENTRAL_FAILURE;
+
+	return CTRLdrive(handle, macaddr);
+}
+
+/**
+* [Subrotina] MEMlabel
+*
+*/
+int MEMlabel(SAPoTCentral* handle, const uint8_t* label, char macaddr[18]){
+
+	SAPoTCentral_memory* memory = &handle->shared->memory;
+	int i;
+
+	macaddr[0] = '\0';
+	pthread_mutex_lock(&memory->lock);
+	for(i=0; i<memory->quantity; i++){
+		if(strncmp(memory->clients[i].label, (const char*) label, 10) == 0){
+			strcpy(macaddr, memory->clients[i].macaddr);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&memory->lock);
+
+	if(macaddr[0] == '\0'){
+		SAPOT_DEBUG("\t Label não cadastrada!\n");
+		handle->error = ERROR_LABEL_NOT_REGISTERED;
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	return SAPOTCENTRAL_SUCCESS;
+}
+
+/**
+* [Controle de Clientes] CTRLactuator 
+*
+*/
+int CTRLactuator(SAPoTCentral* handle){
+
+	//Abrindo conexão com o banco de dados
+	if(handle->opts->databaseProtocol == SQL){ 
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
+			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
+			return SAPOTCENTRAL_FAILURE; 
+		}
+	}
+
+	SAPOT_DEBUG(" CTRLactuator: \n");
+
+	char macaddr[18] = {};
+	int outMessageLength;
+
+	//Verifica no banco de dados qual é o macaddr referente à label recebida via SAPoTMessage_solicitation
+	if(MYSQLlabel(handle, handle->solicitation->label, macaddr) != SAPOTCENTRAL_SUCCESS){
+		//Fechando conexão com banco de dados
+		MYSQLclose(handle);
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	//Encaminhando o acionamento e montando o ack ao usuário que o solicitou
+	outMessageLength = CTRLdrive(handle, macaddr);
+
+	//Fechando conexão com banco de dados
+	MYSQLclose(handle);
+
+	return outMessageLength;	
+}
+
+/**
+* [Controle de Clientes] CTRLdrive
+*
+*/
+int CTRLdrive(SAPoTCentral* handle, const char* macaddr){
+
+	SAPoTMessage_header* header;
+	int outMessageLength;
+
+	//aloca espaço de memória para uma solicitação do tipo SAPoTMessage_actuatorDrive 
+	int msglen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_actuatorDrive);
+	void* msg = SAPoTCentral_alloc(handle, msglen);
+
+	//preenchendo o cabeçalho fixo
+	header = (SAPoTMessage_header*) msg;
+	header->version = SAPOT_PROTOCOL_VERSION;
+	header->ack = 0;
+	header->rsv1 = 0;
+	header->rsv2 = 0;
+	header->rsv3 = 0;
+	header->instruction = 3;
+	header->serial = ++handle->serial;
+	header->length = msglen;
+	getmacID((const char*) handle->id, header->emitterId);
+
+	//preenchendo o payload
+	SAPoTMessage_actuatorDrive* actuatorDrive = (SAPoTMessage_actuatorDrive*) (msg + sizeof(SAPoTMessage_header));
+	actuatorDrive->actuatorId = handle->solicitation->sensorOrActuatorId;
+	actuatorDrive->timeSet = handle->solicitation->timeSet;
+	actuatorDrive->degreeOfPerformance = handle->solicitation->degreeOfPerformance;
+
+	//Clientes que negociaram a versão 2 recebem o acionamento com o cabeçalho compacto
+	uint8_t emitterId[6];
+	getmacID(macaddr, emitterId);
+	SAPoTCentral_device device;
+	if(CTRLfind_device(handle, emitterId, &device) == SAPOTCENTRAL_SUCCESS && device.version == SAPOT_PROTOCOL_VERSION_2) msglen = SAPoTCentral_pack_v2(msg, msglen);
+
+	if(handle->publish(handle, (char*) macaddr, msg, msglen) != SAPOTCENTRAL_SUCCESS){
+		SAPoTCentral_release(handle, msg);
+		return SAPOTCENTRAL_FAILURE;
+	}
+
+	SAPoTCentral_release(handle, msg);
+
+	//alocando espaço de memoria para o ack ao usuário que solicitou o acionamento do atuador
+	outMessageLength = sizeof(SAPoTMessage_header);
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
+	header = (SAPoTMessage_header*) handle->outMessage;
+	SAPoTCentral_ack_header(handle, header, outMessageLength);
+
+	return outMessageLength;
+}
+
+/**
+* [Controle de Clientes] CTRLecho
+*
+*/
+int CTRLecho(SAPoTCentral* handle){
+
+	SAPoTCentral_shared* shared = handle->shared;
+	SAPoTMessage_header* header;
+	SAPoTCentral_echo pending;
+	char topic[18];
+	uint8_t emitterId[6];
+	int i, slot = -1;
+	int msglen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_echo);
+	uint64_t instant = SAPoTMetrics_now();
+	uint32_t now = (uint32_t) instant;
+
+	SAPOT_DEBUG(" CTRLecho: \n");
+
+	if(handle->header->ack == true){
+
+		//Reconhecimento do Cliente: o payload é do Cliente, então só é aceito se corresponder a um eco pendente para ele
+		pthread_mutex_lock(&shared->lock);
+		for(i=0; i<SAPOT_ECHOES; i++){
+			if(shared->echoes[i].expiry < instant || shared->echoes[i].serial != handle->echo->serial || shared->echoes[i].centralIn != handle->echo->centralIn) continue;
+			if(memcmp(shared->echoes[i].emitterId, handle->header->emitterId, 6) != 0 || memcmp(shared->echoes[i].origin, handle->echo->origin, 6) != 0) continue;
+			slot = i;
+			break;
+		}
+		if(slot >= 0){
+			pending = shared->echoes[slot];
+			memset(&shared->echoes[slot], 0, sizeof(SAPoTCentral_echo));
+		}
+		pthread_mutex_unlock(&shared->lock);
+
+		if(slot < 0){
+			handle->error = ERROR_UNEXPECTED_ECHO;
+			return SAPOTCENTRAL_FAILURE;
+		}
+
+		//Devolvendo o eco ao Usuário registrado, com o serial da sua solicitação
+		SAPoTCentral_topic(pending.origin, topic);
+		void* msg = SAPoTCentral_alloc(handle, msglen);
+		header = (SAPoTMessage_header*) msg;
+		SAPoTCentral_ack_header(handle, header, msglen);
+		header->serial = pending.serial;
+
+		SAPoTMessage_echo* echo = (SAPoTMessage_echo*) (msg + sizeof(SAPoTMessage_header));
+		memcpy(echo, handle->echo, sizeof(SAPoTMessage_echo));
+		echo->centralOut = now;
+
+		int result = handle->publish(handle, topic, msg, msglen);
+		SAPoTCentral_release(handle, msg);
+		return (result == SAPOTCENTRAL_SUCCESS) ? 0 : SAPOTCENTRAL_FAILURE;
+	}
+
+	//Solicitação do Usuário: buscando o macaddr referente à etiqueta
+	if(handle->opts->databaseProtocol == SQL){
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
+			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
+			return SAPOTCENTRAL_FAILURE; 
+		}
+		int found = MYSQLlabel(handle, handle->echo->label, topic);
+		MYSQLclose(handle);
+		if(found != SAPOTCENTRAL_SUCCESS) return SAPOTCENTRAL_FAILURE;
+	}
+	else if(MEMlabel(handle, handle->echo->label, topic) != SAPOTCENTRAL_SUCCESS) return SAPOTCENTRAL_FAILURE;
+
+	//Encaminhando o eco ao Cliente, com a origem e o instante de chegada à Central
+	void* msg = SAPoTCentral_alloc(handle, msglen);
+	header = (SAPoTMessage_header*) msg;
 	header->version = SAPOT_PROTOCOL_VERSION;
-	header->ack = 1;
+	header->ack = 0;
 	header->rsv1 = 0;
 	header->rsv2 = 0;
 	header->rsv3 = 0;
-	header->instruction = handle->header->instruction;
-	header->serial = handle->header->serial;
-	header->length = outMessageLength;
-	getmacID((const char*) handle->id, header->emitterId); 
+	header->instruction = 0x0A;
+	header->serial = ++handle->serial;
+	header->length = msglen;
+	getmacID((const char*) handle->id, header->emitterId);
 
-	//Fechando conexão com o banco de dados
-	mysql_close(&handle->MYSQLclient);
-	
-	//Retornando o tamanho da mensagem a ser publicada
-	return outMessageLength;
+	SAPoTMessage_echo* echo = (SAPoTMessage_echo*) (msg + sizeof(SAPoTMessage_header));
+	memcpy(echo, handle->echo, sizeof(SAPoTMessage_echo));
+	memcpy(echo->origin, handle->header->emitterId, 6);
+	echo->serial = handle->header->serial;
+	echo->centralIn = now;
+	echo->centralOut = 0;
+
+	//Registrando o eco pendente: uma posição vazia ou expirada, ou a do eco mais antigo
+	getmacID(topic, emitterId);
+	pthread_mutex_lock(&shared->lock);
+	for(i=0; i<SAPOT_ECHOES; i++){
+		if(shared->echoes[i].expiry < instant){
+			slot = i;
+			break;
+		}
+		if(slot < 0 || shared->echoes[i].expiry < shared->echoes[slot].expiry) slot = i;
+	}
+	memcpy(shared->echoes[slot].emitterId, emitterId, 6);
+	memcpy(shared->echoes[slot].origin, echo->origin, 6);
+	shared->echoes[slot].serial = echo->serial;
+	shared->echoes[slot].centralIn = now;
+	shared->echoes[slot].expiry = instant + (uint64_t) SAPOT_ECHO_TIMEOUT * 1000;
+	pthread_mutex_unlock(&shared->lock);
+
+	//Clientes que negociaram a versão 2 recebem o eco com o cabeçalho compacto
+	SAPoTCentral_device device;
+	if(CTRLfind_device(handle, emitterId, &device) == SAPOTCENTRAL_SUCCESS && device.version == SAPOT_PROTOCOL_VERSION_2) msglen = SAPoTCentral_pack_v2(msg, msglen);
+
+	int result = handle->publish(handle, topic, msg, msglen);
+	SAPoTCentral_release(handle, msg);
+	return (result == SAPOTCENTRAL_SUCCESS) ? 0 : SAPOTCENTRAL_FAILURE;
 }
 
 /**
-* [Subrotina] MYSQLmodification
+* [Controle de Clientes] CTRLreport
 *
 */
-int MYSQLmodification(){
+int CTRLreport(SAPoTCentral* handle){
 
-	//Abrindo conexão com o banco de dados
-	if(opts->databaseProtocol == SQL){ 
-		if(MYSQLconnect() != SAPOTCENTRAL_SUCCESS){
+	SAPoTMessage_header* header;
+	char macaddr[18];
+	uint8_t emitterId[6];
+
+	SAPOT_DEBUG(" CTRLreport: \n");
+
+	//Buscando o macaddr referente à etiqueta
+	if(handle->opts->databaseProtocol == SQL){
+		if(MYSQLconnect(handle) != SAPOTCENTRAL_SUCCESS){
 			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
 			return SAPOTCENTRAL_FAILURE; 
 		}
+		int found = MYSQLlabel(handle, handle->report->label, macaddr);
+		MYSQLclose(handle);
+		if(found != SAPOTCENTRAL_SUCCESS) return SAPOTCENTRAL_FAILURE;
 	}
+	else if(MEMlabel(handle, handle->report->label, macaddr) != SAPOTCENTRAL_SUCCESS) return SAPOTCENTRAL_FAILURE;
 
-	char query[100] = {};
-	int querylen = 0;
-	
-	printf("MYSQLmodification: \n");
-	//Formatando o id do cliente a ser etiquetado
-	upper_string((char*)handle->modification->macaddr);
-	printf("\t macaddr = %s\n", handle->modification->macaddr);
-	printf("\t label = %s\n", handle->modification->label);
-
-	//formatando uma query de update para etiquetar o cliente que já está cadastrado.
-	querylen = sprintf(query, "UPDATE tb_cadastrados SET label='%s' WHERE macaddr='%s';", handle->modification->label, handle->modification->macaddr);
-	printf("\t query = %s\n", query);
-	printf("\t querylen = %d\n", querylen);
-	
-	//Solicita ao servidor a query de atualização do cliente ja existente ou a inserção do novo cliente  
-	if(mysql_real_query(&handle->MYSQLclient, (const char*) query, querylen) != 0){
-		printf("MYSQL Erro(%d): %s\n", mysql_errno(&handle->MYSQLclient), mysql_error(&handle->MYSQLclient));
-		handle->error =  ERROR_DATABASE_INQUIRY;
-		mysql_close(&handle->MYSQLclient);
-		return SAPOTCENTRAL_FAILURE; 
-	}
-
-	//Alocando memória para a mensagem de retorno.
-	int outMessageLength = sizeof(SAPoTMessage_header); 
-	handle->outMessage = malloc(outMessageLength);
-
-	//Preenchendo o cabeçalho fixo
-	SAPoTMessage_header* header = (SAPoTMessage_header*) handle->outMessage;
+	//Encaminhando a configuração ao Cliente
+	int msglen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_report);
+	void* msg = SAPoTCentral_alloc(handle, msglen);
+	header = (SAPoTMessage_header*) msg;
 	header->version = SAPOT_PROTOCOL_VERSION;
-	header->ack = 1;
+	header->ack = 0;
 	header->rsv1 = 0;
 	header->rsv2 = 0;
 	header->rsv3 = 0;
-	header->instruction = handle->header->instruction;
-	header->serial = handle->header->serial;
-	header->length = outMessageLength;
+	header->instruction = 0x0B;
+	header->serial = ++handle->serial;
+	header->length = msglen;
 	getmacID((const char*) handle->id, header->emitterId);
+	memcpy(msg + sizeof(SAPoTMessage_header), handle->report, sizeof(SAPoTMessage_report));
 
-	//Fechando conexão com o banco de dados
-	mysql_close(&handle->MYSQLclient);
+	//Clientes que negociaram a versão 2 recebem a configuração com o cabeçalho compacto
+	SAPoTCentral_device device;
+	getmacID(macaddr, emitterId);
+	if(CTRLfind_device(handle, emitterId, &device) == SAPOTCENTRAL_SUCCESS && device.version == SAPOT_PROTOCOL_VERSION_2) msglen = SAPoTCentral_pack_v2(msg, msglen);
 
-	return outMessageLength;	
+	if(handle->publish(handle, macaddr, msg, msglen) != SAPOTCENTRAL_SUCCESS){
+		SAPoTCentral_release(handle, msg);
+		return SAPOTCENTRAL_FAILURE;
+	}
+	SAPoTCentral_release(handle, msg);
+
+	//O silêncio do sensor passa a ser avaliado com o novo intervalo
+	CTRLset_report(handle, emitterId, handle->report->sensorId, &handle->report->deadband);
+
+	//Reconhecendo a solicitação do Usuário
+	int outMessageLength = sizeof(SAPoTMessage_header);
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
+	SAPoTCentral_ack_header(handle, (SAPoTMessage_header*) handle->outMessage, outMessageLength);
+
+	return outMessageLength;
 }
 
 /**
-* [Subrotina] MYSQLacess
+* [Controle de Clientes] CTRLregistration
 *
 */
-int MYSQLaccess(){
-
-	//Abrindo conexão com o banco de dados
-	if(opts->databaseProtocol == SQL){ 
-		if(MYSQLconnect() != SAPOTCENTRAL_SUCCESS){
-			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
-			return SAPOTCENTRAL_FAILURE; 
+int CTRLregistration(SAPoTCentral* handle, unsigned long id){
+
+	//Negociando a versão do protocolo: o identificador do cliente em tb_cadastrados é seu apelido v2, se couber em 16 bits
+	uint16_t alias = (handle->inVersion == SAPOT_PROTOCOL_VERSION_2 && id <= 0xffff) ? id : SAPOT_CENTRAL_ALIAS;
+	//Um cliente que se recadastra na versão 1 deixa de receber mensagens v2
+	SAPoTCentral_device device = {alias, SAPOT_PROTOCOL_VERSION_2, {0}};
+	memcpy(device.emitterId, handle->header->emitterId, 6);
+	CTRLupdate_device(handle, &device);
+	SAPOT_DEBUG("\t alias = %d\n", alias);
+
+	//Configurações de relato que seguem o vetor de tipos; sem elas, todos os sensores relatam todas as leituras
+	int types = handle->registration->sensorQuantity + handle->registration->actuatorQuantity;
+	int offset = offsetof(SAPoTMessage_registration, sensorActuatorType) + types*sizeof(uint16_t);
+	SAPoTMessage_deadband deadband = {SAPOT_REPORT_PERIODIC, 0, 0, 0};
+	int i;
+	if(handle->payloadLen >= offset + handle->registration->sensorQuantity*(int) sizeof(SAPoTMessage_deadband)){
+		for(i=0; i<handle->registration->sensorQuantity; i++){
+			//O vetor de tipos tem comprimento par, então as configurações podem estar desalinhadas
+			memcpy(&deadband, handle->payload + offset + i*sizeof(SAPoTMessage_deadband), sizeof(SAPoTMessage_deadband));
+			CTRLset_report(handle, handle->header->emitterId, i, &deadband);
 		}
 	}
+	else CTRLset_report(handle, handle->header->emitterId, SAPOT_REPORT_ALL_SENSORS, &deadband);
 
-	printf("MYSQLaccess:\n");
+	//Definindo a mensagem de resposta (na versão 2, o ACK contém o apelido atribuído)
+	int outMessageLength = sizeof(SAPoTMessage_header);
+	if(handle->inVersion == SAPOT_PROTOCOL_VERSION_2) outMessageLength += sizeof(SAPoTMessage_registrationAck);
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
+	SAPoTMessage_header* header = (SAPoTMessage_header*) handle->outMessage;
+	SAPoTCentral_ack_header(handle, header, outMessageLength);
+	if(handle->inVersion == SAPOT_PROTOCOL_VERSION_2) ((SAPoTMessage_registrationAck*) (header + 1))->alias = alias;
 
-	char query[] = "SELECT * FROM tb_cadastrados;";
-	int querylen = strlen(query);
+	return outMessageLength;
+}
 
-	//Estrutura que representa o resultado de uma query solicitada 
-  	MYSQL_RES* sqlResult;
-	//Dá acesso as linhas do resultado de uma query solicitada 
-	MYSQL_ROW sqlRow;
+/**
+* [Controle de Clientes] CTRLdirectory_change
+*
+*/
+void CTRLdirectory_change(SAPoTCentral* handle, const char* macaddr){
 
-	printf("\t query = %s\n", query);
+	SAPoTCentral_directory* directory = &handle->shared->directory;
+	uint8_t mac[6];
 
-	//Solicita ao servidor uma query de consulta sobre as informações da tabela tb_cadastrados  
-	if(mysql_real_query(&handle->MYSQLclient, (const char*) query, querylen) != 0){
-		printf("MYSQL Erro(%d): %s\n", mysql_errno(&handle->MYSQLclient), mysql_error(&handle->MYSQLclient));
-		handle->error =  ERROR_DATABASE_INQUIRY;
-		mysql_close(&handle->MYSQLclient);
-		return SAPOTCENTRAL_FAILURE; 
+	getmacID(macaddr, mac);
+
+	pthread_mutex_lock(&handle->shared->lock);
+	directory->version++;
+	memcpy(directory->journal[directory->version & (SAPOT_DIRECTORY_JOURNAL-1)], mac, 6);
+	pthread_mutex_unlock(&handle->shared->lock);
+}
+
+/**
+* [Controle de Clientes] CTRLdirectory_since
+*
+*/
+int CTRLdirectory_since(SAPoTCentral* handle, char macaddrs[][18], SAPoTMessage_directory* answer){
+
+	SAPoTCentral_directory* directory = &handle->shared->directory;
+	uint32_t version = handle->directory->version;
+	uint8_t changed[SAPOT_DIRECTORY_JOURNAL][6];
+	int quantity = 0;
+	int i;
+
+	memset(answer, 0, sizeof(SAPoTMessage_directory));
+
+	pthread_mutex_lock(&handle->shared->lock);
+
+	answer->epoch = directory->epoch;
+	answer->version = directory->version;
+
+	//Cópia de outro processo da Central, posterior à versão atual ou anterior ao diário: tabela completa
+	if(handle->directory->epoch != directory->epoch || version > directory->version || directory->version - version > SAPOT_DIRECTORY_JOURNAL){
+		pthread_mutex_unlock(&handle->shared->lock);
+		answer->full = 1;
+		return SAPOTCENTRAL_FAILURE;
 	}
 
-	//sqlResult recebe o retorno da query solicitada ao banco de dados
-	sqlResult = mysql_store_result(&handle->MYSQLclient);
-	if(sqlResult == NULL){
-		printf("MYSQL Erro(%d): %s\n", mysql_errno(&handle->MYSQLclient), mysql_error(&handle->MYSQLclient));
-		handle->error =  ERROR_DATABASE_INQUIRY;
-		mysql_close(&handle->MYSQLclient);
-		return SAPOTCENTRAL_FAILURE; 		
+	//Enumerando uma única vez cada Cliente alterado depois da versão da cópia
+	while(version != directory->version){
+		const uint8_t* mac = directory->journal[++version & (SAPOT_DIRECTORY_JOURNAL-1)];
+		for(i=0; i<quantity && memcmp(changed[i], mac, 6) != 0; i++);
+		if(i == quantity) memcpy(changed[quantity++], mac, 6);
 	}
 
-	//Conta a quantidade de linhas de registro existentes na tabela tb_cadastrados, para definir o tamanho do retorno desta operação.
-	int rowQuantity = 0;
-	while((sqlRow = mysql_fetch_row(sqlResult)) != NULL) rowQuantity++;
+	pthread_mutex_unlock(&handle->shared->lock);
 
-	//Reinicia o ponteiro para o início do sqlResult
-	mysql_data_seek(sqlResult, 0);
-		
-	printf("\t rowQuantity = %d\n", rowQuantity);
+	for(i=0; i<quantity; i++) SAPoTCentral_topic(changed[i], macaddrs[i]);
 
-	//Alocando memória para a mensagem de retorno.
-	int outMessageLength = sizeof(SAPoTMessage_header) + (rowQuantity*sizeof(SAPoTMessage_access)); 
-	handle->outMessage = malloc(outMessageLength);
+	return quantity;
+}
+
+/**
+* [Controle de Clientes] CTRLaccess_header
+*
+*/
+uint8_t* CTRLaccess_header(SAPoTCentral* handle, int outMessageLength, bool compact, bool delta, const SAPoTMessage_directory* answer){
+
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
 
 	//Preenchendo o cabeçalho fixo
 	SAPoTMessage_header* header = (SAPoTMessage_header*) handle->outMessage;
-	header->version = SAPOT_PROTOCOL_VERSION;
-	header->ack = 1;
-	header->rsv1 = 0;
-	header->rsv2 = 0;
-	header->rsv3 = 0;
-	header->instruction = handle->header->instruction;
-	header->serial = handle->header->serial;
-	header->length = outMessageLength;
-	getmacID((const char*) handle->id, header->emitterId);
+	SAPoTCentral_ack_header(handle, header, outMessageLength);
+	header->rsv1 = compact;
+	header->rsv2 = delta;
+	header->rsv3 = (answer != NULL);
+
+	//Nas solicitações versionadas, a tabela é precedida pela versão do diretório
+	uint8_t* payload = (uint8_t*) handle->outMessage + sizeof(SAPoTMessage_header);
+	if(answer != NULL){
+		memcpy(payload, answer, sizeof(SAPoTMessage_directory));
+		payload += sizeof(SAPoTMessage_directory);
+	}
 
+	return payload;
+}
 
-	//Ponteiro do tipo SAPoTMessage_access para auxiliar na concatenação das informações de payload
-	SAPoTMessage_access* access;
+/**
+* [Controle de Clientes] CTRLstatistics
+*
+*/
+int CTRLstatistics(SAPoTCentral* handle){
 
-	//Retirando as informações do banco de dados
-	int i=0;
-	while((sqlRow = mysql_fetch_row(sqlResult)) != NULL){
-		access = (SAPoTMessage_access*) (handle->outMessage + sizeof(SAPoTMessage_header) + (i*sizeof(SAPoTMessage_access)));
-		strncpy((char*)access->label, (char*)sqlRow[1], (size_t) 10);
-		strncpy((char*)access->id, (char*)sqlRow[2], (size_t) 17);
-		access->id[17] = 0;
-		access->type = (uint16_t*) atoi(sqlRow[3]);
-		access->sensor = (uint8_t*) atoi(sqlRow[4]);
-		access->actuator = (uint8_t*) atoi(sqlRow[5]);
-		i++;	
-	}
+	SAPOT_DEBUG("CTRLstatistics: \n");
 
-	//Limpa os resultados da query anterior
-	mysql_free_result(sqlResult);
+	SAPoTMessage_statistics* request = (SAPoTMessage_statistics*) handle->payload;
+	SAPoTMetrics_deviceStats stats[SAPOT_STATISTICS_MAX];
+	static const uint8_t anyDevice[6] = {0};
+	int quantity;
 
-	//Fechando conexão com banco de dados
-	mysql_close(&handle->MYSQLclient);
+	//Consulta de um dispositivo específico ou dos dispositivos de maior taxa
+	if(memcmp(request->emitterId, anyDevice, sizeof(anyDevice)) != 0){
+		quantity = (SAPoTMetrics_device_get(&handle->shared->metrics, request->emitterId, &stats[0]) == 0) ? 1 : 0;
+	}
+	else{
+		quantity = (request->quantity == 0) ? SAPOT_METRICS_TOP_DEVICES : request->quantity;
+		if(quantity > SAPOT_STATISTICS_MAX) quantity = SAPOT_STATISTICS_MAX;
+		quantity = SAPoTMetrics_device_top(&handle->shared->metrics, stats, quantity);
+	}
+
+	//Alocando memória para a mensagem de retorno.
+	int outMessageLength = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_statistics) + quantity * sizeof(SAPoTMessage_deviceStatistics);
+	handle->outMessage = SAPoTCentral_alloc(handle, outMessageLength);
 
-	printf("antes do retorno de MYSQLaccess\n");
+	//Preenchendo o cabeçalho fixo
+	SAPoTMessage_header* header = (SAPoTMessage_header*) handle->outMessage;
+	SAPoTCentral_ack_header(handle, header, outMessageLength);
+
+	//Repetindo a consulta com a quantidade de dispositivos retornados
+	SAPoTMessage_statistics* response = (SAPoTMessage_statistics*) ((uint8_t*) handle->outMessage + sizeof(SAPoTMessage_header));
+	*response = *request;
+	response->quantity = quantity;
+
+	SAPoTMessage_deviceStatistics* device = (SAPoTMessage_deviceStatistics*) (response + 1);
+	int i;
+	for(i=0; i<quantity; i++){
+		memcpy(device[i].emitterId, stats[i].emitterId, sizeof(device[i].emitterId));
+		device[i].lastError = stats[i].lastError;
+		device[i].lastSeen = stats[i].lastSeen / 1000000;
+		device[i].messages = stats[i].total;
+		device[i].bytes = stats[i].bytes;
+		device[i].rate = stats[i].rate;
+	}
 
-	return outMessageLength;	
+	return outMessageLength;
 }
 
 /**
-* [Controle de Clientes] CTRLactuator 
+* [Controle de Clientes] CTRLfind_device
 *
 */
-int CTRLactuator(int (*publish)(char*, void*, unsigned int)){
+int CTRLfind_device(SAPoTCentral* handle, const uint8_t emitterId[6], SAPoTCentral_device* device){
 
-	//Abrindo conexão com o banco de dados
-	if(opts->databaseProtocol == SQL){ 
-		if(MYSQLconnect() != SAPOTCENTRAL_SUCCESS){
-			handle->error = ERROR_STARTING_DATABASE_PROTOCOL;
-			return SAPOTCENTRAL_FAILURE; 
+	SAPoTCentral_shared* shared = handle->shared;
+	int i, result = SAPOTCENTRAL_FAILURE;
+
+	pthread_mutex_lock(&shared->lock);
+	for(i=0; i<SAPOT_ALIAS_CACHE_SIZE; i++){
+		if(shared->devices[i].alias != SAPOT_CENTRAL_ALIAS && memcmp(shared->devices[i].emitterId, emitterId, 6) == 0){
+			*device = shared->devices[i];
+			result = SAPOTCENTRAL_SUCCESS;
+			break;
 		}
 	}
+	pthread_mutex_unlock(&shared->lock);
 
-	printf(" CTRLactuator: \n");
+	return result;
+}
 
-	char query[100] = {};
-	int querylen = 0;
-	char macaddr[18] = {};
-	SAPoTMessage_header* header;
-	int outMessageLength;
-	/** Estrutura que representa o resultado de uma query solicitada */
-  	MYSQL_RES* sqlResult;
-	/** Dá acesso a uma linha do resultado de uma query solicitada */
-	MYSQL_ROW sqlRow;
+/**
+* [Controle de Clientes] CTRLfind_alias
+*
+*/
+int CTRLfind_alias(SAPoTCentral* handle, uint16_t alias, SAPoTCentral_device* device){
 
-	//Verifica no banco de dados qual é o macaddr referente à label recebida via SAPoTMessage_solicitation
-	printf("\t label = %s\n", handle->solicitation->label);
-	querylen = sprintf(query, "SELECT macaddr FROM tb_cadastrados WHERE label like '%s';", handle->solicitation->label);
-	printf("\t query = %s\n", query);
-	printf("\t querylen = %d\n", querylen);
+	SAPoTCentral_shared* shared = handle->shared;
+	int result = SAPOTCENTRAL_FAILURE;
 
-	//Solicitando a query ao servidor 
-	if(mysql_real_query(&handle->MYSQLclient, (const char*) query, (unsigned int) querylen) != 0 ){
-		printf("MYSQL Erro(%d): %s\n", mysql_errno(&handle->MYSQLclient), mysql_error(&handle->MYSQLclient));
-		handle->error =  ERROR_DATABASE_INQUIRY;
-		mysql_close(&handle->MYSQLclient);
-		return SAPOTCENTRAL_FAILURE; 
+	pthread_mutex_lock(&shared->lock);
+	if(shared->devices[alias & (SAPOT_ALIAS_CACHE_SIZE-1)].alias == alias){
+		*device = shared->devices[alias & (SAPOT_ALIAS_CACHE_SIZE-1)];
+		result = SAPOTCENTRAL_SUCCESS;
 	}
+	pthread_mutex_unlock(&shared->lock);
 
-	//sqlResult recebe o retorno da query solicitada ao banco de dados:
-	sqlResult = mysql_store_result(&handle->MYSQLclient);
+	return result;
+}
 
-	//Se a label está cadastrada no banco de dados o retorno da query será verdadeiro (result == 1). 
-	//Então o sqlRow receberá o macaddr que refere-se a label.
-	if((sqlRow = mysql_fetch_row(sqlResult)) != NULL){
+/**
+* [Controle de Clientes] CTRLupdate_device
+*
+*/
+void CTRLupdate_device(SAPoTCentral* handle, const SAPoTCentral_device* device){
 
-		//Insere o sqlRow em macaddr
-		strncpy(macaddr, sqlRow[0], 17);
-		upper_string(macaddr);
-		printf("\t macaddr = %s\n", macaddr); 
+	SAPoTCentral_shared* shared = handle->shared;
+	int i;
 
-		//Livrando o espaço de memória do resultado da query
-		mysql_free_result(sqlResult);
+	pthread_mutex_lock(&shared->lock);
+	//Removendo registros anteriores do mesmo Cliente (recadastro com outro apelido ou na versão 1)
+	for(i=0; i<SAPOT_ALIAS_CACHE_SIZE; i++){
+		if(shared->devices[i].alias != SAPOT_CENTRAL_ALIAS && memcmp(shared->devices[i].emitterId, device->emitterId, 6) == 0) memset(&shared->devices[i], 0, sizeof(SAPoTCentral_device));
+	}
+	if(device->alias != SAPOT_CENTRAL_ALIAS) shared->devices[device->alias & (SAPOT_ALIAS_CACHE_SIZE-1)] = *device;
+	pthread_mutex_unlock(&shared->lock);
+}
+
+/**
+* [Controle de Clientes] CTRLset_type
+*
+*/
+void CTRLset_type(SAPoTCentral* handle, const uint8_t emitterId[6], uint16_t type){
 
-		//aloca espaço de memória para uma solicitação do tipo SAPoTMessage_actuatorDrive 
-		int msglen = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_actuatorDrive);
-		void* msg = malloc(msglen);
+	SAPoTCentral_shared* shared = handle->shared;
+	static const uint8_t empty[6] = {0};
+	unsigned int hash = 2166136261u;
+	int i, position;
 
-		//preenchendo o cabeçalho fixo
-		header = (SAPoTMessage_header*) msg;
-		header->version = SAPOT_PROTOCOL_VERSION;
-		header->ack = 0;
-		header->rsv1 = 0;
-		header->rsv2 = 0;
-		header->rsv3 = 0;
-		header->instruction = 3;
-		header->serial = ++handle->serial;
-		header->length = msglen;
-		getmacID((const char*) handle->id, header->emitterId);
-
-		//preenchendo o payload
-		SAPoTMessage_actuatorDrive* actuatorDrive = (SAPoTMessage_actuatorDrive*) (msg + sizeof(SAPoTMessage_header));
-		actuatorDrive->actuatorId = handle->solicitation->sensorOrActuatorId;
-		actuatorDrive->timeSet = handle->solicitation->timeSet;
-		actuatorDrive->degreeOfPerformance = handle->solicitation->degreeOfPerformance;
-
-		if(publish(macaddr, msg, msglen) != SAPOTCENTRAL_SUCCESS){
-			free(msg);
-			return SAPOTCENTRAL_FAILURE;
+	//FNV-1a do endereço MAC binário
+	for(i=0; i<6; i++) hash = (hash ^ emitterId[i]) * 16777619u;
+
+	pthread_mutex_lock(&shared->lock);
+	for(i=0; i<8; i++){
+		position = (hash + i) & (SAPOT_WATCH_TYPES-1);
+		if(memcmp(shared->types[position].emitterId, emitterId, 6) == 0 || memcmp(shared->types[position].emitterId, empty, 6) == 0) break;
+	}
+	if(i == 8) position = hash & (SAPOT_WATCH_TYPES-1);
+	memcpy(shared->types[position].emitterId, emitterId, 6);
+	shared->types[position].type = type;
+	pthread_mutex_unlock(&shared->lock);
+}
+
+/**
+* [Controle de Clientes] CTRLfind_type
+*
+*/
+uint16_t CTRLfind_type(SAPoTCentral* handle, const uint8_t emitterId[6]){
+
+	SAPoTCentral_shared* shared = handle->shared;
+	unsigned int hash = 2166136261u;
+	uint16_t type = SAPOT_WATCH_UNKNOWN_TYPE;
+	int i, position;
+
+	for(i=0; i<6; i++) hash = (hash ^ emitterId[i]) * 16777619u;
+
+	pthread_mutex_lock(&shared->lock);
+	for(i=0; i<8; i++){
+		position = (hash + i) & (SAPOT_WATCH_TYPES-1);
+		if(memcmp(shared->types[position].emitterId, emitterId, 6) == 0){
+			type = shared->types[position].type;
+			break;
 		}
+	}
+	pthread_mutex_unlock(&shared->lock);
 
-		free(msg);
+	return type;
+}
 
-	}else{
+/**
+* [Subrotina] CTRLreading_slot
+*
+* Retorna a posição do sensor sensorId do Cliente emitterId na tabela de últimos valores, ou -1 se ele não estiver na tabela e 
+* insert for falso. Uma nova posição é limpa. Deve ser evocada com SAPoTCentral_shared.lock adquirido.
+*
+*/
+static int CTRLreading_slot(SAPoTCentral_shared* shared, const uint8_t emitterId[6], uint16_t sensorId, bool insert){
 
-		printf("\t Label não cadastrada!\n");
-		handle->error = ERROR_LABEL_NOT_REGISTERED;
-		//Fechando conexão com banco de dados
-		mysql_close(&handle->MYSQLclient);
-		return SAPOTCENTRAL_FAILURE;  
+	static const uint8_t empty[6] = {0};
+	unsigned int hash = 2166136261u;
+	int i, position, vacant = -1;
 
+	//FNV-1a do endereço MAC binário e do sensor
+	for(i=0; i<6; i++) hash = (hash ^ emitterId[i]) * 16777619u;
+	hash = (hash ^ (sensorId & 0xff)) * 16777619u;
+	hash = (hash ^ (sensorId >> 8)) * 16777619u;
+
+	for(i=0; i<8; i++){
+		position = (hash + i) & (SAPOT_READINGS-1);
+		if(shared->readings[position].sensorId == sensorId && memcmp(shared->readings[position].emitterId, emitterId, 6) == 0) return position;
+		if(vacant < 0 && memcmp(shared->readings[position].emitterId, empty, 6) == 0) vacant = position;
 	}
+	if(!insert) return -1;
 
-	//alocando espaço de memoria para o ack ao usuário que solicitou o acionamento do atuador
-	outMessageLength = sizeof(SAPoTMessage_header);
-	handle->outMessage = malloc(outMessageLength);
-	header = (SAPoTMessage_header*) handle->outMessage;
-	header->version = SAPOT_PROTOCOL_VERSION;
-	header->ack = 1;
-	header->rsv1 = 0;
-	header->rsv2 = 0;
-	header->rsv3 = 0;
-	header->instruction = handle->header->instruction;
-	header->serial = handle->header->serial;
-	header->length = outMessageLength;
-	getmacID((const char*) handle->id, header->emitterId);
+	if(vacant < 0) vacant = hash & (SAPOT_READINGS-1);
+	memset(&shared->readings[vacant], 0, sizeof(SAPoTCentral_reading));
+	memcpy(shared->readings[vacant].emitterId, emitterId, 6);
+	shared->readings[vacant].sensorId = sensorId;
 
-	//Fechando conexão com banco de dados
-	mysql_close(&handle->MYSQLclient);
+	return vacant;
+}
 
-	return outMessageLength;	
+/**
+* [Controle de Clientes] CTRLset_report
+*
+*/
+void CTRLset_report(SAPoTCentral* handle, const uint8_t emitterId[6], uint16_t sensorId, const SAPoTMessage_deadband* deadband){
+
+	SAPoTCentral_shared* shared = handle->shared;
+	int i;
+
+	//Sem relato por variação o intervalo entre as leituras não é conhecido pela Central
+	uint32_t heartbeat = (deadband->mode == SAPOT_REPORT_PERIODIC) ? 0 : getTime(deadband->heartbeat >> 12, deadband->heartbeat & 0x0FFF);
+
+	pthread_mutex_lock(&shared->lock);
+	shared->readings[CTRLreading_slot(shared, emitterId, sensorId, true)].heartbeat = heartbeat;
+
+	//A configuração de todos os sensores fica na posição SAPOT_REPORT_ALL_SENSORS, herdada pelos sensores ainda não relatados
+	if(sensorId == SAPOT_REPORT_ALL_SENSORS){
+		for(i=0; i<SAPOT_READINGS; i++){
+			if(memcmp(shared->readings[i].emitterId, emitterId, 6) == 0) shared->readings[i].heartbeat = heartbeat;
+		}
+	}
+	pthread_mutex_unlock(&shared->lock);
+}
+
+/**
+* [Controle de Clientes] CTRLupdate_readings
+*
+*/
+void CTRLupdate_readings(SAPoTCentral* handle){
+
+	SAPoTCentral_shared* shared = handle->shared;
+	struct timespec now;
+	int i, position, all;
+
+	//As idades das amostras são relativas ao recebimento do lote
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t arrival = (int64_t) now.tv_sec*1000 + now.tv_nsec/1000000;
+
+	pthread_mutex_lock(&shared->lock);
+	for(i=0; i<handle->batch->sampleQuantity; i++){
+		if(handle->samples[i].sensorId == SAPOT_REPORT_ALL_SENSORS) continue;
+		int64_t instant = arrival - (int64_t) getTime(handle->batch->timeScale, handle->samples[i].age);
+
+		if((position = CTRLreading_slot(shared, handle->header->emitterId, handle->samples[i].sensorId, false)) < 0){
+			position = CTRLreading_slot(shared, handle->header->emitterId, handle->samples[i].sensorId, true);
+			if((all = CTRLreading_slot(shared, handle->header->emitterId, SAPOT_REPORT_ALL_SENSORS, false)) >= 0) shared->readings[position].heartbeat = shared->readings[all].heartbeat;
+		}
+
+		//Amostras mais antigas que o último valor (ex.: lotes reenviados após uma reconexão) não o substituem
+		if(instant >= shared->readings[position].instant){
+			shared->readings[position].instant = instant;
+			shared->readings[position].value = handle->samples[i].value;
+		}
+	}
+	pthread_mutex_unlock(&shared->lock);
 }
 
 /**
@@ -890,12 +2870,66 @@ void getmacID(const char* MAC, uint8_t ID[6]){
   j=0;
   for(i=0; i<11; i++){
    ID[j] =  (uint8_t)((bff[i]<<4) | (bff[++i]));
-   //printf("ID[%d] = %x\n", j, ID[j]);
+   //SAPOT_DEBUG("ID[%d] = %x\n", j, ID[j]);
    j++;
   }
   
 } 
 
+/**
+* [Utilitário] putVarint
+*
+*/
+int putVarint(uint8_t* buffer, uint32_t value){
+
+	int i = 0;
+
+	while(value >= 0x80){
+		buffer[i++] = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	buffer[i++] = (uint8_t) value;
+
+	return i;
+}
+
+/**
+* [Utilitário] getVarint
+*
+*/
+int getVarint(const uint8_t* buffer, const uint8_t* end, uint32_t* value){
+
+	int i = 0;
+	*value = 0;
+
+	while(&buffer[i] < end && i < 5){
+		*value |= (uint32_t) (buffer[i] & 0x7f) << (7*i);
+		if((buffer[i++] & 0x80) == 0) return i;
+	}
+
+	return 0;
+}
+
+/**
+* [Utilitário] getTime
+*
+*/
+unsigned long getTime(uint8_t scale, uint16_t quantity){
+
+	//Escala de milisegundos
+	if(scale == 0x00) return quantity;
+	//Escala de segundos
+	else if(scale == 0x01) return quantity * 1000UL;
+	//Escala de minutos
+	else if(scale == 0x02) return quantity * 1000UL * 60;
+	//Escala de horas
+	else if(scale == 0x03) return quantity * 1000UL * 60 * 60;
+	//Escala de dias
+	else if(scale == 0x04) return quantity * 1000UL * 60 * 60 * 24;
+
+	return 0;
+}
+
 /**
 *
 *
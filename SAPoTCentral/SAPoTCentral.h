@@ -56,7 +56,7 @@
  * void signalHandling(int signum){
  *
  *	printf("Finalizando a Central SAPoT...\n");
- *	SAPoTCentral_end();
+ *	SAPoTCentral_end(&handle);
  *	exit(1);
  *
  * }
@@ -78,13 +78,13 @@
  *  opts.database.dir = MYSQL_DIR;
  *	
  *  //Iniciando os serviços da Central
- *	if(SAPoTCentral_begin(&handle, &opts, centralId) != SAPOTCENTRAL_SUCCESS){
+ *	if(SAPoTCentral_begin(&handle, &opts, centralId, NULL) != SAPOTCENTRAL_SUCCESS){
  *		printf("SAPoTCentral_begin error (%d)", handle.error);
  *		return -1;
  *	}
  *		
  *	//Entrando em modo loop	
- *	SAPoTCentral_loop(); 
+ *	SAPoTCentral_loop(&handle); 
  *			
  *	return 0;
  *
@@ -124,6 +124,18 @@
  *   PRIMARY KEY (id)
  *   );
  *	@endcode
+ *	<li> Para armazenar as amostras recebidas em lote (instrução 0x08), crie também a tabela tb_registros</li>
+ *	@code{.sql}
+ *	CREATE TABLE tb_registros(
+ *   id BIGINT NOT NULL AUTO_INCREMENT,
+ *   macaddr VARCHAR(18) NOT NULL,
+ *   sensor INT(6) NOT NULL,
+ *   instant DATETIME(3) NOT NULL,
+ *   value FLOAT NOT NULL,
+ *   PRIMARY KEY (id),
+ *   INDEX (macaddr, instant)
+ *   );
+ *	@endcode
  *	<li> Com tabela devidamente configurada, deve-se criar um usuário chamado guest com senha de mesmo nome e 
  *	dar a ele permissões para modificar a tabela tb_cadastrados </li>
  *  @code{.sql}
@@ -145,8 +157,13 @@
 								
 #include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <MQTTClient.h>
 #include <mysql/mysql.h>
+#include "SAPoTLog.h"
+#include "SAPoTMetrics.h"
+#include "SAPoTTrace.h"
+#include "SAPoTCapture.h"
 
 								/************************* Defines ******************************/
 
@@ -156,6 +173,155 @@
 */
 #define SAPOT_PROTOCOL_VERSION 1
 
+/**
+* Indicador da Versão 2 do protocolo: Mensagens com cabeçalho compacto (veja SAPoTMessage_header e SAPoTCentral_unpack_message()). 
+* A Central aceita as versões 1 e 2 simultaneamente e responde a cada mensagem na mesma versão em que ela foi recebida.
+*	
+*/
+#define SAPOT_PROTOCOL_VERSION_2 2
+
+/**
+* Flag do cabeçalho v2: O emissor é identificado por um apelido de 16 bits (atribuído no cadastro) ao invés dos 6 bytes do endereço MAC.
+*
+*/
+#define SAPOT_V2_FLAG_ALIAS 0x01
+
+/**
+* Flag do cabeçalho v2: O payload de um registro (0x05) está no formato de lote (SAPoTMessage_batch), equivalente à instrução 0x08.
+*
+*/
+#define SAPOT_V2_FLAG_BATCH 0x02
+
+/**
+* Flag do cabeçalho v2: O payload está comprimido. Reservada; a Central atual rejeita mensagens com essa flag (#ERROR_UNSUPPORTED_FLAGS).
+*
+*/
+#define SAPOT_V2_FLAG_COMPRESSED 0x04
+
+/**
+* Apelido reservado para a própria Central nas mensagens v2 que ela emite. 
+*
+*/
+#define SAPOT_CENTRAL_ALIAS 0
+
+/**
+* Quantidade de posições da tabela de apelidos mantida em memória pela Central (deve ser uma potência de 2).
+* Apelidos ausentes da tabela são consultados no banco de dados. 
+*
+*/
+#define SAPOT_ALIAS_CACHE_SIZE 1024
+
+/**
+* Quantidade de alterações da tabela de Clientes registradas no diário do diretório (deve ser uma potência de 2). Um Usuário 
+* com o diretório defasado em mais alterações que essa quantidade recebe a tabela completa (veja SAPoTMessage_directory).
+*
+*/
+#define SAPOT_DIRECTORY_JOURNAL 256
+
+/**
+* Quantidade de posições da tabela de tipos de Cliente que define os tópicos de observação (deve ser uma potência de 2). Um novo
+* Cliente ocupa uma das 8 posições seguintes ao hash de seu endereço MAC ou, com todas ocupadas, substitui o Cliente da primeira.
+*
+*/
+#define SAPOT_WATCH_TYPES 1024
+
+/**
+* Tipo utilizado nos tópicos de observação quando o tipo do emissor é desconhecido: Usuários e, com o banco de dados MySQL, 
+* Clientes cadastrados antes do início da Central, até o seu próximo cadastro.
+*
+*/
+#define SAPOT_WATCH_UNKNOWN_TYPE 0xFFFF
+
+/**
+* Quantidade de posições da tabela de últimos valores dos sensores (deve ser uma potência de 2). Uma nova leitura ocupa uma das 
+* 8 posições seguintes ao hash do endereço MAC e do sensor ou, com todas ocupadas, substitui a leitura da primeira.
+*
+*/
+#define SAPOT_READINGS 1024
+
+/**
+* Quantidade de intervalos máximos de silêncio (heartbeat) sem relato após os quais o último valor de um sensor é considerado 
+* desatualizado (veja SAPoTCentral_reading).
+*
+*/
+#define SAPOT_READING_MISSED 3
+
+/**
+* Quantidade de ecos (0x0A) encaminhados aos Clientes que aguardam reconhecimento (veja SAPoTCentral_echo). Com todas as posições 
+* ocupadas, um novo eco substitui o mais antigo.
+*
+*/
+#define SAPOT_ECHOES 64
+
+/**
+* Tempo, em milisegundos, que a Central aguarda o reconhecimento de um eco encaminhado ao Cliente. Reconhecimentos posteriores 
+* são descartados.
+*
+*/
+#define SAPOT_ECHO_TIMEOUT 10000
+
+/**
+* Modo de relato dos sensores (veja SAPoTMessage_deadband): todas as leituras são publicadas.
+*
+*/
+#define SAPOT_REPORT_PERIODIC 0
+
+/**
+* Modo de relato dos sensores: a leitura é publicada quando difere do último valor publicado em mais que o limiar absoluto.
+*
+*/
+#define SAPOT_REPORT_ABSOLUTE 1
+
+/**
+* Modo de relato dos sensores: a leitura é publicada quando difere do último valor publicado em mais que o limiar percentual.
+*
+*/
+#define SAPOT_REPORT_PERCENT 2
+
+/**
+* Identificador de sensor que aplica a configuração de relato (0x0B) a todos os sensores do Cliente.
+*
+*/
+#define SAPOT_REPORT_ALL_SENSORS 0xFFFF
+
+/**
+* Comprimento de cada bloco do pool de buffers da Central, utilizado pelas mensagens de resposta e de acionamento. 
+* Mensagens maiores (ex.: retorno de acesso com muitos Clientes) são alocadas no heap e contabilizadas em SAPoTCentral_stats.
+*
+*/
+#define SAPOT_POOL_BLOCK_SIZE 4096
+
+/**
+* Quantidade de blocos do pool de buffers de cada thread da Central.
+*
+*/
+#define SAPOT_POOL_BLOCKS 4
+
+/**
+* Capacidade inicial da tabela de Clientes do armazenamento em memória (potência de 2), dobrada quando necessário.
+*
+*/
+#define SAPOT_MEMORY_CLIENTS 256
+
+/**
+* Comprimento máximo de uma linha da query de registro em lote: o endereço MAC, o sensor, o instante e o valor (em %.9g) de uma 
+* amostra ocupam no máximo cerca de 95 caracteres.
+*
+*/
+#define SAPOT_BATCH_ROW_SIZE 128
+
+/**
+* Comprimento máximo da query de registro em lote: 100 caracteres de comando e no máximo #SAPOT_BATCH_ROW_SIZE por amostra (até 255 amostras).
+*
+*/
+#define SAPOT_BATCH_QUERY_SIZE (100 + 255*SAPOT_BATCH_ROW_SIZE)
+
+/**
+* Quantidade máxima de dispositivos em uma resposta à consulta de estatísticas (0x09), limitada pelo bloco do pool.
+*
+*/
+#define SAPOT_STATISTICS_MAX 64
+
 /**
 * Código de Retorno: Sucesso: Indica sucesso na operação realizada pela Central SAPoT. 
 *
@@ -252,6 +418,47 @@
 */
 #define ERROR_LABEL_NOT_REGISTERED -10 
 
+/**
+* Código de Erro: Mensagem malformada. Indica que o comprimento da mensagem recebida não comporta
+* o payload declarado em seu cabeçalho (por exemplo, um lote com mais amostras do que bytes recebidos). 
+*
+*/
+#define ERROR_MALFORMED_MESSAGE -11
+
+/**
+* Código de Erro: Apelido desconhecido. Indica que uma mensagem v2 identificou o emissor por um apelido 
+* que não está cadastrado no banco de dados da Central. O Cliente deve refazer seu cadastro.
+*
+*/
+#define ERROR_UNKNOWN_ALIAS -12
+
+/**
+* Código de Erro: Flags não suportadas. Indica que uma mensagem v2 utilizou uma flag que a Central não suporta
+* (por exemplo, #SAPOT_V2_FLAG_COMPRESSED).
+*
+*/
+#define ERROR_UNSUPPORTED_FLAGS -13
+
+/**
+* Código de Erro: Instrução desconhecida. Indica que a instrução da mensagem recebida não possui um manipulador 
+* registrado na tabela de instruções da Central (veja SAPoTCentral_register_instruction()).
+*
+*/
+#define ERROR_UNKNOWN_INSTRUCTION -14
+
+/**
+* Código de Erro: Indica fracasso ao carregar um dos plugins de instrução definidos em SAPoTCentral_create_options.plugins.
+*
+*/
+#define ERROR_LOADING_PLUGIN -15
+
+/**
+* Código de Erro: Eco inesperado. Indica que um Cliente reconheceu um eco (0x0A) que a Central não lhe encaminhou, ou cujo 
+* reconhecimento chegou após #SAPOT_ECHO_TIMEOUT. O reconhecimento é descartado.
+*
+*/
+#define ERROR_UNEXPECTED_ECHO -16
+
 /**
 * Código de Configuração: Indica que o usuário irá utilizar um protocolo não padronizado na SAPoTCentral.h.
 * E portanto a função SAPoTCentral_loop() não será utilizada.
@@ -270,6 +477,21 @@
 */
 #define SQL 1
 
+/**
+* Código de Configuração: Indica que a Central utilizará a transmissão em processo (loopback), sem broker: as mensagens são 
+* entregues pela aplicação através de SAPoTCentral_receive() e as publicações da Central são entregues à função registrada 
+* por SAPoTCentral_set_loopback().
+*
+*/
+#define LOOPBACK 2
+
+/**
+* Código de Configuração: Indica que a Central utilizará o armazenamento em memória (veja SAPoTCentral_memory), sem servidor
+* de banco de dados.
+*
+*/
+#define MEMORY 2
+
 /**
 * Opção de inicialização (Servidores Locais).
 * Define as opções de inicialização SAPoTCentral_create_options. Indicando que o protocolo de transmissão será o MQTTv3.1.1 
@@ -279,7 +501,7 @@
 * (user='guest', pass='guest') e o diretório da base de dados será definido como db_UCC (dir='db_UCC').    
 * 
 */
-#define SAPOTCENTRAL_OPTS_STDLOCAL {1, {"localhost", "1883", NULL, NULL}, 1, {"localhost", "3306", "guest", "guest", "db_UCC"}}
+#define SAPOTCENTRAL_OPTS_STDLOCAL {1, {"localhost", "1883", NULL, NULL}, 1, {"localhost", "3306", "guest", "guest", "db_UCC"}, NULL, 0}
 
 /**
 * Opção de inicialização (Servidores Indefinidos) 
@@ -288,7 +510,16 @@
 * o usuário utilizará outros protocolos não padronizados na SAPoTCentral.h.   
 * 
 */
-#define SAPOTCENTRAL_OPTS_UNDEFINED_PROTOCOLS {0, {NULL, NULL, NULL, NULL}, 0, {NULL, NULL, NULL, NULL, NULL}}
+#define SAPOTCENTRAL_OPTS_UNDEFINED_PROTOCOLS {0, {NULL, NULL, NULL, NULL}, 0, {NULL, NULL, NULL, NULL, NULL}, NULL, 0}
+
+/**
+* Opção de inicialização (Sem Servidores)
+* Define as opções de inicialização SAPoTCentral_create_options com a transmissão em processo (#LOOPBACK) e o armazenamento 
+* em memória (#MEMORY). Todo o caminho das mensagens (estruturação, despacho, manipuladores e publicação) é executado sem 
+* broker e sem MySQL, permitindo medir o custo de CPU da Central isoladamente (veja ucc-microbench) e testá-la sem serviços.
+* 
+*/
+#define SAPOTCENTRAL_OPTS_LOOPBACK {LOOPBACK, {NULL, NULL, NULL, NULL}, MEMORY, {NULL, NULL, NULL, NULL, NULL}, NULL, 0}
 
 
 
@@ -306,16 +537,34 @@
 * que determinam o tamanho total da mensagem e os últimos 6 bytes indentificadores 
 * do emissor da mensagem. 
 *
+* Na versão 2 do protocolo o cabeçalho é compacto e possui comprimento variável (de 7 a 15 bytes):
+* <ul>
+* <li> 1 byte com as flags e a versão, no mesmo formato da versão 1 </li>
+* <li> 1 byte de instrução </li>
+* <li> 1 byte de flags v2 (#SAPOT_V2_FLAG_ALIAS, #SAPOT_V2_FLAG_BATCH, #SAPOT_V2_FLAG_COMPRESSED) </li>
+* <li> Número serial (varint) </li>
+* <li> Comprimento total da mensagem (varint) </li>
+* <li> Identificador do emissor: 2 bytes de apelido se #SAPOT_V2_FLAG_ALIAS estiver ativa, ou os 6 bytes do endereço MAC </li>
+* </ul>
+* A Central sempre converte o cabeçalho recebido para esta estrutura (veja SAPoTCentral_unpack_message()), de forma que 
+* as operações não dependem da versão da mensagem.
+*
 */
 typedef struct{
 	
-	/** Flag reservada para uso futuro */
+	/** Flag de diretório versionado. Em uma solicitação de acesso (0x04) com rsv1 ativo, indica que o payload contém um 
+	* SAPoTMessage_directory com a versão da tabela mantida em cache pelo Usuário, e que a resposta pode conter apenas os 
+	* clientes alterados desde essa versão; a Central ativa essa flag na resposta quando a utiliza. Reservada nas demais instruções. */
 	uint8_t rsv3:1, 
 
-	/** Flag reservada para uso futuro */
+	/** Flag de codificação delta dos endereços MAC. Em uma solicitação de acesso (0x04) com rsv1 ativo, 
+	* indica que a tabela pode ser ordenada por endereço MAC e cada endereço codificado apenas pela diferença 
+	* em relação ao anterior (veja SAPoTMessage_access). Reservada nas demais instruções. */
 	rsv2:1, 
 
-	/** Flag reservada para uso futuro */
+	/** Flag de codificação compacta. Em uma solicitação de acesso (0x04), indica que o Usuário aceita a 
+	* resposta no formato compacto; a Central ativa essa flag na resposta quando a utiliza (veja SAPoTMessage_access).
+	* Reservada nas demais instruções. */
 	rsv1:1, 
 
 	/** Flag identificadora de mensagens de retorno */
@@ -332,6 +581,10 @@ typedef struct{
   	* 0x04: Acesso à informação dos clientes cadastrados no banco de dados da Central (Acess) \n
   	* 0x05: Registro de informação proveniente de sensores e atuadores (Record) \n
   	* 0x06: Etiquetagem de um cliente que está cadastrado no banco de dados da Central (Modification) \n 
+  	* 0x08: Registro em lote de amostras provenientes dos sensores (Batch) \n 
+  	* 0x09: Consulta das estatísticas de mensagens por dispositivo (Statistics) \n 
+  	* 0x0A: Medição do tempo de ida e volta até um Cliente (Echo) \n 
+  	* 0x0B: Configuração do relato por variação dos sensores de um Cliente (Report) \n 
   	**/
   	uint8_t instruction;
   	
@@ -353,6 +606,9 @@ typedef struct{
 * Organiza-se em: 16 bits definidores do tipo de cliente, 8 bits para quantidade de sensores que operam 
 * neste cliente, 8 bits para quantidade de atuatores que operam neste cliente, um vetor com posições de 
 * 16 bits para identificar os tipos de sensores e atuadores que operam neste cliente. 
+*
+* O vetor de tipos pode ser seguido por sensorQuantity estruturas SAPoTMessage_deadband, com a configuração de relato de cada 
+* sensor. Sem elas, a Central considera que todos os sensores relatam todas as leituras (#SAPOT_REPORT_PERIODIC).
 *  
 */
 typedef struct{
@@ -441,6 +697,22 @@ typedef struct{
 * 2 bytes para o tipo de cliente, 1 byte para quantidade de sensores e o último byte para
 * quantidade de atuadores.    
 *
+* Se a solicitação de acesso possuir a flag rsv1 (codificação compacta) ativa, a resposta também a terá 
+* e sua carga útil não utiliza a SAPoTMessage_access, mas sim a seguinte codificação de comprimento variável:
+* <ul>
+* <li> Quantidade de clientes (varint) </li>
+* <li> Para cada cliente: </li>
+*		<ul>
+*			<li> Endereço MAC: 6 bytes binários. Se a flag rsv2 (codificação delta) estiver ativa, a tabela é 
+*			ordenada por endereço MAC e cada endereço é precedido por 1 byte com a quantidade de bytes iniciais 
+*			em comum com o endereço anterior, seguido apenas dos bytes restantes. </li>
+*			<li> Etiqueta: 1 byte de comprimento seguido dos caracteres da etiqueta (sem terminador nulo) </li>
+*			<li> Tipo de cliente (varint), quantidade de sensores (1 byte) e quantidade de atuadores (1 byte) </li>
+*		</ul>
+* </ul>
+* Os campos varint utilizam 7 bits por byte, do menos para o mais significativo, com o bit 8 indicando
+* a continuação do número (veja putVarint()).
+*
 */
 typedef struct{
 
@@ -470,6 +742,38 @@ typedef struct{
   	 
 }SAPoTMessage_access;
 
+/**
+* @brief Versão do diretório de Clientes, para as solicitações de acesso versionadas (flag rsv3).
+*
+* O Usuário que mantém a tabela de acesso em cache (ex.: o gpc) envia na solicitação de acesso (instrução 0x04, flags rsv1 e 
+* rsv3) a versão da sua cópia, ou uma versão nula se não a possuir. A Central responde com as flags rsv1 e rsv3, e o payload 
+* inicia com este cabeçalho, seguido pela tabela no formato compacto (veja SAPoTMessage_access):
+* <ul>
+* <li> Com full ativo: a tabela completa, que substitui a cópia do Usuário </li>
+* <li> Caso contrário: apenas os Clientes cadastrados ou alterados (etiqueta, tipo, sensores ou atuadores) desde a versão 
+*      informada, que são atualizados ou acrescentados à cópia do Usuário (uma tabela vazia indica que a cópia está atualizada) </li>
+* </ul>
+* A versão é mantida pela Central a cada processo (SAPoTCentral_shared.directory), e epoch identifica o processo: um Usuário com 
+* epoch diferente, ou defasado em mais de #SAPOT_DIRECTORY_JOURNAL alterações, recebe a tabela completa. Alterações feitas 
+* diretamente na tabela tb_cadastrados, sem passar pela Central, só são percebidas após uma tabela completa.
+*
+*/
+typedef struct{
+
+	/** Identificador do processo da Central que atribuiu a versão (0 se o Usuário não possui cópia) */
+	uint32_t epoch;
+
+	/** Quantidade de alterações da tabela de Clientes registradas pela Central até a cópia */
+	uint32_t version;
+
+	/** Na resposta, indica que a tabela é completa; reservado na solicitação */
+	uint8_t full;
+
+	/** Reservado para uso futuro */
+	uint8_t rsv[3];
+
+}SAPoTMessage_directory;
+
 /**
 * @brief Estrutura para acessar as de informação enviadas pelo cliente, dentre as quais: Dados dos Sensores, Status 
 * dos Atuadores e possíveis erros de operação.
@@ -558,201 +862,1096 @@ typedef struct {
 	
 }SAPoTMessage_actuatorDrive;
 
+/**
+* @brief Payload da resposta (ACK) a um cadastro realizado na versão 2 do protocolo.
+*
+* Quando o Cliente se cadastra (instrução 0x00) utilizando o cabeçalho v2, a Central negocia a versão 2 para esse 
+* Cliente e responde com o apelido de 16 bits que ele pode utilizar no lugar do endereço MAC (veja #SAPOT_V2_FLAG_ALIAS).
+* O apelido é o identificador do Cliente na tabela tb_cadastrados. Um apelido igual a #SAPOT_CENTRAL_ALIAS indica que 
+* nenhum apelido foi atribuído e o Cliente deve continuar se identificando pelo endereço MAC.
+*
+*/
+typedef struct{
 
+	/** Apelido atribuído ao Cliente */
+	uint16_t alias;
 
-							/************************* Structs for SAPoTCentral *************************/
+}SAPoTMessage_registrationAck;
 
 /**
-* @brief Estrutura para definir as opções de criação de uma Central SAPoT
+* @brief Cabeçalho do payload para registro em lote de amostras dos sensores.
 *
-* Essa estrutura armazena as informações pertinentes aos serviços de transmissão e banco de dados.
-* Na atual versão de protocolo, a Central SAPoT tem suporte apenas para o protocolo MQTT e SQL.
+* Payload emitido pelo Cliente e recebido pela Central (instrução = 0x08). Ao invés de publicar 
+* uma mensagem por amostra, o Cliente acumula N amostras e as envia sob um único cabeçalho fixo.
+* Esse cabeçalho de lote possui 4 bytes divididos em: 8 bits para a quantidade de amostras, 
+* 8 bits para a escala de tempo utilizada pelas idades das amostras e 16 bits reservados. 
+* Logo em seguida, encontram-se as N amostras no formato SAPoTMessage_sample.
 *
 */
 typedef struct{
 
-	/** identificador de protocolo de transmissão: \n 
-	* 	1: MQTT \n 
-	*/
-	uint8_t transmissionProtocol;
-	
-	/** Informações referente ao servidor de transmissão de mensagens */
-	struct{
-		
-		char* host; /*!< Endereço do servidor de transmissão */
-		
-		char* port; /*!< Porta de escuta do servidor de transmissão */
-		
-		char* user; /*!< Usuário para acessar o servidor de transmissão */
-		
-		char* pass; /*!< Senha para acessar o servidor de transmissão */
-		
-	}transmission;
-	
-	/** identificador de protocolo de banco de dados: \n 
-	* 	1: SQL \n 
+	/** Quantidade de amostras (SAPoTMessage_sample) que seguem este cabeçalho */
+	uint8_t sampleQuantity;
+
+	/** Escala de tempo das idades das amostras: \n
+	*	0x0 Milisegundos\n
+	*	0x1 Segundos\n
+	*	0x2 Minutos\n
+	*	0x3 Horas\n
+	*	0x4 Dias\n
 	*/
-	uint8_t databaseProtocol;
-	
-	/** Informações referente ao servidor de banco de dados */
-	struct{
-		
-		char* host; /*!< Endereço do servidor de banco de dados */
-		
-		char* port; /*!< Porta de escuta do servidor de banco de dados */
-		
-		char* user; /*!< Usuário para acessar o servidor de banco de dados */
-		
-		char* pass; /*!< Senha para acessar o servidor de banco de dados */
-		
-		char* dir; /*!< Diretório da base de dados */
-		
-	}database;
-	
-}SAPoTCentral_create_options;
+	uint8_t timeScale;
+
+	/** Reservado para uso futuro */
+	uint16_t rsv;
+
+}SAPoTMessage_batch;
 
 /**
-* @brief Principal estrutura para operar uma Central SAPoT.
+* @brief Amostra de um sensor contida em um lote (veja SAPoTMessage_batch).
 *
-* Essa estrutura armazena as ferramentas necessárias para recepção, manipulação e envio 
-* de mensagem na Central SAPoT, bem como os maniuladores dos clientes MQTT e MySQL. 
-* Além disso, existem outras informações e flags importantes como: o identificador da 
-* Central no formato de endereço MAC, o indicador de erro, o contador serial de mensagens 
-* enviadas pela central e a flag de autorização da rotina de repetição SAPoTCentral_loop().
+* Cada amostra possui 8 bytes divididos em: 16 bits identificadores do sensor, 16 bits para
+* a idade da amostra (tempo decorrido entre a leitura e o envio do lote, na escala definida em 
+* SAPoTMessage_batch.timeScale) e 32 bits para o valor lido (float). A Central converte a idade 
+* em um instante absoluto subtraindo-a do horário de recebimento da mensagem.
 *
 */
 typedef struct{
 
-	/** identificador da Central no formato macaddr (xx:xx:xx:xx:xx:xx) */
-	const char* id;
-	
-	/** Indicador de numero de erro */
-	int error;
-
-	/** 
-	* Flag que permite a execução da SAPoTCentral_loop() se a Central
-	* for inciada corretamente via SAPoTCentral_begin().
-	*/
-	bool inLoop;
+	/** Identificador do sensor */
+	uint16_t sensorId;
 
-	/** Número serial referente as mensagem enviadas pela central*/
-	uint16_t serial;	
+	/** Idade da amostra no momento do envio do lote */
+	uint16_t age;
 
-	/** Ponteiro indicador da mensagem recebida */
-	uint8_t* inMessage;
+	/** Valor lido pelo sensor */
+	float value;
 
-	/** Ponteiro indicador da mensagem a ser enviada para o Usuário */
-	void* outMessage;
-	
-	/** Ponteiro para o cabeçalho da mensagem recebida */
-	SAPoTMessage_header* header;
-	
-	/** Ponteiro para o payload de cadastro de novo cliente */
-	SAPoTMessage_registration* registration;
-	
-	/** Ponteiro para o payload de registro de informação */
-	SAPoTMessage_record* record;
-	
-	/** Ponteiro para o payload de modificação de informação */
-	SAPoTMessage_modification* modification;
-	
-	/** Ponteiro para o payload de solicitação de uso de algum cliente cadastrado */
-	SAPoTMessage_solicitation* solicitation;
-	
-	/** Objeto referente ao cliente MQTT*/
-	MQTTClient MQTTclient;
-	
-	/** Objeto referente ao cliente MYSQL*/
-	MYSQL MYSQLclient;
-	
-	
-}SAPoTCentral;
+}SAPoTMessage_sample;
 
 
-					/************************* Functions for SAPoTCentral *************************/
 
-/** 
-* Essa função inicia a central SAPoT preenchendo as informações passadas pelo usuário através das estruturas SAPoTCentral
-* e SAPoTCentral_create_options. Além disso, inicia o arquivo de log e se o usuário optar por utilizar o modo local-padrão
-* essa função inicia os clientes para comunicação com os serviços MQTT e MySQL.
+/**
+* @brief Payload da consulta de estatísticas por dispositivo.
 *
-* @param userPointer Um ponteiro para o espaço de memória do tipo SAPoTCentral que deseja ser iniciado como Central.
-* @param opts Um ponteiro para o espaço de memória do tipo SAPoTCentral_create_options que contém as configurações iniciais
-* para operação da Central.
-* @param centralId Uma string no formato de um endereço MAC (XX:XX:XX:XX:XX:XX) que identifica a Central. Esse parâmetro 
-* deve ser único em uma rede que possua mais de uma Central SAPoT em operação.  
+* Payload emitido pelo Usuário (instrução = 0x09) e repetido pela Central no início da resposta. Com emitterId nulo, a 
+* Central responde com os quantity dispositivos de maior taxa de mensagens; caso contrário, apenas com o dispositivo informado. 
+* Na resposta, quantity indica a quantidade de SAPoTMessage_deviceStatistics que seguem este payload.
+*
+*/
+typedef struct{
+
+	/** Quantidade de dispositivos solicitados (0 indica #SAPOT_METRICS_TOP_DEVICES) ou retornados */
+	uint8_t quantity;
+
+	/** Reservado para uso futuro */
+	uint8_t rsv;
+
+	/** Dispositivo consultado (nulo para a consulta dos dispositivos de maior taxa) */
+	uint8_t emitterId[6];
+
+}SAPoTMessage_statistics;
+
+/**
+* @brief Estatísticas de um dispositivo na resposta à consulta de estatísticas (veja SAPoTMessage_statistics).
+*
+* Cada posição possui 24 bytes: o endereço MAC do dispositivo, o último código de erro no tratamento de suas mensagens, 
+* o instante da última mensagem, os totais de mensagens e bytes recebidos e a taxa média exponencial de mensagens.
+*
+*/
+typedef struct{
+
+	/** Endereço MAC do dispositivo */
+	uint8_t emitterId[6];
+
+	/** Último código de erro SAPoTCentral (0 se nenhum) */
+	int16_t lastError;
+
+	/** Instante da última mensagem, em segundos desde 1970 */
+	uint32_t lastSeen;
+
+	/** Mensagens recebidas */
+	uint32_t messages;
+
+	/** Bytes recebidos */
+	uint32_t bytes;
+
+	/** Taxa média exponencial de mensagens por segundo (janela de #SAPOT_METRICS_RATE_WINDOW segundos) */
+	float rate;
+
+}SAPoTMessage_deviceStatistics;
+
+/**
+* @brief Payload da medição do tempo de ida e volta até um Cliente (eco).
+*
+* Payload emitido pelo Usuário (instrução = 0x0A) com a etiqueta do Cliente. A Central preenche origin e serial, marca 
+* centralIn e encaminha o eco ao Cliente, que o devolve inalterado como reconhecimento (ACK). Ao receber o reconhecimento, 
+* a Central marca centralOut e o encaminha ao Usuário origin com o serial da solicitação original. Dessa forma, 
+* centralOut - centralIn é o trecho Central → Cliente → Central (broker, rede sem fio e processamento do Cliente), e o 
+* restante do tempo de ida e volta medido pelo Usuário é o trecho Usuário ↔ Central. Esse payload possui 32 bytes.
+*
+*/
+typedef struct{
+
+	/** Etiqueta do Cliente */
+	uint8_t label[11];
+
+	/** Reservado para uso futuro */
+	uint8_t rsv;
+
+	/** Usuário que solicitou o eco (preenchido pela Central) */
+	uint8_t origin[6];
+
+	/** Serial da solicitação do Usuário (preenchido pela Central) */
+	uint16_t serial;
+
+	/** Número de sequência atribuído pelo Usuário */
+	uint32_t sequence;
+
+	/** Instante, em microssegundos (relógio monotônico da Central), da chegada da solicitação à Central */
+	uint32_t centralIn;
+
+	/** Instante, em microssegundos (relógio monotônico da Central), da chegada do reconhecimento do Cliente à Central */
+	uint32_t centralOut;
+
+}SAPoTMessage_echo;
+
+/**
+* @brief Configuração do relato por variação (deadband) de um sensor.
+*
+* Com os modos #SAPOT_REPORT_ABSOLUTE e #SAPOT_REPORT_PERCENT, o Cliente publica uma leitura apenas quando ela difere do último 
+* valor publicado em mais que o limiar, ou quando o último valor foi publicado há heartbeat (intervalo máximo de silêncio). A 
+* ausência de amostras de um sensor indica, portanto, que seu valor não mudou (veja SAPoTCentral_reading). Essa estrutura possui 
+* 8 bytes e segue o vetor de tipos no cadastro (0x00) ou a etiqueta na configuração de relato (0x0B).
+*
+*/
+typedef struct{
+
+	/** Modo de relato: #SAPOT_REPORT_PERIODIC, #SAPOT_REPORT_ABSOLUTE ou #SAPOT_REPORT_PERCENT */
+	uint8_t mode;
+
+	/** Reservado para uso futuro */
+	uint8_t rsv;
+
+	/** Intervalo máximo de silêncio, no formato de tempo SAPoT (veja SAPoTMessage_solicitation.timeSet); 0 desativa o heartbeat */
+	uint16_t heartbeat;
+
+	/** Limiar absoluto (na unidade do sensor) ou percentual do último valor publicado */
+	float threshold;
+
+}SAPoTMessage_deadband;
+
+/**
+* @brief Payload da configuração do relato por variação dos sensores de um Cliente.
+*
+* Payload emitido pelo Usuário (instrução = 0x0B) com a etiqueta do Cliente. A Central registra o intervalo máximo de silêncio 
+* na tabela de últimos valores, encaminha a configuração ao Cliente e reconhece a solicitação do Usuário, como no acionamento 
+* de um atuador. Esse payload possui 24 bytes.
+*
+*/
+typedef struct{
+
+	/** Etiqueta do Cliente */
+	uint8_t label[11];
+
+	/** Reservado para uso futuro */
+	uint8_t rsv;
+
+	/** Identificador do sensor, ou #SAPOT_REPORT_ALL_SENSORS */
+	uint16_t sensorId;
+
+	/** Reservado para uso futuro */
+	uint16_t rsv2;
+
+	/** Configuração de relato */
+	SAPoTMessage_deadband deadband;
+
+}SAPoTMessage_report;
+
+
+
+							/************************* Structs for SAPoTCentral *************************/
+
+/**
+* @brief Posição da tabela de apelidos mantida pela Central.
+*
+* Relaciona o apelido de um Cliente ao seu endereço MAC e à versão de protocolo negociada em seu cadastro. 
+* A versão é utilizada para definir o cabeçalho das mensagens que a Central envia ao Cliente (veja CTRLactuator()).
+*
+*/
+typedef struct{
+
+	/** Apelido do Cliente (#SAPOT_CENTRAL_ALIAS indica posição vazia) */
+	uint16_t alias;
+
+	/** Versão de protocolo negociada no cadastro */
+	uint8_t version;
+
+	/** Endereço MAC do Cliente */
+	uint8_t emitterId[6];
+
+}SAPoTCentral_device;
+
+/**
+* @brief Cliente cadastrado na Central (uma linha de tb_cadastrados).
+*
+*/
+typedef struct{
+
+	/** Etiqueta do Cliente */
+	char label[11];
+
+	/** Endereço MAC do Cliente em caixa alta (XX:XX:XX:XX:XX:XX) */
+	char macaddr[18];
+
+	/** Tipo de Cliente (veja SAPoTMessage_access) */
+	uint16_t type;
+
+	/** Quantidade de sensores */
+	uint8_t sensor;
+
+	/** Quantidade de atuadores */
+	uint8_t actuator;
+
+}SAPoTCentral_client;
+
+/**
+* @brief Armazenamento em memória (#MEMORY), alternativo ao MySQL.
+*
+* Mantém a tabela de Clientes cadastrados, em que o identificador de cada Cliente (e seu apelido v2) é sua posição mais um, como 
+* o identificador autoincrementado de tb_cadastrados. Os Clientes são localizados pelo endereço MAC através de uma tabela hash de 
+* endereçamento aberto; as consultas por etiqueta percorrem a tabela. As amostras dos lotes são apenas contabilizadas.
+*
+*/
+typedef struct{
+
+	/** Exclusão mútua da tabela */
+	pthread_mutex_t lock;
+
+	/** Clientes cadastrados */
+	SAPoTCentral_client* clients;
+
+	/** Quantidade de Clientes cadastrados */
+	int quantity;
+
+	/** Capacidade da tabela de Clientes (potência de 2) */
+	int capacity;
+
+	/** Tabela hash (2*capacity posições) com o identificador dos Clientes indexados pelo endereço MAC (0 indica posição vazia) */
+	int* index;
+
+	/** Quantidade de amostras recebidas em lotes */
+	unsigned long samples;
+
+}SAPoTCentral_memory;
+
+/**
+* @brief Cabeçalho de um buffer de SAPoTCentral_alloc(), que o precede na memória e identifica a sua origem.
+*
+*/
+typedef union{
+
+	/** Pool ao qual o bloco pertence (NULL se o buffer foi alocado no heap) */
+	struct SAPoTCentral_pool* pool;
+
+	/** Mantém o buffer alinhado em 8 bytes */
+	uint64_t align;
+
+}SAPoTCentral_block;
+
+/**
+* @brief Pool de buffers de tamanho fixo de uma thread da Central.
+*
+* Cada thread que trata mensagens (a thread do cliente MQTT de cada Central e a de SAPoTCentral_loop()) tem o seu pool, alocado
+* no primeiro SAPoTCentral_alloc() da thread. Os blocos são entregues por SAPoTCentral_alloc() e devolvidos por 
+* SAPoTCentral_release() através de uma pilha de blocos livres, sem exclusão mútua, de forma que o caminho de uma mensagem em 
+* regime permanente não realiza alocações no heap nem disputa o mutex do contexto compartilhado.
+*
+* Um bloco devolvido por outra thread (ex.: por um plugin) é empilhado, sem bloqueio, na pilha de devoluções do pool dono, que a 
+* recolhe quando os seus blocos livres se esgotam. O pool é liberado quando a thread dona termina e todos os seus blocos foram 
+* devolvidos.
+*
+*/
+typedef struct SAPoTCentral_pool{
+
+	/** Blocos de memória do pool, cada um precedido pelo seu SAPoTCentral_block */
+	uint8_t blocks[SAPOT_POOL_BLOCKS][sizeof(SAPoTCentral_block) + SAPOT_POOL_BLOCK_SIZE] __attribute__((aligned(8)));
+
+	/** Pilha de blocos livres (utilizada apenas pela thread dona) */
+	uint8_t* freeBlocks[SAPOT_POOL_BLOCKS];
+
+	/** Quantidade de blocos livres na pilha */
+	int freeCount;
+
+	/** Pilha de blocos devolvidos por outras threads, encadeados pelo início do buffer */
+	_Atomic(uint8_t*) returned;
+
+	/** Referências ao pool: uma por bloco em uso e uma da thread dona, até o seu término */
+	atomic_int references;
+
+}SAPoTCentral_pool;
+
+/**
+* @brief Estatísticas de alocação de memória da Central (veja SAPoTCentral_get_stats()).
+*
+* Em regime permanente heapAllocations não deve crescer: cada mensagem utiliza apenas blocos do pool. Os contadores somam os
+* pools de todas as threads e são atualizados atomicamente, sem o mutex do contexto compartilhado.
+*
+*/
+typedef struct{
+
+	/** Quantidade de blocos entregues pelos pools */
+	atomic_ulong poolAllocations;
+
+	/** Quantidade de alocações no heap realizadas pela Central (mensagens maiores que o bloco ou pool esgotado) */
+	atomic_ulong heapAllocations;
+
+	/** Quantidade de liberações de memória alocada no heap */
+	atomic_ulong heapReleases;
+
+	/** Quantidade de blocos dos pools em uso */
+	atomic_int poolInUse;
+
+	/** Maior quantidade de blocos dos pools em uso simultaneamente */
+	atomic_int poolPeak;
+
+}SAPoTCentral_stats;
+
+/**
+* @brief Versão e diário de alterações do diretório de Clientes (veja SAPoTMessage_directory).
+*
+* Cada cadastro ou alteração efetiva de um Cliente incrementa a versão e registra seu endereço MAC na posição 
+* (versão & (SAPOT_DIRECTORY_JOURNAL-1)) do diário, de forma que as alterações posteriores a uma versão ainda coberta pelo 
+* diário são enumeradas sem consultar o banco de dados. Protegido por SAPoTCentral_shared.lock.
+*
+*/
+typedef struct{
+
+	/** Identificador do processo (instante de início e pid), diferente de 0 */
+	uint32_t epoch;
+
+	/** Versão atual: quantidade de alterações registradas */
+	uint32_t version;
+
+	/** Endereços MAC dos Clientes alterados, indexados por (versão & (SAPOT_DIRECTORY_JOURNAL-1)) */
+	uint8_t journal[SAPOT_DIRECTORY_JOURNAL][6];
+
+}SAPoTCentral_directory;
+
+/**
+* @brief Posição da tabela de tipos de Cliente, que define o tópico de observação de suas mensagens (veja SAPoTCentral_watch()).
+*
+*/
+typedef struct{
+
+	/** Endereço MAC do Cliente (nulo indica posição vazia) */
+	uint8_t emitterId[6];
+
+	/** Tipo de Cliente (veja SAPoTMessage_registration) */
+	uint16_t type;
+
+}SAPoTCentral_clientType;
+
+/**
+* @brief Último valor de um sensor (veja CTRLupdate_readings()).
+*
+* Atualizado pelas amostras dos lotes (0x08). Com o relato por variação, o Cliente não publica leituras iguais à anterior: enquanto 
+* o último valor tiver menos de #SAPOT_READING_MISSED intervalos máximos de silêncio, ele continua sendo o valor atual do sensor. 
+* Sem intervalo máximo de silêncio conhecido, o último valor nunca é considerado desatualizado.
+*
+*/
+typedef struct{
+
+	/** Endereço MAC do Cliente (nulo indica posição vazia) */
+	uint8_t emitterId[6];
+
+	/** Identificador do sensor */
+	uint16_t sensorId;
+
+	/** Último valor relatado */
+	float value;
+
+	/** Intervalo máximo de silêncio, em milisegundos (0 se desconhecido ou desativado) */
+	uint32_t heartbeat;
+
+	/** Instante da leitura do último valor, em milisegundos desde 1970 (0 se nenhum valor foi relatado) */
+	int64_t instant;
+
+}SAPoTCentral_reading;
+
+/**
+* @brief Eco encaminhado a um Cliente, aguardando o seu reconhecimento (veja CTRLecho()).
+*
+* O Cliente devolve o payload do eco inalterado, inclusive o Usuário de origem e o serial. Por isso a Central só encaminha um 
+* reconhecimento que corresponda a um eco que ela encaminhou ao mesmo Cliente há menos de #SAPOT_ECHO_TIMEOUT, e o devolve à 
+* origem registrada, nunca à informada pelo Cliente.
+*
+*/
+typedef struct{
+
+	/** Endereço MAC do Cliente ao qual o eco foi encaminhado (nulo indica posição vazia) */
+	uint8_t emitterId[6];
+
+	/** Usuário que solicitou o eco */
+	uint8_t origin[6];
+
+	/** Serial da solicitação do Usuário */
+	uint16_t serial;
+
+	/** Instante de chegada da solicitação à Central, copiado em SAPoTMessage_echo.centralIn */
+	uint32_t centralIn;
+
+	/** Instante, em microssegundos (relógio monotônico da Central), após o qual o reconhecimento é descartado */
+	uint64_t expiry;
+
+}SAPoTCentral_echo;
+
+/**
+* @brief Contexto compartilhado entre Centrais de um mesmo processo.
+*
+* Um processo pode operar várias Centrais (ex.: uma por andar de um prédio), cada uma com seu próprio centralId, cliente MQTT
+* e conexão MySQL. Os recursos que não dependem do centralId ficam neste contexto: o arquivo de log, as 
+* estatísticas de alocação e a tabela de apelidos (as Centrais que o compartilham devem utilizar a mesma base de dados).
+* O acesso é protegido por um mutex, pois os manipuladores de Centrais diferentes executam em threads diferentes.
+*
+* O contexto é iniciado por SAPoTCentral_shared_init() e passado a SAPoTCentral_begin(). Se nenhum contexto for informado, 
+* a Central utiliza um contexto próprio (SAPoTCentral.ownShared).
+*
+*/
+typedef struct{
+
+	/** Exclusão mútua da tabela de apelidos, do diretório e das tabelas de tipos, de últimos valores e de ecos */
+	pthread_mutex_t lock;
+
+	/** Log assíncrono (veja SAPoTLog.h) */
+	SAPoTLog log;
+
+	/** Estatísticas de alocação de memória */
+	SAPoTCentral_stats stats;
+
+	/** Métricas de desempenho (veja SAPoTMetrics.h) */
+	SAPoTMetrics metrics;
+
+	/** Rastreamento amostrado das mensagens (veja SAPoTTrace.h), ativado por SAPoTTrace_enable() */
+	SAPoTTrace trace;
+
+	/** Captura do tráfego recebido (veja SAPoTCapture.h), ativada por SAPoTCapture_begin() */
+	SAPoTCapture capture;
+
+	/** Tabela de apelidos dos Clientes que negociaram a versão 2, indexada por (apelido & (SAPOT_ALIAS_CACHE_SIZE-1)) */
+	SAPoTCentral_device devices[SAPOT_ALIAS_CACHE_SIZE];
+
+	/** Armazenamento em memória, utilizado pelas Centrais configuradas com #MEMORY */
+	SAPoTCentral_memory memory;
+
+	/** Versão do diretório de Clientes, para as solicitações de acesso versionadas */
+	SAPoTCentral_directory directory;
+
+	/** Tipos dos Clientes, para os tópicos de observação, indexados pelo hash do endereço MAC */
+	SAPoTCentral_clientType types[SAPOT_WATCH_TYPES];
+
+	/** Últimos valores dos sensores, indexados pelo hash do endereço MAC e do sensor */
+	SAPoTCentral_reading readings[SAPOT_READINGS];
+
+	/** Ecos encaminhados aos Clientes que aguardam reconhecimento */
+	SAPoTCentral_echo echoes[SAPOT_ECHOES];
+
+}SAPoTCentral_shared;
+
+/**
+* @brief Estrutura para definir as opções de criação de uma Central SAPoT
+*
+* Essa estrutura armazena as informações pertinentes aos serviços de transmissão e banco de dados.
+* Na atual versão de protocolo, a Central SAPoT tem suporte apenas para o protocolo MQTT e SQL.
+*
+*/
+typedef struct{
+
+	/** identificador de protocolo de transmissão: \n 
+	* 	1: MQTT \n 
+	* 	2: LOOPBACK \n 
+	*/
+	uint8_t transmissionProtocol;
+	
+	/** Informações referente ao servidor de transmissão de mensagens */
+	struct{
+		
+		char* host; /*!< Endereço do servidor de transmissão */
+		
+		char* port; /*!< Porta de escuta do servidor de transmissão */
+		
+		char* user; /*!< Usuário para acessar o servidor de transmissão */
+		
+		char* pass; /*!< Senha para acessar o servidor de transmissão */
+		
+	}transmission;
+	
+	/** identificador de protocolo de banco de dados: \n 
+	* 	1: SQL \n 
+	* 	2: MEMORY \n 
+	*/
+	uint8_t databaseProtocol;
+	
+	/** Informações referente ao servidor de banco de dados */
+	struct{
+		
+		char* host; /*!< Endereço do servidor de banco de dados */
+		
+		char* port; /*!< Porta de escuta do servidor de banco de dados */
+		
+		char* user; /*!< Usuário para acessar o servidor de banco de dados */
+		
+		char* pass; /*!< Senha para acessar o servidor de banco de dados */
+		
+		char* dir; /*!< Diretório da base de dados */
+		
+	}database;
+
+	/** Lista de plugins de instrução (shared objects) separados por ':', carregados em SAPoTCentral_begin(). 
+	* Cada plugin deve exportar a função #SAPOTCENTRAL_PLUGIN_INIT, que registra suas instruções através de 
+	* SAPoTCentral_register_instruction(). NULL indica que nenhum plugin será carregado. */
+	char* plugins;
+
+	/** Intervalo, em segundos, de publicação das métricas no tópico <tt>centralId/stats</tt> por SAPoTCentral_loop(). 0 desativa a publicação. */
+	int statsInterval;
+
+	/** Republica as mensagens recebidas dos Clientes nos tópicos de observação <tt>centralId/watch/tipo/macaddr</tt> (veja 
+	* SAPoTCentral_watch()), assinados pelo <tt>gpc watch</tt>. Desativado, nenhuma publicação adicional é feita. */
+	bool watch;
+	
+}SAPoTCentral_create_options;
+
+/* Declaração antecipada do manipulador SAPoTCentral, utilizado pelos manipuladores de instrução */
+struct SAPoTCentral;
+
+/**
+* @brief Manipulador de uma instrução SAPoT.
+*
+* A Central mantém uma tabela com 256 manipuladores, indexada pelo código da instrução (SAPoTMessage_header.instruction). 
+* SAPoTCentral_unpack_message() verifica o comprimento mínimo do payload e evoca a validação do manipulador, enquanto 
+* SAPoTCentral_set_operation() evoca a execução e, se houver mensagem de resposta, a publica. As instruções padrão do 
+* protocolo são registradas em SAPoTCentral_begin(); novas instruções podem ser registradas pela aplicação ou por plugins
+* através de SAPoTCentral_register_instruction().
+*
+* Mensagens de reconhecimento (ack) recebidas pela Central são apenas validadas, nunca executadas.
+*
+*/
+typedef struct{
+
+	/** Nome da instrução (NULL indica posição sem manipulador) */
+	const char* name;
+
+	/** Comprimento mínimo do payload de uma requisição dessa instrução */
+	int payloadSize;
+
+	/** Estrutura e valida o payload recebido (SAPoTCentral.payload), preenchendo os ponteiros de payload do manipulador SAPoTCentral. 
+	* Retorna #SAPOTCENTRAL_SUCCESS ou #SAPOTCENTRAL_FAILURE (com SAPoTCentral.error definido). Opcional. */
+	int (*validate)(struct SAPoTCentral* handle);
+
+	/** Executa a instrução e monta a mensagem de resposta em SAPoTCentral.outMessage (obtida com SAPoTCentral_alloc()). Retorna o comprimento da resposta,
+	* 0 se a instrução não gera resposta ou #SAPOTCENTRAL_FAILURE. NULL indica que a instrução não possui operação na Central. */
+	int (*execute)(struct SAPoTCentral* handle);
+
+	/** Publica a resposta montada pela execução e devolve SAPoTCentral.outMessage com SAPoTCentral_release(). NULL indica a resposta padrão SAPoTCentral_respond(). */
+	int (*respond)(struct SAPoTCentral* handle, int outMessageLength);
+
+	/** Republica as mensagens recebidas dessa instrução nos tópicos de observação, com SAPoTCentral_create_options.watch ativo */
+	bool watched;
+
+	/** Executa a operação também para os reconhecimentos (ACK) recebidos dessa instrução (ex.: o eco devolvido pelo Cliente) */
+	bool acknowledged;
+
+}SAPoTCentral_instruction;
+
+/**
+* Nome da função que um plugin de instrução deve exportar. Ela possui o formato <tt>int SAPoTCentral_plugin_init(SAPoTCentral* handle)</tt> e 
+* retorna #SAPOTCENTRAL_SUCCESS após registrar as instruções do plugin na Central recebida. Com várias Centrais no mesmo processo, 
+* a função é evocada uma vez para cada Central que carrega o plugin.
+*
+*/
+#define SAPOTCENTRAL_PLUGIN_INIT "SAPoTCentral_plugin_init"
+
+/**
+* @brief Principal estrutura para operar uma Central SAPoT.
+*
+* Essa estrutura armazena as ferramentas necessárias para recepção, manipulação e envio 
+* de mensagem na Central SAPoT, bem como os maniuladores dos clientes MQTT e MySQL. 
+* Além disso, existem outras informações e flags importantes como: o identificador da 
+* Central no formato de endereço MAC, o indicador de erro, o contador serial de mensagens 
+* enviadas pela central e a flag de autorização da rotina de repetição SAPoTCentral_loop().
+*
+* Todo o estado da Central está contido nessa estrutura, que é passada a todas as funções da biblioteca. Assim, um 
+* processo pode operar várias Centrais simultaneamente (veja SAPoTCentral_shared).
+*
+*/
+typedef struct SAPoTCentral{
+
+	/** identificador da Central no formato macaddr (xx:xx:xx:xx:xx:xx) */
+	const char* id;
+	
+	/** Indicador de numero de erro */
+	int error;
+
+	/** 
+	* Flag que permite a execução da SAPoTCentral_loop() se a Central
+	* for inciada corretamente via SAPoTCentral_begin().
+	*/
+	bool inLoop;
+
+	/** Número serial referente as mensagem enviadas pela central*/
+	uint16_t serial;	
+
+	/** Ponteiro indicador da mensagem recebida */
+	uint8_t* inMessage;
+
+	/** Versão de protocolo da mensagem recebida */
+	uint8_t inVersion;
+
+	/** Flags v2 da mensagem recebida (0 para mensagens v1) */
+	uint8_t inFlags;
+
+	/** Ponteiro para o payload da mensagem recebida (logo após o cabeçalho, de comprimento variável na versão 2) */
+	uint8_t* payload;
+
+	/** Comprimento do payload da mensagem recebida */
+	int payloadLen;
+
+	/** Cabeçalho da mensagem recebida convertido para o formato da versão 1 */
+	SAPoTMessage_header headerData;
+
+	/** Tabela de manipuladores de instrução, indexada pelo código da instrução */
+	SAPoTCentral_instruction instructions[256];
+
+	/** Função de publicação recebida por SAPoTCentral_set_operation(), disponível aos manipuladores durante a execução */
+	int (*publish)(struct SAPoTCentral*, char*, void*, unsigned int);
+
+	/** Função de publicação do protocolo de transmissão (MQTTpublish() ou LOOPpublish()), definida em SAPoTCentral_begin() */
+	int (*transmit)(struct SAPoTCentral*, char*, void*, unsigned int);
+
+	/** Destino das publicações da transmissão em processo (veja SAPoTCentral_set_loopback()) */
+	void (*loopback)(void* context, const char* topic, const void* payload, unsigned int payloadLen);
+
+	/** Contexto repassado à função loopback */
+	void* loopbackContext;
+
+	/** Ponteiro indicador da mensagem a ser enviada para o Usuário */
+	void* outMessage;
+	
+	/** Ponteiro para o cabeçalho da mensagem recebida */
+	SAPoTMessage_header* header;
+	
+	/** Ponteiro para o payload de cadastro de novo cliente */
+	SAPoTMessage_registration* registration;
+	
+	/** Ponteiro para o payload de registro de informação */
+	SAPoTMessage_record* record;
+	
+	/** Ponteiro para o payload de modificação de informação */
+	SAPoTMessage_modification* modification;
+	
+	/** Ponteiro para o payload de solicitação de uso de algum cliente cadastrado */
+	SAPoTMessage_solicitation* solicitation;
+
+	/** Ponteiro para o cabeçalho do payload de registro em lote */
+	SAPoTMessage_batch* batch;
+
+	/** Vetor com as amostras do lote recebido (SAPoTMessage_batch.sampleQuantity posições) */
+	SAPoTMessage_sample* samples;
+
+	/** Ponteiro para a versão do diretório de uma solicitação de acesso versionada (NULL nas demais solicitações de acesso) */
+	SAPoTMessage_directory* directory;
+
+	/** Ponteiro para o payload de eco (solicitação do Usuário ou reconhecimento do Cliente) */
+	SAPoTMessage_echo* echo;
+
+	/** Ponteiro para o payload de configuração do relato por variação */
+	SAPoTMessage_report* report;
+	
+	/** Objeto referente ao cliente MQTT*/
+	MQTTClient MQTTclient;
+	
+	/** Objeto referente ao cliente MYSQL*/
+	MYSQL MYSQLclient;
+
+	/** Opções de criação da Central */
+	SAPoTCentral_create_options* opts;
+
+	/** Contexto compartilhado (arquivo de log, estatísticas e tabela de apelidos) */
+	SAPoTCentral_shared* shared;
+
+	/** Contexto próprio, utilizado quando nenhum contexto compartilhado é informado em SAPoTCentral_begin() */
+	SAPoTCentral_shared ownShared;
+
+	/** Texto das métricas publicadas no tópico de estatísticas, alocado na primeira publicação (veja SAPoTCentral_publish_metrics()) */
+	char* metricsText;
+
+	/** Estado da última tentativa de conexão com o broker MQTT */
+	int MQTTstatus;
+
+	/** Token da última mensagem MQTT entregue */
+	volatile MQTTClient_deliveryToken MQTTdeliveredtoken;
+
+	/** Tempo acumulado, em microssegundos, nas publicações da mensagem em tratamento (fase de publicação das métricas) */
+	uint64_t publishTime;
+
+	/** Indica se a mensagem em tratamento foi amostrada para o rastreamento (veja SAPOT_TRACE_BEGIN()) */
+	bool traced;
+	
+	
+}SAPoTCentral;
+
+
+					/************************* Functions for SAPoTCentral *************************/
+
+/** 
+* Essa função inicia a central SAPoT preenchendo as informações passadas pelo usuário através das estruturas SAPoTCentral
+* e SAPoTCentral_create_options. Além disso, inicia o arquivo de log e se o usuário optar por utilizar o modo local-padrão
+* essa função inicia os clientes para comunicação com os serviços MQTT e MySQL.
+*
+* @param handle Um ponteiro para o espaço de memória do tipo SAPoTCentral que deseja ser iniciado como Central.
+* @param opts Um ponteiro para o espaço de memória do tipo SAPoTCentral_create_options que contém as configurações iniciais
+* para operação da Central.
+* @param centralId Uma string no formato de um endereço MAC (XX:XX:XX:XX:XX:XX) que identifica a Central. Esse parâmetro 
+* deve ser único em uma rede que possua mais de uma Central SAPoT em operação.  
+* @param shared Contexto compartilhado com outras Centrais do processo (veja SAPoTCentral_shared), ou NULL para que a Central 
+* utilize um contexto próprio, com os arquivos de log de prefixo ucc_log.
 *  
 * @return Essa função retorna #SAPOTCENTRAL_FAILURE no caso de não conseguir iniciar a Central, ou retorna #SAPOTCENTRAL_SUCCESS 
 * em caso de sucesso.
 *
 */
-int SAPoTCentral_begin(SAPoTCentral* userPointer , SAPoTCentral_create_options* opts, const char* centralId);
+int SAPoTCentral_begin(SAPoTCentral* handle, SAPoTCentral_create_options* opts, const char* centralId, SAPoTCentral_shared* shared);
+
+/**
+* Inicia um contexto compartilhado entre Centrais: inicia o log assíncrono (nível #SAPOT_LOG_INFO, alterável em 
+* SAPoTCentral_shared.log.level), o pool de buffers e a tabela de apelidos.
+*
+* @param shared Contexto a ser iniciado.
+* @param logPrefix Prefixo dos arquivos de log binário, rotacionados a cada #SAPOT_LOG_MAX_SIZE bytes ou #SAPOT_LOG_MAX_AGE segundos.
+*
+* @return #SAPOTCENTRAL_SUCCESS, ou #SAPOTCENTRAL_FAILURE se o arquivo de log não puder ser criado.
+*
+*/
+int SAPoTCentral_shared_init(SAPoTCentral_shared* shared, const char* logPrefix);
+
+/**
+* Finaliza um contexto compartilhado, registrando as estatísticas de alocação e encerrando o log (os registros pendentes são escritos). Deve ser chamada 
+* após SAPoTCentral_end() de todas as Centrais que o utilizam.
+*
+* @param shared Contexto a ser finalizado.
+*
+*/
+void SAPoTCentral_shared_destroy(SAPoTCentral_shared* shared);
+
+/** 
+* Essa função finaliza os serviços da central SAPoT. Fecha o arquivo de log (se a Central utilizar um contexto próprio) e se 
+* estiver operando no modo local-padrão, encerra os serviços MQTT e MySQL. Não possue retorno.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* 
+*/
+void SAPoTCentral_end(SAPoTCentral* handle);
+
+/** 
+* Essa função pode ser utilizada se, e somente se a Central for configurada no modelo local-padrão através da definição 
+* #SAPOTCENTRAL_OPTS_STDLOCAL (veja também SAPoTCentral_create_options). Além disso, essa função mantém a conexão entre 
+* a Central e o broker MQTT realizando um ping no servidor MQTT a cada 30 segundos. Não possue retorno.  
+* Com várias Centrais no mesmo processo, basta executar a rotina de uma delas: as mensagens de cada Central são recebidas pela 
+* thread de seu cliente MQTT.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+*
+*/
+void SAPoTCentral_loop(SAPoTCentral* handle);
+
+/**
+* Essa função recebe uma mensagem e à estrutura utilizando os ponteiros SAPoTMessage do manipulador SAPoTCentral de acordo com 
+* a instrução contida em seu cabeçalho. No caso da Central operar em modeo local-padrão (veja SAPoTCentral_create_options 
+* e #SAPOTCENTRAL_OPTS_STDLOCAL) as mensagem são recebidas via MQTTmessageArrived() através do procotocolo MQTT. Não obstante,
+* essa função também armazena no arquivo de log os parâmetros do cabeçalho de todas as mensagem recebidas. (veja SAPoTMessage_header).
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param message Ponteiro @c void* para o espaço de memória da mensagem.
+* @param messageLen Um número inteiro referente ao comprimento da mensagem. 
+*
+* Mensagens nas versões 1 e 2 do protocolo são aceitas. O cabeçalho v2 é convertido para SAPoTCentral.headerData e, se o emissor 
+* estiver identificado por um apelido, este é resolvido para o endereço MAC através da tabela de apelidos (ou do banco de dados).
+*
+* @return Essa função retorna #SAPOTCENTRAL_FAILURE para o caso da versão de protocolo da mensagem não ser suportada pela Central, 
+* da mensagem estar malformada ou do apelido do emissor ser desconhecido, ou retorna #SAPOTCENTRAL_SUCCESS caso contrário.  
+*
+*/
+int SAPoTCentral_unpack_message(SAPoTCentral* handle, void* message, int messageLen);
+
+/**
+* Subrotina de SAPoTCentral_unpack_message(): Converte o cabeçalho v2 de SAPoTCentral.inMessage para SAPoTCentral.headerData, 
+* resolve o apelido do emissor e desloca o payload para o início do buffer recebido (mantendo seu alinhamento). Uma mensagem 
+* cujo comprimento declarado difere do comprimento recebido é rejeitada com #ERROR_MALFORMED_MESSAGE.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param messageLen Comprimento da mensagem recebida.
+*
+* @return #SAPOTCENTRAL_SUCCESS ou #SAPOTCENTRAL_FAILURE (veja SAPoTCentral.error).
+*
+*/
+int SAPoTCentral_unpack_v2(SAPoTCentral* handle, int messageLen);
+
+/**
+* Converte, no mesmo espaço de memória, uma mensagem com cabeçalho v1 emitida pela Central para o cabeçalho v2 
+* (identificando a Central pelo apelido #SAPOT_CENTRAL_ALIAS). O payload é deslocado para logo após o novo cabeçalho.
+*
+* @param message Mensagem com cabeçalho SAPoTMessage_header.
+* @param messageLen Comprimento total da mensagem.
+*
+* @return O comprimento total da mensagem convertida.
+*
+*/
+int SAPoTCentral_pack_v2(uint8_t* message, int messageLen);
+
+/**
+* Preenche o cabeçalho v1 de uma resposta (ACK) da Central à mensagem em tratamento: mesma instrução e serial da requisição,
+* flags reservadas zeradas e a Central como emissora. Utilizada pelos manipuladores ao montar SAPoTCentral.outMessage.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param header Cabeçalho da resposta.
+* @param outMessageLength Comprimento total da resposta.
+*
+*/
+void SAPoTCentral_ack_header(SAPoTCentral* handle, SAPoTMessage_header* header, int outMessageLength);
+
+/**
+* Formata um identificador de Cliente como seu endereço MAC em caixa alta (XX:XX:XX:XX:XX:XX), que é também o tópico MQTT do Cliente.
+*
+* @param emitterId Identificador do Cliente.
+* @param topic Destino, com espaço para 18 caracteres.
+*
+*/
+void SAPoTCentral_topic(const uint8_t emitterId[6], char topic[18]);
+
+/**
+* Serializa um cliente cadastrado na carga útil da resposta de acesso (veja SAPoTMessage_access).
+*
+* @param payload Posição de escrita na carga útil.
+* @param client Cliente cadastrado.
+* @param compact Utiliza a codificação compacta em vez da seção fixa SAPoTMessage_access.
+* @param previous Na codificação delta, endereço MAC do cliente anterior (atualizado com o endereço serializado); NULL caso contrário.
+*
+* @return A quantidade de bytes escritos (no máximo 25 na codificação compacta).
+*
+*/
+int SAPoTCentral_pack_access(uint8_t* payload, const SAPoTCentral_client* client, bool compact, uint8_t previous[6]);
+
+/**
+* Essa função pode ser utilizada se, e somente se a Central for configurada no modelo local-padrão através da definição 
+* #SAPOTCENTRAL_OPTS_STDLOCAL (veja também SAPoTCentral_create_options). Após a execução da SAPoTCentral_unpack_message() 
+* essa função evoca a execução do manipulador da instrução contida no cabeçalho (veja SAPoTCentral_instruction). 
+* As instruções padrão são executadas por: 
+* <ul>
+* <li> 0x00: MYSQLregistration() </li> 
+* <li> 0x01: sem operação na Central</li>
+* <li> 0x02: sem operação na Central</li>
+* <li> 0x03: CTRLactuator() </li>
+* <li> 0x04: MYSQLaccess() </li>
+* <li> 0x05: sem operação na Central</li>
+* <li> 0x06: MYSQLmodification() </li>
+* <li> 0x08: MYSQLbatch() </li>
+* <li> 0x09: CTRLstatistics() </li>
+* <li> 0x0A: CTRLecho() (também para os reconhecimentos) </li>
+* <li> 0x0B: CTRLreport() </li>
+* </ul> 
+* Com o armazenamento em memória (#MEMORY), as funções MYSQL* e CTRLactuator() são substituídas pelas funções MEM* equivalentes.
+*
+* Além disso, após operar com sucesso envia-se a mensagem de resposta (reconhecimento) para o emissor da instrução.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param publish Ponteiro para uma função que realiza a transmissão de mensagens para comunicar a Central com os Clientes e 
+* Usuários. Essa função deve receber uma string com o endereço do destinatário da mensagem, um @c void* com o conteúdo da 
+* mensagem e um inteiro positivo com o comprimento total da mensagem.   
+* 
+* @return Essa função retorna #SAPOTCENTRAL_FAILURE em dois casos: Primeiramente se ocorrer algum erro na operação realizada, 
+* ou em segundo momento se não for possível enviar a mensagem de reconhecimento. Contudo, essa função retorna #SAPOTCENTRAL_SUCCESS
+* se a operação for realizada com sucesso e se a mensagem de reconhecimento for enviada ao emissor da instrução. 
+*
+*/
+int SAPoTCentral_set_operation(SAPoTCentral* handle, int (*publish)(SAPoTCentral*, char*, void*, unsigned int));
+
+/**
+* Trata uma mensagem recebida pela Central: a estrutura via SAPoTCentral_unpack_message() e a executa via SAPoTCentral_set_operation() 
+* com a função de publicação do protocolo de transmissão, contabilizando as métricas e o rastreamento. É evocada por MQTTmessageArrived() 
+* e, com a transmissão em processo (#LOOPBACK), diretamente pela aplicação, na thread que trata as mensagens da Central.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param message Mensagem SAPoT recebida (com cabeçalho v2, o buffer é modificado).
+* @param messageLen Comprimento da mensagem.
+*
+* @return #SAPOTCENTRAL_SUCCESS ou #SAPOTCENTRAL_FAILURE (veja SAPoTCentral.error).
+*
+*/
+int SAPoTCentral_receive(SAPoTCentral* handle, void* message, int messageLen);
+
+/**
+* Republica a mensagem em tratamento, já estruturada, no tópico de observação <tt>centralId/watch/TTTT/XX:XX:XX:XX:XX:XX</tt>, 
+* com o tipo do emissor em hexadecimal (#SAPOT_WATCH_UNKNOWN_TYPE se desconhecido) e seu endereço MAC. A mensagem é republicada 
+* sempre com o cabeçalho v1, com o emissor resolvido nas mensagens v2 identificadas por apelido. É evocada por SAPoTCentral_receive() 
+* para as instruções marcadas em SAPoTCentral_instruction.watched, se SAPoTCentral_create_options.watch estiver ativo.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+*
+* @return #SAPOTCENTRAL_SUCCESS ou #SAPOTCENTRAL_FAILURE se a publicação falhar.
+*
+*/
+int SAPoTCentral_watch(SAPoTCentral* handle);
+
+/**
+* Define o destino das publicações da transmissão em processo (#LOOPBACK). Deve ser evocada após SAPoTCentral_begin(). Sem destino, 
+* as publicações são descartadas.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param loopback Função que recebe cada publicação da Central (tópico, mensagem e comprimento), na thread que a publicou. A mensagem
+* pertence à Central e só é válida durante a chamada.
+* @param context Contexto repassado à função.
+*
+*/
+void SAPoTCentral_set_loopback(SAPoTCentral* handle, void (*loopback)(void*, const char*, const void*, unsigned int), void* context);
+
+/**
+* Essa função mostra na tela através de um printf a definição do error contido no manipulador SAPoTCentral.
+* 
+* @retrun retorna o número do erro contido no manipulador SAPoTCentral. 
+*
+*/
+int SAPoTCentral_error(SAPoTCentral* handle);
 
-/** 
-* Essa função finaliza os serviços da central SAPoT. Fecha o arquivo de log e se estiver operando no modo local-padrão, 
-* encerra os serviços MQTT e MySQL. Não possue parâmetros de entrada nem retorno.
-* 
+/**
+* Retorna as estatísticas de alocação de memória da Central, permitindo verificar se o caminho das mensagens
+* permanece livre de alocações no heap sob carga.
+*
+* @return Ponteiro para as estatísticas contidas no manipulador SAPoTCentral.
+*
 */
-void SAPoTCentral_end();
+const SAPoTCentral_stats* SAPoTCentral_get_stats(SAPoTCentral* handle);
 
-/** 
-* Essa função pode ser utilizada se, e somente se a Central for configurada no modelo local-padrão através da definição 
-* #SAPOTCENTRAL_OPTS_STDLOCAL (veja também SAPoTCentral_create_options). Além disso, essa função mantém a conexão entre 
-* a Central e o broker MQTT realizando um ping no servidor MQTT a cada 30 segundos. Não possue parâmetros de entrada nem 
-* retorno.  
+/**
+* Gera as métricas de um contexto compartilhado no formato de texto do Prometheus: as métricas de SAPoTMetrics_render() acrescidas
+* da ocupação do pool de buffers, dos registros de log pendentes e dos últimos valores dos sensores (sapot_sensor_value, omitido 
+* quando desatualizado, e sapot_sensor_age_seconds). É a função de geração do servidor de métricas do contexto.
+*
+* @param context Ponteiro para o contexto SAPoTCentral_shared.
+* @param buffer Buffer de destino.
+* @param size Tamanho do buffer.
+* @param topDevices Quantidade de dispositivos de maior taxa incluídos.
+*
+* @return Comprimento do texto gerado.
 *
 */
-void SAPoTCentral_loop(); 
+size_t SAPoTCentral_metrics_render(void* context, char* buffer, size_t size, int topDevices);
 
 /**
-* Essa função recebe uma mensagem e à estrutura utilizando os ponteiros SAPoTMessage do manipulador SAPoTCentral de acordo com 
-* a instrução contida em seu cabeçalho. No caso da Central operar em modeo local-padrão (veja SAPoTCentral_create_options 
-* e #SAPOTCENTRAL_OPTS_STDLOCAL) as mensagem são recebidas via MQTTmessageArrived() através do procotocolo MQTT. Não obstante,
-* essa função também armazena no arquivo de log os parâmetros do cabeçalho de todas as mensagem recebidas. (veja SAPoTMessage_header).
+* Inicia o servidor HTTP de métricas de um contexto compartilhado (veja SAPoTMetrics_listen()). O servidor é encerrado por
+* SAPoTCentral_shared_destroy().
 *
-* @param message Ponteiro @c void* para o espaço de memória da mensagem.
-* @param messageLen Um número inteiro referente ao comprimento da mensagem. 
+* @param shared Contexto compartilhado.
+* @param address "porta" ou "host:porta" TCP (padrão 127.0.0.1) ou o caminho de um socket UNIX.
 *
-* @return Essa função retorna #SAPOTCENTRAL_FAILURE para o caso da versão de protocolo da mensagem não coincidir com versão de 
-* protocolo da Central, ou retorna #SAPOTCENTRAL_SUCCESS caso contrário.  
+* @return #SAPOTCENTRAL_SUCCESS, ou #SAPOTCENTRAL_FAILURE se o servidor não puder ser iniciado.
 *
 */
-int SAPoTCentral_unpack_message(void* message, int messageLen);
+int SAPoTCentral_metrics_listen(SAPoTCentral_shared* shared, const char* address);
 
 /**
-* Essa função pode ser utilizada se, e somente se a Central for configurada no modelo local-padrão através da definição 
-* #SAPOTCENTRAL_OPTS_STDLOCAL (veja também SAPoTCentral_create_options). Após a execução da SAPoTCentral_unpack_message() 
-* essa função utiliza da instrução contida no cabeçalho do manipulador SAPoTCentral para operar com tais possibilidades: 
-* <ul>
-* <li> 0x00: MYSQLregistration() </li> 
-* <li> 0x01: </li>
-* <li> 0x02: </li>
-* <li> 0x03: CTRLactuator() </li>
-* <li> 0x04: MYSQLaccess() </li>
-* <li> 0x05: </li>
-* <li> 0x06: MYSQLmodification() </li>
-* </ul> 
+* Publica as métricas do contexto da Central no tópico <tt>centralId/stats</tt>. Evocada periodicamente por SAPoTCentral_loop()
+* se SAPoTCentral_create_options.statsInterval for positivo.
 *
-* Além disso, após operar com sucesso envia-se uma mensagem de reconhecimento para o emissor da instrução.
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
 *
-* @param publish Ponteiro para uma função que realiza a transmissão de mensagens para comunicar a Central com os Clientes e 
-* Usuários. Essa função deve receber uma string com o endereço do destinatário da mensagem, um @c void* com o conteúdo da 
-* mensagem e um inteiro positivo com o comprimento total da mensagem.   
-* 
-* @return Essa função retorna #SAPOTCENTRAL_FAILURE em dois casos: Primeiramente se ocorrer algum erro na operação realizada, 
-* ou em segundo momento se não for possível enviar a mensagem de reconhecimento. Contudo, essa função retorna #SAPOTCENTRAL_SUCCESS
-* se a operação for realizada com sucesso e se a mensagem de reconhecimento for enviada ao emissor da instrução. 
+* @return #SAPOTCENTRAL_SUCCESS ou #SAPOTCENTRAL_FAILURE se a publicação falhar.
 *
 */
-int SAPoTCentral_set_operation(int (*publish)(char*, void*, unsigned int));
+int SAPoTCentral_publish_metrics(SAPoTCentral* handle);
 
 /**
-* Essa função mostra na tela através de um printf a definição do error contido no manipulador SAPoTCentral.
-* 
-* @retrun retorna o número do erro contido no manipulador SAPoTCentral. 
+* Exporta os intervalos do rastreamento do contexto no formato JSON de eventos do Chrome (veja SAPoTTrace_dump()). Evocada por 
+* SAPoTCentral_loop() quando SAPoTTrace.dumpRequested é ativado (ex.: pelo tratamento de um sinal).
+*
+* @param shared Contexto compartilhado.
+* @param path Caminho do arquivo de destino. NULL utiliza o prefixo do log seguido de <tt>-trace-AAAAMMDD-HHMMSS.json</tt>.
+*
+* @return Quantidade de intervalos exportados ou #SAPOTCENTRAL_FAILURE se o arquivo não puder ser escrito.
+*
+*/
+int SAPoTCentral_trace_dump(SAPoTCentral_shared* shared, const char* path);
+
+/**
+* Obtém um buffer do pool da thread que a evoca (veja SAPoTCentral_pool). Se o comprimento solicitado for maior que 
+* #SAPOT_POOL_BLOCK_SIZE ou se o pool estiver esgotado, o buffer é alocado no heap e contabilizado em SAPoTCentral_stats.heapAllocations.
+* O buffer pode ser devolvido por qualquer thread.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param size Comprimento do buffer.
+*
+* @return Ponteiro para o buffer (alinhado em 8 bytes), ou NULL se não houver memória.
+*
+*/
+void* SAPoTCentral_alloc(SAPoTCentral* handle, size_t size);
+
+/**
+* Devolve ao pool de origem (ou libera do heap) um buffer obtido por SAPoTCentral_alloc(), em qualquer thread. A devolução ao pool 
+* da própria thread não utiliza operações atômicas sobre o pool.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param buffer Buffer a ser devolvido. NULL é ignorado.
+*
+*/
+void SAPoTCentral_release(SAPoTCentral* handle, void* buffer);
+
+/**
+* Registra (ou substitui) o manipulador de uma instrução na tabela de instruções da Central. Deve ser chamada após 
+* SAPoTCentral_begin(), que registra as instruções padrão e carrega os plugins.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param instruction Código da instrução (SAPoTMessage_header.instruction).
+* @param handler Manipulador da instrução; é copiado para a tabela. Um manipulador com nome NULL remove a instrução.
+*
+* @return #SAPOTCENTRAL_SUCCESS.
+*
+*/
+int SAPoTCentral_register_instruction(SAPoTCentral* handle, uint8_t instruction, const SAPoTCentral_instruction* handler);
+
+/**
+* Carrega os plugins de instrução listados em SAPoTCentral_create_options.plugins (veja #SAPOTCENTRAL_PLUGIN_INIT).
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param plugins Lista de caminhos de shared objects separados por ':'.
+*
+* @return #SAPOTCENTRAL_SUCCESS, ou #SAPOTCENTRAL_FAILURE se algum plugin não puder ser carregado ou inicializado.
+*
+*/
+int SAPoTCentral_load_plugins(SAPoTCentral* handle, const char* plugins);
+
+/**
+* Resposta padrão dos manipuladores de instrução: publica SAPoTCentral.outMessage no tópico do emissor da mensagem recebida 
+* (convertendo-a para a versão 2 se a mensagem recebida era v2) e devolve a resposta ao pool (SAPoTCentral_release()).
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param outMessageLength Comprimento da mensagem de resposta.
+*
+* @return #SAPOTCENTRAL_SUCCESS ou #SAPOTCENTRAL_FAILURE se a publicação falhar.
+*
+*/
+int SAPoTCentral_respond(SAPoTCentral* handle, int outMessageLength);
+
+/**
+* Gera um evento no log binário da Central (veja SAPoTLog_record). Eventos de mensagem (abaixo de #SAPOT_EVENT_CENTRAL)
+* carregam a instrução, o serial e o emissor da mensagem em tratamento; todos os eventos carregam o código de erro corrente.
+*
+* @param handle Ponteiro para o manipulador SAPoTCentral da Central.
+* @param level Nível do evento (#SAPOT_LOG_DEBUG a #SAPOT_LOG_ERROR).
+* @param event Tipo de evento (SAPOT_EVENT_*).
+* @param value Argumento do evento.
+* @param aux Argumento auxiliar do evento.
 *
 */
-int SAPoTCentral_error();
+void SAPoTCentral_log(SAPoTCentral* handle, int level, uint8_t event, uint32_t value, uint32_t aux);
 
 
 					/************************* Functions for MQTT **************************/
@@ -774,7 +1973,7 @@ int SAPoTCentral_error();
 * @see <a href="https://www.eclipse.org/paho">Projeto Eclipse Paho </a>   
 *
 */
-int MQTTconnect();
+int MQTTconnect(SAPoTCentral* handle);
 
 /**
 * Essa função foi implementada baseada na biblioteca MQTTClient.h do projeto Eclipse Paho. Ela possui um padrão de argumentos 
@@ -812,41 +2011,321 @@ void MQTTconnectionLost(void* context, char* cause);
 * 
 *
 */
-int MQTTpublish(char* topic, void* payload, unsigned int payloadLen);
+int MQTTpublish(SAPoTCentral* handle, char* topic, void* payload, unsigned int payloadLen);
+
+
+					/************************* Functions for Loopback *************************/
+
+/**
+* Função: Publicação da transmissão em processo (#LOOPBACK): entrega a mensagem à função SAPoTCentral.loopback, contabilizando-a 
+* nas métricas e no rastreamento como MQTTpublish().
+*
+*/
+int LOOPpublish(SAPoTCentral* handle, char* topic, void* payload, unsigned int payloadLen);
 					
 					
+					/************************* Functions for Instructions *************************/
+
+/**
+* Função: Estrutura o payload de cadastro (0x00).
+*
+*/
+int SAPoTCentral_validate_registration(SAPoTCentral* handle);
+
+/**
+* Função: Estrutura o payload de solicitação (0x01 a 0x03).
+*
+*/
+int SAPoTCentral_validate_solicitation(SAPoTCentral* handle);
+
+/**
+* Função: Estrutura o payload opcional de acesso (0x04): a versão do diretório, nas solicitações versionadas (flags rsv1 e rsv3).
+*
+*/
+int SAPoTCentral_validate_access(SAPoTCentral* handle);
+
+/**
+* Função: Estrutura o payload de registro (0x05).
+*
+*/
+int SAPoTCentral_validate_record(SAPoTCentral* handle);
+
+/**
+* Função: Estrutura o payload de etiquetagem (0x06), garantindo o terminador nulo do endereço MAC e da etiqueta.
+*
+*/
+int SAPoTCentral_validate_modification(SAPoTCentral* handle);
+
+/**
+* Função: Estrutura o payload de registro em lote (0x08), verificando se a mensagem comporta as amostras declaradas.
+*
+*/
+int SAPoTCentral_validate_batch(SAPoTCentral* handle);
+
+/**
+* Função: Estrutura o payload de eco (0x0A), da solicitação ou do reconhecimento, garantindo o terminador nulo da etiqueta.
+*
+*/
+int SAPoTCentral_validate_echo(SAPoTCentral* handle);
+
+/**
+* Função: Estrutura o payload de configuração do relato por variação (0x0B), garantindo o terminador nulo da etiqueta.
+*
+*/
+int SAPoTCentral_validate_report(SAPoTCentral* handle);
+
+
 					/************************* Functions for MySQL *************************/
 					
 /**
 * Função: Conecta o cliente ao servidor MySQL
 *
 */					
-int MYSQLconnect();
+int MYSQLconnect(SAPoTCentral* handle);
+
+/**
+* Função: Encerra a conexão aberta por MYSQLconnect(), contabilizando-a nas métricas
+*
+*/
+void MYSQLclose(SAPoTCentral* handle);
+
+/**
+* Função: Solicita uma query ao servidor MySQL (mysql_real_query()), registrando-a no rastreamento
+*
+*/
+int MYSQLquery(SAPoTCentral* handle, const char* query, unsigned long length);
 
 /**
 * Função: Realiza as operações necessárias no banco de dados MYSQL 
 * para cadastrar ou atualizar as informações de cadastrado de um cliente SAPoT.
 *
 */
-int MYSQLregistration();
+int MYSQLregistration(SAPoTCentral* handle);
 
 /**
 * Função: Realiza a etiquetagem de um cliente SAPoT ja cadastrados no banco de dados MYSQL.
 *
 */
-int MYSQLmodification();
+int MYSQLmodification(SAPoTCentral* handle);
 
 /**
 * Função: Acessa os dados de todos os clientes cadastrados no banco de dados MYSQL.
 *
 */
-int MYSQLaccess();
+int MYSQLaccess(SAPoTCentral* handle);
+
+/**
+* Função: Armazena, em uma única query, todas as amostras de um lote (instrução 0x08) na tabela tb_registros.
+*
+*/
+int MYSQLbatch(SAPoTCentral* handle);
+
+/**
+* Função: Copia em macaddr o endereço MAC do Cliente de etiqueta label, com a conexão ao banco de dados já aberta. Retorna 
+* #SAPOTCENTRAL_FAILURE (com SAPoTCentral.error definido) se a etiqueta não estiver cadastrada.
+*
+*/
+int MYSQLlabel(SAPoTCentral* handle, const uint8_t* label, char macaddr[18]);
+
+/**
+* Função: Busca no banco de dados o endereço MAC do Cliente de apelido alias, preenche device e o insere na tabela de apelidos.
+*
+*/
+int MYSQLalias(SAPoTCentral* handle, uint16_t alias, SAPoTCentral_device* device);
+
+/**
+* Função: Converte uma linha de tb_cadastrados (id, label, macaddr, type, sensor, actuator) em client, com o endereço MAC em caixa alta.
+*
+*/
+void MYSQLrow(MYSQL_ROW sqlRow, SAPoTCentral_client* client);
+
+
+					/************************* Functions for Memory storage *************************/
+
+/**
+* Função: Inicia o armazenamento em memória vazio (evocada por SAPoTCentral_shared_init()).
+*
+*/
+void MEMinit(SAPoTCentral_memory* memory);
+
+/**
+* Função: Libera a tabela de Clientes do armazenamento em memória (evocada por SAPoTCentral_shared_destroy()).
+*
+*/
+void MEMend(SAPoTCentral_memory* memory);
+
+/**
+* Função: Retorna o identificador do Cliente de endereço macaddr, ou 0 se ele não estiver cadastrado. Deve ser evocada com 
+* SAPoTCentral_memory.lock adquirido.
+*
+*/
+int MEMfind(SAPoTCentral_memory* memory, const char* macaddr);
+
+/**
+* Função: Cadastra o Cliente de endereço macaddr, com a etiqueta padrão, ampliando a tabela se necessário. Retorna seu 
+* identificador, ou 0 se não houver memória. Deve ser evocada com SAPoTCentral_memory.lock adquirido.
+*
+*/
+int MEMinsert(SAPoTCentral_memory* memory, const char* macaddr);
+
+/**
+* Função: Cadastra ou atualiza as informações de cadastro de um cliente SAPoT no armazenamento em memória (equivalente a MYSQLregistration()).
+*
+*/
+int MEMregistration(SAPoTCentral* handle);
+
+/**
+* Função: Realiza a etiquetagem de um cliente SAPoT no armazenamento em memória (equivalente a MYSQLmodification()).
+*
+*/
+int MEMmodification(SAPoTCentral* handle);
+
+/**
+* Função: Acessa os dados de todos os clientes cadastrados no armazenamento em memória (equivalente a MYSQLaccess()).
+*
+*/
+int MEMaccess(SAPoTCentral* handle);
+
+/**
+* Função: Contabiliza as amostras de um lote (instrução 0x08) e o reconhece (equivalente a MYSQLbatch()).
+*
+*/
+int MEMbatch(SAPoTCentral* handle);
+
+/**
+* Função: Busca no armazenamento em memória o Cliente de apelido alias (equivalente a MYSQLalias()).
+*
+*/
+int MEMalias(SAPoTCentral* handle, uint16_t alias, SAPoTCentral_device* device);
+
+/**
+* Função: Busca no armazenamento em memória o Cliente de etiqueta SAPoTCentral.solicitation->label e lhe encaminha o 
+* acionamento através de CTRLdrive() (equivalente a CTRLactuator()).
+*
+*/
+int MEMactuator(SAPoTCentral* handle);
+
+/**
+* Função: Copia em macaddr o endereço MAC do Cliente de etiqueta label (equivalente a MYSQLlabel()).
+*
+*/
+int MEMlabel(SAPoTCentral* handle, const uint8_t* label, char macaddr[18]);
 
 
 					/************************* Client control functions *************************/
 
 
-int CTRLactuator(int (*publish)(char*, void*, unsigned int));
+/**
+* Função: Encaminha a solicitação de acionamento (0x03) ao Cliente de etiqueta SAPoTCentral.solicitation->label, 
+* através da função de publicação SAPoTCentral.publish.
+*
+*/
+int CTRLactuator(SAPoTCentral* handle);
+
+/**
+* Função: Publica no tópico macaddr o acionamento solicitado em SAPoTCentral.solicitation (com o cabeçalho v2 se o Cliente o 
+* negociou) e monta o reconhecimento ao Usuário. Retorna o comprimento do reconhecimento ou #SAPOTCENTRAL_FAILURE.
+*
+*/
+int CTRLdrive(SAPoTCentral* handle, const char* macaddr);
+
+/**
+* Função: Encaminha a solicitação de eco (0x0A) ao Cliente de etiqueta SAPoTCentral.echo->label, e o reconhecimento do 
+* Cliente ao Usuário que a solicitou (veja SAPoTMessage_echo). O reconhecimento só é encaminhado se corresponder a um eco pendente 
+* (veja SAPoTCentral_echo); caso contrário, falha com #ERROR_UNEXPECTED_ECHO. Não monta resposta ao emissor: retorna 0 ou 
+* #SAPOTCENTRAL_FAILURE.
+*
+*/
+int CTRLecho(SAPoTCentral* handle);
+
+/**
+* Função: Encaminha a configuração de relato (0x0B) ao Cliente de etiqueta SAPoTCentral.report->label, registra seu intervalo 
+* máximo de silêncio na tabela de últimos valores e monta o reconhecimento ao Usuário.
+*
+*/
+int CTRLreport(SAPoTCentral* handle);
+
+/**
+* Função: Registra na tabela de últimos valores a configuração de relato deadband do sensor sensorId (ou de todos os sensores 
+* já relatados, com #SAPOT_REPORT_ALL_SENSORS) do Cliente de endereço MAC emitterId.
+*
+*/
+void CTRLset_report(SAPoTCentral* handle, const uint8_t emitterId[6], uint16_t sensorId, const SAPoTMessage_deadband* deadband);
+
+/**
+* Função: Atualiza a tabela de últimos valores com as amostras do lote em tratamento (instrução 0x08), mantendo a mais recente de 
+* cada sensor.
+*
+*/
+void CTRLupdate_readings(SAPoTCentral* handle);
+
+/**
+* Função: Conclui o cadastro do Cliente de identificador id (negociação da versão e tabela de apelidos) e monta o reconhecimento, 
+* que na versão 2 contém o apelido atribuído. Retorna o comprimento do reconhecimento.
+*
+*/
+int CTRLregistration(SAPoTCentral* handle, unsigned long id);
+
+/**
+* Função: Registra no diretório a alteração do Cliente de endereço macaddr (cadastro, etiqueta, tipo, sensores ou atuadores).
+*
+*/
+void CTRLdirectory_change(SAPoTCentral* handle, const char* macaddr);
+
+/**
+* Função: Preenche answer com a versão atual do diretório e copia em macaddrs (espaço para #SAPOT_DIRECTORY_JOURNAL endereços) 
+* os endereços dos Clientes alterados desde a versão da solicitação versionada SAPoTCentral.directory. Retorna a quantidade 
+* de Clientes alterados, ou #SAPOTCENTRAL_FAILURE se a tabela completa deve ser enviada (answer->full ativo).
+*
+*/
+int CTRLdirectory_since(SAPoTCentral* handle, char macaddrs[][18], SAPoTMessage_directory* answer);
+
+/**
+* Função: Aloca SAPoTCentral.outMessage com outMessageLength bytes, preenche o cabeçalho da resposta de acesso (flags de 
+* codificação e, nas solicitações versionadas, a versão answer) e retorna a posição da tabela na carga útil.
+*
+*/
+uint8_t* CTRLaccess_header(SAPoTCentral* handle, int outMessageLength, bool compact, bool delta, const SAPoTMessage_directory* answer);
+
+/**
+* Função: Responde à consulta de estatísticas (0x09) com as estatísticas do dispositivo informado ou dos dispositivos 
+* de maior taxa de mensagens (veja SAPoTMessage_statistics).
+*
+*/
+int CTRLstatistics(SAPoTCentral* handle);
+
+/**
+* Função: Procura na tabela de apelidos o Cliente de endereço MAC emitterId e copia sua posição em device. Retorna 
+* #SAPOTCENTRAL_FAILURE se o Cliente não negociou a versão 2.
+*
+*/
+int CTRLfind_device(SAPoTCentral* handle, const uint8_t emitterId[6], SAPoTCentral_device* device);
+
+/**
+* Função: Copia em device a posição da tabela de apelidos referente ao apelido alias. Retorna #SAPOTCENTRAL_FAILURE se o apelido 
+* não estiver na tabela.
+*
+*/
+int CTRLfind_alias(SAPoTCentral* handle, uint16_t alias, SAPoTCentral_device* device);
+
+/**
+* Função: Atualiza a tabela de apelidos com a posição device, removendo posições anteriores do mesmo Cliente. Um apelido 
+* #SAPOT_CENTRAL_ALIAS apenas remove o Cliente da tabela (recadastro na versão 1).
+*
+*/
+void CTRLupdate_device(SAPoTCentral* handle, const SAPoTCentral_device* device);
+
+/**
+* Função: Registra na tabela de tipos o tipo do Cliente de endereço MAC emitterId (informado em seu cadastro).
+*
+*/
+void CTRLset_type(SAPoTCentral* handle, const uint8_t emitterId[6], uint16_t type);
+
+/**
+* Função: Retorna o tipo do Cliente de endereço MAC emitterId, ou #SAPOT_WATCH_UNKNOWN_TYPE se ele não estiver na tabela de tipos.
+*
+*/
+uint16_t CTRLfind_type(SAPoTCentral* handle, const uint8_t emitterId[6]);
 
 
 		
@@ -864,5 +2343,24 @@ void upper_string(char s[]);
 */
 void getmacID(const char* MAC, uint8_t ID[6]);
 
+/**
+* Função: Escreve um inteiro sem sinal no formato varint (7 bits por byte, bit mais significativo indica continuação) 
+* e retorna a quantidade de bytes escritos (de 1 a 5).
+*
+*/
+int putVarint(uint8_t* buffer, uint32_t value);
+
+/**
+* Função: Lê um inteiro sem sinal no formato varint entre buffer e end. Retorna a quantidade de bytes lidos, ou 0 se o varint estiver truncado.
+*
+*/
+int getVarint(const uint8_t* buffer, const uint8_t* end, uint32_t* value);
+
+/**
+* Função: Converte uma quantidade de tempo na escala SAPoT (0x0 ms, 0x1 s, 0x2 min, 0x3 h, 0x4 dias) em milisegundos 
+*
+*/
+unsigned long getTime(uint8_t scale, uint16_t quantity);
+
 
 #endif /* SAPOTCENTRAL_H */
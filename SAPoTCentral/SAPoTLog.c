@@ -0,0 +1,372 @@
+
+/*
+*	SAPoTLog.c define o subsistema de log assíncrono e binário da Central SAPoT
+*
+*
+*
+*/
+
+			/************************* Headers ******************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "SAPoTLog.h"
+
+/* Anel da thread corrente e log ao qual ele pertence */
+static __thread SAPoTLog_ring* localRing = NULL;
+static __thread SAPoTLog* localLog = NULL;
+
+/* Nomes dos níveis de log */
+static const char* levelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+/* Nomes dos eventos de mensagem (a partir de 0x01) e dos eventos da Central (a partir de SAPOT_EVENT_CENTRAL) */
+static const char* messageEventNames[] = {"RECEIVED", "UNPACK_ERROR", "OPERATION_ERROR", "DATABASE_ERROR", "PUBLISH_ERROR"};
+static const char* centralEventNames[] = {"MQTT_RECONNECT", "MQTT_ERROR", "CONNECTION_LOST", "DELIVERED", "ALLOC_STATS", "LOG_DROPPED", "CAPTURE_STOPPED"};
+
+/* Function's prototype */
+static void* SAPoTLog_writer(void* context);
+static int SAPoTLog_flush(SAPoTLog* log);
+static void SAPoTLog_commit(SAPoTLog* log, const SAPoTLog_record* records, size_t quantity);
+static int SAPoTLog_open(SAPoTLog* log);
+static uint64_t SAPoTLog_now(void);
+static SAPoTLog_ring* SAPoTLog_ring_get(SAPoTLog* log);
+
+/**
+* [Principal] SAPoTLog_begin
+*
+*/
+int SAPoTLog_begin(SAPoTLog* log, const char* prefix, int level, off_t maxSize, time_t maxAge){
+
+	snprintf(log->prefix, sizeof(log->prefix), "%s", prefix);
+	log->maxSize = maxSize;
+	log->maxAge = maxAge;
+	log->fd = -1;
+	if(SAPoTLog_open(log) != 0) return -1;
+
+	log->level = level;
+	atomic_init(&log->rings, NULL);
+	pthread_mutex_init(&log->lock, NULL);
+	pthread_cond_init(&log->stop, NULL);
+	log->running = 1;
+
+	if(pthread_create(&log->writer, NULL, SAPoTLog_writer, log) != 0){
+		close(log->fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+* [Principal] SAPoTLog_end
+*
+*/
+void SAPoTLog_end(SAPoTLog* log){
+
+	//Sinalizando o encerramento para a thread de escrita, que esvazia os anéis antes de terminar
+	pthread_mutex_lock(&log->lock);
+	log->running = 0;
+	pthread_cond_signal(&log->stop);
+	pthread_mutex_unlock(&log->lock);
+	pthread_join(log->writer, NULL);
+
+	//Descartando a área pré-alocada não utilizada
+	if(log->fd >= 0){
+		ftruncate(log->fd, log->written);
+		close(log->fd);
+	}
+
+	//Liberando os anéis
+	SAPoTLog_ring* ring = atomic_load(&log->rings);
+	while(ring != NULL){
+		SAPoTLog_ring* next = ring->next;
+		free(ring);
+		ring = next;
+	}
+	atomic_store(&log->rings, NULL);
+	if(localLog == log){
+		localLog = NULL;
+		localRing = NULL;
+	}
+
+	pthread_cond_destroy(&log->stop);
+	pthread_mutex_destroy(&log->lock);
+}
+
+/**
+* [Principal] SAPoTLog_write
+*
+*/
+void SAPoTLog_write(SAPoTLog* log, SAPoTLog_record* record){
+
+	if(record->level < log->level) return;
+
+	SAPoTLog_ring* ring = SAPoTLog_ring_get(log);
+	if(ring == NULL) return;
+
+	record->time = SAPoTLog_now();
+
+	//Limite de taxa dos registros de erro, por thread e por segundo
+	if(record->level >= SAPOT_LOG_ERROR){
+		time_t second = record->time / 1000000;
+		if(second != ring->errorWindow){
+			ring->errorWindow = second;
+			ring->errorCount = 0;
+		}
+		if(++ring->errorCount > SAPOT_LOG_ERROR_RATE){
+			atomic_fetch_add_explicit(&ring->suppressed, 1, memory_order_relaxed);
+			return;
+		}
+	}
+
+	//Apenas o produtor altera head, então basta verificar se o consumidor liberou a próxima posição
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if(head - tail >= SAPOT_LOG_RING_SIZE){
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	ring->records[head & (SAPOT_LOG_RING_SIZE-1)] = *record;
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+* [Principal] SAPoTLog_event_name
+*
+*/
+const char* SAPoTLog_event_name(uint8_t event){
+
+	if(event >= SAPOT_EVENT_CENTRAL){
+		if(event - SAPOT_EVENT_CENTRAL < (int) (sizeof(centralEventNames)/sizeof(centralEventNames[0]))) return centralEventNames[event - SAPOT_EVENT_CENTRAL];
+	}
+	else if(event >= 1 && event - 1 < (int) (sizeof(messageEventNames)/sizeof(messageEventNames[0]))) return messageEventNames[event - 1];
+
+	return NULL;
+}
+
+/**
+* [Principal] SAPoTLog_level_name
+*
+*/
+const char* SAPoTLog_level_name(uint8_t level){
+
+	return levelNames[level & 0x03];
+}
+
+/**
+* [Subrotina] SAPoTLog_now
+*
+*/
+static uint64_t SAPoTLog_now(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+* [Subrotina] SAPoTLog_open
+*
+*/
+static int SAPoTLog_open(SAPoTLog* log){
+
+	char path[256];
+	struct tm date;
+	uint64_t created = SAPoTLog_now();
+	time_t now = created / 1000000;
+
+	//Fechando o arquivo corrente e descartando a área pré-alocada não utilizada
+	if(log->fd >= 0){
+		ftruncate(log->fd, log->written);
+		close(log->fd);
+		log->fd = -1;
+	}
+
+	//Arquivo nomeado pelo instante de criação; um sufixo evita sobrescrever arquivos criados no mesmo segundo
+	localtime_r(&now, &date);
+	int len = snprintf(path, sizeof(path), "%s-", log->prefix);
+	len += strftime(path + len, sizeof(path) - len, "%Y%m%d-%H%M%S", &date);
+	int attempt;
+	for(attempt = 0; attempt < 100; attempt++){
+		if(attempt == 0) snprintf(path + len, sizeof(path) - len, ".sapl");
+		else snprintf(path + len, sizeof(path) - len, ".%d.sapl", attempt);
+		log->fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0640);
+		if(log->fd >= 0 || errno != EEXIST) break;
+	}
+	if(log->fd < 0) return -1;
+
+	//Pré-alocando o tamanho máximo sem alterar o tamanho aparente do arquivo
+	fallocate(log->fd, FALLOC_FL_KEEP_SIZE, 0, log->maxSize);
+
+	SAPoTLog_fileHeader header;
+	memcpy(header.magic, SAPOT_LOG_MAGIC, sizeof(header.magic));
+	header.version = SAPOT_LOG_FORMAT_VERSION;
+	header.recordSize = sizeof(SAPoTLog_record);
+	header.created = created;
+	if(write(log->fd, &header, sizeof(header)) != sizeof(header)){
+		close(log->fd);
+		log->fd = -1;
+		return -1;
+	}
+
+	log->written = sizeof(header);
+	log->opened = now;
+
+	return 0;
+}
+
+/**
+* [Subrotina] SAPoTLog_ring_get
+*
+*/
+static SAPoTLog_ring* SAPoTLog_ring_get(SAPoTLog* log){
+
+	if(localLog == log) return localRing;
+
+	//Procurando um anel já cadastrado pela thread neste log
+	pthread_t self = pthread_self();
+	SAPoTLog_ring* ring = atomic_load(&log->rings);
+	while(ring != NULL && !pthread_equal(ring->owner, self)) ring = ring->next;
+
+	//Primeiro registro da thread neste log: o anel é alocado uma única vez e inserido no início da lista
+	if(ring == NULL){
+		ring = calloc(1, sizeof(SAPoTLog_ring));
+		if(ring == NULL) return NULL;
+		ring->owner = self;
+		pthread_mutex_lock(&log->lock);
+		ring->next = atomic_load(&log->rings);
+		atomic_store(&log->rings, ring);
+		pthread_mutex_unlock(&log->lock);
+	}
+
+	localLog = log;
+	localRing = ring;
+	return ring;
+}
+
+/**
+* [Subrotina] SAPoTLog_writer
+*
+*/
+static void* SAPoTLog_writer(void* context){
+
+	SAPoTLog* log = (SAPoTLog*) context;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&log->lock);
+	while(log->running){
+
+		//Aguardando o intervalo de escrita ou o sinal de encerramento
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += SAPOT_LOG_FLUSH_INTERVAL * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&log->stop, &log->lock, &deadline);
+
+		pthread_mutex_unlock(&log->lock);
+		SAPoTLog_flush(log);
+		pthread_mutex_lock(&log->lock);
+	}
+	pthread_mutex_unlock(&log->lock);
+
+	//Escrevendo os registros pendentes
+	SAPoTLog_flush(log);
+
+	return NULL;
+}
+
+/**
+* [Subrotina] SAPoTLog_flush
+*
+*/
+static int SAPoTLog_flush(SAPoTLog* log){
+
+	SAPoTLog_record buffer[512];
+	size_t used = 0;
+	int records = 0;
+
+	SAPoTLog_ring* ring;
+	for(ring = atomic_load(&log->rings); ring != NULL; ring = ring->next){
+
+		unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+		for(; tail != head; tail++){
+
+			//Escrevendo o lote, mantendo uma posição livre para o registro de descartes
+			if(used >= sizeof(buffer)/sizeof(buffer[0]) - 1){
+				SAPoTLog_commit(log, buffer, used);
+				used = 0;
+			}
+
+			buffer[used++] = ring->records[tail & (SAPOT_LOG_RING_SIZE-1)];
+			records++;
+		}
+
+		//Liberando as posições lidas para o produtor
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+		//Registrando os descartes desde a última passagem
+		unsigned long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+		unsigned long suppressed = atomic_exchange_explicit(&ring->suppressed, 0, memory_order_relaxed);
+		if(dropped || suppressed){
+
+			//A posição livre do lote pode ter sido ocupada pelo registro de descartes do anel anterior
+			if(used >= sizeof(buffer)/sizeof(buffer[0]) - 1){
+				SAPoTLog_commit(log, buffer, used);
+				used = 0;
+			}
+
+			SAPoTLog_record* record = &buffer[used++];
+			memset(record, 0, sizeof(SAPoTLog_record));
+			record->time = SAPoTLog_now();
+			record->event = SAPOT_EVENT_LOG_DROPPED;
+			record->level = SAPOT_LOG_WARN;
+			record->value = dropped;
+			record->aux = suppressed;
+		}
+	}
+
+	if(used > 0) SAPoTLog_commit(log, buffer, used);
+
+	return records;
+}
+
+/**
+* [Subrotina] SAPoTLog_commit
+*
+*/
+static void SAPoTLog_commit(SAPoTLog* log, const SAPoTLog_record* records, size_t quantity){
+
+	while(quantity > 0){
+
+		//Rotacionando o arquivo por tamanho ou por idade; sem arquivo (falha anterior) uma nova criação é tentada
+		if(log->fd < 0 || log->written + (off_t) sizeof(SAPoTLog_record) > log->maxSize || (log->maxAge > 0 && time(NULL) - log->opened >= log->maxAge)){
+			if(SAPoTLog_open(log) != 0) return;
+		}
+
+		//Escrevendo apenas os registros que cabem no arquivo corrente
+		size_t room = (log->maxSize - log->written) / sizeof(SAPoTLog_record);
+		if(room == 0) room = 1;
+		if(room > quantity) room = quantity;
+
+		ssize_t size = room * sizeof(SAPoTLog_record);
+		if(write(log->fd, records, size) != size) return;
+		log->written += size;
+		records += room;
+		quantity -= room;
+	}
+}
@@ -0,0 +1,376 @@
+/**
+ * @file SAPoTLog.h
+ * @brief Subsistema de log assíncrono e binário da Central SAPoT.
+ *
+ * O log é composto por eventos de tamanho fixo (SAPoTLog_record): instante, tipo de evento, nível, instrução, serial,
+ * emissor e código de erro da mensagem relacionada, além de dois argumentos específicos de cada evento.
+ *
+ * As threads que geram eventos (ex.: a thread do cliente MQTT de cada Central) apenas copiam o registro para um anel
+ * próprio da thread, sem bloqueios nem chamadas de sistema. Uma thread de escrita esvazia periodicamente os anéis de todas
+ * as threads e escreve os registros em lote no arquivo de log corrente.
+ *
+ * Os arquivos são nomeados <tt>prefixo-AAAAMMDD-HHMMSS.sapl</tt>, iniciam com um SAPoTLog_fileHeader e são rotacionados ao
+ * atingir o tamanho ou a idade máxima informados em SAPoTLog_begin(). Cada arquivo é pré-alocado com fallocate() no tamanho
+ * máximo, evitando a fragmentação e a atualização dos blocos alocados a cada escrita. A ferramenta ucc-logdump decodifica e
+ * filtra os arquivos.
+ *
+ * O subsistema possui níveis de log (veja #SAPOT_LOG_DEBUG a #SAPOT_LOG_ERROR), limita a taxa de registros de erro por thread
+ * (#SAPOT_LOG_ERROR_RATE) e contabiliza os registros descartados por anel cheio ou por limite de taxa (#SAPOT_EVENT_LOG_DROPPED).
+ *
+ * As mensagens de depuração impressas na tela (SAPOT_DEBUG()) só são compiladas se a macro SAPOT_DEBUG_PRINT for definida
+ * (<tt>make DEBUG=1</tt>); caso contrário são removidas do caminho das mensagens.
+ *
+ */
+
+#ifndef SAPOTLOG_H
+#define SAPOTLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+/**
+* Nível de log: Depuração.
+*
+*/
+#define SAPOT_LOG_DEBUG 0
+
+/**
+* Nível de log: Informação (nível padrão).
+*
+*/
+#define SAPOT_LOG_INFO 1
+
+/**
+* Nível de log: Alerta.
+*
+*/
+#define SAPOT_LOG_WARN 2
+
+/**
+* Nível de log: Erro.
+*
+*/
+#define SAPOT_LOG_ERROR 3
+
+/**
+* Quantidade de registros do anel de cada thread (deve ser uma potência de 2).
+*
+*/
+#define SAPOT_LOG_RING_SIZE 1024
+
+/**
+* Quantidade máxima de registros de erro aceitos por thread a cada segundo. Os excedentes são descartados e contabilizados.
+*
+*/
+#define SAPOT_LOG_ERROR_RATE 20
+
+/**
+* Intervalo, em milissegundos, entre as passagens da thread de escrita.
+*
+*/
+#define SAPOT_LOG_FLUSH_INTERVAL 100
+
+/**
+* Tamanho máximo padrão de cada arquivo de log, em bytes.
+*
+*/
+#define SAPOT_LOG_MAX_SIZE (16*1024*1024)
+
+/**
+* Idade máxima padrão de cada arquivo de log, em segundos.
+*
+*/
+#define SAPOT_LOG_MAX_AGE 86400
+
+/**
+* Identificador dos arquivos de log binário.
+*
+*/
+#define SAPOT_LOG_MAGIC "SAPL"
+
+/**
+* Versão do formato dos arquivos de log binário.
+*
+*/
+#define SAPOT_LOG_FORMAT_VERSION 1
+
+/**
+* Evento: Mensagem recebida. value: comprimento declarado; aux: (versão << 8) | ack.
+*
+* Os eventos abaixo de #SAPOT_EVENT_CENTRAL são eventos de mensagem e carregam a instrução, o serial e o emissor da mensagem em tratamento.
+*/
+#define SAPOT_EVENT_RECEIVED 0x01
+
+/**
+* Evento: Fracasso ao estruturar a mensagem recebida.
+*
+*/
+#define SAPOT_EVENT_UNPACK_ERROR 0x02
+
+/**
+* Evento: Fracasso ao executar a instrução recebida.
+*
+*/
+#define SAPOT_EVENT_OPERATION_ERROR 0x03
+
+/**
+* Evento: Erro do servidor MySQL. value: código de erro MySQL (mysql_errno).
+*
+*/
+#define SAPOT_EVENT_DATABASE_ERROR 0x04
+
+/**
+* Evento: Fracasso ao publicar uma mensagem. value: código de retorno do cliente MQTT.
+*
+*/
+#define SAPOT_EVENT_PUBLISH_ERROR 0x05
+
+/**
+* Início dos eventos da Central, que não se referem a uma mensagem.
+*
+*/
+#define SAPOT_EVENT_CENTRAL 0x80
+
+/**
+* Evento: O cliente MQTT desconectado é recriado.
+*
+*/
+#define SAPOT_EVENT_MQTT_RECONNECT 0x80
+
+/**
+* Evento: Fracasso ao conectar com o broker MQTT. value: código de retorno; aux: etapa (1 criação, 2 callbacks, 3 conexão, 4 inscrição).
+*
+*/
+#define SAPOT_EVENT_MQTT_ERROR 0x81
+
+/**
+* Evento: Conexão com o broker MQTT perdida.
+*
+*/
+#define SAPOT_EVENT_CONNECTION_LOST 0x82
+
+/**
+* Evento: Entrega de mensagem MQTT confirmada. value: token.
+*
+*/
+#define SAPOT_EVENT_DELIVERED 0x83
+
+/**
+* Evento: Estatísticas de alocação. value: alocações no heap; aux: pico de blocos do pool em uso.
+*
+*/
+#define SAPOT_EVENT_ALLOC_STATS 0x84
+
+/**
+* Evento: Registros descartados. value: por anel cheio; aux: por limite de taxa de erros.
+*
+*/
+#define SAPOT_EVENT_LOG_DROPPED 0x85
+
+/**
+* Evento: Captura do tráfego encerrada automaticamente (veja SAPoTCapture_flush()). value: mensagens capturadas; aux: motivo 
+* (1 tamanho máximo do arquivo, 2 fracasso na escrita).
+*
+*/
+#define SAPOT_EVENT_CAPTURE_STOPPED 0x86
+
+/**
+* Imprime uma mensagem de depuração na tela. Sem SAPOT_DEBUG_PRINT a chamada é removida pelo compilador,
+* mantendo apenas a verificação dos argumentos.
+*
+*/
+#ifdef SAPOT_DEBUG_PRINT
+#define SAPOT_DEBUG(...) printf(__VA_ARGS__)
+#else
+#define SAPOT_DEBUG(...) do{ if(0) printf(__VA_ARGS__); }while(0)
+#endif
+
+/**
+* @brief Registro de log binário (32 bytes, little-endian).
+*
+*/
+typedef struct __attribute__((packed)){
+
+	/** Instante do evento, em microssegundos desde 1970 (CLOCK_REALTIME) */
+	uint64_t time;
+
+	/** Tipo de evento (SAPOT_EVENT_*) */
+	uint8_t event;
+
+	/** Nível do registro */
+	uint8_t level;
+
+	/** Instrução da mensagem relacionada */
+	uint8_t instruction;
+
+	/** Reservado */
+	uint8_t rsv;
+
+	/** Serial da mensagem relacionada */
+	uint16_t serial;
+
+	/** Emissor da mensagem relacionada */
+	uint8_t emitterId[6];
+
+	/** Código de erro SAPoTCentral */
+	int32_t error;
+
+	/** Argumento do evento */
+	uint32_t value;
+
+	/** Argumento auxiliar do evento */
+	uint32_t aux;
+
+}SAPoTLog_record;
+
+/**
+* @brief Cabeçalho dos arquivos de log binário (16 bytes), seguido pelos registros.
+*
+*/
+typedef struct __attribute__((packed)){
+
+	/** Identificador #SAPOT_LOG_MAGIC (sem terminador nulo) */
+	char magic[4];
+
+	/** Versão do formato (#SAPOT_LOG_FORMAT_VERSION) */
+	uint16_t version;
+
+	/** Tamanho de cada registro */
+	uint16_t recordSize;
+
+	/** Instante de criação do arquivo, em microssegundos */
+	uint64_t created;
+
+}SAPoTLog_fileHeader;
+
+/**
+* @brief Anel de registros de uma thread.
+*
+* O anel possui um único produtor (a thread dona) e um único consumidor (a thread de escrita), sincronizados apenas pelos
+* índices atômicos head e tail.
+*
+*/
+typedef struct SAPoTLog_ring{
+
+	/** Registros do anel */
+	SAPoTLog_record records[SAPOT_LOG_RING_SIZE];
+
+	/** Próximo registro a ser escrito pelo produtor */
+	atomic_uint head;
+
+	/** Próximo registro a ser lido pela thread de escrita */
+	atomic_uint tail;
+
+	/** Registros descartados por anel cheio */
+	atomic_ulong dropped;
+
+	/** Registros de erro descartados pelo limite de taxa */
+	atomic_ulong suppressed;
+
+	/** Segundo corrente da janela de limite de taxa */
+	time_t errorWindow;
+
+	/** Registros de erro aceitos na janela corrente */
+	int errorCount;
+
+	/** Thread dona do anel */
+	pthread_t owner;
+
+	/** Próximo anel da lista do log */
+	struct SAPoTLog_ring* next;
+
+}SAPoTLog_ring;
+
+/**
+* @brief Log assíncrono.
+*
+*/
+typedef struct{
+
+	/** Nível mínimo dos registros aceitos */
+	int level;
+
+	/** Prefixo (caminho e nome base) dos arquivos de log */
+	char prefix[200];
+
+	/** Tamanho máximo de cada arquivo, em bytes */
+	off_t maxSize;
+
+	/** Idade máxima de cada arquivo, em segundos (0 desabilita a rotação por tempo) */
+	time_t maxAge;
+
+	/** Descritor do arquivo corrente */
+	int fd;
+
+	/** Bytes escritos no arquivo corrente */
+	off_t written;
+
+	/** Instante de criação do arquivo corrente */
+	time_t opened;
+
+	/** Lista de anéis das threads que já geraram registros */
+	_Atomic(SAPoTLog_ring*) rings;
+
+	/** Exclusão mútua do cadastro de anéis e da sinalização da thread de escrita */
+	pthread_mutex_t lock;
+
+	/** Sinaliza o encerramento para a thread de escrita */
+	pthread_cond_t stop;
+
+	/** Indica se a thread de escrita deve continuar em operação */
+	int running;
+
+	/** Thread de escrita */
+	pthread_t writer;
+
+}SAPoTLog;
+
+/**
+* Inicia o log: cria o primeiro arquivo e inicia a thread de escrita.
+*
+* @param log Log a ser iniciado.
+* @param prefix Prefixo (caminho e nome base) dos arquivos de log.
+* @param level Nível mínimo dos registros aceitos.
+* @param maxSize Tamanho máximo de cada arquivo, em bytes.
+* @param maxAge Idade máxima de cada arquivo, em segundos (0 desabilita a rotação por tempo).
+*
+* @return 0 em caso de sucesso ou -1 se o arquivo não puder ser criado ou a thread não puder ser iniciada.
+*
+*/
+int SAPoTLog_begin(SAPoTLog* log, const char* prefix, int level, off_t maxSize, time_t maxAge);
+
+/**
+* Encerra o log: escreve os registros pendentes, finaliza a thread de escrita, fecha o arquivo e libera os anéis.
+*
+* @param log Log a ser encerrado.
+*
+*/
+void SAPoTLog_end(SAPoTLog* log);
+
+/**
+* Copia um registro para o anel da thread chamadora, preenchendo o seu instante. Não bloqueia: se o anel estiver cheio
+* o registro é descartado e contabilizado. Registros abaixo do nível do log são ignorados.
+*
+* @param log Log de destino.
+* @param record Registro a ser escrito.
+*
+*/
+void SAPoTLog_write(SAPoTLog* log, SAPoTLog_record* record);
+
+/**
+* Retorna o nome de um tipo de evento (ex.: "RECEIVED") ou NULL se o evento for desconhecido.
+*
+*/
+const char* SAPoTLog_event_name(uint8_t event);
+
+/**
+* Retorna o nome de um nível de log (ex.: "ERROR").
+*
+*/
+const char* SAPoTLog_level_name(uint8_t level);
+
+#endif /* SAPOTLOG_H */
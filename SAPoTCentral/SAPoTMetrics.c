@@ -0,0 +1,456 @@
+
+/*
+*	SAPoTMetrics.c define as métricas de desempenho da Central SAPoT e o servidor que as expõe
+*
+*
+*
+*/
+
+			/************************* Headers ******************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "SAPoTMetrics.h"
+
+/* Limites superiores das faixas dos histogramas, em microssegundos (a última faixa é +Inf) */
+static const uint64_t bucketBounds[SAPOT_METRICS_BUCKETS-1] = {10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000};
+
+/* Nomes das fases de tratamento */
+static const char* phaseNames[SAPOT_METRICS_PHASES] = {"unpack", "database", "publish"};
+
+/* Function's prototype */
+static void* SAPoTMetrics_server(void* context);
+static SAPoTMetrics_device* SAPoTMetrics_device_find(SAPoTMetrics* metrics, const uint8_t emitterId[6], int create);
+static void SAPoTMetrics_device_copy(SAPoTMetrics_device* device, SAPoTMetrics_deviceStats* stats, uint64_t now);
+static uint64_t SAPoTMetrics_realtime(void);
+static size_t SAPoTMetrics_append(char* buffer, size_t size, size_t used, const char* format, ...) __attribute__((format(printf, 4, 5)));
+
+/**
+* [Principal] SAPoTMetrics_init
+*
+*/
+void SAPoTMetrics_init(SAPoTMetrics* metrics){
+
+	//Os contadores atômicos sem bloqueio são representados como inteiros, de forma que zerar a memória os inicializa
+	memset(metrics, 0, sizeof(SAPoTMetrics));
+	metrics->listenFd = -1;
+}
+
+/**
+* [Principal] SAPoTMetrics_end
+*
+*/
+void SAPoTMetrics_end(SAPoTMetrics* metrics){
+
+	if(metrics->listenFd < 0) return;
+
+	//Desbloqueando o accept() da thread do servidor
+	shutdown(metrics->listenFd, SHUT_RDWR);
+	close(metrics->listenFd);
+	pthread_join(metrics->server, NULL);
+	metrics->listenFd = -1;
+}
+
+/**
+* [Principal] SAPoTMetrics_now
+*
+*/
+uint64_t SAPoTMetrics_now(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+* [Principal] SAPoTMetrics_observe
+*
+*/
+void SAPoTMetrics_observe(SAPoTMetrics* metrics, uint8_t instruction, int phase, uint64_t elapsed){
+
+	SAPoTMetrics_histogram* histogram = &metrics->instructions[instruction].latency[phase];
+
+	int bucket = 0;
+	while(bucket < SAPOT_METRICS_BUCKETS-1 && elapsed > bucketBounds[bucket]) bucket++;
+
+	atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&histogram->sum, elapsed, memory_order_relaxed);
+}
+
+/**
+* [Principal] SAPoTMetrics_error
+*
+*/
+void SAPoTMetrics_error(SAPoTMetrics* metrics, uint8_t instruction, int error){
+
+	atomic_fetch_add_explicit(&metrics->instructions[instruction].errors, 1, memory_order_relaxed);
+	if(error < 0 && error > -SAPOT_METRICS_ERRORS) atomic_fetch_add_explicit(&metrics->errors[-error], 1, memory_order_relaxed);
+}
+
+/**
+* [Principal] SAPoTMetrics_device_update
+*
+*/
+void SAPoTMetrics_device_update(SAPoTMetrics* metrics, const uint8_t emitterId[6], uint8_t instruction, unsigned int bytes, int error){
+
+	SAPoTMetrics_device* device = SAPoTMetrics_device_find(metrics, emitterId, 1);
+	if(device == NULL){
+		atomic_fetch_add_explicit(&metrics->devicesOverflow, 1, memory_order_relaxed);
+		return;
+	}
+
+	if(instruction >= SAPOT_METRICS_DEVICE_INSTRUCTIONS) instruction = SAPOT_METRICS_DEVICE_INSTRUCTIONS - 1;
+	atomic_fetch_add_explicit(&device->messages[instruction], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&device->bytes, bytes, memory_order_relaxed);
+	if(error != 0) atomic_store_explicit(&device->lastError, error, memory_order_relaxed);
+
+	//Taxa média exponencial: a taxa anterior decai pelo intervalo desde a última mensagem e cada mensagem soma 1/janela
+	uint64_t now = SAPoTMetrics_realtime();
+	uint64_t previous = atomic_exchange_explicit(&device->lastSeen, now, memory_order_relaxed);
+	double decay = (previous != 0 && now > previous) ? exp(-(double) (now - previous) / (SAPOT_METRICS_RATE_WINDOW * 1e6)) : 1.0;
+
+	unsigned long long expected = atomic_load_explicit(&device->rate, memory_order_relaxed);
+	unsigned long long desired;
+	do{
+		double rate;
+		memcpy(&rate, &expected, sizeof(rate));
+		rate = rate * decay + 1.0 / SAPOT_METRICS_RATE_WINDOW;
+		memcpy(&desired, &rate, sizeof(rate));
+	}while(!atomic_compare_exchange_weak_explicit(&device->rate, &expected, desired, memory_order_relaxed, memory_order_relaxed));
+}
+
+/**
+* [Principal] SAPoTMetrics_device_get
+*
+*/
+int SAPoTMetrics_device_get(SAPoTMetrics* metrics, const uint8_t emitterId[6], SAPoTMetrics_deviceStats* stats){
+
+	SAPoTMetrics_device* device = SAPoTMetrics_device_find(metrics, emitterId, 0);
+	if(device == NULL) return -1;
+
+	SAPoTMetrics_device_copy(device, stats, SAPoTMetrics_realtime());
+	return 0;
+}
+
+/**
+* [Principal] SAPoTMetrics_device_top
+*
+*/
+int SAPoTMetrics_device_top(SAPoTMetrics* metrics, SAPoTMetrics_deviceStats* stats, int quantity){
+
+	uint64_t now = SAPoTMetrics_realtime();
+	SAPoTMetrics_deviceStats candidate;
+	int found = 0;
+	int i, j;
+
+	//Seleção por inserção dos maiores: o vetor de destino permanece ordenado de forma decrescente
+	for(i=0; i<SAPOT_METRICS_DEVICES && quantity > 0; i++){
+		if(atomic_load_explicit(&metrics->devices[i].key, memory_order_acquire) == 0) continue;
+
+		SAPoTMetrics_device_copy(&metrics->devices[i], &candidate, now);
+		if(found == quantity && candidate.rate <= stats[found-1].rate) continue;
+
+		j = (found < quantity) ? found++ : found - 1;
+		while(j > 0 && stats[j-1].rate < candidate.rate){
+			stats[j] = stats[j-1];
+			j--;
+		}
+		stats[j] = candidate;
+	}
+
+	return found;
+}
+
+/**
+* [Principal] SAPoTMetrics_render
+*
+*/
+size_t SAPoTMetrics_render(SAPoTMetrics* metrics, char* buffer, size_t size, int topDevices){
+
+	size_t used = 0;
+	int i, phase, bucket;
+
+	used = SAPoTMetrics_append(buffer, size, used, "# HELP sapot_messages_total Mensagens recebidas por instrução.\n# TYPE sapot_messages_total counter\n");
+	for(i=0; i<256; i++){
+		unsigned long messages = atomic_load_explicit(&metrics->instructions[i].messages, memory_order_relaxed);
+		if(messages) used = SAPoTMetrics_append(buffer, size, used, "sapot_messages_total{instruction=\"%d\"} %lu\n", i, messages);
+	}
+
+	used = SAPoTMetrics_append(buffer, size, used, "# HELP sapot_message_errors_total Mensagens cujo tratamento fracassou, por instrução.\n# TYPE sapot_message_errors_total counter\n");
+	for(i=0; i<256; i++){
+		unsigned long errors = atomic_load_explicit(&metrics->instructions[i].errors, memory_order_relaxed);
+		if(errors) used = SAPoTMetrics_append(buffer, size, used, "sapot_message_errors_total{instruction=\"%d\"} %lu\n", i, errors);
+	}
+
+	used = SAPoTMetrics_append(buffer, size, used, "# HELP sapot_errors_total Erros por código de erro SAPoTCentral.\n# TYPE sapot_errors_total counter\n");
+	for(i=1; i<SAPOT_METRICS_ERRORS; i++){
+		unsigned long errors = atomic_load_explicit(&metrics->errors[i], memory_order_relaxed);
+		if(errors) used = SAPoTMetrics_append(buffer, size, used, "sapot_errors_total{code=\"%d\"} %lu\n", -i, errors);
+	}
+
+	used = SAPoTMetrics_append(buffer, size, used, "# HELP sapot_phase_latency_seconds Latência de cada fase de tratamento das mensagens.\n# TYPE sapot_phase_latency_seconds histogram\n");
+	for(i=0; i<256; i++){
+		for(phase=0; phase<SAPOT_METRICS_PHASES; phase++){
+
+			SAPoTMetrics_histogram* histogram = &metrics->instructions[i].latency[phase];
+			unsigned long count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+			if(count == 0) continue;
+
+			//Faixas acumuladas, como exigido pelo formato
+			unsigned long cumulative = 0;
+			for(bucket=0; bucket<SAPOT_METRICS_BUCKETS-1; bucket++){
+				cumulative += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+				used = SAPoTMetrics_append(buffer, size, used, "sapot_phase_latency_seconds_bucket{instruction=\"%d\",phase=\"%s\",le=\"%g\"} %lu\n", i, phaseNames[phase], bucketBounds[bucket] / 1e6, cumulative);
+			}
+			cumulative += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+			used = SAPoTMetrics_append(buffer, size, used, "sapot_phase_latency_seconds_bucket{instruction=\"%d\",phase=\"%s\",le=\"+Inf\"} %lu\n", i, phaseNames[phase], cumulative);
+			used = SAPoTMetrics_append(buffer, size, used, "sapot_phase_latency_seconds_sum{instruction=\"%d\",phase=\"%s\"} %.6f\n", i, phaseNames[phase], atomic_load_explicit(&histogram->sum, memory_order_relaxed) / 1e6);
+			used = SAPoTMetrics_append(buffer, size, used, "sapot_phase_latency_seconds_count{instruction=\"%d\",phase=\"%s\"} %lu\n", i, phaseNames[phase], cumulative);
+		}
+	}
+
+	used = SAPoTMetrics_append(buffer, size, used,
+		"# TYPE sapot_messages_in_flight gauge\nsapot_messages_in_flight %d\n"
+		"# TYPE sapot_received_bytes_total counter\nsapot_received_bytes_total %lu\n"
+		"# TYPE sapot_published_bytes_total counter\nsapot_published_bytes_total %lu\n"
+		"# TYPE sapot_db_connections_active gauge\nsapot_db_connections_active %d\n"
+		"# TYPE sapot_db_connections_peak gauge\nsapot_db_connections_peak %d\n"
+		"# TYPE sapot_db_connections_total counter\nsapot_db_connections_total %lu\n"
+		"# TYPE sapot_db_connect_errors_total counter\nsapot_db_connect_errors_total %lu\n"
+		"# TYPE sapot_mqtt_reconnects_total counter\nsapot_mqtt_reconnects_total %lu\n"
+		"# TYPE sapot_mqtt_connections_lost_total counter\nsapot_mqtt_connections_lost_total %lu\n"
+		"# TYPE sapot_publish_errors_total counter\nsapot_publish_errors_total %lu\n",
+		atomic_load(&metrics->inFlight), atomic_load(&metrics->bytesIn), atomic_load(&metrics->bytesOut),
+		atomic_load(&metrics->databaseActive), atomic_load(&metrics->databasePeak), atomic_load(&metrics->databaseConnections),
+		atomic_load(&metrics->databaseConnectErrors), atomic_load(&metrics->mqttReconnects), atomic_load(&metrics->mqttConnectionsLost),
+		atomic_load(&metrics->publishErrors));
+
+	//Dispositivos de maior taxa de mensagens (os vetores estáticos evitam alocações a cada renderização e são protegidos por renderLock)
+	static SAPoTMetrics_deviceStats top[SAPOT_METRICS_DEVICES];
+	static char emitters[SAPOT_METRICS_DEVICES][18];
+	static pthread_mutex_t renderLock = PTHREAD_MUTEX_INITIALIZER;
+	if(topDevices > SAPOT_METRICS_DEVICES) topDevices = SAPOT_METRICS_DEVICES;
+	if(topDevices > 0){
+		pthread_mutex_lock(&renderLock);
+		int quantity = SAPoTMetrics_device_top(metrics, top, topDevices);
+
+		//O formato exige as amostras de cada métrica agrupadas
+		for(i=0; i<quantity; i++){
+			snprintf(emitters[i], sizeof(emitters[i]), "%02X:%02X:%02X:%02X:%02X:%02X", top[i].emitterId[0], top[i].emitterId[1], top[i].emitterId[2], top[i].emitterId[3], top[i].emitterId[4], top[i].emitterId[5]);
+		}
+
+		used = SAPoTMetrics_append(buffer, size, used, "# HELP sapot_device_rate Taxa média exponencial de mensagens por segundo dos dispositivos de maior taxa.\n# TYPE sapot_device_rate gauge\n");
+		for(i=0; i<quantity; i++) used = SAPoTMetrics_append(buffer, size, used, "sapot_device_rate{emitter=\"%s\"} %.4f\n", emitters[i], top[i].rate);
+		used = SAPoTMetrics_append(buffer, size, used, "# TYPE sapot_device_messages_total counter\n");
+		for(i=0; i<quantity; i++) used = SAPoTMetrics_append(buffer, size, used, "sapot_device_messages_total{emitter=\"%s\"} %lu\n", emitters[i], top[i].total);
+		used = SAPoTMetrics_append(buffer, size, used, "# TYPE sapot_device_received_bytes_total counter\n");
+		for(i=0; i<quantity; i++) used = SAPoTMetrics_append(buffer, size, used, "sapot_device_received_bytes_total{emitter=\"%s\"} %lu\n", emitters[i], top[i].bytes);
+		used = SAPoTMetrics_append(buffer, size, used, "# TYPE sapot_device_last_seen_seconds gauge\n");
+		for(i=0; i<quantity; i++) used = SAPoTMetrics_append(buffer, size, used, "sapot_device_last_seen_seconds{emitter=\"%s\"} %.3f\n", emitters[i], top[i].lastSeen / 1e6);
+		used = SAPoTMetrics_append(buffer, size, used, "# TYPE sapot_device_last_error gauge\n");
+		for(i=0; i<quantity; i++) used = SAPoTMetrics_append(buffer, size, used, "sapot_device_last_error{emitter=\"%s\"} %d\n", emitters[i], top[i].lastError);
+		pthread_mutex_unlock(&renderLock);
+	}
+
+	used = SAPoTMetrics_append(buffer, size, used, "# TYPE sapot_devices_overflow_total counter\nsapot_devices_overflow_total %lu\n", atomic_load(&metrics->devicesOverflow));
+
+	return used;
+}
+
+/**
+* [Principal] SAPoTMetrics_listen
+*
+*/
+int SAPoTMetrics_listen(SAPoTMetrics* metrics, const char* address){
+
+	int fd;
+
+	//Socket UNIX: o caminho é recriado a cada início
+	if(address[0] == '/' || address[0] == '.'){
+		struct sockaddr_un local;
+		memset(&local, 0, sizeof(local));
+		local.sun_family = AF_UNIX;
+		if(strlen(address) >= sizeof(local.sun_path)) return -1;
+		strcpy(local.sun_path, address);
+		unlink(address);
+		if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+		if(bind(fd, (struct sockaddr*) &local, sizeof(local)) != 0){
+			close(fd);
+			return -1;
+		}
+	}
+	//Socket TCP: "porta" escuta apenas na interface local
+	else{
+		struct sockaddr_in local;
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		const char* port = strrchr(address, ':');
+		if(port != NULL){
+			char host[64];
+			snprintf(host, sizeof(host), "%.*s", (int) (port - address), address);
+			if(inet_pton(AF_INET, host, &local.sin_addr) != 1) return -1;
+			port++;
+		}
+		else port = address;
+		local.sin_port = htons(atoi(port));
+
+		if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+		int reuse = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if(bind(fd, (struct sockaddr*) &local, sizeof(local)) != 0){
+			close(fd);
+			return -1;
+		}
+	}
+
+	if(listen(fd, 8) != 0){
+		close(fd);
+		return -1;
+	}
+
+	metrics->listenFd = fd;
+	if(pthread_create(&metrics->server, NULL, SAPoTMetrics_server, metrics) != 0){
+		close(fd);
+		metrics->listenFd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+* [Subrotina] SAPoTMetrics_server
+*
+*/
+static void* SAPoTMetrics_server(void* context){
+
+	SAPoTMetrics* metrics = (SAPoTMetrics*) context;
+	char request[1024];
+	char* text = malloc(SAPOT_METRICS_TEXT_SIZE);
+	if(text == NULL) return NULL;
+
+	int client;
+	while((client = accept(metrics->listenFd, NULL, NULL)) >= 0){
+
+		//A requisição é lida apenas para esvaziar o socket: qualquer caminho recebe as métricas
+		struct timeval timeout = {1, 0};
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		ssize_t received = recv(client, request, sizeof(request) - 1, 0);
+		request[(received > 0) ? received : 0] = '\0';
+
+		//Quantidade de dispositivos de maior taxa: parâmetro top=N da linha de requisição
+		int topDevices = SAPOT_METRICS_TOP_DEVICES;
+		char* end = strstr(request, "\r\n");
+		if(end != NULL) *end = '\0';
+		char* top = strstr(request, "top=");
+		if(top != NULL) topDevices = atoi(top + 4);
+
+		size_t length = (metrics->render != NULL) ? metrics->render(metrics->context, text, SAPOT_METRICS_TEXT_SIZE, topDevices) : SAPoTMetrics_render(metrics, text, SAPOT_METRICS_TEXT_SIZE, topDevices);
+
+		char header[160];
+		int headerLength = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", length);
+		send(client, header, headerLength, MSG_NOSIGNAL);
+		send(client, text, length, MSG_NOSIGNAL);
+		close(client);
+	}
+
+	free(text);
+	return NULL;
+}
+
+/**
+* [Subrotina] SAPoTMetrics_device_find
+*
+*/
+static SAPoTMetrics_device* SAPoTMetrics_device_find(SAPoTMetrics* metrics, const uint8_t emitterId[6], int create){
+
+	unsigned long long key = 1ULL << 48;
+	int i;
+	for(i=0; i<6; i++) key |= (unsigned long long) emitterId[i] << (8*(5-i));
+
+	//Sondagem linear a partir do hash multiplicativo do endereço MAC
+	unsigned int index = (unsigned int) ((key * 0x9E3779B97F4A7C15ULL) >> 32);
+	for(i=0; i<SAPOT_METRICS_DEVICES; i++){
+
+		SAPoTMetrics_device* device = &metrics->devices[(index + i) & (SAPOT_METRICS_DEVICES-1)];
+		unsigned long long current = atomic_load_explicit(&device->key, memory_order_acquire);
+		if(current == key) return device;
+		if(current != 0) continue;
+		if(!create) return NULL;
+
+		//Reservando a posição vazia; se outra thread a reservou antes, ela pode ter reservado para o mesmo dispositivo
+		if(atomic_compare_exchange_strong_explicit(&device->key, &current, key, memory_order_acq_rel, memory_order_acquire)) return device;
+		if(current == key) return device;
+	}
+
+	return NULL;
+}
+
+/**
+* [Subrotina] SAPoTMetrics_device_copy
+*
+*/
+static void SAPoTMetrics_device_copy(SAPoTMetrics_device* device, SAPoTMetrics_deviceStats* stats, uint64_t now){
+
+	unsigned long long key = atomic_load_explicit(&device->key, memory_order_acquire);
+	int i;
+	for(i=0; i<6; i++) stats->emitterId[i] = key >> (8*(5-i));
+
+	stats->total = 0;
+	for(i=0; i<SAPOT_METRICS_DEVICE_INSTRUCTIONS; i++){
+		stats->messages[i] = atomic_load_explicit(&device->messages[i], memory_order_relaxed);
+		stats->total += stats->messages[i];
+	}
+	stats->bytes = atomic_load_explicit(&device->bytes, memory_order_relaxed);
+	stats->lastError = atomic_load_explicit(&device->lastError, memory_order_relaxed);
+	stats->lastSeen = atomic_load_explicit(&device->lastSeen, memory_order_relaxed);
+
+	//Decaindo a taxa até o instante da consulta: dispositivos silenciosos tendem a zero
+	unsigned long long bits = atomic_load_explicit(&device->rate, memory_order_relaxed);
+	memcpy(&stats->rate, &bits, sizeof(stats->rate));
+	if(now > stats->lastSeen) stats->rate *= exp(-(double) (now - stats->lastSeen) / (SAPOT_METRICS_RATE_WINDOW * 1e6));
+}
+
+/**
+* [Subrotina] SAPoTMetrics_realtime
+*
+*/
+static uint64_t SAPoTMetrics_realtime(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+* [Subrotina] SAPoTMetrics_append
+*
+*/
+static size_t SAPoTMetrics_append(char* buffer, size_t size, size_t used, const char* format, ...){
+
+	if(used + 1 >= size) return used;
+
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer + used, size - used, format, args);
+	va_end(args);
+
+	//Texto truncado: o buffer fica cheio
+	if(len < 0) return used;
+	if((size_t) len >= size - used) return size - 1;
+	return used + len;
+}
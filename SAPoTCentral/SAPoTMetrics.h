@@ -0,0 +1,345 @@
+/**
+ * @file SAPoTMetrics.h
+ * @brief Métricas de desempenho da Central SAPoT.
+ *
+ * As métricas são contadores atômicos atualizados no caminho das mensagens sem bloqueios: mensagens e erros por instrução,
+ * erros por código, histogramas de latência por instrução e por fase (estruturação, banco de dados e publicação), mensagens
+ * em tratamento e uso das conexões com o banco de dados e com o broker.
+ *
+ * As métricas também mantêm uma tabela de estatísticas por dispositivo (emitterId), atualizada apenas com operações atômicas:
+ * instante da última mensagem, mensagens por instrução, bytes recebidos, taxa média exponencial de mensagens e último erro.
+ * SAPoTMetrics_device_top() retorna os dispositivos de maior taxa.
+ *
+ * SAPoTMetrics_render() gera as métricas no formato de texto do Prometheus. Elas podem ser servidas por HTTP em uma porta local
+ * ou em um socket UNIX (SAPoTMetrics_listen()) e publicadas periodicamente em um tópico MQTT (veja SAPoTCentral_create_options).
+ *
+ */
+
+#ifndef SAPOTMETRICS_H
+#define SAPOTMETRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+* Fase de tratamento de uma mensagem: estruturação e validação (SAPoTCentral_unpack_message()).
+*
+*/
+#define SAPOT_PHASE_UNPACK 0
+
+/**
+* Fase de tratamento de uma mensagem: execução da instrução, descontadas as publicações (dominada pelas operações MySQL).
+*
+*/
+#define SAPOT_PHASE_DATABASE 1
+
+/**
+* Fase de tratamento de uma mensagem: publicações MQTT (resposta e acionamentos).
+*
+*/
+#define SAPOT_PHASE_PUBLISH 2
+
+/**
+* Quantidade de fases de tratamento de uma mensagem.
+*
+*/
+#define SAPOT_METRICS_PHASES 3
+
+/**
+* Quantidade de faixas dos histogramas de latência, incluindo a faixa +Inf.
+*
+*/
+#define SAPOT_METRICS_BUCKETS 16
+
+/**
+* Quantidade de códigos de erro contabilizados (os códigos SAPoTCentral são negativos, de -1 a -(SAPOT_METRICS_ERRORS-1)).
+*
+*/
+#define SAPOT_METRICS_ERRORS 32
+
+/**
+* Quantidade de posições da tabela de estatísticas por dispositivo (deve ser uma potência de 2).
+*
+*/
+#define SAPOT_METRICS_DEVICES 1024
+
+/**
+* Quantidade de contadores de mensagens por instrução de cada dispositivo. As instruções a partir de
+* (SAPOT_METRICS_DEVICE_INSTRUCTIONS-1) são contabilizadas no último contador.
+*
+*/
+#define SAPOT_METRICS_DEVICE_INSTRUCTIONS 16
+
+/**
+* Constante de tempo, em segundos, da taxa média exponencial de mensagens de cada dispositivo.
+*
+*/
+#define SAPOT_METRICS_RATE_WINDOW 60.0
+
+/**
+* Quantidade padrão de dispositivos de maior taxa incluídos no texto das métricas.
+*
+*/
+#define SAPOT_METRICS_TOP_DEVICES 10
+
+/**
+* Tamanho do buffer utilizado para gerar o texto das métricas.
+*
+*/
+#define SAPOT_METRICS_TEXT_SIZE (256*1024)
+
+/**
+* @brief Histograma de latência, em microssegundos.
+*
+* As faixas não são cumulativas no armazenamento; o acúmulo exigido pelo Prometheus é feito em SAPoTMetrics_render().
+*
+*/
+typedef struct{
+
+	/** Quantidade de observações em cada faixa */
+	atomic_ulong buckets[SAPOT_METRICS_BUCKETS];
+
+	/** Quantidade total de observações */
+	atomic_ulong count;
+
+	/** Soma das observações, em microssegundos */
+	atomic_ulong sum;
+
+}SAPoTMetrics_histogram;
+
+/**
+* @brief Métricas de uma instrução.
+*
+*/
+typedef struct{
+
+	/** Mensagens recebidas */
+	atomic_ulong messages;
+
+	/** Mensagens cujo tratamento fracassou */
+	atomic_ulong errors;
+
+	/** Latência de cada fase de tratamento */
+	SAPoTMetrics_histogram latency[SAPOT_METRICS_PHASES];
+
+}SAPoTMetrics_instruction;
+
+/**
+* @brief Posição da tabela de estatísticas por dispositivo.
+*
+* A posição é reservada atomicamente pela primeira mensagem do dispositivo (sondagem linear a partir do hash do emitterId)
+* e nunca é liberada. Todos os campos são atualizados sem bloqueios.
+*
+*/
+typedef struct{
+
+	/** emitterId do dispositivo nos 48 bits menos significativos, com o bit 48 ativo (0 indica posição vazia) */
+	atomic_ullong key;
+
+	/** Instante da última mensagem, em microssegundos desde 1970 */
+	atomic_ullong lastSeen;
+
+	/** Taxa média exponencial de mensagens por segundo no instante lastSeen (representação binária de um double) */
+	atomic_ullong rate;
+
+	/** Mensagens recebidas por instrução */
+	atomic_ulong messages[SAPOT_METRICS_DEVICE_INSTRUCTIONS];
+
+	/** Bytes recebidos */
+	atomic_ulong bytes;
+
+	/** Último código de erro no tratamento de uma mensagem do dispositivo (0 se nenhum) */
+	atomic_int lastError;
+
+}SAPoTMetrics_device;
+
+/**
+* @brief Cópia das estatísticas de um dispositivo, retornada por SAPoTMetrics_device_top().
+*
+*/
+typedef struct{
+
+	/** Endereço MAC do dispositivo */
+	uint8_t emitterId[6];
+
+	/** Instante da última mensagem, em microssegundos desde 1970 */
+	uint64_t lastSeen;
+
+	/** Mensagens recebidas por instrução */
+	unsigned long messages[SAPOT_METRICS_DEVICE_INSTRUCTIONS];
+
+	/** Total de mensagens recebidas */
+	unsigned long total;
+
+	/** Bytes recebidos */
+	unsigned long bytes;
+
+	/** Taxa média exponencial de mensagens por segundo, decaída até o instante da consulta */
+	double rate;
+
+	/** Último código de erro */
+	int lastError;
+
+}SAPoTMetrics_deviceStats;
+
+/**
+* @brief Métricas da Central.
+*
+*/
+typedef struct{
+
+	/** Métricas indexadas pelo código da instrução */
+	SAPoTMetrics_instruction instructions[256];
+
+	/** Erros indexados pelo código de erro com sinal invertido */
+	atomic_ulong errors[SAPOT_METRICS_ERRORS];
+
+	/** Bytes recebidos */
+	atomic_ulong bytesIn;
+
+	/** Bytes publicados */
+	atomic_ulong bytesOut;
+
+	/** Mensagens em tratamento */
+	atomic_int inFlight;
+
+	/** Conexões MySQL abertas */
+	atomic_int databaseActive;
+
+	/** Maior quantidade de conexões MySQL abertas simultaneamente */
+	atomic_int databasePeak;
+
+	/** Conexões MySQL estabelecidas */
+	atomic_ulong databaseConnections;
+
+	/** Fracassos de conexão MySQL */
+	atomic_ulong databaseConnectErrors;
+
+	/** Conexões MQTT recriadas */
+	atomic_ulong mqttReconnects;
+
+	/** Conexões MQTT perdidas */
+	atomic_ulong mqttConnectionsLost;
+
+	/** Fracassos de publicação MQTT */
+	atomic_ulong publishErrors;
+
+	/** Estatísticas por dispositivo */
+	SAPoTMetrics_device devices[SAPOT_METRICS_DEVICES];
+
+	/** Mensagens de dispositivos não contabilizados por falta de posição livre na tabela */
+	atomic_ulong devicesOverflow;
+
+	/** Socket de escuta do servidor de métricas (-1 se desativado) */
+	int listenFd;
+
+	/** Thread do servidor de métricas */
+	pthread_t server;
+
+	/** Gera o texto servido pelo servidor de métricas (as métricas acrescidas das informações do contexto), incluindo os topDevices dispositivos de maior taxa */
+	size_t (*render)(void* context, char* buffer, size_t size, int topDevices);
+
+	/** Contexto de render */
+	void* context;
+
+}SAPoTMetrics;
+
+/**
+* Inicia as métricas, zerando os contadores. O servidor permanece desativado.
+*
+*/
+void SAPoTMetrics_init(SAPoTMetrics* metrics);
+
+/**
+* Encerra o servidor de métricas, se ativo.
+*
+*/
+void SAPoTMetrics_end(SAPoTMetrics* metrics);
+
+/**
+* Retorna um instante monotônico, em microssegundos, para a medição de latências.
+*
+*/
+uint64_t SAPoTMetrics_now(void);
+
+/**
+* Registra uma observação de latência no histograma de uma fase de uma instrução.
+*
+* @param metrics Métricas da Central.
+* @param instruction Código da instrução.
+* @param phase Fase de tratamento (#SAPOT_PHASE_UNPACK, #SAPOT_PHASE_DATABASE ou #SAPOT_PHASE_PUBLISH).
+* @param elapsed Latência, em microssegundos.
+*
+*/
+void SAPoTMetrics_observe(SAPoTMetrics* metrics, uint8_t instruction, int phase, uint64_t elapsed);
+
+/**
+* Contabiliza um fracasso no tratamento de uma mensagem de uma instrução.
+*
+* @param metrics Métricas da Central.
+* @param instruction Código da instrução.
+* @param error Código de erro SAPoTCentral.
+*
+*/
+void SAPoTMetrics_error(SAPoTMetrics* metrics, uint8_t instruction, int error);
+
+/**
+* Atualiza as estatísticas de um dispositivo após o tratamento de uma de suas mensagens.
+*
+* @param metrics Métricas da Central.
+* @param emitterId Endereço MAC do dispositivo.
+* @param instruction Código da instrução da mensagem.
+* @param bytes Comprimento da mensagem.
+* @param error Código de erro do tratamento (0 em caso de sucesso, mantendo o último erro registrado).
+*
+*/
+void SAPoTMetrics_device_update(SAPoTMetrics* metrics, const uint8_t emitterId[6], uint8_t instruction, unsigned int bytes, int error);
+
+/**
+* Consulta as estatísticas de um dispositivo.
+*
+* @return 0 em caso de sucesso ou -1 se o dispositivo não possuir estatísticas.
+*
+*/
+int SAPoTMetrics_device_get(SAPoTMetrics* metrics, const uint8_t emitterId[6], SAPoTMetrics_deviceStats* stats);
+
+/**
+* Retorna os dispositivos de maior taxa de mensagens, em ordem decrescente de taxa.
+*
+* @param metrics Métricas da Central.
+* @param stats Vetor de destino com quantity posições.
+* @param quantity Quantidade máxima de dispositivos.
+*
+* @return Quantidade de dispositivos copiados.
+*
+*/
+int SAPoTMetrics_device_top(SAPoTMetrics* metrics, SAPoTMetrics_deviceStats* stats, int quantity);
+
+/**
+* Gera as métricas no formato de texto do Prometheus.
+*
+* @param metrics Métricas da Central.
+* @param buffer Buffer de destino.
+* @param size Tamanho do buffer.
+* @param topDevices Quantidade de dispositivos de maior taxa incluídos (veja SAPoTMetrics_device_top()).
+*
+* @return Comprimento do texto gerado (limitado a size-1).
+*
+*/
+size_t SAPoTMetrics_render(SAPoTMetrics* metrics, char* buffer, size_t size, int topDevices);
+
+/**
+* Inicia o servidor HTTP de métricas, que responde a qualquer requisição com o texto gerado por SAPoTMetrics.render. 
+* O parâmetro de consulta <tt>top=N</tt> (ex.: <tt>/metrics?top=50</tt>) define a quantidade de dispositivos de maior taxa incluídos.
+*
+* @param metrics Métricas da Central, com render e context definidos.
+* @param address Endereço de escuta: "porta" ou "host:porta" (TCP, padrão 127.0.0.1) ou o caminho de um socket UNIX (iniciado por '/' ou '.').
+*
+* @return 0 em caso de sucesso ou -1 se o socket não puder ser criado ou a thread não puder ser iniciada.
+*
+*/
+int SAPoTMetrics_listen(SAPoTMetrics* metrics, const char* address);
+
+#endif /* SAPOTMETRICS_H */
@@ -0,0 +1,175 @@
+
+/*
+*	SAPoTTrace.c define o rastreamento amostrado das mensagens tratadas pela Central SAPoT
+*
+*
+*
+*/
+
+			/************************* Headers ******************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "SAPoTTrace.h"
+
+/* Nomes das etapas, exportados como nomes dos eventos */
+static const char* stageNames[SAPOT_SPANS] = {"callback", "unpack", "execute", "mysql_connect", "query", "publish", "respond"};
+
+/* Identificador da thread corrente (0 até a primeira consulta) */
+static __thread uint32_t currentThread;
+
+/* Function's prototype */
+static uint32_t SAPoTTrace_thread(void);
+
+/**
+* [Principal] SAPoTTrace_init
+*
+*/
+void SAPoTTrace_init(SAPoTTrace* trace){
+
+	memset(trace, 0, sizeof(SAPoTTrace));
+}
+
+/**
+* [Principal] SAPoTTrace_enable
+*
+*/
+int SAPoTTrace_enable(SAPoTTrace* trace, unsigned int sampleRate){
+
+	if(sampleRate == 0){
+		SAPoTTrace_end(trace);
+		return 0;
+	}
+
+	if(trace->spans == NULL){
+		//Zerando as sequências: posições nunca escritas não são exportadas
+		trace->spans = calloc(SAPOT_TRACE_RING_SIZE, sizeof(SAPoTTrace_span));
+		if(trace->spans == NULL) return -1;
+	}
+
+	atomic_store(&trace->messages, 0);
+	trace->sampleRate = sampleRate;
+	return 0;
+}
+
+/**
+* [Principal] SAPoTTrace_end
+*
+*/
+void SAPoTTrace_end(SAPoTTrace* trace){
+
+	trace->sampleRate = 0;
+	free(trace->spans);
+	trace->spans = NULL;
+}
+
+/**
+* [Principal] SAPoTTrace_sample
+*
+*/
+bool SAPoTTrace_sample(SAPoTTrace* trace){
+
+	return atomic_fetch_add_explicit(&trace->messages, 1, memory_order_relaxed) % trace->sampleRate == 0;
+}
+
+/**
+* [Principal] SAPoTTrace_now
+*
+*/
+uint64_t SAPoTTrace_now(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+* [Principal] SAPoTTrace_record
+*
+*/
+void SAPoTTrace_record(SAPoTTrace* trace, int stage, uint64_t begin, uint8_t instruction, uint16_t serial, const uint8_t emitterId[6]){
+
+	if(trace->spans == NULL) return;
+
+	uint64_t end = SAPoTTrace_now();
+	unsigned long position = atomic_fetch_add_explicit(&trace->head, 1, memory_order_relaxed);
+	SAPoTTrace_span* span = &trace->spans[position & (SAPOT_TRACE_RING_SIZE-1)];
+
+	//A sequência zerada durante a escrita invalida leituras concorrentes de SAPoTTrace_dump()
+	atomic_store_explicit(&span->sequence, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	span->begin = begin;
+	span->duration = (uint32_t) (end - begin);
+	span->thread = SAPoTTrace_thread();
+	span->stage = (uint8_t) stage;
+	span->instruction = instruction;
+	span->serial = serial;
+	memcpy(span->emitterId, emitterId, 6);
+
+	atomic_store_explicit(&span->sequence, position + 1, memory_order_release);
+}
+
+/**
+* [Principal] SAPoTTrace_dump
+*
+*/
+int SAPoTTrace_dump(SAPoTTrace* trace, FILE* file){
+
+	int exported = 0;
+	int pid = (int) getpid();
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	if(trace->spans != NULL){
+
+		//Percorrendo do intervalo mais antigo ainda presente no anel até o mais recente
+		unsigned long head = atomic_load(&trace->head);
+		unsigned long position = head > SAPOT_TRACE_RING_SIZE ? head - SAPOT_TRACE_RING_SIZE : 0;
+
+		for(; position < head; position++){
+
+			SAPoTTrace_span* slot = &trace->spans[position & (SAPOT_TRACE_RING_SIZE-1)];
+			unsigned long sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+			if(sequence != position + 1) continue;
+
+			SAPoTTrace_span span;
+			span.begin = slot->begin;
+			span.duration = slot->duration;
+			span.thread = slot->thread;
+			span.stage = slot->stage;
+			span.instruction = slot->instruction;
+			span.serial = slot->serial;
+			memcpy(span.emitterId, slot->emitterId, 6);
+
+			//Descartando o intervalo se ele foi sobrescrito durante a cópia
+			atomic_thread_fence(memory_order_acquire);
+			if(atomic_load_explicit(&slot->sequence, memory_order_relaxed) != sequence || span.stage >= SAPOT_SPANS) continue;
+
+			fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"sapot\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":%d,\"tid\":%u,"
+				"\"args\":{\"emitterId\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"serial\":%u,\"instruction\":%u}}",
+				exported ? "," : "", stageNames[span.stage], (unsigned long long) span.begin, span.duration, pid, span.thread,
+				span.emitterId[0], span.emitterId[1], span.emitterId[2], span.emitterId[3], span.emitterId[4], span.emitterId[5],
+				span.serial, span.instruction);
+			exported++;
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+	return exported;
+}
+
+/**
+* [Subrotina] SAPoTTrace_thread
+*
+*/
+static uint32_t SAPoTTrace_thread(void){
+
+	if(currentThread == 0) currentThread = (uint32_t) syscall(SYS_gettid);
+	return currentThread;
+}
@@ -0,0 +1,205 @@
+/**
+ * @file SAPoTTrace.h
+ * @brief Rastreamento amostrado de mensagens da Central SAPoT.
+ *
+ * Com o rastreamento ativo, uma a cada SAPoTTrace.sampleRate mensagens recebidas é rastreada: cada etapa do seu tratamento
+ * (callback MQTT, estruturação, execução, conexão MySQL, consultas, publicações e resposta) gera um intervalo (SAPoTTrace_span)
+ * com instantes monotônicos, identificado pelo par (emitterId, serial) da mensagem. Os intervalos são escritos sem bloqueios em
+ * um anel circular e podem ser exportados sob demanda no formato JSON de eventos do Chrome (chrome://tracing ou Perfetto)
+ * por SAPoTTrace_dump().
+ *
+ * Com o rastreamento desativado, o custo no caminho das mensagens é um único desvio por etapa (SAPOT_TRACE_BEGIN() e
+ * SAPOT_TRACE_END() testam apenas SAPoTCentral.traced).
+ *
+ */
+
+#ifndef SAPOTTRACE_H
+#define SAPOTTRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/**
+* Quantidade de intervalos do anel de rastreamento (deve ser uma potência de 2). Os intervalos mais antigos são sobrescritos.
+*
+*/
+#define SAPOT_TRACE_RING_SIZE 16384
+
+/**
+* Etapa: callback de recebimento da mensagem (tratamento completo).
+*
+*/
+#define SAPOT_SPAN_CALLBACK 0
+
+/**
+* Etapa: estruturação e validação da mensagem.
+*
+*/
+#define SAPOT_SPAN_UNPACK 1
+
+/**
+* Etapa: execução da instrução.
+*
+*/
+#define SAPOT_SPAN_EXECUTE 2
+
+/**
+* Etapa: conexão com o servidor MySQL.
+*
+*/
+#define SAPOT_SPAN_MYSQL_CONNECT 3
+
+/**
+* Etapa: consulta ao servidor MySQL (ex.: consulta da etiqueta em CTRLactuator()).
+*
+*/
+#define SAPOT_SPAN_QUERY 4
+
+/**
+* Etapa: publicação MQTT.
+*
+*/
+#define SAPOT_SPAN_PUBLISH 5
+
+/**
+* Etapa: resposta ao emissor da mensagem (inclui a publicação).
+*
+*/
+#define SAPOT_SPAN_RESPOND 6
+
+/**
+* Quantidade de etapas rastreadas.
+*
+*/
+#define SAPOT_SPANS 7
+
+/**
+* Inicia um intervalo: retorna o instante corrente se a mensagem em tratamento é rastreada, ou 0.
+*
+*/
+#define SAPOT_TRACE_BEGIN(handle) ((handle)->traced ? SAPoTTrace_now() : 0)
+
+/**
+* Encerra um intervalo iniciado por SAPOT_TRACE_BEGIN(), registrando-o no anel se a mensagem em tratamento é rastreada.
+*
+*/
+#define SAPOT_TRACE_END(handle, stage, begin) do{ if((handle)->traced) SAPoTTrace_record(&(handle)->shared->trace, (stage), (begin), \
+	(handle)->headerData.instruction, (handle)->headerData.serial, (handle)->headerData.emitterId); }while(0)
+
+/**
+* @brief Intervalo de uma etapa de tratamento de uma mensagem rastreada.
+*
+*/
+typedef struct{
+
+	/** Posição de escrita do intervalo mais um (0 indica posição nunca escrita). Permite detectar leituras concorrentes com a escrita. */
+	atomic_ulong sequence;
+
+	/** Início do intervalo, em microssegundos (CLOCK_MONOTONIC) */
+	uint64_t begin;
+
+	/** Duração do intervalo, em microssegundos */
+	uint32_t duration;
+
+	/** Identificador da thread que executou a etapa */
+	uint32_t thread;
+
+	/** Etapa (SAPOT_SPAN_*) */
+	uint8_t stage;
+
+	/** Instrução da mensagem */
+	uint8_t instruction;
+
+	/** Serial da mensagem */
+	uint16_t serial;
+
+	/** Emissor da mensagem */
+	uint8_t emitterId[6];
+
+}SAPoTTrace_span;
+
+/**
+* @brief Rastreamento de mensagens.
+*
+*/
+typedef struct{
+
+	/** Rastreia uma a cada sampleRate mensagens (0 desativa o rastreamento) */
+	unsigned int sampleRate;
+
+	/** Mensagens recebidas desde a ativação, para a amostragem */
+	atomic_ulong messages;
+
+	/** Próxima posição de escrita do anel */
+	atomic_ulong head;
+
+	/** Anel de intervalos (alocado por SAPoTTrace_enable()) */
+	SAPoTTrace_span* spans;
+
+	/** Solicitação de exportação pendente (ex.: ativada por um sinal e atendida por SAPoTCentral_loop()) */
+	atomic_int dumpRequested;
+
+}SAPoTTrace;
+
+/**
+* Inicia o rastreamento desativado.
+*
+*/
+void SAPoTTrace_init(SAPoTTrace* trace);
+
+/**
+* Ativa o rastreamento, alocando o anel de intervalos. Deve ser evocada antes do início do tratamento das mensagens.
+*
+* @param trace Rastreamento.
+* @param sampleRate Rastreia uma a cada sampleRate mensagens.
+*
+* @return 0 em caso de sucesso ou -1 se o anel não puder ser alocado.
+*
+*/
+int SAPoTTrace_enable(SAPoTTrace* trace, unsigned int sampleRate);
+
+/**
+* Desativa o rastreamento e libera o anel de intervalos.
+*
+*/
+void SAPoTTrace_end(SAPoTTrace* trace);
+
+/**
+* Decide se a mensagem recebida deve ser rastreada. Deve ser evocada apenas com o rastreamento ativo.
+*
+*/
+bool SAPoTTrace_sample(SAPoTTrace* trace);
+
+/**
+* Retorna o instante monotônico corrente, em microssegundos.
+*
+*/
+uint64_t SAPoTTrace_now(void);
+
+/**
+* Registra no anel o intervalo de uma etapa, do instante begin até o instante corrente.
+*
+* @param trace Rastreamento.
+* @param stage Etapa (SAPOT_SPAN_*).
+* @param begin Início do intervalo, retornado por SAPOT_TRACE_BEGIN().
+* @param instruction Instrução da mensagem rastreada.
+* @param serial Serial da mensagem rastreada.
+* @param emitterId Emissor da mensagem rastreada.
+*
+*/
+void SAPoTTrace_record(SAPoTTrace* trace, int stage, uint64_t begin, uint8_t instruction, uint16_t serial, const uint8_t emitterId[6]);
+
+/**
+* Exporta os intervalos do anel no formato JSON de eventos do Chrome.
+*
+* @param trace Rastreamento.
+* @param file Arquivo de destino.
+*
+* @return Quantidade de intervalos exportados.
+*
+*/
+int SAPoTTrace_dump(SAPoTTrace* trace, FILE* file);
+
+#endif /* SAPOTTRACE_H */
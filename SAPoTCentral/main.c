@@ -23,37 +23,110 @@
 #include "SAPoTCentral.h"
 
 /* Declaração de Objetos */
-SAPoTCentral SAPoTcentral;
+SAPoTCentral* SAPoTcentrals; //Uma Central para cada centralId
+int SAPoTcentralQuantity = 0;
+SAPoTCentral_shared SAPoTshared; //Log, pool de buffers e tabela de apelidos compartilhados entre as Centrais
 
 void signalHandling(int signum){
 
 	printf("Finalizando a UCC...\n");
-	SAPoTCentral_end();
+	int i;
+	for(i=0; i<SAPoTcentralQuantity; i++) SAPoTCentral_end(&SAPoTcentrals[i]);
+	SAPoTCentral_shared_destroy(&SAPoTshared);
 	exit(1);
 
 }
 
+void traceSignalHandling(int signum){
+
+	//A exportação é feita por SAPoTCentral_loop(), fora do tratador de sinal
+	atomic_store(&SAPoTshared.trace.dumpRequested, 1);
+}
+
 /* Função Principal */
 int main(int argc, char *argv[]) {
 
 	signal(SIGINT, signalHandling);
 
-	//Definindo o identificador da central
-	const char* centralId = "00:00:00:00:00:00";
+	//Uso: ./ucc [-p plugin1.so:plugin2.so] [-l nível de log (0 a 3)] [-m endereço de métricas] [-s intervalo de estatísticas] [-t amostragem do rastreamento] [-c arquivo de captura] [-M] [-w] [centralId ...]
+	char* plugins = NULL;
+	char* metricsAddress = NULL;
+	char* capturePath = NULL;
+	int statsInterval = 0;
+	int traceRate = 0;
+	int logLevel = SAPOT_LOG_INFO;
+	bool memory = false;
+	bool watch = false;
+	int opt;
+	while((opt = getopt(argc, argv, "p:l:m:s:t:c:Mw")) != -1){
+		if(opt == 'p') plugins = optarg;
+		else if(opt == 'l') logLevel = atoi(optarg);
+		else if(opt == 'm') metricsAddress = optarg;
+		else if(opt == 's') statsInterval = atoi(optarg);
+		else if(opt == 't') traceRate = atoi(optarg);
+		else if(opt == 'c') capturePath = optarg;
+		else if(opt == 'M') memory = true;
+		else if(opt == 'w') watch = true;
+		else{
+			printf("Uso: %s [-p plugins] [-l nível de log] [-m porta ou socket de métricas] [-s intervalo de estatísticas] [-t 1 a cada N mensagens rastreadas] [-c arquivo de captura] [-M armazenamento em memória] [-w tópicos de observação] [centralId ...]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	//Definindo os identificadores das centrais (uma por andar, por exemplo)
+	const char* defaultId = "00:00:00:00:00:00";
+	const char** centralIds = (optind < argc) ? (const char**) &argv[optind] : &defaultId;
+	int centralQuantity = (optind < argc) ? argc - optind : 1;
 	
 	//Configurando as opções de inicialização da central
 	//SAPoTCentral_create_options SAPoTopts = {MQTT, {"10.10.40.84", "1883", "LDAP", NULL}, SQL, {"localhost", "3306", "ucc", "uccpass123", "db_UCC"}};
 	//SAPoTCentral_create_options SAPoTopts = {MQTT, {"10.10.40.84", "1883", "LDAP", NULL}, SQL, {"10.10.40.84", "3306", "ucc", "uccpass123", "db_UCC"}};
-	SAPoTCentral_create_options SAPoTopts = {MQTT, {"localhost", "1883", NULL, NULL}, SQL, {"localhost", "3306", "ucc", "uccpass123", "db_UCC"}};
+	SAPoTCentral_create_options SAPoTopts = {MQTT, {"localhost", "1883", NULL, NULL}, SQL, {"localhost", "3306", "ucc", "uccpass123", "db_UCC"}, NULL, 0, false};
+	SAPoTopts.plugins = plugins;
+	SAPoTopts.statsInterval = statsInterval;
+	//Com -w, as mensagens dos Clientes são republicadas em centralId/watch/tipo/macaddr para o gpc watch
+	SAPoTopts.watch = watch;
+	//Com -M, os cadastros e amostras ficam em memória e a UCC dispensa o servidor MySQL (ex.: make bench sem banco de dados)
+	if(memory) SAPoTopts.databaseProtocol = MEMORY;
 
-	//Iniciando os serviços da Central
-	if(SAPoTCentral_begin(&SAPoTcentral, &SAPoTopts, centralId) != SAPOTCENTRAL_SUCCESS){
-		printf("SAPoTCentral_begin error (%d)", SAPoTcentral.error);
+	//Iniciando o contexto compartilhado entre as centrais
+	if(SAPoTCentral_shared_init(&SAPoTshared, "ucc_log") != SAPOTCENTRAL_SUCCESS){
+		printf("SAPoTCentral_shared_init error\n");
 		return -1;
 	}
+	SAPoTshared.log.level = logLevel;
+
+	//Servindo as métricas em formato Prometheus (ex.: -m 9100 ou -m /run/ucc/metrics.sock)
+	if(metricsAddress != NULL && SAPoTCentral_metrics_listen(&SAPoTshared, metricsAddress) != SAPOTCENTRAL_SUCCESS){
+		printf("SAPoTCentral_metrics_listen error: %s\n", metricsAddress);
+	}
+
+	//Rastreando 1 a cada traceRate mensagens; o rastreamento é exportado em ucc_log-trace-*.json a cada SIGUSR1 (ex.: kill -USR1 <pid>)
+	if(traceRate > 0){
+		if(SAPoTTrace_enable(&SAPoTshared.trace, traceRate) != 0) printf("SAPoTTrace_enable error\n");
+		else signal(SIGUSR1, traceSignalHandling);
+	}
+
+	//Capturando as mensagens recebidas para reprodução pelo ucc-replay (ex.: -c incidente.sapc)
+	if(capturePath != NULL && SAPoTCapture_begin(&SAPoTshared.capture, capturePath, 0) != 0){
+		printf("SAPoTCapture_begin error: %s\n", capturePath);
+	}
+
+	SAPoTcentrals = calloc(centralQuantity, sizeof(SAPoTCentral));
+	if(SAPoTcentrals == NULL) return -1;
+
+	//Iniciando os serviços de cada Central
+	int i;
+	for(i=0; i<centralQuantity; i++){
+		if(SAPoTCentral_begin(&SAPoTcentrals[i], &SAPoTopts, centralIds[i], &SAPoTshared) != SAPOTCENTRAL_SUCCESS){
+			printf("SAPoTCentral_begin error (%d) on %s\n", SAPoTcentrals[i].error, centralIds[i]);
+			return -1;
+		}
+		SAPoTcentralQuantity++;
+	}
 		
-	//Entrando em modo loop	
-	SAPoTCentral_loop(); 
+	//Entrando em modo loop: as mensagens de cada Central são tratadas pela thread de seu cliente MQTT
+	SAPoTCentral_loop(&SAPoTcentrals[0]); 
 			
 	return 0;
 
@@ -0,0 +1,639 @@
+/*
+* ucc-bench: gerador de carga que simula uma frota de Clientes SAPoT contra uma UCC em execução (make bench).
+*
+*	Uso: ./ucc-bench [-H host] [-P porta] [-c centralId] [-n dispositivos] [-C conexões] [-g usuários] [-d duração]
+*	                 [-p período] [-b amostras] [-a intervalo] [-A acessos] [-T timeout] [-o arquivo] [-L rótulo]
+*
+*	O teste é dividido em fases:
+*		1. Cadastro: todos os dispositivos se cadastram de uma só vez (0x00);
+*		2. Etiquetagem: um usuário etiqueta os dispositivos com atuador (0x06);
+*		3. Regime: durante a duração do teste, os dispositivos enviam lotes de amostras (0x08) a cada período e respondem aos
+*		   acionamentos recebidos (0x03), enquanto os usuários (como o gpc) solicitam acionamentos (0x03) e, a cada A
+*		   solicitações, o acesso à tabela de Clientes (0x04).
+*
+*	Os dispositivos são distribuídos entre C conexões MQTT, cada uma inscrita nos tópicos de seus dispositivos. As respostas
+*	são associadas às requisições pelo emissor e pelo serial. Ao final são impressos, para cada instrução, as mensagens enviadas
+*	e respondidas, a vazão e os percentis de latência p50, p99 e p999. Com -o, os resultados são acrescentados em formato
+*	TSV ao arquivo informado, para a comparação entre versões.
+*
+*/
+
+/* Bibliotecas */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <MQTTClient.h>
+#include "SAPoTCentral.h"
+
+/* Prefixo dos endereços MAC simulados (administrados localmente): 02:5A:00:00:HH:LL para dispositivos e 02:5A:FF:00:00:NN para usuários */
+#define BENCH_MAC_DEVICE 0x00
+#define BENCH_MAC_USER 0xFF
+
+/* Requisições pendentes por dispositivo e por usuário (potências de 2) */
+#define BENCH_DEVICE_PENDING 8
+#define BENCH_USER_PENDING 1024
+
+/* Histogramas log-lineares: 32 subfaixas por potência de 2 (erro relativo de até 3%), até 2^36 us */
+#define BENCH_SUB_BUCKETS 32
+#define BENCH_BUCKETS (BENCH_SUB_BUCKETS * 32)
+
+/* Linhas do relatório */
+enum{ STAT_REGISTRATION, STAT_MODIFICATION, STAT_BATCH, STAT_SOLICITATION, STAT_DRIVE, STAT_ACCESS, STAT_COUNT };
+static const char* statNames[STAT_COUNT] = {"Registration", "Modification", "Batch", "ActuatorSolicitation", "ActuatorDrive", "Access"};
+
+/* Estatísticas de uma instrução */
+typedef struct{
+
+	atomic_ulong sent;
+	atomic_ulong answered;
+	atomic_ullong firstSent;
+	atomic_ullong lastAnswer;
+	atomic_ullong max;
+	atomic_ulong buckets[BENCH_BUCKETS];
+
+}BenchStat;
+
+/* Dispositivo simulado */
+typedef struct{
+
+	char topic[18];
+	uint8_t id[6];
+	char label[11];
+	bool actuator;
+	uint16_t serial;
+	uint64_t next;
+	/* Instante de envio (48 bits) e serial (16 bits) de cada requisição pendente, indexados pelo serial */
+	atomic_ullong pending[BENCH_DEVICE_PENDING];
+	/* Instante da última solicitação de acionamento destinada ao dispositivo (0 se nenhuma) */
+	atomic_ullong driveRequested;
+
+}BenchDevice;
+
+/* Conexão MQTT (um grupo de dispositivos ou um usuário) */
+typedef struct{
+
+	MQTTClient client;
+	int index;
+	bool user;
+	int first;
+	int quantity;
+	uint8_t id[6];
+	char topic[18];
+	uint16_t serial;
+	atomic_ullong pending[BENCH_USER_PENDING];
+	unsigned int seed;
+	pthread_t thread;
+
+}BenchConnection;
+
+/* Configuração do teste */
+typedef struct{
+
+	const char* host;
+	const char* port;
+	const char* centralId;
+	int devices;
+	int connections;
+	int users;
+	int duration;
+	int period;
+	int samples;
+	int interval;
+	int accessEvery;
+	int timeout;
+	const char* output;
+	const char* label;
+
+}BenchOptions;
+
+/* Objetos */
+static BenchOptions opts = {"localhost", "1883", "00:00:00:00:00:00", 1000, 8, 2, 30, 1000, 4, 100, 20, 5000, NULL, "bench"};
+static BenchStat stats[STAT_COUNT];
+static BenchDevice* devices;
+static BenchConnection* connections;
+static int* actuators;
+static int actuatorQuantity;
+static atomic_int running;
+static uint64_t steadyEnd;
+
+/* Instante monotônico em microssegundos */
+static uint64_t now_us(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Dorme até um instante monotônico em microssegundos */
+static void sleep_until(uint64_t instant){
+
+	struct timespec t = {instant / 1000000, (instant % 1000000) * 1000};
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0);
+}
+
+/* Faixa do histograma de uma latência */
+static int bucket_of(uint64_t value){
+
+	if(value < BENCH_SUB_BUCKETS) return value;
+	int exponent = 63 - __builtin_clzll(value) - 4;
+	int index = exponent * (BENCH_SUB_BUCKETS/2) + (int) (value >> exponent);
+	return index < BENCH_BUCKETS ? index : BENCH_BUCKETS - 1;
+}
+
+/* Maior latência representada por uma faixa do histograma */
+static uint64_t bucket_value(int index){
+
+	if(index < BENCH_SUB_BUCKETS) return index;
+	int exponent = index / (BENCH_SUB_BUCKETS/2) - 1;
+	uint64_t mantissa = index % (BENCH_SUB_BUCKETS/2) + BENCH_SUB_BUCKETS/2;
+	return ((mantissa + 1) << exponent) - 1;
+}
+
+/* Contabiliza uma requisição enviada */
+static void stat_sent(int stat, uint64_t instant){
+
+	uint64_t expected = 0;
+	atomic_compare_exchange_strong(&stats[stat].firstSent, &expected, instant);
+	atomic_fetch_add_explicit(&stats[stat].sent, 1, memory_order_relaxed);
+}
+
+/* Contabiliza uma resposta e sua latência */
+static void stat_answered(int stat, uint64_t sent, uint64_t instant){
+
+	BenchStat* s = &stats[stat];
+	uint64_t latency = instant - sent;
+	atomic_fetch_add_explicit(&s->answered, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&s->buckets[bucket_of(latency)], 1, memory_order_relaxed);
+
+	uint64_t max = atomic_load_explicit(&s->max, memory_order_relaxed);
+	while(latency > max && !atomic_compare_exchange_weak(&s->max, &max, latency));
+	uint64_t last = atomic_load_explicit(&s->lastAnswer, memory_order_relaxed);
+	while(instant > last && !atomic_compare_exchange_weak(&s->lastAnswer, &last, instant));
+}
+
+/* Percentil de uma estatística, em microssegundos */
+static uint64_t stat_percentile(BenchStat* s, double percentile){
+
+	unsigned long answered = atomic_load(&s->answered);
+	unsigned long target = (unsigned long) (answered * percentile + 0.5);
+	unsigned long count = 0;
+	int i;
+
+	if(answered == 0) return 0;
+	if(target == 0) target = 1;
+	for(i=0; i<BENCH_BUCKETS; i++){
+		count += atomic_load_explicit(&s->buckets[i], memory_order_relaxed);
+		if(count >= target) return bucket_value(i) < s->max ? bucket_value(i) : s->max;
+	}
+	return s->max;
+}
+
+/* Converte um emissor em seu tópico (endereço MAC em maiúsculas, como em SAPoTCentral_respond()) */
+static void mac_topic(const uint8_t id[6], char topic[18]){
+
+	sprintf(topic, "%02X:%02X:%02X:%02X:%02X:%02X", id[0], id[1], id[2], id[3], id[4], id[5]);
+}
+
+/* Converte um endereço MAC no formato xx:xx:xx:xx:xx:xx */
+static int mac_parse(const char* text, uint8_t id[6]){
+
+	unsigned int b[6];
+	int i;
+	if(sscanf(text, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) return -1;
+	for(i=0; i<6; i++) id[i] = b[i];
+	return 0;
+}
+
+/* Monta o cabeçalho v1 de uma mensagem */
+static void fill_header(uint8_t* message, uint8_t instruction, bool ack, uint16_t serial, uint16_t length, const uint8_t id[6]){
+
+	SAPoTMessage_header* header = (SAPoTMessage_header*) message;
+	memset(header, 0, sizeof(SAPoTMessage_header));
+	header->version = SAPOT_PROTOCOL_VERSION;
+	header->ack = ack;
+	header->instruction = instruction;
+	header->serial = serial;
+	header->length = length;
+	memcpy(header->emitterId, id, 6);
+}
+
+/* Publica uma mensagem na Central (QoS 0, sem esperar a entrega) */
+static int publish(BenchConnection* connection, const char* topic, void* message, int length){
+
+	MQTTClient_message pubmsg = MQTTClient_message_initializer;
+	MQTTClient_deliveryToken token;
+	pubmsg.payload = message;
+	pubmsg.payloadlen = length;
+	pubmsg.qos = 0;
+	pubmsg.retained = 0;
+	return MQTTClient_publishMessage(connection->client, topic, &pubmsg, &token) == MQTTCLIENT_SUCCESS ? 0 : -1;
+}
+
+/* Reserva a posição de uma requisição pendente (uma requisição anterior ainda sem resposta é descartada e contabilizada como perdida no relatório) */
+static void pending_store(atomic_ullong* slot, uint16_t serial, uint64_t instant){
+
+	atomic_store(slot, ((uint64_t) serial << 48) | (instant & 0xFFFFFFFFFFFFULL));
+}
+
+/* Libera a posição de uma requisição respondida, retornando seu instante de envio (0 se não estava pendente) */
+static uint64_t pending_take(atomic_ullong* slot, uint16_t serial){
+
+	uint64_t value = atomic_load(slot);
+	if(value == 0 || (value >> 48) != serial) return 0;
+	if(!atomic_compare_exchange_strong(slot, &value, 0)) return 0;
+	return value & 0xFFFFFFFFFFFFULL;
+}
+
+/* Envia o cadastro de um dispositivo: um sensor de temperatura e, para um a cada quatro dispositivos, um atuador */
+static void send_registration(BenchConnection* connection, BenchDevice* device){
+
+	uint8_t message[sizeof(SAPoTMessage_header) + 4 + 2*2];
+	int length = sizeof(SAPoTMessage_header) + 4 + 2*(1 + device->actuator);
+	uint8_t* payload = message + sizeof(SAPoTMessage_header);
+	uint16_t serial = ++device->serial;
+
+	fill_header(message, 0x00, false, serial, length, device->id);
+	payload[0] = 0x01; payload[1] = 0x00; //SMCAI
+	payload[2] = 1;
+	payload[3] = device->actuator;
+	memset(&payload[4], 0, 4); //TMP e CAC
+
+	uint64_t instant = now_us();
+	pending_store(&device->pending[serial & (BENCH_DEVICE_PENDING-1)], serial, instant);
+	stat_sent(STAT_REGISTRATION, instant);
+	publish(connection, opts.centralId, message, length);
+}
+
+/* Envia um lote de amostras de um dispositivo */
+static void send_batch(BenchConnection* connection, BenchDevice* device){
+
+	uint8_t message[sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_batch) + 255*sizeof(SAPoTMessage_sample)];
+	int length = sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_batch) + opts.samples*sizeof(SAPoTMessage_sample);
+	SAPoTMessage_batch* batch = (SAPoTMessage_batch*) (message + sizeof(SAPoTMessage_header));
+	SAPoTMessage_sample* samples = (SAPoTMessage_sample*) (batch + 1);
+	uint16_t serial = ++device->serial;
+	int i;
+
+	fill_header(message, 0x08, false, serial, length, device->id);
+	batch->sampleQuantity = opts.samples;
+	batch->timeScale = 0;
+	batch->rsv = 0;
+	for(i=0; i<opts.samples; i++){
+		samples[i].sensorId = 0;
+		samples[i].age = (opts.samples - 1 - i) * (opts.period / opts.samples);
+		samples[i].value = 20.0f + (rand_r(&connection->seed) % 1000) / 100.0f;
+	}
+
+	uint64_t instant = now_us();
+	pending_store(&device->pending[serial & (BENCH_DEVICE_PENDING-1)], serial, instant);
+	stat_sent(STAT_BATCH, instant);
+	publish(connection, opts.centralId, message, length);
+}
+
+/* Envia uma requisição de usuário (etiquetagem, solicitação ou acesso), aguardando posição livre na tabela de pendentes */
+static void send_user_request(BenchConnection* user, int stat, uint8_t instruction, const void* payload, int payloadLen){
+
+	uint8_t message[sizeof(SAPoTMessage_header) + 64];
+	int length = sizeof(SAPoTMessage_header) + payloadLen;
+	uint16_t serial = ++user->serial;
+	atomic_ullong* slot = &user->pending[serial & (BENCH_USER_PENDING-1)];
+
+	//Limitando as requisições em trânsito ao tamanho da tabela (até o timeout)
+	uint64_t deadline = now_us() + (uint64_t) opts.timeout * 1000;
+	while(atomic_load(slot) != 0 && now_us() < deadline) usleep(1000);
+
+	fill_header(message, instruction, false, serial, length, user->id);
+	if(instruction == 0x04){
+		//Aceita a tabela no formato compacto com codificação delta, como o gpc
+		((SAPoTMessage_header*) message)->rsv1 = 1;
+		((SAPoTMessage_header*) message)->rsv2 = 1;
+	}
+	if(payloadLen > 0) memcpy(message + sizeof(SAPoTMessage_header), payload, payloadLen);
+
+	uint64_t instant = now_us();
+	pending_store(slot, serial, instant);
+	stat_sent(stat, instant);
+	publish(user, opts.centralId, message, length);
+}
+
+/* Solicita o acionamento do atuador de um dispositivo, como em "gpc solicitation <label> ON" */
+static void send_solicitation(BenchConnection* user, BenchDevice* device){
+
+	SAPoTMessage_solicitation solicitation;
+	memset(&solicitation, 0, sizeof(solicitation));
+	memcpy(solicitation.label, device->label, sizeof(solicitation.label));
+	solicitation.sensorOrActuatorId = 1;
+	solicitation.timeSet = 0x1001;
+	solicitation.degreeOfPerformance = 0xffff;
+
+	uint64_t instant = now_us();
+	stat_sent(STAT_DRIVE, instant);
+	atomic_store(&device->driveRequested, instant);
+	send_user_request(user, STAT_SOLICITATION, 0x03, &solicitation, sizeof(solicitation));
+}
+
+/* Trata as mensagens recebidas pelos dispositivos e pelos usuários */
+static int messageArrived(void* context, char* topicName, int topicLen, MQTTClient_message* MQTTmsg){
+
+	BenchConnection* connection = (BenchConnection*) context;
+	uint64_t instant = now_us();
+	uint8_t id[6];
+
+	//O tópico de resposta é o endereço MAC do destinatário (topicLen é 0 se topicName terminar em '\0')
+	char topic[18] = {0};
+	memcpy(topic, topicName, topicLen > 0 && topicLen < 18 ? (size_t) topicLen : strnlen(topicName, 17));
+
+	if(MQTTmsg->payloadlen < (int) sizeof(SAPoTMessage_header) || mac_parse(topic, id) != 0) goto done;
+	SAPoTMessage_header header;
+	memcpy(&header, MQTTmsg->payload, sizeof(header));
+
+	//Respostas aos usuários
+	if(id[2] == BENCH_MAC_USER){
+		int stat = header.instruction == 0x03 ? STAT_SOLICITATION : header.instruction == 0x04 ? STAT_ACCESS : header.instruction == 0x06 ? STAT_MODIFICATION : -1;
+		uint64_t sent;
+		if(header.ack && stat >= 0 && (sent = pending_take(&connection->pending[header.serial & (BENCH_USER_PENDING-1)], header.serial)) != 0){
+			stat_answered(stat, sent, instant);
+		}
+		goto done;
+	}
+
+	int index = (id[4] << 8) | id[5];
+	if(index >= opts.devices) goto done;
+	BenchDevice* device = &devices[index];
+
+	//Acionamento encaminhado pela Central: o dispositivo confirma o acionamento com o mesmo serial
+	if(!header.ack && header.instruction == 0x03){
+		uint64_t requested = atomic_exchange(&device->driveRequested, 0);
+		if(requested != 0) stat_answered(STAT_DRIVE, requested, instant);
+		uint8_t ack[sizeof(SAPoTMessage_header)];
+		fill_header(ack, 0x03, true, header.serial, sizeof(ack), device->id);
+		publish(connection, opts.centralId, ack, sizeof(ack));
+		goto done;
+	}
+
+	//Respostas ao cadastro e aos lotes
+	uint64_t sent;
+	if(header.ack && (sent = pending_take(&device->pending[header.serial & (BENCH_DEVICE_PENDING-1)], header.serial)) != 0){
+		if(header.instruction == 0x00) stat_answered(STAT_REGISTRATION, sent, instant);
+		else if(header.instruction == 0x08) stat_answered(STAT_BATCH, sent, instant);
+	}
+
+done:
+	MQTTClient_freeMessage(&MQTTmsg);
+	MQTTClient_free(topicName);
+	return 1;
+}
+
+/* Conexão perdida: o teste continua, mas as respostas seguintes são contabilizadas como perdidas */
+static void connectionLost(void* context, char* cause){
+
+	BenchConnection* connection = (BenchConnection*) context;
+	fprintf(stderr, "Conexão %d perdida: %s\n", connection->index, cause != NULL ? cause : "desconhecida");
+}
+
+/* Conecta uma conexão ao broker e a inscreve nos tópicos de seus dispositivos ou do usuário */
+static int bench_connect(BenchConnection* connection){
+
+	char serverURI[128];
+	char clientId[64];
+	snprintf(serverURI, sizeof(serverURI), "tcp://%s:%s", opts.host, opts.port);
+	snprintf(clientId, sizeof(clientId), "ucc-bench-%d-%d", (int) getpid(), connection->index);
+
+	if(MQTTClient_create(&connection->client, serverURI, clientId, MQTTCLIENT_PERSISTENCE_NONE, NULL) != MQTTCLIENT_SUCCESS) return -1;
+	if(MQTTClient_setCallbacks(connection->client, connection, connectionLost, messageArrived, NULL) != MQTTCLIENT_SUCCESS) return -1;
+
+	MQTTClient_connectOptions MQTTopts = MQTTClient_connectOptions_initializer;
+	MQTTopts.keepAliveInterval = 60;
+	MQTTopts.cleansession = 1;
+	if(MQTTClient_connect(connection->client, &MQTTopts) != MQTTCLIENT_SUCCESS) return -1;
+
+	if(connection->user) return MQTTClient_subscribe(connection->client, connection->topic, 0) == MQTTCLIENT_SUCCESS ? 0 : -1;
+
+	//Inscrevendo nos tópicos dos dispositivos em grupos de até 128
+	char* topics[128];
+	int qos[128];
+	int i, count = 0;
+	for(i=0; i<connection->quantity; i++){
+		topics[count] = devices[connection->first + i].topic;
+		qos[count++] = 0;
+		if(count == 128 || i == connection->quantity - 1){
+			if(MQTTClient_subscribeMany(connection->client, count, topics, qos) != MQTTCLIENT_SUCCESS) return -1;
+			count = 0;
+		}
+	}
+	return 0;
+}
+
+/* Aguarda as respostas de uma estatística até o timeout sem novas respostas */
+static void wait_answers(int stat){
+
+	unsigned long answered = atomic_load(&stats[stat].answered);
+	uint64_t deadline = now_us() + (uint64_t) opts.timeout * 1000;
+	while(answered < atomic_load(&stats[stat].sent) && now_us() < deadline){
+		usleep(10000);
+		unsigned long current = atomic_load(&stats[stat].answered);
+		if(current != answered) deadline = now_us() + (uint64_t) opts.timeout * 1000;
+		answered = current;
+	}
+}
+
+/* Thread de uma conexão de dispositivos em regime: cada dispositivo envia um lote a cada período */
+static void* device_thread(void* context){
+
+	BenchConnection* connection = (BenchConnection*) context;
+	uint64_t tick = now_us();
+
+	while(atomic_load(&running)){
+		uint64_t instant = now_us();
+		if(instant >= steadyEnd) break;
+		int i;
+		for(i=0; i<connection->quantity; i++){
+			BenchDevice* device = &devices[connection->first + i];
+			if(instant >= device->next){
+				send_batch(connection, device);
+				device->next += (uint64_t) opts.period * 1000;
+			}
+		}
+		tick += 1000;
+		if(tick < instant) tick = instant;
+		sleep_until(tick);
+	}
+	return NULL;
+}
+
+/* Thread de um usuário em regime: solicita acionamentos a cada intervalo e, a cada A solicitações, o acesso à tabela */
+static void* user_thread(void* context){
+
+	BenchConnection* user = (BenchConnection*) context;
+	uint64_t next = now_us();
+	unsigned long requests = 0;
+
+	while(atomic_load(&running) && next < steadyEnd){
+		sleep_until(next);
+		if(opts.accessEvery > 0 && ++requests % opts.accessEvery == 0) send_user_request(user, STAT_ACCESS, 0x04, NULL, 0);
+		else if(actuatorQuantity > 0) send_solicitation(user, &devices[actuators[rand_r(&user->seed) % actuatorQuantity]]);
+		next += (uint64_t) opts.interval * 1000;
+	}
+	return NULL;
+}
+
+/* Imprime o relatório e, com -o, o acrescenta ao arquivo TSV */
+static void report(void){
+
+	FILE* output = NULL;
+	if(opts.output != NULL && (output = fopen(opts.output, "a")) == NULL) perror(opts.output);
+
+	printf("\n%-21s %9s %9s %7s %10s %9s %9s %9s %9s\n", "instruction", "sent", "answered", "lost", "msg/s", "p50(ms)", "p99(ms)", "p999(ms)", "max(ms)");
+
+	int i;
+	for(i=0; i<STAT_COUNT; i++){
+		BenchStat* s = &stats[i];
+		unsigned long sent = atomic_load(&s->sent);
+		unsigned long answered = atomic_load(&s->answered);
+		if(sent == 0) continue;
+
+		uint64_t elapsed = s->lastAnswer > s->firstSent ? s->lastAnswer - s->firstSent : 0;
+		double rate = elapsed > 0 ? answered * 1e6 / elapsed : 0;
+		double p50 = stat_percentile(s, 0.50) / 1000.0;
+		double p99 = stat_percentile(s, 0.99) / 1000.0;
+		double p999 = stat_percentile(s, 0.999) / 1000.0;
+		double max = s->max / 1000.0;
+
+		printf("%-21s %9lu %9lu %7lu %10.1f %9.3f %9.3f %9.3f %9.3f\n", statNames[i], sent, answered, sent - answered, rate, p50, p99, p999, max);
+		if(output != NULL) fprintf(output, "%s\t%d\t%s\t%lu\t%lu\t%lu\t%.1f\t%.3f\t%.3f\t%.3f\t%.3f\n", opts.label, opts.devices, statNames[i], sent, answered, sent - answered, rate, p50, p99, p999, max);
+	}
+
+	if(output != NULL) fclose(output);
+}
+
+/* Função Principal */
+int main(int argc, char *argv[]){
+
+	int opt;
+	while((opt = getopt(argc, argv, "H:P:c:n:C:g:d:p:b:a:A:T:o:L:")) != -1){
+		if(opt == 'H') opts.host = optarg;
+		else if(opt == 'P') opts.port = optarg;
+		else if(opt == 'c') opts.centralId = optarg;
+		else if(opt == 'n') opts.devices = atoi(optarg);
+		else if(opt == 'C') opts.connections = atoi(optarg);
+		else if(opt == 'g') opts.users = atoi(optarg);
+		else if(opt == 'd') opts.duration = atoi(optarg);
+		else if(opt == 'p') opts.period = atoi(optarg);
+		else if(opt == 'b') opts.samples = atoi(optarg);
+		else if(opt == 'a') opts.interval = atoi(optarg);
+		else if(opt == 'A') opts.accessEvery = atoi(optarg);
+		else if(opt == 'T') opts.timeout = atoi(optarg);
+		else if(opt == 'o') opts.output = optarg;
+		else if(opt == 'L') opts.label = optarg;
+		else{
+			fprintf(stderr, "Uso: %s [-H host] [-P porta] [-c centralId] [-n dispositivos] [-C conexões] [-g usuários] [-d duração (s)] "
+				"[-p período dos lotes (ms)] [-b amostras por lote] [-a intervalo dos usuários (ms)] [-A acessos a cada N solicitações] "
+				"[-T timeout (ms)] [-o arquivo.tsv] [-L rótulo]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(opts.devices < 1 || opts.devices > 0xFFFF || opts.connections < 1 || opts.users < 1 || opts.samples < 1 || opts.samples > 255 || opts.period < 1 || opts.interval < 1 || mac_parse(opts.centralId, (uint8_t[6]){0}) != 0){
+		fprintf(stderr, "Parâmetros inválidos\n");
+		return 1;
+	}
+	if(opts.connections > opts.devices) opts.connections = opts.devices;
+
+	devices = calloc(opts.devices, sizeof(BenchDevice));
+	actuators = calloc(opts.devices, sizeof(int));
+	connections = calloc(opts.connections + opts.users, sizeof(BenchConnection));
+	if(devices == NULL || actuators == NULL || connections == NULL) return 1;
+
+	//Criando os dispositivos: um a cada quatro possui atuador e recebe uma etiqueta
+	int i;
+	for(i=0; i<opts.devices; i++){
+		BenchDevice* device = &devices[i];
+		uint8_t id[6] = {0x02, 0x5A, BENCH_MAC_DEVICE, 0x00, i >> 8, i & 0xFF};
+		memcpy(device->id, id, 6);
+		mac_topic(id, device->topic);
+		device->actuator = (i % 4 == 0);
+		//opts.devices é limitado a 0xFFFF (os dois últimos bytes do MAC), então a etiqueta tem sempre 5 dígitos e é única
+		snprintf(device->label, sizeof(device->label), "bn%05u", (unsigned int) (uint16_t) i);
+		if(device->actuator) actuators[actuatorQuantity++] = i;
+	}
+
+	//Distribuindo os dispositivos entre as conexões e criando os usuários
+	for(i=0; i<opts.connections + opts.users; i++){
+		BenchConnection* connection = &connections[i];
+		connection->index = i;
+		connection->seed = i + 1;
+		if(i < opts.connections){
+			connection->first = (long) opts.devices * i / opts.connections;
+			connection->quantity = (long) opts.devices * (i + 1) / opts.connections - connection->first;
+		}
+		else{
+			uint8_t id[6] = {0x02, 0x5A, BENCH_MAC_USER, 0x00, 0x00, i - opts.connections};
+			connection->user = true;
+			memcpy(connection->id, id, 6);
+			mac_topic(id, connection->topic);
+		}
+		if(bench_connect(connection) != 0){
+			fprintf(stderr, "Falha ao conectar a conexão %d em %s:%s\n", i, opts.host, opts.port);
+			return 1;
+		}
+	}
+	BenchConnection* users = &connections[opts.connections];
+	atomic_store(&running, 1);
+
+	//Fase 1: cadastro simultâneo de toda a frota
+	printf("Cadastrando %d dispositivos em %d conexões...\n", opts.devices, opts.connections);
+	for(i=0; i<opts.connections; i++){
+		int j;
+		for(j=0; j<connections[i].quantity; j++) send_registration(&connections[i], &devices[connections[i].first + j]);
+	}
+	wait_answers(STAT_REGISTRATION);
+
+	//Fase 2: etiquetagem dos dispositivos com atuador, como em "gpc modification <macaddr> <label>"
+	printf("Etiquetando %d dispositivos com atuador...\n", actuatorQuantity);
+	for(i=0; i<actuatorQuantity; i++){
+		SAPoTMessage_modification modification;
+		memset(&modification, 0, sizeof(modification));
+		memcpy(modification.macaddr, devices[actuators[i]].topic, 17);
+		memcpy(modification.label, devices[actuators[i]].label, 10);
+		send_user_request(&users[0], STAT_MODIFICATION, 0x06, &modification, sizeof(modification));
+	}
+	wait_answers(STAT_MODIFICATION);
+
+	//Fase 3: regime, com os lotes distribuídos uniformemente ao longo do período
+	printf("Regime por %d s: lotes de %d amostras a cada %d ms, %d usuários a cada %d ms...\n", opts.duration, opts.samples, opts.period, opts.users, opts.interval);
+	uint64_t start = now_us();
+	steadyEnd = start + (uint64_t) opts.duration * 1000000;
+	for(i=0; i<opts.devices; i++) devices[i].next = start + (uint64_t) opts.period * 1000 * i / opts.devices;
+	for(i=0; i<opts.connections + opts.users; i++){
+		if(pthread_create(&connections[i].thread, NULL, connections[i].user ? user_thread : device_thread, &connections[i]) != 0){
+			fprintf(stderr, "Falha ao iniciar a thread %d\n", i);
+			return 1;
+		}
+	}
+	for(i=0; i<opts.connections + opts.users; i++) pthread_join(connections[i].thread, NULL);
+
+	//Aguardando as respostas em trânsito
+	wait_answers(STAT_BATCH);
+	wait_answers(STAT_SOLICITATION);
+	wait_answers(STAT_ACCESS);
+	atomic_store(&running, 0);
+
+	report();
+
+	for(i=0; i<opts.connections + opts.users; i++){
+		MQTTClient_disconnect(connections[i].client, 1000);
+		MQTTClient_destroy(&connections[i].client);
+	}
+
+	free(devices);
+	free(actuators);
+	free(connections);
+	return 0;
+}
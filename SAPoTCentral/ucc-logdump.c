@@ -0,0 +1,185 @@
+/*
+* ucc-logdump: decodifica e filtra os arquivos de log binário (.sapl) da UCC SAPoT.
+*
+*	Uso: ./ucc-logdump [-e emitterId] [-i instrução] [-t evento] [-l nível] [-s início] [-u fim] arquivo.sapl ...
+*
+*	Os instantes de início e fim são aceitos no formato "AAAA-MM-DD HH:MM:SS" (hora local) ou em segundos desde 1970.
+*
+*/
+
+/* Bibliotecas */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "SAPoTLog.h"
+
+/* Filtros selecionados na linha de comando */
+typedef struct{
+
+	bool byEmitter;
+	uint8_t emitterId[6];
+	int instruction;
+	int event;
+	int level;
+	uint64_t since;
+	uint64_t until;
+
+}LogFilter;
+
+/* Converte um instante da linha de comando em microssegundos desde 1970 */
+static int parseTime(const char* text, uint64_t* time){
+
+	struct tm date;
+	memset(&date, 0, sizeof(date));
+	const char* end = strptime(text, "%Y-%m-%d %H:%M:%S", &date);
+	if(end != NULL && *end == '\0'){
+		date.tm_isdst = -1;
+		*time = (uint64_t) mktime(&date) * 1000000;
+		return 0;
+	}
+
+	char* last;
+	unsigned long long seconds = strtoull(text, &last, 10);
+	if(*text == '\0' || *last != '\0') return -1;
+	*time = seconds * 1000000;
+	return 0;
+}
+
+/* Converte o nome ou o número de um evento */
+static int parseEvent(const char* text){
+
+	int event;
+	for(event = 0; event < 256; event++){
+		const char* name = SAPoTLog_event_name(event);
+		if(name != NULL && strcasecmp(name, text) == 0) return event;
+	}
+
+	char* last;
+	event = strtol(text, &last, 0);
+	if(*text == '\0' || *last != '\0' || event < 0 || event > 255) return -1;
+	return event;
+}
+
+/* Verifica se um registro passa pelos filtros */
+static bool matches(const LogFilter* filter, const SAPoTLog_record* record){
+
+	if(record->level < filter->level) return false;
+	if(filter->event >= 0 && record->event != filter->event) return false;
+	if(filter->instruction >= 0 && (record->event >= SAPOT_EVENT_CENTRAL || record->instruction != filter->instruction)) return false;
+	if(filter->byEmitter && memcmp(record->emitterId, filter->emitterId, 6) != 0) return false;
+	if(record->time < filter->since || record->time > filter->until) return false;
+	return true;
+}
+
+/* Imprime um registro decodificado */
+static void printRecord(const SAPoTLog_record* record){
+
+	char date[32];
+	struct tm local;
+	time_t seconds = record->time / 1000000;
+	localtime_r(&seconds, &local);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+
+	const char* name = SAPoTLog_event_name(record->event);
+	printf("%s.%06lu %-5s ", date, (unsigned long) (record->time % 1000000), SAPoTLog_level_name(record->level));
+	if(name != NULL) printf("%-15s", name);
+	else printf("EVENT_0x%02x     ", record->event);
+
+	if(record->event < SAPOT_EVENT_CENTRAL){
+		printf(" I=%u S=%u EID=%02x:%02x:%02x:%02x:%02x:%02x", record->instruction, record->serial,
+			record->emitterId[0], record->emitterId[1], record->emitterId[2], record->emitterId[3], record->emitterId[4], record->emitterId[5]);
+	}
+	printf(" E=%d V=%u A=%u\n", record->error, record->value, record->aux);
+}
+
+/* Decodifica um arquivo, retornando a quantidade de registros impressos ou -1 em caso de erro */
+static long dumpFile(const char* path, const LogFilter* filter){
+
+	FILE* file = fopen(path, "rb");
+	if(file == NULL){
+		perror(path);
+		return -1;
+	}
+
+	SAPoTLog_fileHeader header;
+	if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, SAPOT_LOG_MAGIC, sizeof(header.magic)) != 0){
+		fprintf(stderr, "%s: não é um arquivo de log SAPoT\n", path);
+		fclose(file);
+		return -1;
+	}
+	if(header.version != SAPOT_LOG_FORMAT_VERSION || header.recordSize != sizeof(SAPoTLog_record)){
+		fprintf(stderr, "%s: formato de log não suportado (versão %u, registro de %u bytes)\n", path, header.version, header.recordSize);
+		fclose(file);
+		return -1;
+	}
+
+	long printed = 0;
+	SAPoTLog_record records[256];
+	size_t quantity;
+	while((quantity = fread(records, sizeof(SAPoTLog_record), 256, file)) > 0){
+		size_t i;
+		for(i=0; i<quantity; i++){
+			if(matches(filter, &records[i])){
+				printRecord(&records[i]);
+				printed++;
+			}
+		}
+	}
+
+	fclose(file);
+	return printed;
+}
+
+/* Função Principal */
+int main(int argc, char *argv[]){
+
+	LogFilter filter = {false, {0}, -1, -1, SAPOT_LOG_DEBUG, 0, UINT64_MAX};
+	unsigned int id[6];
+	int opt;
+
+	while((opt = getopt(argc, argv, "e:i:t:l:s:u:")) != -1){
+		if(opt == 'e'){
+			if(sscanf(optarg, "%x:%x:%x:%x:%x:%x", &id[0], &id[1], &id[2], &id[3], &id[4], &id[5]) != 6){
+				fprintf(stderr, "emitterId inválido: %s\n", optarg);
+				return 1;
+			}
+			int i;
+			for(i=0; i<6; i++) filter.emitterId[i] = id[i];
+			filter.byEmitter = true;
+		}
+		else if(opt == 'i') filter.instruction = strtol(optarg, NULL, 0) & 0xFF;
+		else if(opt == 't'){
+			if((filter.event = parseEvent(optarg)) < 0){
+				fprintf(stderr, "Evento inválido: %s\n", optarg);
+				return 1;
+			}
+		}
+		else if(opt == 'l') filter.level = atoi(optarg);
+		else if((opt == 's' && parseTime(optarg, &filter.since) != 0) || (opt == 'u' && parseTime(optarg, &filter.until) != 0)){
+			fprintf(stderr, "Instante inválido: %s\n", optarg);
+			return 1;
+		}
+		else if(opt == '?'){
+			fprintf(stderr, "Uso: %s [-e emitterId] [-i instrução] [-t evento] [-l nível] [-s início] [-u fim] arquivo.sapl ...\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind >= argc){
+		fprintf(stderr, "Uso: %s [-e emitterId] [-i instrução] [-t evento] [-l nível] [-s início] [-u fim] arquivo.sapl ...\n", argv[0]);
+		return 1;
+	}
+
+	int status = 0;
+	for(; optind < argc; optind++){
+		if(dumpFile(argv[optind], &filter) < 0) status = 1;
+	}
+
+	return status;
+}
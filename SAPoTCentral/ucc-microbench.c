@@ -0,0 +1,497 @@
+/*
+* ucc-microbench: microbenchmarks das funções por onde passa toda mensagem tratada pela Central (make microbench).
+*
+*	Uso: ./ucc-microbench [-f filtro] [-r repetições] [-t tempo por repetição (ms)] [-c cpu] [-o arquivo] [-L rótulo]
+*
+*	Casos medidos:
+*		unpack_v1       SAPoTCentral_unpack_message() de um cadastro (0x00) com cabeçalho v1;
+*		unpack_v2       SAPoTCentral_unpack_message() de um cadastro com cabeçalho v2 e apelido (inclui a cópia da mensagem,
+*		                pois a estruturação v2 desloca o payload no próprio buffer);
+*		topic           SAPoTCentral_topic(): formatação do emitterId como tópico, com upper_string();
+*		getmacID        getmacID() do identificador da Central;
+*		ack_header      SAPoTCentral_ack_header(): cabeçalho da resposta;
+*		pack_v2         SAPoTCentral_pack_v2() de uma resposta de cadastro (inclui a cópia da resposta v1);
+*		access_fixed    SAPoTCentral_pack_access() de um cliente em uma seção SAPoTMessage_access;
+*		access_compact  SAPoTCentral_pack_access() de um cliente na codificação compacta;
+*		access_delta    SAPoTCentral_pack_access() de um cliente na codificação compacta com delta dos endereços MAC;
+*		pipeline_*      SAPoTCentral_receive() de uma mensagem completa (estruturação, despacho, manipulador, métricas e publicação
+*		                da resposta), com a transmissão em processo e o armazenamento em memória (SAPOTCENTRAL_OPTS_LOOPBACK):
+*		                cadastro (0x00), lote de 4 amostras v1 e v2 (0x08), acionamento (0x03, publica o acionamento e o
+*		                reconhecimento) e acesso compacto a uma tabela de 64 Clientes (0x04).
+*
+*	Cada caso é calibrado até que uma repetição dure o tempo informado e então executado R vezes com a mesma quantidade de
+*	iterações. São impressos a mediana, o mínimo e o máximo de ns/op entre as repetições e a quantidade de alocações no heap
+*	por operação (malloc, calloc e realloc da thread de medição). O log da Central fica restrito a erros, de forma que a
+*	escrita no disco não interfira nas medições. Nenhum caso depende de broker ou de servidor MySQL. Com -o, os resultados
+*	são acrescentados em formato TSV ao arquivo informado, para a comparação entre versões (ex.: -L $(git rev-parse --short HEAD)).
+*
+*/
+
+/* Bibliotecas */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include "SAPoTCentral.h"
+#include "SAPoTLog.h"
+
+/* Repetições máximas por caso */
+#define MICROBENCH_MAX_REPETITIONS 100
+
+/* Clientes cadastrados na tabela em memória antes das medições */
+#define MICROBENCH_CLIENTS 64
+
+/* Mensagens de entrada dos casos pipeline_* */
+enum{ MSG_REGISTRATION, MSG_BATCH, MSG_BATCH_V2, MSG_ACTUATOR, MSG_ACCESS, MSG_COUNT };
+
+/* Caso de medição: executa a operação iterations vezes */
+typedef struct{
+
+	const char* name;
+	void (*run)(long iterations);
+
+}BenchCase;
+
+/* Opções */
+static struct{
+
+	const char* filter;
+	int repetitions;
+	int time;
+	int cpu;
+	const char* output;
+	const char* label;
+
+}opts = {NULL, 10, 100, -1, NULL, "microbench"};
+
+/* Alocações no heap realizadas pela thread de medição */
+static __thread unsigned long allocations;
+
+/* Central sem servidores, utilizada pelos casos */
+static SAPoTCentral_shared shared;
+static SAPoTCentral central;
+static SAPoTCentral_create_options centralOpts = SAPOTCENTRAL_OPTS_LOOPBACK;
+
+/* Publicações recebidas da Central */
+static unsigned long published;
+
+/* Mensagens de entrada e linha de tb_cadastrados utilizadas pelos casos */
+static uint8_t messageV1[64];
+static int messageV1Len;
+static uint8_t messageV2[64];
+static int messageV2Len;
+static uint8_t buffer[256];
+static const SAPoTCentral_client client = {"sala01", "5C:CF:7F:0A:1B:2C", 1, 4, 2};
+static uint8_t pipeline[MSG_COUNT][128];
+static int pipelineLen[MSG_COUNT];
+
+/* Resultado acumulado das operações, para que o compilador não as elimine */
+static volatile uint32_t sink;
+
+/* Interposição das funções de alocação da glibc, para a contagem de alocações por operação */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size){ allocations++; return __libc_malloc(size); }
+void* calloc(size_t count, size_t size){ allocations++; return __libc_calloc(count, size); }
+void* realloc(void* ptr, size_t size){ allocations++; return __libc_realloc(ptr, size); }
+
+/* Instante monotônico em nanossegundos */
+static uint64_t now_ns(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+			/************************* Casos ******************************/
+
+static void bench_unpack_v1(long iterations){
+
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++){
+		acc += SAPoTCentral_unpack_message(&central, messageV1, messageV1Len);
+		acc += central.header->serial;
+	}
+	sink += acc;
+}
+
+static void bench_unpack_v2(long iterations){
+
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++){
+		memcpy(buffer, messageV2, messageV2Len);
+		acc += SAPoTCentral_unpack_message(&central, buffer, messageV2Len);
+		acc += central.header->emitterId[5];
+	}
+	sink += acc;
+}
+
+static void bench_topic(long iterations){
+
+	char topic[18];
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++){
+		central.headerData.emitterId[5] = (uint8_t) i;
+		SAPoTCentral_topic(central.headerData.emitterId, topic);
+		acc += topic[16];
+	}
+	sink += acc;
+}
+
+static void bench_getmacID(long iterations){
+
+	uint8_t id[6];
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++){
+		getmacID(central.id, id);
+		acc += id[5];
+	}
+	sink += acc;
+}
+
+static void bench_ack_header(long iterations){
+
+	SAPoTMessage_header* header = (SAPoTMessage_header*) buffer;
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++){
+		SAPoTCentral_ack_header(&central, header, sizeof(SAPoTMessage_header) + (i & 0x7));
+		acc += header->length;
+	}
+	sink += acc;
+}
+
+static void bench_pack_v2(long iterations){
+
+	uint8_t response[sizeof(SAPoTMessage_header) + sizeof(SAPoTMessage_registrationAck)];
+	SAPoTCentral_ack_header(&central, (SAPoTMessage_header*) response, sizeof(response));
+	memset(response + sizeof(SAPoTMessage_header), 0x5a, sizeof(SAPoTMessage_registrationAck));
+
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++){
+		memcpy(buffer, response, sizeof(response));
+		acc += SAPoTCentral_pack_v2(buffer, sizeof(response));
+	}
+	sink += acc;
+}
+
+static void bench_access_fixed(long iterations){
+
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++) acc += SAPoTCentral_pack_access(buffer, &client, false, NULL);
+	sink += acc + buffer[5];
+}
+
+static void bench_access_compact(long iterations){
+
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++) acc += SAPoTCentral_pack_access(buffer, &client, true, NULL);
+	sink += acc + buffer[5];
+}
+
+static void bench_access_delta(long iterations){
+
+	uint8_t previous[6] = {0x5c, 0xcf, 0x7f, 0x0a, 0x00, 0x00};
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++){
+		//Mantém o prefixo comum de 4 bytes, como em uma tabela ordenada do mesmo fabricante
+		previous[4] = 0;
+		acc += SAPoTCentral_pack_access(buffer, &client, true, previous);
+	}
+	sink += acc + buffer[5];
+}
+
+/* Entrega uma mensagem à Central como o callback MQTT (a estruturação v2 modifica o buffer, então ele é copiado) */
+static void pipeline_run(int message, long iterations){
+
+	uint32_t acc = 0;
+	long i;
+	for(i=0; i<iterations; i++){
+		memcpy(buffer, pipeline[message], pipelineLen[message]);
+		acc += SAPoTCentral_receive(&central, buffer, pipelineLen[message]);
+	}
+	sink += acc;
+}
+
+static void bench_pipeline_registration(long iterations){ pipeline_run(MSG_REGISTRATION, iterations); }
+static void bench_pipeline_batch(long iterations){ pipeline_run(MSG_BATCH, iterations); }
+static void bench_pipeline_batch_v2(long iterations){ pipeline_run(MSG_BATCH_V2, iterations); }
+static void bench_pipeline_actuator(long iterations){ pipeline_run(MSG_ACTUATOR, iterations); }
+static void bench_pipeline_access(long iterations){ pipeline_run(MSG_ACCESS, iterations); }
+
+static const BenchCase cases[] = {
+	{"unpack_v1", bench_unpack_v1},
+	{"unpack_v2", bench_unpack_v2},
+	{"topic", bench_topic},
+	{"getmacID", bench_getmacID},
+	{"ack_header", bench_ack_header},
+	{"pack_v2", bench_pack_v2},
+	{"access_fixed", bench_access_fixed},
+	{"access_compact", bench_access_compact},
+	{"access_delta", bench_access_delta},
+	{"pipeline_registration", bench_pipeline_registration},
+	{"pipeline_batch", bench_pipeline_batch},
+	{"pipeline_batch_v2", bench_pipeline_batch_v2},
+	{"pipeline_actuator", bench_pipeline_actuator},
+	{"pipeline_access", bench_pipeline_access},
+};
+
+			/************************* Harness ******************************/
+
+/* Destino das publicações da Central (transmissão em processo) */
+static void loopback(void* context, const char* topic, const void* payload, unsigned int payloadLen){
+
+	published++;
+}
+
+/* Monta uma mensagem v1 da instrução informada, emitida pelo endereço id */
+static int message_v1(uint8_t* message, uint8_t instruction, const uint8_t id[6], const void* payload, int payloadLen, bool rsv1){
+
+	SAPoTMessage_header header = {0};
+	header.version = SAPOT_PROTOCOL_VERSION;
+	header.rsv1 = rsv1;
+	header.instruction = instruction;
+	header.serial = 1;
+	header.length = sizeof(SAPoTMessage_header) + payloadLen;
+	memcpy(header.emitterId, id, 6);
+	memcpy(message, &header, sizeof(header));
+	if(payloadLen > 0) memcpy(&message[sizeof(header)], payload, payloadLen);
+	return header.length;
+}
+
+/* Cadastra e etiqueta os Clientes da tabela em memória e monta as mensagens dos casos pipeline_* */
+static int prepare_pipeline(void){
+
+	uint8_t user[6] = {0x02, 0x5A, 0xFF, 0x00, 0x00, 0x01};
+	uint8_t id[6] = {0x5C, 0xCF, 0x7F, 0x0A, 0x00, 0x00};
+	SAPoTMessage_registration registration = {0};
+	registration.clientType = 0x01;
+	registration.sensorQuantity = 4;
+	registration.actuatorQuantity = 1;
+	uint8_t message[128];
+	int i;
+
+	for(i=0; i<MICROBENCH_CLIENTS; i++){
+		id[5] = i;
+		if(SAPoTCentral_receive(&central, message, message_v1(message, 0x00, id, &registration, sizeof(registration), false)) != SAPOTCENTRAL_SUCCESS) return -1;
+
+		SAPoTMessage_modification modification = {{0}};
+		SAPoTCentral_topic(id, (char*) modification.macaddr);
+		snprintf((char*) modification.label, sizeof(modification.label), "sala%02d", i);
+		if(SAPoTCentral_receive(&central, message, message_v1(message, 0x06, user, &modification, sizeof(modification), false)) != SAPOTCENTRAL_SUCCESS) return -1;
+	}
+	if(shared.memory.quantity != MICROBENCH_CLIENTS) return -1;
+
+	//Lote de 4 amostras do primeiro Cliente
+	uint8_t batch[sizeof(SAPoTMessage_batch) + 4*sizeof(SAPoTMessage_sample)] = {0};
+	((SAPoTMessage_batch*) batch)->sampleQuantity = 4;
+	for(i=0; i<4; i++){
+		SAPoTMessage_sample* sample = (SAPoTMessage_sample*) (batch + sizeof(SAPoTMessage_batch)) + i;
+		sample->sensorId = i;
+		sample->age = 100*i;
+		sample->value = 21.5f + i;
+	}
+	id[5] = 0;
+	pipelineLen[MSG_REGISTRATION] = message_v1(pipeline[MSG_REGISTRATION], 0x00, id, &registration, sizeof(registration), false);
+	pipelineLen[MSG_BATCH] = message_v1(pipeline[MSG_BATCH], 0x08, id, batch, sizeof(batch), false);
+
+	//O mesmo lote com cabeçalho v2 e o apelido do Cliente (sua posição na tabela em memória)
+	SAPoTCentral_device device = {1, SAPOT_PROTOCOL_VERSION_2, {0}};
+	memcpy(device.emitterId, id, 6);
+	CTRLupdate_device(&central, &device);
+	uint8_t* v2 = pipeline[MSG_BATCH_V2];
+	int len = 0;
+	v2[len++] = SAPOT_PROTOCOL_VERSION_2 << 4;
+	v2[len++] = 0x08;
+	v2[len++] = SAPOT_V2_FLAG_ALIAS;
+	len += putVarint(&v2[len], 1);
+	len += putVarint(&v2[len], 3 + 1 + 1 + 2 + sizeof(batch));
+	v2[len++] = device.alias & 0xff;
+	v2[len++] = device.alias >> 8;
+	memcpy(&v2[len], batch, sizeof(batch));
+	pipelineLen[MSG_BATCH_V2] = len + sizeof(batch);
+
+	//Acionamento do atuador do Cliente de etiqueta sala07 e acesso compacto à tabela
+	SAPoTMessage_solicitation solicitation = {{0}};
+	strcpy((char*) solicitation.label, "sala07");
+	solicitation.sensorOrActuatorId = 0;
+	solicitation.timeSet = 0x1005;
+	solicitation.degreeOfPerformance = 0xffff;
+	pipelineLen[MSG_ACTUATOR] = message_v1(pipeline[MSG_ACTUATOR], 0x03, user, &solicitation, sizeof(solicitation), false);
+	pipelineLen[MSG_ACCESS] = message_v1(pipeline[MSG_ACCESS], 0x04, user, NULL, 0, true);
+
+	//Validando as mensagens: cada uma deve ser executada e publicar sua resposta (o acionamento publica também o comando)
+	static const int publications[MSG_COUNT] = {1, 1, 1, 2, 1};
+	for(i=0; i<MSG_COUNT; i++){
+		unsigned long before = published;
+		memcpy(buffer, pipeline[i], pipelineLen[i]);
+		if(SAPoTCentral_receive(&central, buffer, pipelineLen[i]) != SAPOTCENTRAL_SUCCESS || published - before != (unsigned long) publications[i]) return -1;
+	}
+
+	return 0;
+}
+
+/* Monta as mensagens de entrada: um cadastro v1 e o mesmo cadastro v2 com apelido */
+static int prepare(void){
+
+	uint8_t payload[offsetof(SAPoTMessage_registration, actuatorQuantity) + sizeof(uint8_t) + 8] = {0};
+	SAPoTMessage_registration* registration = (SAPoTMessage_registration*) payload;
+	registration->clientType = 0x01;
+	registration->sensorQuantity = 4;
+	registration->actuatorQuantity = 2;
+
+	SAPoTMessage_header header = {0};
+	header.version = SAPOT_PROTOCOL_VERSION;
+	header.instruction = 0x00;
+	header.serial = 0x1234;
+	header.length = sizeof(SAPoTMessage_header) + sizeof(payload);
+	getmacID("5C:CF:7F:0A:1B:2C", header.emitterId);
+	memcpy(messageV1, &header, sizeof(header));
+	memcpy(&messageV1[sizeof(header)], payload, sizeof(payload));
+	messageV1Len = header.length;
+
+	//Cabeçalho v2 com o apelido 7, presente na tabela de apelidos da Central
+	SAPoTCentral_device device = {7, SAPOT_PROTOCOL_VERSION_2, {0}};
+	memcpy(device.emitterId, header.emitterId, 6);
+	CTRLupdate_device(&central, &device);
+
+	int len = 0;
+	messageV2[len++] = SAPOT_PROTOCOL_VERSION_2 << 4;
+	messageV2[len++] = 0x00;
+	messageV2[len++] = SAPOT_V2_FLAG_ALIAS;
+	len += putVarint(&messageV2[len], header.serial);
+	len += putVarint(&messageV2[len], 3 + 2 + 1 + 2 + sizeof(payload));
+	messageV2[len++] = device.alias & 0xff;
+	messageV2[len++] = device.alias >> 8;
+	memcpy(&messageV2[len], payload, sizeof(payload));
+	messageV2Len = len + sizeof(payload);
+
+	//Validando as mensagens antes das medições
+	if(SAPoTCentral_unpack_message(&central, messageV1, messageV1Len) != SAPOTCENTRAL_SUCCESS) return -1;
+	memcpy(buffer, messageV2, messageV2Len);
+	if(SAPoTCentral_unpack_message(&central, buffer, messageV2Len) != SAPOTCENTRAL_SUCCESS) return -1;
+	if(memcmp(central.header->emitterId, device.emitterId, 6) != 0) return -1;
+
+	return 0;
+}
+
+static int compare_double(const void* a, const void* b){
+
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+/* Executa um caso: calibração, aquecimento e repetições */
+static void measure(const BenchCase* bench, FILE* output){
+
+	double samples[MICROBENCH_MAX_REPETITIONS];
+	uint64_t target = (uint64_t) opts.time * 1000000ULL;
+	uint64_t begin, elapsed;
+	long iterations = 1;
+
+	//Calibração (que também aquece caches e preditores): dobra as iterações até que uma execução dure o tempo alvo
+	while(true){
+		begin = now_ns();
+		bench->run(iterations);
+		elapsed = now_ns() - begin;
+		if(elapsed >= target || iterations >= (1L << 40)) break;
+		if(elapsed < target / 64) iterations *= 16;
+		else iterations *= 2;
+	}
+
+	unsigned long allocated = allocations;
+	int i;
+	for(i=0; i<opts.repetitions; i++){
+		begin = now_ns();
+		bench->run(iterations);
+		samples[i] = (double) (now_ns() - begin) / iterations;
+	}
+	double perOp = (double) (allocations - allocated) / ((double) iterations * opts.repetitions);
+
+	qsort(samples, opts.repetitions, sizeof(double), compare_double);
+	double median = (opts.repetitions % 2) ? samples[opts.repetitions/2] : (samples[opts.repetitions/2 - 1] + samples[opts.repetitions/2]) / 2;
+	double min = samples[0];
+	double max = samples[opts.repetitions - 1];
+
+	printf("%-22s %12ld %10.2f %10.2f %10.2f %10.3f\n", bench->name, iterations, median, min, max, perOp);
+	if(output != NULL) fprintf(output, "%s\t%s\t%ld\t%.2f\t%.2f\t%.2f\t%.3f\n", opts.label, bench->name, iterations, median, min, max, perOp);
+}
+
+/* Função Principal */
+int main(int argc, char *argv[]){
+
+	int opt;
+	while((opt = getopt(argc, argv, "f:r:t:c:o:L:")) != -1){
+		if(opt == 'f') opts.filter = optarg;
+		else if(opt == 'r') opts.repetitions = atoi(optarg);
+		else if(opt == 't') opts.time = atoi(optarg);
+		else if(opt == 'c') opts.cpu = atoi(optarg);
+		else if(opt == 'o') opts.output = optarg;
+		else if(opt == 'L') opts.label = optarg;
+		else{
+			fprintf(stderr, "Uso: %s [-f filtro] [-r repetições] [-t tempo por repetição (ms)] [-c cpu] [-o arquivo.tsv] [-L rótulo]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(opts.repetitions < 1 || opts.repetitions > MICROBENCH_MAX_REPETITIONS || opts.time < 1){
+		fprintf(stderr, "Parâmetros inválidos\n");
+		return 1;
+	}
+
+	//Fixar a thread de medição em uma CPU reduz a variação entre repetições
+	if(opts.cpu >= 0){
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(opts.cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set) != 0) perror("sched_setaffinity");
+	}
+
+	//Central sem servidores: transmissão em processo e armazenamento em memória
+	if(SAPoTCentral_shared_init(&shared, "ucc-microbench_log") != SAPOTCENTRAL_SUCCESS){
+		fprintf(stderr, "SAPoTCentral_shared_init error\n");
+		return 1;
+	}
+	shared.log.level = SAPOT_LOG_ERROR;
+	if(SAPoTCentral_begin(&central, &centralOpts, "00:00:00:00:00:01", &shared) != SAPOTCENTRAL_SUCCESS){
+		fprintf(stderr, "Falha ao iniciar a Central (erro %d)\n", SAPoTCentral_error(&central));
+		SAPoTCentral_shared_destroy(&shared);
+		return 1;
+	}
+	SAPoTCentral_set_loopback(&central, loopback, NULL);
+	if(prepare() != 0 || prepare_pipeline() != 0){
+		fprintf(stderr, "Falha ao preparar a Central (erro %d)\n", SAPoTCentral_error(&central));
+		SAPoTCentral_shared_destroy(&shared);
+		return 1;
+	}
+
+	FILE* output = NULL;
+	if(opts.output != NULL && (output = fopen(opts.output, "a")) == NULL) perror(opts.output);
+
+	printf("\n%-22s %12s %10s %10s %10s %10s\n", "case", "iterations", "ns/op", "min", "max", "allocs/op");
+
+	unsigned int i;
+	for(i=0; i<sizeof(cases)/sizeof(cases[0]); i++){
+		if(opts.filter != NULL && strstr(cases[i].name, opts.filter) == NULL) continue;
+		measure(&cases[i], output);
+	}
+
+	if(output != NULL) fclose(output);
+	SAPoTCentral_shared_destroy(&shared);
+
+	return 0;
+}
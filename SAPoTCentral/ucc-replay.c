@@ -0,0 +1,216 @@
+/*
+* ucc-replay: publica em um broker as mensagens de arquivos de captura (.sapc) gerados pela UCC (./ucc -c arquivo.sapc).
+*
+*	Uso: ./ucc-replay [-H host] [-P porta] [-x velocidade] [-t tópico] [-r repetições] [-q qos] [-d] arquivo.sapc ...
+*
+*	As mensagens são publicadas nos tópicos e com os intervalos em que chegaram à UCC, multiplicados por 1/velocidade:
+*	-x 1 (padrão) reproduz o tráfego original, -x 10 o reproduz 10 vezes mais rápido e -x 0 publica na velocidade máxima.
+*	Com -t, todas as mensagens são publicadas no tópico informado (ex.: o centralId de uma UCC de teste). Os arquivos são
+*	reproduzidos em sequência, -r vezes. Com -d, as mensagens são apenas listadas, sem conexão com o broker.
+*
+*	Ao final são impressos as mensagens publicadas, a vazão e o atraso médio e máximo das publicações em relação aos instantes
+*	programados (um atraso crescente indica que o broker ou a rede não acompanham a velocidade solicitada).
+*
+*/
+
+/* Bibliotecas */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <MQTTClient.h>
+#include "SAPoTCentral.h"
+#include "SAPoTCapture.h"
+
+/* Configuração da reprodução */
+typedef struct{
+
+	const char* host;
+	const char* port;
+	double speed;
+	const char* topic;
+	int repetitions;
+	int qos;
+	bool dump;
+
+}ReplayOptions;
+
+/* Resultados da reprodução */
+typedef struct{
+
+	unsigned long messages;
+	unsigned long long bytes;
+	unsigned long failures;
+	uint64_t totalLag;
+	uint64_t maxLag;
+
+}ReplayStats;
+
+/* Objetos */
+static ReplayOptions opts = {"localhost", "1883", 1.0, NULL, 1, 0, false};
+static ReplayStats stats;
+static MQTTClient client;
+
+/* Instante monotônico em microssegundos */
+static uint64_t now_us(void){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Dorme até um instante monotônico em microssegundos */
+static void sleep_until(uint64_t instant){
+
+	struct timespec t = {instant / 1000000, (instant % 1000000) * 1000};
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0);
+}
+
+/* Lista uma mensagem capturada: instante de chegada, tópico, comprimento e, se possível, versão, instrução, serial e emissor */
+static void dump_entry(const SAPoTCapture_entry* entry){
+
+	time_t seconds = entry->time / 1000000;
+	struct tm date;
+	char text[32];
+	localtime_r(&seconds, &date);
+	strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &date);
+	printf("%s.%06u %-17s %5u", text, (unsigned) (entry->time % 1000000), entry->topic, entry->payloadLen);
+
+	if(entry->payloadLen >= 2){
+		int version = entry->payload[0] >> 4;
+		printf(" v%d 0x%02X", version, entry->payload[1]);
+		if(version == 1 && entry->payloadLen >= sizeof(SAPoTMessage_header)){
+			SAPoTMessage_header header;
+			memcpy(&header, entry->payload, sizeof(header));
+			printf("%s serial %5u emissor %02X:%02X:%02X:%02X:%02X:%02X", header.ack ? " ack" : "", header.serial,
+				header.emitterId[0], header.emitterId[1], header.emitterId[2], header.emitterId[3], header.emitterId[4], header.emitterId[5]);
+		}
+	}
+	printf("\n");
+}
+
+/* Publica uma mensagem capturada */
+static void publish_entry(const SAPoTCapture_entry* entry){
+
+	MQTTClient_message pubmsg = MQTTClient_message_initializer;
+	MQTTClient_deliveryToken token;
+	pubmsg.payload = entry->payload;
+	pubmsg.payloadlen = entry->payloadLen;
+	pubmsg.qos = opts.qos;
+	pubmsg.retained = 0;
+
+	if(MQTTClient_publishMessage(client, opts.topic != NULL ? opts.topic : entry->topic, &pubmsg, &token) != MQTTCLIENT_SUCCESS){
+		stats.failures++;
+		return;
+	}
+	if(opts.qos > 0) MQTTClient_waitForCompletion(client, token, 10000);
+
+	stats.messages++;
+	stats.bytes += entry->payloadLen;
+}
+
+/* Reproduz um arquivo de captura, com os instantes relativos ao seu primeiro registro */
+static int replay_file(const char* path){
+
+	SAPoTCapture_reader reader;
+	if(SAPoTCapture_open(&reader, path) != 0){
+		fprintf(stderr, "Arquivo de captura inválido: %s\n", path);
+		return -1;
+	}
+
+	SAPoTCapture_entry entry;
+	uint64_t first = 0, start = 0;
+	int status;
+	while((status = SAPoTCapture_read(&reader, &entry)) == 1){
+
+		if(opts.dump){
+			dump_entry(&entry);
+			continue;
+		}
+
+		if(start == 0){
+			first = entry.time;
+			start = now_us();
+		}
+
+		if(opts.speed > 0){
+			uint64_t scheduled = start + (uint64_t) ((entry.time - first) / opts.speed);
+			uint64_t now = now_us();
+			if(now < scheduled) sleep_until(scheduled);
+			else{
+				stats.totalLag += now - scheduled;
+				if(now - scheduled > stats.maxLag) stats.maxLag = now - scheduled;
+			}
+		}
+
+		publish_entry(&entry);
+	}
+
+	if(status < 0) fprintf(stderr, "Registro corrompido ou truncado em %s (reprodução interrompida no arquivo)\n", path);
+
+	SAPoTCapture_close(&reader);
+	return 0;
+}
+
+/* Função Principal */
+int main(int argc, char *argv[]){
+
+	int opt;
+	while((opt = getopt(argc, argv, "H:P:x:t:r:q:d")) != -1){
+		if(opt == 'H') opts.host = optarg;
+		else if(opt == 'P') opts.port = optarg;
+		else if(opt == 'x') opts.speed = atof(optarg);
+		else if(opt == 't') opts.topic = optarg;
+		else if(opt == 'r') opts.repetitions = atoi(optarg);
+		else if(opt == 'q') opts.qos = atoi(optarg);
+		else if(opt == 'd') opts.dump = true;
+		else{
+			fprintf(stderr, "Uso: %s [-H host] [-P porta] [-x velocidade (0 = máxima)] [-t tópico] [-r repetições] [-q qos] [-d] arquivo.sapc ...\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind >= argc || opts.speed < 0 || opts.repetitions < 1 || opts.qos < 0 || opts.qos > 2){
+		fprintf(stderr, "Parâmetros inválidos\n");
+		return 1;
+	}
+
+	if(!opts.dump){
+		char serverURI[128];
+		char clientId[64];
+		snprintf(serverURI, sizeof(serverURI), "tcp://%s:%s", opts.host, opts.port);
+		snprintf(clientId, sizeof(clientId), "ucc-replay-%d", (int) getpid());
+
+		MQTTClient_connectOptions MQTTopts = MQTTClient_connectOptions_initializer;
+		MQTTopts.keepAliveInterval = 60;
+		MQTTopts.cleansession = 1;
+		if(MQTTClient_create(&client, serverURI, clientId, MQTTCLIENT_PERSISTENCE_NONE, NULL) != MQTTCLIENT_SUCCESS ||
+		   MQTTClient_connect(client, &MQTTopts) != MQTTCLIENT_SUCCESS){
+			fprintf(stderr, "Falha ao conectar em %s:%s\n", opts.host, opts.port);
+			return 1;
+		}
+	}
+
+	uint64_t start = now_us();
+	int repetition, i;
+	for(repetition = 0; repetition < (opts.dump ? 1 : opts.repetitions); repetition++){
+		for(i = optind; i < argc; i++) replay_file(argv[i]);
+	}
+
+	if(opts.dump) return 0;
+
+	double elapsed = (now_us() - start) / 1e6;
+	printf("Mensagens publicadas: %lu (%llu bytes) em %.3f s, %.0f msg/s\n", stats.messages, stats.bytes, elapsed, elapsed > 0 ? stats.messages / elapsed : 0.0);
+	if(stats.failures > 0) printf("Falhas de publicação: %lu\n", stats.failures);
+	if(opts.speed > 0 && stats.messages > 0){
+		printf("Atraso em relação ao programado: médio %.1f us, máximo %llu us\n", (double) stats.totalLag / stats.messages, (unsigned long long) stats.maxLag);
+	}
+
+	MQTTClient_disconnect(client, 1000);
+	MQTTClient_destroy(&client);
+	return stats.failures > 0 ? 1 : 0;
+}
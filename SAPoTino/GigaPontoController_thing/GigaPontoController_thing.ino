@@ -12,6 +12,13 @@
 //#define THING_TOPIC "GC/things/"
 //Versão
 #define SAPOT_VERSION 1
+#define SAPOT_VERSION_2 2
+//Flags do cabeçalho v2
+#define SAPOT_V2_FLAG_ALIAS 0x01
+#define SAPOT_V2_FLAG_BATCH 0x02
+#define SAPOT_V2_FLAG_COMPRESSED 0x04
+//Tamanho máximo do cabeçalho v2 (flags, instrução, flags v2, serial e comprimento em varint, MAC)
+#define SAPOT_V2_HEADER_MAX 15
 //Thing Type
 #define CMD 0x00
 #define SMCAI 0x01
@@ -36,6 +43,39 @@
 //Request Type
 #define ALL 0x0000
 #define NON 0xffff
+//Estados da conexão com a rede (máquina de estados não bloqueante, avançada por SAPoTnetworkLoop a cada SAPoTloop)
+#define NET_WIFI_OFF 0 //Sem rede: WiFi.begin() ao fim da espera (backoff)
+#define NET_WIFI_WAIT 1 //Aguardando a associação à rede (até NET_WIFI_TIMEOUT)
+#define NET_MQTT_OFF 2 //Com rede e sem broker: MQTTclient.connect() ao fim da espera (backoff)
+#define NET_REGISTER 3 //Conectado ao broker e aguardando o ack do cadastro (reenviado a cada NET_REGISTER_TIMEOUT)
+#define NET_ONLINE 4 //Conectado e cadastrado na Central
+//Tempos da conexão, em milissegundos
+#define NET_WIFI_TIMEOUT 15000
+#define NET_REGISTER_TIMEOUT 30000
+#define NET_BACKOFF_MIN 500
+#define NET_BACKOFF_MAX 60000
+//Tempo limite, em segundos, de cada operação de socket do broker (a PubSubClient bloqueia até ele em connect())
+#define NET_SOCKET_TIMEOUT 2
+//Batch: quantidade máxima de amostras por lote (12 + 4 + 24*8 = 208 bytes, abaixo do MQTT_MAX_PACKET_SIZE de 256 bytes da PubSubClient)
+#define SAPOT_BATCH_MAX 24
+//Fila de amostras: capacidade (12 bytes por amostra) e critérios de envio do lote (quantidade de amostras ou idade da mais antiga, em ms)
+#define SAPOT_BUFFER_SIZE 128
+#define SAPOT_FLUSH_SAMPLES 16
+#define SAPOT_FLUSH_DEADLINE 10000
+//Relato por variação (instrução 0B): modos da banda morta e sensor que representa todos os sensores
+#define REPORT_PERIODIC 0 //Todas as leituras são publicadas
+#define REPORT_ABSOLUTE 1 //Publicada se a variação em relação ao último valor relatado exceder o limiar
+#define REPORT_PERCENT 2 //Publicada se a variação exceder o limiar, em porcentagem do último valor relatado
+#define REPORT_ALL 0xffff
+//Temporizadores: 0 para a requisição dos sensores e 1 a amountOfActuators para o atuador de mesmo identificador
+#define TIMER_SENSOR 0
+#define TIMER_NONE 0xff //Posição no heap de um temporizador inativo
+#define TIMER_IDLE 0 //Atuador desligado
+#define TIMER_START 1 //Acionamento pendente: o atuador é ligado no próximo SAPoTloop
+#define TIMER_RUNNING 2 //Atuador ligado até o prazo
+//Sono do SAPoTloop até o próximo prazo, em ms: máximo (mantém o keepalive do broker; 0 desativa o sono) e fatia entre as verificações do socket
+#define SAPOT_SLEEP_MAX 1000
+#define SAPOT_SLEEP_SLICE 50
 
 /************************************************ Estrutura de dados *********************************************/
 
@@ -46,17 +86,15 @@ typedef struct{
   uint8_t type; //Tipo do cliente
   const char* centralID; //Identificador da Central de comandos
   uint8_t status; //Identifica a situação do cliente
+  uint8_t version; //Versão do protocolo negociada no cadastro (SAPOT_VERSION ou SAPOT_VERSION_2)
+  uint16_t alias; //Apelido v2 atribuído pela Central no cadastro (0: nenhum, o cliente se identifica pelo MAC)
   uint16_t sensorRequestID; //Identifica qual sensor será requisitado
   uint32_t sensorRequestTime; //Tempo para próxima requisição do sensor
-  uint16_t actuatorRequestID; //Identifica qual atuador será acionado
-  uint32_t actuatorRequestTime; //Tempo que o atuador permanece em execução 
-  uint16_t actuatorRequestDegree; //Grau de atuação requerido para acionamento do atuador
   uint16_t* sensorVector; //Ponteiro para o vetor de sensores
   uint16_t* actuatorVector; //Ponteiro para o vetor de atuadores
   uint8_t amountOfSensors; //Quantidade de Sensores instalados no cliente
   uint8_t amountOfActuators; //Quantidade de Atuadores instalados no cliente
   unsigned long currentTime; //Tempo atual
-  void* previousTime; //Tempo anterior
 }SAPoTClient;
 
 /* SAPoT Network: Variáveis para atuação na rede SAPoT */
@@ -67,6 +105,10 @@ typedef struct{
   int MQTT_port;
   const char* MQTT_user;
   const char* MQTT_pass; 
+  uint8_t state; //Estado da conexão (NET_*)
+  unsigned long stateTime; //millis() da entrada no estado ou da última tentativa
+  unsigned long wait; //Espera até a próxima tentativa (com variação aleatória)
+  unsigned long backoff; //Espera base, dobrada a cada falha até NET_BACKOFF_MAX
 }SAPoTNetwork;
 
 /* SAPoT Message: Variáveis para manipulação de um pacote SAPoT*/
@@ -128,6 +170,88 @@ typedef struct{
 typedef struct{
 }actuator_drive_ack_SAPoT;
 
+/* Comando 08: Registro em lote de amostras dos sensores (seguido de sample_quantity estruturas sample_SAPoT) */
+typedef struct{
+  uint8_t sample_quantity; //Quantidade de amostras no lote
+  uint8_t time_scale; //Escala de tempo das idades (0: ms, 1: s, 2: min, 3: horas, 4: dias)
+  uint16_t rsv; //Reservado
+}batch_SAPoT;
+
+/* Amostra contida em um lote (Comando 08) */
+typedef struct{
+  uint16_t sensor_id; //Identificador do sensor
+  uint16_t age; //Tempo decorrido entre a leitura e o envio do lote (na escala time_scale)
+  float value; //Valor lido
+}sample_SAPoT;
+
+/* Comando 0A: Eco, devolvido inalterado como ACK para a medição do tempo de ida e volta (gpc probe) */
+typedef struct{
+  uint8_t label[11]; //Etiqueta do cliente
+  uint8_t rsv; //Reservado
+  uint8_t origin[6]; //Usuário que solicitou o eco (preenchido pela Central)
+  uint16_t serial; //Serial da solicitação do usuário (preenchido pela Central)
+  uint32_t sequence; //Número de sequência do usuário
+  uint32_t central_in; //Instantes de chegada da solicitação e do eco à Central (relógio da Central)
+  uint32_t central_out;
+}echo_SAPoT;
+
+/* Banda morta de um sensor: segue o vetor de tipos no registro (Comando 00), uma por sensor, e compõe o Comando 0B */
+typedef struct{
+  uint8_t mode; //Modo de relato (REPORT_*)
+  uint8_t rsv; //Reservado
+  uint16_t heartbeat; //Tempo máximo sem relatos, no formato de tempo SAPoT (0: sem heartbeat)
+  float threshold; //Limiar da variação (absoluto ou em porcentagem)
+}deadband_SAPoT;
+
+/* Comando 0B: Configuração do relato por variação de um sensor (ou de todos, com sensor_id = REPORT_ALL) */
+typedef struct{
+  uint8_t label[11]; //Etiqueta do cliente
+  uint8_t rsv; //Reservado
+  uint16_t sensor_id; //Identificador do sensor
+  uint16_t rsv2; //Reservado
+  deadband_SAPoT deadband;
+}report_SAPoT;
+
+/* SAPoT Report: Estado local do relato por variação de um sensor */
+typedef struct{
+  deadband_SAPoT deadband; //Configuração vigente
+  unsigned long heartbeat; //Heartbeat em milissegundos (0: sem heartbeat)
+  float lastValue; //Último valor relatado
+  unsigned long lastTime; //millis() do último relato
+  bool reported; //FALSE até o primeiro relato (ou após uma nova configuração): a próxima leitura é publicada
+}SAPoTReport;
+
+/* SAPoT Timer: Prazo da próxima leitura dos sensores ou do próximo passo do acionamento de um atuador */
+typedef struct{
+  unsigned long deadline; //millis() do prazo
+  uint32_t period; //Tempo que o atuador permanece em execução
+  uint16_t degree; //Grau de atuação requerido para acionamento do atuador
+  uint8_t state; //Passo do acionamento (TIMER_IDLE, TIMER_START ou TIMER_RUNNING)
+  uint8_t position; //Posição no heap (TIMER_NONE se inativo)
+}SAPoTTimer;
+
+/* SAPoT Scheduler: Temporizadores ativos em um min-heap ordenado pelo prazo (o mais próximo em heap[0]) */
+typedef struct{
+  SAPoTTimer* timers; //Temporizadores, indexados por TIMER_SENSOR e pelo identificador do atuador
+  uint8_t* heap; //Índices dos temporizadores ativos
+  uint8_t count; //Quantidade de temporizadores ativos
+}SAPoTScheduler;
+
+/* Amostra lida localmente, antes de ser codificada em um lote */
+typedef struct{
+  uint16_t sensorID; //Identificador do sensor
+  unsigned long time; //millis() no instante da leitura
+  float value; //Valor lido
+}SAPoTSample;
+
+/* SAPoT Buffer: Fila circular das amostras lidas e ainda não publicadas (mantidas durante a falta de conexão) */
+typedef struct{
+  SAPoTSample samples[SAPOT_BUFFER_SIZE];
+  uint16_t first; //Posição da amostra mais antiga
+  uint16_t count; //Quantidade de amostras na fila
+  unsigned long dropped; //Amostras descartadas com a fila cheia (as mais antigas são sobrescritas)
+}SAPoTBuffer;
+
 
 /************************************************ Objetos e Variáveis *************************************************************/
 
@@ -135,9 +259,9 @@ typedef struct{
 SAPoTClient SAPoTclient;
 SAPoTNetwork SAPoTnetwork;
 SAPoTMessage SAPoTmessage;
-unsigned long* sensorPreviousTime;
-unsigned long* actuatorPreviousTime;
-uint8_t actuatorTimeCounter;
+SAPoTBuffer SAPoTbuffer;
+SAPoTReport* SAPoTreports;
+SAPoTScheduler SAPoTscheduler;
 
 /* Objetos de acesso a rede (Wifi e MQTT) */
 WiFiClient WiFiclient;
@@ -164,31 +288,53 @@ bool SAPoTClient_begin(const char* central_id, uint8_t type, uint8_t howManySens
     SAPoTclient.type = 0xff;
     return FALSE;
   }
-    
+
+  //Os temporizadores dos atuadores são indexados em 8 bits (TIMER_NONE marca o temporizador inativo)
+  if(howManyActuators >= TIMER_NONE){
+    Serial.println("SAPoTClient_begin: too many actuators !");
+    SAPoTclient.type = 0xff;
+    return FALSE;
+  }
+
   //Preenchendo as informações do objeto global SAPoTclient
   SAPoTclient.currentTime = millis();
-  SAPoTclient.previousTime = malloc((howManySensors + howManyActuators) * sizeof(unsigned long));
   SAPoTclient.serial = 0;
   getmacID(WiFi.macAddress().c_str(), SAPoTclient.id); //A função getmacID transforma o macaddr da placa em um identificador SAPoT
   SAPoTclient.centralID = central_id;
   SAPoTclient.type = type;
   SAPoTclient.status = 0;
+  SAPoTclient.version = SAPOT_VERSION_2;
+  SAPoTclient.alias = 0;
   SAPoTclient.sensorRequestTime = 0; 
-  SAPoTclient.actuatorRequestTime = 0; 
   SAPoTclient.sensorRequestID = NON; 
-  SAPoTclient.actuatorRequestID = NON; 
   SAPoTclient.sensorVector = whichSensors; 
   SAPoTclient.actuatorVector = whichActuators;
   SAPoTclient.amountOfSensors = howManySensors;
   SAPoTclient.amountOfActuators = howManyActuators;
 
-  //Inicializando os vetores temporais para o controle dos sensores e atuadores.
-  sensorPreviousTime = (unsigned long*) SAPoTclient.previousTime;
-  actuatorPreviousTime = (unsigned long*) (SAPoTclient.previousTime + (howManySensors * sizeof(unsigned long)));
+  //Inicializando os temporizadores dos sensores e atuadores (todos inativos).
+  SAPoTscheduler.timers = (SAPoTTimer*) malloc((howManyActuators + 1) * sizeof(SAPoTTimer));
+  SAPoTscheduler.heap = (uint8_t*) malloc(howManyActuators + 1);
+  SAPoTscheduler.count = 0;
   int i;
-  for(i=0; i<howManySensors; i++) sensorPreviousTime[i] = 0;
-  for(i=0; i<howManyActuators; i++) actuatorPreviousTime[i] = 0;
-  actuatorTimeCounter = 0;
+  for(i=0; i<=howManyActuators; i++){
+    SAPoTscheduler.timers[i].state = TIMER_IDLE;
+    SAPoTscheduler.timers[i].position = TIMER_NONE;
+  }
+
+  //Todos os sensores iniciam com o relato periódico (veja SAPoTClient_deadband)
+  SAPoTreports = (SAPoTReport*) malloc(howManySensors * sizeof(SAPoTReport));
+  for(i=0; i<howManySensors; i++){
+    SAPoTreports[i].deadband.mode = REPORT_PERIODIC;
+    SAPoTreports[i].deadband.rsv = 0;
+    SAPoTreports[i].deadband.heartbeat = 0;
+    SAPoTreports[i].deadband.threshold = 0;
+    SAPoTreports[i].heartbeat = 0;
+    SAPoTreports[i].reported = FALSE;
+  }
+  SAPoTbuffer.first = 0;
+  SAPoTbuffer.count = 0;
+  SAPoTbuffer.dropped = 0;
 
   Serial.println();
   Serial.println("SAPoTClient:");
@@ -199,24 +345,47 @@ bool SAPoTClient_begin(const char* central_id, uint8_t type, uint8_t howManySens
   Serial.println("\t Status: " + String(SAPoTclient.status));
   Serial.println("\t Sensor Request ID: " + String(SAPoTclient.sensorRequestID));
   Serial.println("\t Sensor Request Time: " + String(SAPoTclient.sensorRequestTime));
-  Serial.println("\t Actuator Request ID: " + String(SAPoTclient.actuatorRequestID));
-  Serial.println("\t Actuator Request Time: " + String(SAPoTclient.actuatorRequestTime));
-  Serial.println("\t Actuator Request Degree: " + String(SAPoTclient.actuatorRequestDegree));
   Serial.println("\t Amount of Sensors: " + String(SAPoTclient.amountOfSensors));
   for(i=0; i<SAPoTclient.amountOfSensors; i++) Serial.println("\t Sensor Vector[" + String(i) + "]: " + String(SAPoTclient.sensorVector[i])); 
   Serial.println("\t Amount of Actuators: " + String(SAPoTclient.amountOfActuators));
   for(i=0; i<SAPoTclient.amountOfActuators; i++) Serial.println("\t Actuator Vector[" + String(i) + "]: " + String(SAPoTclient.actuatorVector[i]));
   Serial.println("\t Current Time: " + String(SAPoTclient.currentTime, DEC));
-  for(i=0; i<(SAPoTclient.amountOfSensors + SAPoTclient.amountOfActuators); i++) Serial.println("\t Previous Time: " + String(((unsigned long*) SAPoTclient.previousTime)[i], DEC)); 
+  Serial.println("\t Timers: " + String(SAPoTclient.amountOfActuators + 1));
   
   return TRUE;
   
 }
 
 /*
- * Função: Conecta o Cliente SAPoT com a rede e solicita registro na Cental 
+ * Função: Configura o relato por variação de um sensor (ou de todos): a leitura só é publicada quando difere do último valor relatado em 
+ *  mais que o limiar, ou quando o heartbeat expira sem relatos. Deve ser evocada antes do SAPoTloop; a Central pode alterá-la (Comando 0B).
+ *  @parâmetros: identificador do sensor (ou REPORT_ALL), modo (REPORT_*), limiar e heartbeat no formato de tempo SAPoT (ex.: 0x200A = 10 min).
+ *  @retorno: TRUE se o relato for configurado, se não retorna FALSE.
+ */
+bool SAPoTClient_deadband(uint16_t sensorID, uint8_t mode, float threshold, uint16_t heartbeat){
+
+  if(mode > REPORT_PERCENT || (sensorID != REPORT_ALL && sensorID >= SAPoTclient.amountOfSensors)){
+    Serial.println("SAPoTClient_deadband: invalid sensor or mode !");
+    return FALSE;
+  }
+
+  int i;
+  for(i=0; i<SAPoTclient.amountOfSensors; i++){
+    if(sensorID != REPORT_ALL && i != sensorID) continue;
+    SAPoTreports[i].deadband.mode = mode;
+    SAPoTreports[i].deadband.heartbeat = heartbeat;
+    SAPoTreports[i].deadband.threshold = threshold;
+    SAPoTreports[i].heartbeat = (mode == REPORT_PERIODIC || heartbeat == 0) ? 0 : getTime(heartbeat);
+    SAPoTreports[i].reported = FALSE;
+  }
+  return TRUE;
+}
+
+/*
+ * Função: Configura a conexão do Cliente SAPoT com a rede e o broker. A conexão e o cadastro na Central são realizados sem 
+ *  bloqueio pelo SAPoTloop (veja SAPoTnetworkLoop), que continua a operar os sensores e atuadores enquanto o cliente está desconectado.
  *  @parametros: ssid da rede Wifi, senha da rede wifi, endereço do server MQTT, porta de escuta da broker MQTT, login para acessar o broker, senha para acessar o broker.
- *  @retorno: TRUE se o cliente for registrado na central com sucesso, se não retorna FALSE
+ *  @retorno: TRUE se a conexão for configurada, se não retorna FALSE
  */
 bool SAPoTClient_connect(const char* ssid, const char* password, const char* mqtt_server,const int broker_port, const char* broker_login, const char* broker_pass){
 
@@ -238,159 +407,514 @@ bool SAPoTClient_connect(const char* ssid, const char* password, const char* mqt
   SAPoTnetwork.MQTT_port = broker_port;
   SAPoTnetwork.MQTT_user = broker_login;
   SAPoTnetwork.MQTT_pass = broker_pass;
-  
-  
-  do{
-    //Verifica/Realiza a conexão com a rede via Wifi
-    WiFiconnect();
-  
-    //Verifica/Realiza a conexão com o servidor MQTT
-    MQTTconnect();
-  
-    //Definindo o tamanho do pacote de registro.
-    SAPoTmessage.length = (sizeof(fixed_header_SAPoT)+ sizeof(registration_SAPoT)+2*SAPoTclient.amountOfSensors+2*SAPoTclient.amountOfActuators);
-    Serial.println("SAPoTmessage.length " + String(SAPoTmessage.length));
-  
-    //Concatenando as estruturas do cabeçalho fixo (fh) e do payload (pl) no mesmo espaço de memória (SAPoTmessage.data).
-    SAPoTmessage.data = malloc(SAPoTmessage.length);
-    fixed_header_SAPoT *fh = (fixed_header_SAPoT*) SAPoTmessage.data;
-    registration_SAPoT *pl = (registration_SAPoT*) (SAPoTmessage.data + sizeof(fixed_header_SAPoT));
-  
-    //Preenchendo o espaço de memória (fixed header)
-    fh->version = SAPOT_VERSION;
-    fh->ack = 0;
-    fh->rsv1 = 0;
-    fh->rsv2 = 0;
-    fh->rsv3 = 0;
-    fh->instruction = 0;
-    fh->serial = SAPoTclient.serial;
-    fh->length = SAPoTmessage.length;
-    int i;
-    for(i=0; i<6; i++) fh->client_id[i] = SAPoTclient.id[i];
-  
-    //Preenchendo o espaço de memória (payload: Registration)
-    pl->thing_type = SAPoTclient.type;
-    pl->sensor_quantity = SAPoTclient.amountOfSensors;
-    pl->actuator_quantity = SAPoTclient.amountOfActuators;
-    for(i=0; i<SAPoTclient.amountOfSensors; i++) pl->sensor_actuator_type[i] = SAPoTclient.sensorVector[i]; 
-    for(i=0; i<SAPoTclient.amountOfActuators; i++) pl->sensor_actuator_type[i+SAPoTclient.amountOfSensors] = SAPoTclient.actuatorVector[i];
-  
-    //Print da mensagem para verificação dos dados.
-    Serial.println("SAPoTmessage: " + String(SAPoTmessage.length) + "Bytes");
-    for(i=0; i<SAPoTmessage.length; i++){ 
-       Serial.print("["+ String(i) +"]: ");
-       Serial.println(((uint8_t*)SAPoTmessage.data)[i], HEX);
-    } 
-  
-    //Publicando o pacote de registro no tópico de escuta da Central.
-    Serial.println("Publishing on topic: " + String(SAPoTclient.centralID));
-    if(MQTTclient.publish(SAPoTclient.centralID, (byte*)SAPoTmessage.data,(byte)SAPoTmessage.length, 0) < 0){
-        Serial.println("SAPoTClient_connect Error: unable to post on broker");
-        free(SAPoTmessage.data);
-        return FALSE; 
-    }
-  
-    //Livrando o espaço de memória referente ao pacote enviado
-    free(SAPoTmessage.data);
-  
-    //Esperando o retorno da central por 30 segundos, se não realiza o cadastro novamente.
-    Serial.print("Waiting for a Central response !");    
-    for(i=0; i<60; i++){
-      Serial.print(".");
+
+  //Limitando o bloqueio de cada tentativa de conexão ao broker (conexão TCP e CONNACK)
+  WiFiclient.setTimeout(NET_SOCKET_TIMEOUT * 1000);
+  MQTTclient.setSocketTimeout(NET_SOCKET_TIMEOUT);
+  MQTTclient.setServer(SAPoTnetwork.MQTT_server, SAPoTnetwork.MQTT_port);
+  MQTTclient.setCallback(MQTTCallBackMessage);
+
+  //Com o light sleep, o rádio e a CPU dormem durante as esperas (delay) do SAPoTloop entre os beacons do ponto de acesso
+  WiFi.setSleepMode(WIFI_LIGHT_SLEEP);
+
+  //A primeira tentativa de conexão é imediata
+  SAPoTnetwork.state = NET_WIFI_OFF;
+  SAPoTnetwork.stateTime = millis();
+  SAPoTnetwork.wait = 0;
+  SAPoTnetwork.backoff = NET_BACKOFF_MIN;
+
+  return TRUE;
+}
+
+/*
+ * Função: Publica o pacote de cadastro do cliente no tópico da Central (com o cabeçalho v2 o cadastro também negocia a versão 2).
+ *  @parâmetros: Nenhum.
+ *  @retorno: TRUE se o cadastro for publicado, se não retorna FALSE.
+ */
+bool SAPoTregister(){
+
+  //Definindo o tamanho do payload de registro (o vetor de tipos é seguido pela banda morta de cada sensor).
+  uint16_t typesLength = sizeof(registration_SAPoT)+2*SAPoTclient.amountOfSensors+2*SAPoTclient.amountOfActuators;
+  uint16_t payloadLength = typesLength + SAPoTclient.amountOfSensors*sizeof(deadband_SAPoT);
+
+  //Preenchendo o espaço de memória (payload: Registration)
+  registration_SAPoT *pl = (registration_SAPoT*) malloc(payloadLength);
+  pl->thing_type = SAPoTclient.type;
+  pl->sensor_quantity = SAPoTclient.amountOfSensors;
+  pl->actuator_quantity = SAPoTclient.amountOfActuators;
+  int i;
+  for(i=0; i<SAPoTclient.amountOfSensors; i++) pl->sensor_actuator_type[i] = SAPoTclient.sensorVector[i]; 
+  for(i=0; i<SAPoTclient.amountOfActuators; i++) pl->sensor_actuator_type[i+SAPoTclient.amountOfSensors] = SAPoTclient.actuatorVector[i];
+  for(i=0; i<SAPoTclient.amountOfSensors; i++) memcpy((uint8_t*) pl + typesLength + i*sizeof(deadband_SAPoT), &SAPoTreports[i].deadband, sizeof(deadband_SAPoT));
+
+  //Publicando o pacote de registro no tópico de escuta da Central
+  Serial.println("Publishing on topic: " + String(SAPoTclient.centralID) + " (SAPoT v" + String(SAPoTclient.version) + ")");
+  bool published = SAPoTpublish(0, 0, 0, pl, payloadLength);
+  if(published == FALSE) Serial.println("SAPoTregister Error: unable to post on broker");
+
+  //Livrando o espaço de memória referente ao payload enviado
+  free(pl);
+  return published;
+}
+
+/*
+ * Função: Agenda a próxima tentativa de conexão após uma falha, com espera exponencial (NET_BACKOFF_MIN a NET_BACKOFF_MAX) e variação
+ *  aleatória, para que os clientes de uma mesma rede não se reconectem todos no mesmo instante após uma queda do broker ou do Wi-Fi.
+ *  @parâmetros: estado a partir do qual a conexão será retomada (NET_WIFI_OFF ou NET_MQTT_OFF).
+ *  @retorno: Nenhum.
+ */
+void SAPoTnetworkRetry(uint8_t state){
+
+  SAPoTnetwork.state = state;
+  SAPoTnetwork.stateTime = millis();
+  SAPoTnetwork.wait = SAPoTnetwork.backoff / 2 + random(SAPoTnetwork.backoff / 2 + 1);
+  SAPoTnetwork.backoff = (SAPoTnetwork.backoff >= NET_BACKOFF_MAX / 2) ? NET_BACKOFF_MAX : SAPoTnetwork.backoff * 2;
+  Serial.println("SAPoTnetwork: next attempt in " + String(SAPoTnetwork.wait) + "ms");
+}
+
+/*
+ * Função: Avança a máquina de estados da conexão (Wi-Fi, broker e cadastro na Central) sem bloquear: cada evocação realiza no máximo
+ *  uma tentativa de conexão, limitada por NET_SOCKET_TIMEOUT. Deve ser evocada a cada iteração do loop (pelo SAPoTloop).
+ *  @parâmetros: Nenhum.
+ *  @retorno: TRUE se o cliente estiver conectado ao broker e cadastrado na Central, se não retorna FALSE.
+ */
+bool SAPoTnetworkLoop(){
+
+  unsigned long now = millis();
+
+  //Detectando a perda da rede ou do broker nos estados conectados
+  if(SAPoTnetwork.state >= NET_MQTT_OFF && WiFi.status() != WL_CONNECTED){
+    Serial.println("SAPoTnetwork: Wi-Fi connection lost");
+    SAPoTnetwork.state = NET_WIFI_OFF;
+    SAPoTnetwork.stateTime = now;
+    SAPoTnetwork.wait = 0;
+  }
+  else if(SAPoTnetwork.state >= NET_REGISTER && !MQTTclient.connected()){
+    Serial.println("SAPoTnetwork: broker connection lost, state " + String(MQTTclient.state()));
+    SAPoTnetwork.state = NET_MQTT_OFF;
+    SAPoTnetwork.stateTime = now;
+    SAPoTnetwork.wait = 0;
+  }
+
+  if(SAPoTnetwork.state == NET_WIFI_OFF){
+    if(now - SAPoTnetwork.stateTime >= SAPoTnetwork.wait){
       WiFiconnect();
-      MQTTconnect();
-      if(SAPoTclient.status == 1) return TRUE;
-      delay(500);
+      SAPoTnetwork.state = NET_WIFI_WAIT;
+      SAPoTnetwork.stateTime = now;
     }
-    Serial.println();
-    if(SAPoTclient.status != 1) Serial.println("No response from Central. Requesting registration again !");
-    
-  }while(SAPoTclient.status != 1);
+  }
+  else if(SAPoTnetwork.state == NET_WIFI_WAIT){
+    if(WiFi.status() == WL_CONNECTED){
+      Serial.println("SAPoTnetwork: connected to " + String(SAPoTnetwork.WiFi_ssid) + ", IP " + WiFi.localIP().toString());
+      SAPoTnetwork.state = NET_MQTT_OFF;
+      SAPoTnetwork.stateTime = now;
+      SAPoTnetwork.wait = 0;
+      SAPoTnetwork.backoff = NET_BACKOFF_MIN;
+    }
+    else if(now - SAPoTnetwork.stateTime >= NET_WIFI_TIMEOUT){
+      Serial.println("SAPoTnetwork: unable to join " + String(SAPoTnetwork.WiFi_ssid));
+      WiFi.disconnect();
+      SAPoTnetworkRetry(NET_WIFI_OFF);
+    }
+  }
+  else if(SAPoTnetwork.state == NET_MQTT_OFF){
+    if(now - SAPoTnetwork.stateTime >= SAPoTnetwork.wait){
+      if(MQTTconnect() == FALSE) SAPoTnetworkRetry(NET_MQTT_OFF);
+      else{
+        //O cadastro é refeito a cada conexão ao broker: a Central pode ter sido reiniciada e perdido o apelido v2
+        SAPoTclient.status = 0;
+        SAPoTclient.alias = 0;
+        SAPoTnetwork.backoff = NET_BACKOFF_MIN;
+        SAPoTnetwork.state = NET_REGISTER;
+        SAPoTnetwork.stateTime = millis();
+        SAPoTregister();
+      }
+    }
+  }
+  else if(SAPoTnetwork.state == NET_REGISTER){
+    MQTTclient.loop();
+    if(SAPoTclient.status == 1){
+      Serial.println("SAPoTnetwork: online");
+      SAPoTnetwork.state = NET_ONLINE;
+      SAPoTnetwork.stateTime = now;
+    }
+    else if(now - SAPoTnetwork.stateTime >= NET_REGISTER_TIMEOUT){
+      Serial.println("No response from Central. Requesting registration again !");
+      //Uma Central que não suporta a versão 2 descarta o cadastro, então a próxima tentativa utiliza a versão 1
+      if(SAPoTclient.version == SAPOT_VERSION_2){
+        Serial.println("Falling back to SAPoT v1.");
+        SAPoTclient.version = SAPOT_VERSION;
+      }
+      SAPoTnetwork.stateTime = now;
+      SAPoTregister();
+    }
+  }
+  else if(SAPoTnetwork.state == NET_ONLINE) MQTTclient.loop();
+
+  return SAPoTnetwork.state == NET_ONLINE;
 }
 
 /*
- * Função: Executa as operações com os sensores e/ou atuadores de acordo com o que for solicitado pela Central
+ * Função: Executa as operações com os sensores e/ou atuadores de acordo com o que for solicitado pela Central, na ordem dos prazos dos 
+ *  temporizadores (vários atuadores podem estar acionados ao mesmo tempo), e dorme até o próximo prazo ou a chegada de dados do broker.
  *  @parâmetros: float* sensorControl(uint16 sensorID), void actuatorControl(uint16_t actuatorID, uint16_t degreeOfPerformance).  
- *  @retorno: #CRIAR TABELA DE RETORNO#
+ *  @retorno: TRUE se o cliente estiver conectado ao broker e cadastrado na Central, se não retorna FALSE.
+ *  obs: O SAPoTloop pode dormir até SAPOT_SLEEP_MAX ms a cada evocação.
  */
 int SAPoTloop(float* (*sensorControl)(uint16_t), void (*actuatorControl)(uint16_t, uint16_t)){
 
   float* sensorInfo;
   int duty;
+  int i;
   
-  WiFiconnect();
-  MQTTconnect();
+  //A conexão avança sem bloquear: as leituras e os tempos dos atuadores continuam sem rede
+  bool online = SAPoTnetworkLoop();
   SAPoTclient.currentTime = millis();
-  
-  if(SAPoTclient.sensorRequestID != NON){
-      if((SAPoTclient.currentTime - sensorPreviousTime[SAPoTclient.sensorRequestID]) >= SAPoTclient.sensorRequestTime){
-          sensorInfo = sensorControl(SAPoTclient.sensorRequestID);
-          
-          SAPoTclient.serial++;
-          
-          //Definindo o tamanho da mensagem de resposta
-          if(SAPoTclient.sensorRequestID == ALL) SAPoTmessage.length = sizeof(fixed_header_SAPoT) + SAPoTclient.amountOfSensors * sizeof(float);
-          else SAPoTmessage.length = sizeof(fixed_header_SAPoT) + sizeof(float);
-          
-          //Preenchendo o cabeçalho da mensagem
-          SAPoTmessage.data = malloc(SAPoTmessage.length);
-          fixed_header_SAPoT* fh = (fixed_header_SAPoT*) SAPoTmessage.data;
-          fh->version = SAPOT_VERSION;
-          fh->ack = 1;
-          fh->rsv1 = 0;
-          fh->rsv2 = 0;
-          fh->rsv3 = 0;
-          fh->serial = SAPoTclient.serial;
-          fh->length = SAPoTmessage.length;
-          int i;
-          for(i=0; i<6; i++) fh->client_id[i] = SAPoTclient.id[i];
-
-          //Preenchendo o payload da mensagem
-          if(SAPoTclient.sensorRequestID == ALL){
-            fh->instruction = 1;
-            request_of_all_ack_SAPoT* pl = (request_of_all_ack_SAPoT*) (SAPoTmessage.data + sizeof(fixed_header_SAPoT));
-            for(i=0; i<SAPoTclient.amountOfSensors; i++) pl->sensors_info[i] = sensorInfo[i];
-          }
-          else{
-            fh->instruction = 2;
-            sensor_request_ack_SAPoT* pl = (sensor_request_ack_SAPoT*) (SAPoTmessage.data + sizeof(fixed_header_SAPoT));
-            pl->sensor_info = sensorInfo[0]; 
-          }
-
-          //Enviando as informações para a Central
-          if(MQTTclient.publish(SAPoTclient.centralID, (byte*) SAPoTmessage.data, (byte) SAPoTmessage.length, 0) < 0) Serial.println("SAPoTloop Error: unable to post on broker"); 
-          
-          free(SAPoTmessage.data);
-          
-          sensorPreviousTime[SAPoTclient.sensorRequestID] = millis();
+
+  //Executando os temporizadores vencidos, do prazo mais antigo ao mais recente (cada um no máximo uma vez por iteração)
+  uint8_t due = SAPoTscheduler.count;
+  while(due-- > 0 && SAPoTscheduler.count > 0 && (long) (SAPoTclient.currentTime - SAPoTscheduler.timers[SAPoTscheduler.heap[0]].deadline) >= 0){
+    uint8_t index = SAPoTscheduler.heap[0];
+    SAPoTTimer* timer = &SAPoTscheduler.timers[index];
+
+    if(index == TIMER_SENSOR){
+      if(SAPoTclient.sensorRequestID == NON || sensorControl == NULL){
+        SAPoTtimerCancel(TIMER_SENSOR);
+        continue;
       }
+      sensorInfo = sensorControl(SAPoTclient.sensorRequestID);
+      
+      //Armazenando as leituras relatáveis na fila, publicada em lotes (instrução 08) por SAPoTbufferFlush
+      if(SAPoTclient.sensorRequestID == ALL) for(i=0; i<SAPoTclient.amountOfSensors; i++) SAPoTreport(i, sensorInfo[i]);
+      else SAPoTreport(SAPoTclient.sensorRequestID, sensorInfo[0]);
+
+      //O próximo prazo é contado a partir do anterior, sem acumular o atraso das iterações (exceto após um atraso maior que o período)
+      unsigned long deadline = timer->deadline + SAPoTclient.sensorRequestTime;
+      if((long) (SAPoTclient.currentTime - deadline) >= 0) deadline = SAPoTclient.currentTime + SAPoTclient.sensorRequestTime;
+      SAPoTtimerSet(TIMER_SENSOR, deadline);
+    }
+    else if(timer->state == TIMER_START){ //Liga
+      duty = (int) timer->degree;
+      duty = map(duty, 0, 65535, 0, 1023); 
+      actuatorControl(index, duty);
+      timer->state = TIMER_RUNNING;
+      SAPoTtimerSet(index, SAPoTclient.currentTime + timer->period);
+    }
+    else{ //Desliga
+      actuatorControl(index, 0);
+      timer->state = TIMER_IDLE;
+      SAPoTtimerCancel(index);
+    }
   }
-
   
-  SAPoTclient.currentTime = millis();
-  if(SAPoTclient.actuatorRequestID != NON){
-       if((SAPoTclient.currentTime - actuatorPreviousTime[SAPoTclient.actuatorRequestID]) >= SAPoTclient.actuatorRequestTime){
-           actuatorTimeCounter++;
-           if(actuatorTimeCounter == 1){ //Liga
-             duty = (int) SAPoTclient.actuatorRequestDegree;
-             duty = map(duty, 0, 65535, 0, 1023); 
-             actuatorControl(SAPoTclient.actuatorRequestID, duty);
-           }
-           if(actuatorTimeCounter == 2){ //Desliga
-             actuatorControl(SAPoTclient.actuatorRequestID, 0);
-             actuatorTimeCounter = 0;
-             SAPoTclient.actuatorRequestID = NON;
-           }
-           actuatorPreviousTime[SAPoTclient.actuatorRequestID] = millis();
-     
-       }
+  //Publicando um lote da fila, se cheia o suficiente ou antiga demais (após uma reconexão, um lote por iteração até esvaziá-la)
+  SAPoTbufferFlush(online);
+
+  //Dormindo até o próximo prazo ou a chegada de dados do broker
+  SAPoTsleep(online);
+
+  return online;
+}
+
+/*
+ * Função: Ativa um temporizador ou altera o prazo de um temporizador ativo, reposicionando-o no heap.
+ *  @parâmetros: índice do temporizador (TIMER_SENSOR ou identificador do atuador) e prazo em millis().
+ *  @retorno: Nenhum.
+ */
+void SAPoTtimerSet(uint8_t index, unsigned long deadline){
+
+  SAPoTTimer* timer = &SAPoTscheduler.timers[index];
+  timer->deadline = deadline;
+  if(timer->position == TIMER_NONE){
+    timer->position = SAPoTscheduler.count;
+    SAPoTscheduler.heap[SAPoTscheduler.count++] = index;
   }
-  
+  SAPoTtimerSift(timer->position);
+}
+
+/*
+ * Função: Desativa um temporizador, substituindo-o no heap pelo último temporizador ativo.
+ *  @parâmetros: índice do temporizador (TIMER_SENSOR ou identificador do atuador).
+ *  @retorno: Nenhum.
+ */
+void SAPoTtimerCancel(uint8_t index){
+
+  uint8_t position = SAPoTscheduler.timers[index].position;
+  if(position == TIMER_NONE) return;
+
+  SAPoTscheduler.timers[index].position = TIMER_NONE;
+  SAPoTscheduler.count--;
+  if(position == SAPoTscheduler.count) return;
+
+  SAPoTscheduler.heap[position] = SAPoTscheduler.heap[SAPoTscheduler.count];
+  SAPoTscheduler.timers[SAPoTscheduler.heap[position]].position = position;
+  SAPoTtimerSift(position);
+}
+
+/*
+ * Função: Restaura a ordem do heap a partir de uma posição, subindo o temporizador enquanto o seu prazo for anterior ao do pai e, 
+ *  se não subir, descendo-o enquanto for posterior ao do filho mais próximo (os prazos são comparados pela diferença, por causa do 
+ *  retorno do millis() a zero).
+ *  @parâmetros: posição no heap.
+ *  @retorno: Nenhum.
+ */
+void SAPoTtimerSift(uint8_t position){
+
+  uint8_t* heap = SAPoTscheduler.heap;
+  SAPoTTimer* timers = SAPoTscheduler.timers;
+  uint8_t index = heap[position];
+  unsigned long deadline = timers[index].deadline;
+
+  while(position > 0 && (long) (deadline - timers[heap[(position - 1) / 2]].deadline) < 0){
+    heap[position] = heap[(position - 1) / 2];
+    timers[heap[position]].position = position;
+    position = (position - 1) / 2;
+  }
+  while(TRUE){
+    uint16_t child = 2 * position + 1;
+    if(child >= SAPoTscheduler.count) break;
+    if(child + 1 < SAPoTscheduler.count && (long) (timers[heap[child + 1]].deadline - timers[heap[child]].deadline) < 0) child++;
+    if((long) (timers[heap[child]].deadline - deadline) >= 0) break;
+    heap[position] = heap[child];
+    timers[heap[position]].position = position;
+    position = child;
+  }
+  heap[position] = index;
+  timers[index].position = position;
+}
+
+/*
+ * Função: Limita a espera ao tempo restante até um prazo.
+ *  @parâmetros: prazo em millis() e espera atual, em ms.
+ *  @retorno: a menor entre a espera e o tempo restante (0 se o prazo já passou).
+ */
+unsigned long SAPoTuntil(unsigned long deadline, unsigned long wait){
+
+  long remaining = (long) (deadline - millis());
+  if(remaining <= 0) return 0;
+  return ((unsigned long) remaining < wait) ? remaining : wait;
+}
+
+/*
+ * Função: Dorme (delay, com o rádio em light sleep) até o próximo prazo dos temporizadores, do envio do lote ou da conexão, ou até a 
+ *  chegada de dados do broker, verificada a cada SAPOT_SLEEP_SLICE ms. A espera é limitada a SAPOT_SLEEP_MAX ms para que o 
+ *  MQTTclient.loop() mantenha a conexão com o broker (keepalive).
+ *  @parâmetros: TRUE se o cliente estiver conectado e cadastrado na Central.
+ *  @retorno: Tempo dormido, em ms.
+ */
+unsigned long SAPoTsleep(bool online){
+
+  unsigned long wait = SAPOT_SLEEP_MAX;
+
+  //Próximo temporizador
+  if(SAPoTscheduler.count > 0) wait = SAPoTuntil(SAPoTscheduler.timers[SAPoTscheduler.heap[0]].deadline, wait);
+
+  //Próximo lote (veja SAPoTbufferFlush)
+  if(online && SAPoTbuffer.count >= SAPOT_FLUSH_SAMPLES) wait = 0;
+  else if(online && SAPoTbuffer.count > 0) wait = SAPoTuntil(SAPoTbuffer.samples[SAPoTbuffer.first].time + SAPOT_FLUSH_DEADLINE, wait);
+
+  //Próxima tentativa de conexão (veja SAPoTnetworkLoop); a associação à rede é verificada a cada fatia
+  if(SAPoTnetwork.state == NET_WIFI_OFF || SAPoTnetwork.state == NET_MQTT_OFF) wait = SAPoTuntil(SAPoTnetwork.stateTime + SAPoTnetwork.wait, wait);
+  else if(SAPoTnetwork.state == NET_WIFI_WAIT && wait > SAPOT_SLEEP_SLICE) wait = SAPOT_SLEEP_SLICE;
+  else if(SAPoTnetwork.state == NET_REGISTER) wait = SAPoTuntil(SAPoTnetwork.stateTime + NET_REGISTER_TIMEOUT, wait);
+
+  unsigned long start = millis();
+  unsigned long slept = 0;
+  while(slept < wait && !WiFiclient.available()){
+    delay((wait - slept < SAPOT_SLEEP_SLICE) ? wait - slept : SAPOT_SLEEP_SLICE);
+    slept = millis() - start;
+  }
+  return slept;
+}
+
+/*
+ * Função: Aplica a banda morta do sensor à leitura e a insere na fila se ela deve ser relatada: no relato periódico, no primeiro relato, 
+ *  quando a variação em relação ao último valor relatado excede o limiar ou quando o heartbeat expira (a Central considera o silêncio 
+ *  como valor inalterado, e o heartbeat distingue um valor estável de um sensor perdido).
+ *  @parâmetros: identificador do sensor e valor lido.
+ *  @retorno: TRUE se a leitura for inserida na fila, se não retorna FALSE.
+ */
+bool SAPoTreport(uint16_t sensorID, float value){
+
+  if(sensorID >= SAPoTclient.amountOfSensors){
+    SAPoTbufferPush(sensorID, value);
+    return TRUE;
+  }
+
+  SAPoTReport* report = &SAPoTreports[sensorID];
+  float deviation = fabs(value - report->lastValue);
+  bool push;
+  if(report->deadband.mode == REPORT_PERIODIC || report->reported == FALSE) push = TRUE;
+  else if(report->heartbeat != 0 && (millis() - report->lastTime) >= report->heartbeat) push = TRUE;
+  else if(report->deadband.mode == REPORT_ABSOLUTE) push = deviation > report->deadband.threshold;
+  else push = deviation > fabs(report->lastValue) * report->deadband.threshold / 100;
+
+  if(push == FALSE) return FALSE;
+
+  SAPoTbufferPush(sensorID, value);
+  report->lastValue = value;
+  report->lastTime = millis();
+  report->reported = TRUE;
+  return TRUE;
+}
+
+/*
+ * Função: Insere uma amostra na fila de amostras; com a fila cheia, a amostra mais antiga é descartada.
+ *  @parâmetros: identificador do sensor e valor lido.
+ *  @retorno: Nenhum.
+ */
+void SAPoTbufferPush(uint16_t sensorID, float value){
+
+  if(SAPoTbuffer.count == SAPOT_BUFFER_SIZE){
+    SAPoTbuffer.first = (SAPoTbuffer.first + 1) % SAPOT_BUFFER_SIZE;
+    SAPoTbuffer.count--;
+    SAPoTbuffer.dropped++;
+  }
+
+  SAPoTSample* sample = &SAPoTbuffer.samples[(SAPoTbuffer.first + SAPoTbuffer.count) % SAPOT_BUFFER_SIZE];
+  sample->sensorID = sensorID;
+  sample->time = millis();
+  sample->value = value;
+  SAPoTbuffer.count++;
+}
+
+/*
+ * Função: Publica em um lote as amostras mais antigas da fila (até SAPOT_BATCH_MAX) quando há SAPOT_FLUSH_SAMPLES amostras ou a mais 
+ *  antiga tem SAPOT_FLUSH_DEADLINE ms. As amostras só deixam a fila após a publicação do lote, então as lidas sem conexão são 
+ *  enviadas (com as idades corretas) após a reconexão.
+ *  @parâmetros: TRUE se o cliente estiver conectado e cadastrado na Central.
+ *  @retorno: TRUE se um lote for publicado, se não retorna FALSE.
+ */
+bool SAPoTbufferFlush(bool online){
+
+  if(online == FALSE || SAPoTbuffer.count == 0) return FALSE;
+  if(SAPoTbuffer.count < SAPOT_FLUSH_SAMPLES && (millis() - SAPoTbuffer.samples[SAPoTbuffer.first].time) < SAPOT_FLUSH_DEADLINE) return FALSE;
+
+  //Copiando as amostras para um vetor contínuo (a fila pode dar a volta no fim do vetor)
+  SAPoTSample samples[SAPOT_BATCH_MAX];
+  uint8_t quantity = (SAPoTbuffer.count < SAPOT_BATCH_MAX) ? SAPoTbuffer.count : SAPOT_BATCH_MAX;
+  int i;
+  for(i=0; i<quantity; i++) samples[i] = SAPoTbuffer.samples[(SAPoTbuffer.first + i) % SAPOT_BUFFER_SIZE];
+
+  if(SAPoTpublishBatch(samples, quantity) == FALSE) return FALSE;
+
+  SAPoTbuffer.first = (SAPoTbuffer.first + quantity) % SAPOT_BUFFER_SIZE;
+  SAPoTbuffer.count -= quantity;
+  if(SAPoTbuffer.dropped > 0){
+    Serial.println("SAPoTbufferFlush: " + String(SAPoTbuffer.dropped) + " samples dropped while offline");
+    SAPoTbuffer.dropped = 0;
+  }
+  return TRUE;
 }
 
 /*
- * Função: Verifica e efetua a conexão do Cliente WiFi com a rede
- *  @parametro: identificador da rede (ssid) e senha da rede (pass)
+ * Função: Publica várias amostras em uma única mensagem SAPoT (instrução 08), sob um só cabeçalho fixo.
+ *  @parâmetros: vetor de amostras lidas localmente e quantidade de amostras (até SAPOT_BATCH_MAX).
+ *  @retorno: TRUE se o lote for publicado, se não retorna FALSE.
+ */
+bool SAPoTpublishBatch(SAPoTSample* samples, uint8_t quantity){
+
+  const unsigned long scaleUnit[] = {1UL, 1000UL, 60000UL, 3600000UL, 86400000UL};
+  unsigned long now = millis();
+  unsigned long oldest = 0;
+  uint8_t scale = 0;
+  int i;
+
+  if(quantity > SAPOT_BATCH_MAX) quantity = SAPOT_BATCH_MAX;
+
+  //Escolhendo a menor escala de tempo capaz de representar a idade da amostra mais antiga em 16 bits
+  for(i=0; i<quantity; i++) if((now - samples[i].time) > oldest) oldest = now - samples[i].time;
+  while(scale < 4 && (oldest / scaleUnit[scale]) > 0xffff) scale++;
+
+  //Concatenando o cabeçalho do lote (bh) e as amostras (pl) no mesmo espaço de memória
+  uint16_t payloadLength = sizeof(batch_SAPoT) + quantity * sizeof(sample_SAPoT);
+  batch_SAPoT* bh = (batch_SAPoT*) malloc(payloadLength);
+  sample_SAPoT* pl = (sample_SAPoT*) ((uint8_t*) bh + sizeof(batch_SAPoT));
+
+  //Preenchendo o cabeçalho do lote e as amostras
+  bh->sample_quantity = quantity;
+  bh->time_scale = scale;
+  bh->rsv = 0;
+  for(i=0; i<quantity; i++){
+    pl[i].sensor_id = samples[i].sensorID;
+    pl[i].age = (uint16_t) ((now - samples[i].time) / scaleUnit[scale]);
+    pl[i].value = samples[i].value;
+  }
+
+  //Enviando o lote para a Central
+  bool published = SAPoTpublish(8, 0, 0, bh, payloadLength);
+  if(!published) Serial.println("SAPoTpublishBatch Error: unable to post on broker");
+
+  free(bh);
+  return published;
+}
+
+/*
+ * Função: Monta o cabeçalho fixo (v1, ou o cabeçalho compacto v2 se negociado no cadastro) e publica uma mensagem SAPoT no tópico da Central.
+ *  O payload é copiado para logo após o cabeçalho, então ele pode ser montado em uma estrutura alinhada mesmo que o cabeçalho v2 tenha comprimento ímpar.
+ *  @parâmetros: instrução, flag de ack, flags v2 adicionais, payload e comprimento do payload.
+ *  @retorno: TRUE se a mensagem for publicada, se não retorna FALSE.
+ */
+bool SAPoTpublish(uint8_t instruction, uint8_t ack, uint8_t flags, const void* payload, uint16_t payloadLength){
+
+  uint8_t header[SAPOT_V2_HEADER_MAX];
+  uint8_t headerLength = 0;
+  int i;
+
+  SAPoTclient.serial++;
+
+  if(SAPoTclient.version == SAPOT_VERSION_2){
+    //O apelido substitui o MAC a partir do momento em que é atribuído pela Central
+    if(SAPoTclient.alias != 0) flags |= SAPOT_V2_FLAG_ALIAS;
+    //O comprimento total depende do tamanho do próprio cabeçalho, então o varint do comprimento é estimado até convergir
+    uint16_t length = payloadLength + 7;
+    while(TRUE){
+      headerLength = 0;
+      header[headerLength++] = (SAPOT_VERSION_2 << 4) | (ack << 3);
+      header[headerLength++] = instruction;
+      header[headerLength++] = flags;
+      headerLength += putVarint(&header[headerLength], SAPoTclient.serial);
+      headerLength += putVarint(&header[headerLength], length);
+      if(flags & SAPOT_V2_FLAG_ALIAS){
+        header[headerLength++] = SAPoTclient.alias & 0xff;
+        header[headerLength++] = SAPoTclient.alias >> 8;
+      }
+      else for(i=0; i<6; i++) header[headerLength++] = SAPoTclient.id[i];
+      if(headerLength + payloadLength == length) break;
+      length = headerLength + payloadLength;
+    }
+  }
+  else{
+    fixed_header_SAPoT fh;
+    fh.version = SAPOT_VERSION;
+    fh.ack = ack;
+    fh.rsv1 = 0;
+    fh.rsv2 = 0;
+    fh.rsv3 = 0;
+    fh.instruction = instruction;
+    fh.serial = SAPoTclient.serial;
+    fh.length = sizeof(fixed_header_SAPoT) + payloadLength;
+    for(i=0; i<6; i++) fh.client_id[i] = SAPoTclient.id[i];
+    memcpy(header, &fh, sizeof(fixed_header_SAPoT));
+    headerLength = sizeof(fixed_header_SAPoT);
+  }
+
+  //Concatenando o cabeçalho e o payload no mesmo espaço de memória (SAPoTmessage.data)
+  SAPoTmessage.length = headerLength + payloadLength;
+  SAPoTmessage.data = malloc(SAPoTmessage.length);
+  memcpy(SAPoTmessage.data, header, headerLength);
+  memcpy((uint8_t*) SAPoTmessage.data + headerLength, payload, payloadLength);
+  Serial.println("SAPoTmessage: " + String(SAPoTmessage.length) + "Bytes");
+
+  bool published = MQTTclient.publish(SAPoTclient.centralID, (byte*) SAPoTmessage.data, SAPoTmessage.length, 0);
+
+  free(SAPoTmessage.data);
+  return published;
+}
+
+/*
+ * Função: Verifica a conexão do Cliente WiFi com a rede e, se desconectado, inicia a associação sem aguardá-la (veja SAPoTnetworkLoop)
+ *  @parametro: Nenhum (identificador da rede e senha em SAPoTnetwork)
  *  @retorno: FALSE se não conectado à rede, TRUE se conectado à rede.
  */
 bool WiFiconnect(){
@@ -399,51 +923,40 @@ bool WiFiconnect(){
     //Serial.println("Wifi Client remains connected.");
     return TRUE;
   }
-  else{
-      WiFi.begin(SAPoTnetwork.WiFi_ssid, SAPoTnetwork.WiFi_pass); 
-      Serial.println();
-      Serial.println("Connecting to the network: " + String(SAPoTnetwork.WiFi_ssid) + ". Wait please!");
-      while(WiFi.status() != WL_CONNECTED){ 
-        Serial.print(".");
-        delay(1000);      
-      }
-  }  
+
+  WiFi.begin(SAPoTnetwork.WiFi_ssid, SAPoTnetwork.WiFi_pass); 
+  Serial.println();
+  Serial.println("Connecting to the network: " + String(SAPoTnetwork.WiFi_ssid) + ".");
+  return FALSE;
 }
 
 /*
- * Função: Verifica e efetua a conexão do Cliente MQTT com o broker 
- *  @parâmetros: endereço do broker, porta de escuta do broker, login e senha para se conectar ao broker, identificador do cliente
- *  @retorno: FALSE se não estiver conectado ao servidor, TRUE se estiver.
+ * Função: Realiza uma tentativa de conexão do Cliente MQTT com o broker e assina o tópico do cliente (bloqueia no máximo NET_SOCKET_TIMEOUT)
+ *  @parâmetros: Nenhum (endereço, porta, login e senha do broker em SAPoTnetwork; o identificador do cliente é o seu MAC)
+ *  @retorno: FALSE se não conectar ao servidor, TRUE se conectar.
  *  obs: Deve ser usado junto com MQTTclient.loop() para persistência da conexão com o servidor.
  */
 bool MQTTconnect(){
 
-  MQTTclient.loop();
-  int state = MQTTclient.state();
-  if(state != 0){
-    Serial.println("MQTTclient.state(): " + String(state));
-    Serial.print("Connecting to Broker: " + String(SAPoTnetwork.MQTT_server) + ":" + String(SAPoTnetwork.MQTT_port)); 
-    Serial.print(", With login: " + String(SAPoTnetwork.MQTT_user) + ":" + String(SAPoTnetwork.MQTT_pass)); 
-    Serial.println(", With ID: " + WiFi.macAddress());
-    MQTTclient.setServer(SAPoTnetwork.MQTT_server, SAPoTnetwork.MQTT_port);
-    MQTTclient.setCallback(MQTTCallBackMessage); 
-     
-    if(MQTTclient.connect(WiFi.macAddress().c_str(), SAPoTnetwork.MQTT_user, SAPoTnetwork.MQTT_pass) == 0){
-        Serial.println("MQTTconnect error: unable to connect on broker mqtt");
-        return FALSE;  
-    }
-    
-    Serial.print("Subscription topic: " + WiFi.macAddress());
-    if(MQTTclient.subscribe(WiFi.macAddress().c_str()) == 0){
-        Serial.print("MQTTconnect error: unable to subscribe on topic");
-        return FALSE;
-    }
+  Serial.print("Connecting to Broker: " + String(SAPoTnetwork.MQTT_server) + ":" + String(SAPoTnetwork.MQTT_port)); 
+  Serial.print(", With login: " + String(SAPoTnetwork.MQTT_user) + ":" + String(SAPoTnetwork.MQTT_pass)); 
+  Serial.println(", With ID: " + WiFi.macAddress());
+   
+  if(MQTTclient.connect(WiFi.macAddress().c_str(), SAPoTnetwork.MQTT_user, SAPoTnetwork.MQTT_pass) == 0){
+      Serial.println("MQTTconnect error: unable to connect on broker mqtt, state " + String(MQTTclient.state()));
+      return FALSE;  
+  }
+  
+  Serial.print("Subscription topic: " + WiFi.macAddress());
+  if(MQTTclient.subscribe(WiFi.macAddress().c_str()) == 0){
+      Serial.println("MQTTconnect error: unable to subscribe on topic");
+      MQTTclient.disconnect();
+      return FALSE;
+  }
 
-    Serial.println();
-    Serial.println("MQTTconnect successfully executed !");
-    return TRUE;      
-    }
-   else return TRUE;  
+  Serial.println();
+  Serial.println("MQTTconnect successfully executed !");
+  return TRUE;      
 }
 
 /*
@@ -456,18 +969,39 @@ void MQTTCallBackMessage(char* topic, byte* message, unsigned int message_length
   Serial.println();
   Serial.println("Message recieved from topic: " + String(topic) + ", with " + String(message_length) + " bytes"); 
   
-  //Estruturando a mensagem recebida.
+  //Estruturando a mensagem recebida: a versão define o formato do cabeçalho (o v2 pode ter menos bytes que o cabeçalho fixo)
   fixed_header_SAPoT p;
+  memset(&p, 0, sizeof(p));
+  if(message_length < 2){
+    Serial.println("Malformed SAPoT header!");
+    return;
+  }
   p.version = (message[0]) >> 4;
   p.ack = (message[0] & 0x0f) >> 3;
   p.rsv1 = (message[0] & 0x07) >> 2;
   p.rsv2 = (message[0] & 0x02) >> 1;
   p.rsv3 = (message[0] & 0x01);
   p.instruction = message[1];
-  p.serial = (message[2] & 0xffff) | ((message[3] & 0xffff) << 8);
-  p.length = (message[4] & 0xffff) | ((message[5] & 0xffff) << 8);
-  int i;
-  for(i=0; i<6; i++) p.client_id[i] = message[i+6];
+
+  //O cabeçalho v2 tem comprimento variável, então o payload começa em offset
+  unsigned int offset;
+  if(p.version == SAPOT_VERSION_2){
+    if((offset = unpackHeaderV2(message, message_length, &p)) == 0){
+      Serial.println("Malformed SAPoT v2 header!");
+      return;
+    }
+  }
+  else{
+    if(message_length < sizeof(fixed_header_SAPoT)){
+      Serial.println("Malformed SAPoT header!");
+      return;
+    }
+    p.serial = (message[2] & 0xffff) | ((message[3] & 0xffff) << 8);
+    p.length = (message[4] & 0xffff) | ((message[5] & 0xffff) << 8);
+    int i;
+    for(i=0; i<6; i++) p.client_id[i] = message[i+6];
+    offset = sizeof(fixed_header_SAPoT);
+  }
 
   //Printando o cabeçalho fixo da messagem recebida para verificação dos dados.
   Serial.println("Version = "+ String(p.version, HEX));
@@ -482,46 +1016,110 @@ void MQTTCallBackMessage(char* topic, byte* message, unsigned int message_length
   Serial.println();
 
   //Tratando as informações da mensagem recebida
-  if((p.version) != SAPOT_VERSION) Serial.println("Packet with incompatible verison!");
+  if((p.version) != SAPOT_VERSION && (p.version) != SAPOT_VERSION_2) Serial.println("Packet with incompatible verison!");
   else{
-    if(p.ack == TRUE) ackHandling(p.instruction);
+    if(p.ack == TRUE) ackHandling(p.instruction, p.version, &message[offset], message_length - offset);
     else{
       if(p.instruction == 0){
         Serial.println("Instruction recieved: Register a new client.");
       }
-      else if(p.instruction == 1){
+      else if(p.instruction == 1 && message_length - offset >= 2){
         Serial.println("Instruction recieved: Request for all sensors");
         SAPoTclient.sensorRequestID = 0;
-        SAPoTclient.sensorRequestTime = getTime((message[sizeof(fixed_header_SAPoT)] & 0xffff) | ((message[sizeof(fixed_header_SAPoT)+1] & 0xffff) << 8));   
+        SAPoTclient.sensorRequestTime = getTime((message[offset] & 0xffff) | ((message[offset+1] & 0xffff) << 8));   
+        SAPoTtimerSet(TIMER_SENSOR, millis());
       }
-      else if(p.instruction == 2){
+      else if(p.instruction == 2 && message_length - offset >= 4){
         Serial.println("Instruction recieved: Request for a specific sensor");
-        SAPoTclient.sensorRequestID = (message[sizeof(fixed_header_SAPoT)] & 0xffff) | ((message[sizeof(fixed_header_SAPoT)+1] & 0xffff) << 8); 
-        SAPoTclient.sensorRequestTime = getTime((message[sizeof(fixed_header_SAPoT)+2] & 0xffff) | ((message[sizeof(fixed_header_SAPoT)+3] & 0xffff) << 8));
+        SAPoTclient.sensorRequestID = (message[offset] & 0xffff) | ((message[offset+1] & 0xffff) << 8); 
+        SAPoTclient.sensorRequestTime = getTime((message[offset+2] & 0xffff) | ((message[offset+3] & 0xffff) << 8));
+        SAPoTtimerSet(TIMER_SENSOR, millis());
       }
-      else if(p.instruction == 3){
+      else if(p.instruction == 3 && message_length - offset >= 6){
         Serial.println("Instruction recieved: Acting request");
-        SAPoTclient.actuatorRequestID = (message[sizeof(fixed_header_SAPoT)] & 0xffff) | ((message[sizeof(fixed_header_SAPoT)+1] & 0xffff) << 8);
-        SAPoTclient.actuatorRequestTime = getTime(((message[sizeof(fixed_header_SAPoT)+2] & 0xffff) | ((message[sizeof(fixed_header_SAPoT)+3] & 0xffff) << 8)));
-        SAPoTclient.actuatorRequestDegree = (message[sizeof(fixed_header_SAPoT)+4] & 0xffff) | ((message[sizeof(fixed_header_SAPoT)+5] & 0xffff) << 8);
+        //Cada atuador tem o seu temporizador: um novo acionamento de um atuador ligado o reinicia com o novo grau e tempo
+        uint16_t actuatorID = (message[offset] & 0xffff) | ((message[offset+1] & 0xffff) << 8);
+        if(actuatorID == 0 || actuatorID > SAPoTclient.amountOfActuators) Serial.println("Acting request: actuator not found !");
+        else{
+          SAPoTTimer* timer = &SAPoTscheduler.timers[actuatorID];
+          timer->period = getTime(((message[offset+2] & 0xffff) | ((message[offset+3] & 0xffff) << 8)));
+          timer->degree = (message[offset+4] & 0xffff) | ((message[offset+5] & 0xffff) << 8);
+          timer->state = TIMER_START;
+          SAPoTtimerSet(actuatorID, millis());
+        }
       }
       else if(p.instruction == 4){
         Serial.println("Instruction recieved: Stop sensor request");
         SAPoTclient.sensorRequestID = NON;
+        SAPoTtimerCancel(TIMER_SENSOR);
+      }
+      else if(p.instruction == 0x0A && message_length - offset >= sizeof(echo_SAPoT)){
+        //O eco é devolvido imediatamente, sem esperar o SAPoTloop: o tempo medido inclui apenas a rede e o tratamento da mensagem
+        Serial.println("Instruction recieved: Echo");
+        if(SAPoTpublish(0x0A, 1, 0, &message[offset], sizeof(echo_SAPoT)) == FALSE) Serial.println("Echo Error: unable to post on broker");
+      }
+      else if(p.instruction == 0x0B && message_length - offset >= sizeof(report_SAPoT)){
+        Serial.println("Instruction recieved: Report configuration");
+        //O payload segue um cabeçalho v2 de comprimento variável, então é copiado para uma estrutura alinhada
+        report_SAPoT report;
+        memcpy(&report, &message[offset], sizeof(report_SAPoT));
+        SAPoTClient_deadband(report.sensor_id, report.deadband.mode, report.deadband.threshold, report.deadband.heartbeat);
       }
     }
   }
 }
 
+/*
+ * Função: Converte o cabeçalho compacto (v2) da mensagem recebida para a estrutura fixed_header_SAPoT.
+ *  @parâmetros: Mensagem recebida, comprimento da mensagem e cabeçalho a ser preenchido.
+ *  @retorno: Posição do payload na mensagem, ou 0 se o cabeçalho estiver truncado.
+ */
+unsigned int unpackHeaderV2(byte* message, unsigned int message_length, fixed_header_SAPoT* p){
+
+  unsigned int offset = 3;
+  uint32_t value;
+  int len;
+
+  if(message_length < 7) return 0;
+  uint8_t flags = message[2];
+
+  if((len = getVarint(&message[offset], &message[message_length], &value)) == 0) return 0;
+  p->serial = value;
+  offset += len;
+  if((len = getVarint(&message[offset], &message[message_length], &value)) == 0) return 0;
+  p->length = value;
+  offset += len;
+
+  //Emissor identificado por apelido (a Central utiliza o apelido 0) ou pelo endereço MAC
+  int i;
+  if(flags & SAPOT_V2_FLAG_ALIAS){
+    if(offset + 2 > message_length) return 0;
+    for(i=0; i<6; i++) p->client_id[i] = 0;
+    offset += 2;
+  }
+  else{
+    if(offset + 6 > message_length) return 0;
+    for(i=0; i<6; i++) p->client_id[i] = message[offset++];
+  }
+
+  return offset;
+}
+
 /*
  * Função: Trata as mensagens de reconhecimento (Acknowledgment).
- *  @parâmetros: De qual instrução o ack provêm.
+ *  @parâmetros: De qual instrução o ack provêm, versão do cabeçalho do ack, payload do ack e seu comprimento.
  *  @retorno: Nenhum.
  */
-void ackHandling(uint8_t instruction){
+void ackHandling(uint8_t instruction, uint8_t version, byte* payload, unsigned int payload_length){
   //Função para tratar os ack's. A princípio, essa função só é necessária para a operação da central.
 
-  if(instruction == 0) SAPoTclient.status = 1;
+  if(instruction == 0){
+    SAPoTclient.status = 1;
+    //A versão do ack de cadastro define a versão negociada; na versão 2 o payload contém o apelido atribuído
+    SAPoTclient.version = version;
+    if(version == SAPOT_VERSION_2 && payload_length >= 2) SAPoTclient.alias = payload[0] | (payload[1] << 8);
+    Serial.println("Registered with SAPoT v" + String(SAPoTclient.version) + ", alias " + String(SAPoTclient.alias));
+  }
   
   
 }
@@ -537,7 +1135,7 @@ void getmacID(const char* MAC, uint8_t ID[6]){
   int j=0;
   uint8_t bff[12];
     
-  for(i=0; i<(strlen(MAC)); i++){
+  for(i=0; i<(int) strlen(MAC); i++){
     
     if(MAC[i] == ':');
     else if(MAC[i] >= 'A'){
@@ -554,18 +1152,50 @@ void getmacID(const char* MAC, uint8_t ID[6]){
   } 
   
   j=0;
-  for(i=0; i<11; i++){
-   ID[j] =  (uint8_t)((bff[i]<<4) | (bff[++i]));
+  for(i=0; i<11; i+=2){
+   ID[j] =  (uint8_t)((bff[i]<<4) | (bff[i+1]));
    //Serial.println(thingID[j], HEX);
    j++;
   }
   
 } 
 
+/*
+ * Função: Escreve um inteiro sem sinal no formato varint (7 bits por byte, bit mais significativo indica continuação).
+ *  @parâmetros: buffer de destino e valor.
+ *  @retorno: Quantidade de bytes escritos.
+ */
+uint8_t putVarint(uint8_t* buffer, uint32_t value){
+
+  uint8_t i = 0;
+  while(value >= 0x80){
+    buffer[i++] = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  buffer[i++] = (uint8_t) value;
+  return i;
+}
+
+/*
+ * Função: Lê um inteiro sem sinal no formato varint.
+ *  @parâmetros: início e fim do buffer, variável de destino.
+ *  @retorno: Quantidade de bytes lidos, ou 0 se o varint estiver truncado.
+ */
+int getVarint(const uint8_t* buffer, const uint8_t* end, uint32_t* value){
+
+  int i = 0;
+  *value = 0;
+  while(&buffer[i] < end && i < 5){
+    *value |= (uint32_t) (buffer[i] & 0x7f) << (7*i);
+    if((buffer[i++] & 0x80) == 0) return i;
+  }
+  return 0;
+}
+
 /*
  * Função: Trata o tempo recebido via SAPoT.
  *  @parâmetros: Tempo estruturado em SAPoT (1º byte = Escala de tempo; 2º, 3º e 4º bytes = Quantidade de tempo).
- *  @retorno: tempo em milisegundos.
+ *  @retorno: tempo em milisegundos (0 se a escala for desconhecida).
  */
 unsigned long getTime(uint16_t _time){
 
@@ -600,6 +1230,10 @@ unsigned long getTime(uint16_t _time){
       return (quantity * 1000 * 60 * 60 * 24);
     }
 
+    //Escala desconhecida: nenhum tempo
+    Serial.println("GetTime: unknown scale");
+    return 0;
+
 }
 
 /************************************************************************************************************/
@@ -639,7 +1273,7 @@ void setup(){
   //Inicializa cliente SAPoT
   SAPoTClient_begin(central_id, SMCAI, 0, 2, NULL, actuatorVector);
 
-  //Conecta o cliente à rede e faz seu registro na central
+  //Configura a conexão do cliente à rede; a conexão e o registro na central são concluídos pelo SAPoTloop
   SAPoTClient_connect(ssid, password, mqtt_server, broker_port, broker_user, broker_pass);
  
 }
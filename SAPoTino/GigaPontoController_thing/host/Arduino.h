@@ -0,0 +1,60 @@
+/**
+* Simulacro do núcleo Arduino para a compilação do sketch no computador (veja Makefile). O tempo é controlado pelo teste por 
+* meio de fakeNow: delay() apenas o avança.
+*
+*/
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+
+typedef uint8_t byte;
+#define HEX 16
+#define DEC 10
+#define OUTPUT 1
+#define LOW 0
+#define D5 5
+#define D8 8
+
+extern unsigned long fakeNow;
+inline unsigned long millis(){ return fakeNow; }
+inline void delay(unsigned long ms){ fakeNow += ms; }
+inline long random(long max){ return max > 0 ? rand() % max : 0; }
+inline long map(long x, long inMin, long inMax, long outMin, long outMax){ return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin; }
+inline void pinMode(int, int){}
+inline void digitalWrite(int, int){}
+
+//Definida pelo teste, para observar os atuadores
+void analogWrite(int pin, int value);
+
+class String{
+  public:
+    std::string s;
+    String(){}
+    String(const char* c) : s(c ? c : "(null)"){}
+    String(const std::string& x) : s(x){}
+    String(int v, int base = 10){ char b[32]; snprintf(b, 32, base == HEX ? "%x" : "%d", v); s = b; }
+    String(unsigned int v, int base = 10){ char b[32]; snprintf(b, 32, base == HEX ? "%x" : "%u", v); s = b; }
+    String(long v, int base = 10){ char b[32]; snprintf(b, 32, "%ld", v); s = b; }
+    String(unsigned long v, int base = 10){ char b[32]; snprintf(b, 32, "%lu", v); s = b; }
+    String(float v){ char b[32]; snprintf(b, 32, "%.2f", v); s = b; }
+    String(double v){ char b[32]; snprintf(b, 32, "%.2f", v); s = b; }
+    const char* c_str() const { return s.c_str(); }
+    String toString() const { return *this; }
+    unsigned int length() const { return s.size(); }
+};
+inline String operator+(const String& a, const String& b){ return String(a.s + b.s); }
+inline String operator+(const String& a, const char* b){ return String(a.s + b); }
+inline String operator+(const char* a, const String& b){ return String(std::string(a) + b.s); }
+
+//A porta serial só imprime com quiet falso (make test V=1)
+struct FakeSerial{
+  bool quiet = false;
+  void begin(int){}
+  void print(const String& x){ if(!quiet) printf("%s", x.c_str()); }
+  void println(const String& x = String("")){ if(!quiet) printf("%s\n", x.c_str()); }
+};
+extern FakeSerial Serial;
@@ -0,0 +1,34 @@
+/**
+* Simulacro da biblioteca ESP8266WiFi. A associação à rede termina 3 s após WiFi.begin(), se a rede estiver disponível 
+* (available); status() e begin() são definidos pelo teste.
+*
+*/
+#pragma once
+#include "Arduino.h"
+
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+#define WIFI_LIGHT_SLEEP 1
+
+struct FakeWiFi{
+  bool available = true;
+  int st = WL_DISCONNECTED;
+  unsigned long joinAt = 0;
+  int begins = 0;
+  int status();
+  void begin(const char* ssid, const char* pass);
+  void setSleepMode(int){}
+  void disconnect(){ st = WL_DISCONNECTED; }
+  String macAddress(){ return String("AA:BB:CC:00:00:01"); }
+  String localIP(){ return String("10.0.0.2"); }
+};
+extern FakeWiFi WiFi;
+
+//Definida pelo teste: indica se há mensagem do broker a ser entregue
+int fakeAvailable();
+
+class WiFiClient{
+  public:
+    void setTimeout(unsigned long){}
+    int available(){ return fakeAvailable(); }
+};
@@ -0,0 +1,5 @@
+/**
+* Simulacro da biblioteca NTPClient: o sketch apenas a inclui.
+*
+*/
+#pragma once
@@ -0,0 +1,26 @@
+/**
+* Simulacro da biblioteca PubSubClient. connect(), loop() e publish() são definidos pelo teste, que simula o broker e a Central.
+*
+*/
+#pragma once
+#include "ESP8266WiFi.h"
+
+class PubSubClient{
+  public:
+    typedef void (*Callback)(char*, uint8_t*, unsigned int);
+    Callback cb = 0;
+    bool conn = false;
+    int connects = 0;
+    int published = 0;
+    PubSubClient(WiFiClient&){}
+    void setServer(const char*, int){}
+    void setCallback(Callback c){ cb = c; }
+    void setSocketTimeout(int){}
+    bool connect(const char* id, const char* user, const char* pass);
+    bool subscribe(const char*){ return conn; }
+    bool loop();
+    int state(){ return conn ? 0 : -3; }
+    bool connected(){ return conn; }
+    void disconnect(){ conn = false; }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained);
+};
@@ -0,0 +1,206 @@
+/**
+* Teste da máquina de estados da rede (SAPoTnetworkLoop) no computador: o sketch é compilado com os simulacros deste diretório 
+* e o tempo simulado atravessa quedas da rede sem fio, do broker e da Central. Em cada fase o teste verifica se o Cliente 
+* deixou ou voltou ao estado NET_ONLINE, e se nenhuma iteração do SAPoTloop() bloqueou por mais de NET_LOOP_BLOCK_MAX.
+*
+* As leituras e os atuadores não dependem da rede: o sensor TEST_SENSOR é lido a cada segundo durante todo o teste, e no início 
+* de cada queda o atuador 1 é acionado por TEST_DRIVE ms. Em cada queda o teste verifica se o atuador foi desligado no prazo, 
+* ainda sem conexão, e se o sensor foi lido em todos os segundos; após cada retorno, se as leituras foram publicadas em lotes.
+*
+* Uso: make test (ou make test V=1 para imprimir as mensagens da porta serial)
+*
+*/
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "PubSubClient.h"
+
+#define NET_LOOP_BLOCK_MAX 2000
+#define TEST_SENSOR 7
+#define TEST_DRIVE 20000
+
+unsigned long fakeNow = 0;
+FakeSerial Serial;
+FakeWiFi WiFi;
+
+//Broker e Central simulados: a Central reconhece o cadastro 50 ms após a sua publicação
+bool brokerUp = true, centralUp = true, ackPending = false;
+unsigned long ackAt = 0;
+
+//Leituras do sensor, lotes publicados e instantes em que o atuador 1 (pino D5) foi ligado e desligado
+int samples = 0, batches = 0;
+unsigned long driveOn = 0, driveOff = 0;
+
+void analogWrite(int pin, int value){
+  if(pin != D5) return;
+  if(value != 0) driveOn = fakeNow;
+  else driveOff = fakeNow;
+}
+
+int FakeWiFi::status(){
+  if(!available) st = WL_DISCONNECTED;
+  else if(begins && fakeNow >= joinAt) st = WL_CONNECTED;
+  return st;
+}
+
+void FakeWiFi::begin(const char*, const char*){
+  begins++;
+  joinAt = fakeNow + 3000;
+  st = WL_DISCONNECTED;
+}
+
+bool PubSubClient::connect(const char*, const char*, const char*){
+  connects++;
+  fakeNow += 100;
+  conn = brokerUp && WiFi.status() == WL_CONNECTED;
+  return conn;
+}
+
+bool PubSubClient::publish(const char*, const uint8_t* payload, unsigned int, bool){
+  if(!conn) return false;
+  published++;
+  if(payload[1] == 0x08) batches++;
+  if(payload[1] == 0x00 && centralUp){
+    ackPending = true;
+    ackAt = fakeNow + 50;
+  }
+  return true;
+}
+
+bool PubSubClient::loop(){
+  if(!conn) return false;
+  if(!brokerUp || WiFi.status() != WL_CONNECTED){
+    conn = false;
+    return false;
+  }
+  if(ackPending && fakeNow >= ackAt){
+    //Reconhecimento v1 do cadastro, sem payload
+    uint8_t ack[12] = {0};
+    ack[0] = (1 << 4) | (1 << 3);
+    ack[4] = 12;
+    ackPending = false;
+    cb((char*) "AA:BB:CC:00:00:01", ack, 12);
+  }
+  return true;
+}
+
+int fakeAvailable(){
+  return ackPending && fakeNow >= ackAt;
+}
+
+#include "thing.ino.cpp"
+
+float* sensorStub(uint16_t){
+  static float value;
+  samples++;
+  value = 20 + samples % 5;
+  return &value;
+}
+
+//Entrega ao Cliente uma mensagem v1 da Central (instrução 0x02 ou 0x03) com o payload de 16 bits informado
+static void deliver(uint8_t instruction, const uint16_t* payload, int quantity){
+  uint8_t message[12 + 6] = {0};
+  message[0] = SAPOT_VERSION << 4;
+  message[1] = instruction;
+  message[4] = 12 + 2*quantity;
+  memcpy(&message[12], payload, 2*quantity);
+  MQTTCallBackMessage((char*) "AA:BB:CC:00:00:01", message, 12 + 2*quantity);
+}
+
+typedef struct{
+  unsigned long start;
+  const char* description;
+  bool online;
+  void (*event)();
+}Phase;
+
+static void none(){}
+static void WiFiDown(){ WiFi.available = false; }
+static void WiFiUp(){ WiFi.available = true; }
+static void brokerDown(){ brokerUp = false; }
+static void brokerUpAgain(){ brokerUp = true; }
+static void centralDown(){ centralUp = false; MQTTclient.conn = false; }
+static void centralUpAgain(){ centralUp = true; }
+
+int main(){
+
+  const char* names[] = {"NET_WIFI_OFF", "NET_WIFI_WAIT", "NET_MQTT_OFF", "NET_REGISTER", "NET_ONLINE"};
+  Phase phases[] = {
+    {0, "inicialização", true, none},
+    {60000, "queda da rede sem fio", false, WiFiDown},
+    {90000, "retorno da rede sem fio", true, WiFiUp},
+    {150000, "queda do broker", false, brokerDown},
+    {250000, "retorno do broker", true, brokerUpAgain},
+    {300000, "queda da Central e do broker", false, centralDown},
+    {350000, "retorno da Central", true, centralUpAgain},
+    {450000, NULL, false, none}
+  };
+  int phase, failures = 0, last = -1;
+  unsigned long block = 0;
+
+  Serial.quiet = getenv("V") == NULL;
+  setup();
+
+  //Leitura do sensor TEST_SENSOR a cada segundo (0x1001)
+  const uint16_t request[2] = {TEST_SENSOR, 0x1001};
+  deliver(0x02, request, 2);
+
+  for(phase=0; phases[phase].description != NULL; phase++){
+    bool reached = false;
+    int offState = -1, phaseSamples = samples, phaseBatches = batches;
+    unsigned long end = phases[phase + 1].start;
+
+    phases[phase].event();
+
+    //No início de cada queda, o atuador 1 é acionado com o grau máximo por TEST_DRIVE ms (0x1000 | segundos)
+    if(!phases[phase].online){
+      const uint16_t drive[3] = {1, (uint16_t) (0x1000 | TEST_DRIVE / 1000), 0xFFFF};
+      driveOff = 0;
+      deliver(0x03, drive, 3);
+    }
+
+    while(fakeNow < end){
+      unsigned long before = fakeNow, off = driveOff;
+      SAPoTloop(sensorStub, actuatorControl);
+      if(fakeNow - before > block) block = fakeNow - before;
+      if(driveOff != off) offState = SAPoTnetwork.state;
+      if(SAPoTnetwork.state != last){
+        printf("t=%7lu %s (backoff %lu, connects %d, begins %d)\n", fakeNow, names[SAPoTnetwork.state], SAPoTnetwork.backoff, MQTTclient.connects, WiFi.begins);
+        last = SAPoTnetwork.state;
+      }
+      if((SAPoTnetwork.state == NET_ONLINE) == phases[phase].online) reached = true;
+      fakeNow += 10;
+    }
+    phaseSamples = samples - phaseSamples;
+    phaseBatches = batches - phaseBatches;
+
+    if(!reached){
+      printf("FALHA: %s: o Cliente não %s\n", phases[phase].description, phases[phase].online ? "voltou a NET_ONLINE" : "deixou NET_ONLINE");
+      failures++;
+    }
+    if(!phases[phase].online){
+      unsigned long expected = driveOn + TEST_DRIVE;
+      printf("  %s: atuador ligado em t=%lu e desligado em t=%lu (%s), %d leituras\n", phases[phase].description, driveOn, driveOff, offState >= 0 ? names[offState] : "-", phaseSamples);
+      if(driveOn < phases[phase].start || driveOff < expected || driveOff > expected + NET_LOOP_BLOCK_MAX || offState == NET_ONLINE){
+        printf("FALHA: %s: o atuador não foi desligado sem conexão em t=%lu\n", phases[phase].description, expected);
+        failures++;
+      }
+    }
+    if(phaseSamples < (int) ((end - phases[phase].start) / 1000) - 1){
+      printf("FALHA: %s: apenas %d leituras em %lu s\n", phases[phase].description, phaseSamples, (end - phases[phase].start) / 1000);
+      failures++;
+    }
+    if(phase > 0 && phases[phase].online && phaseBatches == 0){
+      printf("FALHA: %s: nenhuma leitura publicada\n", phases[phase].description);
+      failures++;
+    }
+  }
+
+  printf("maior bloqueio do SAPoTloop(): %lu ms\n", block);
+  if(block > NET_LOOP_BLOCK_MAX){
+    printf("FALHA: o SAPoTloop() bloqueou por mais de %d ms\n", NET_LOOP_BLOCK_MAX);
+    failures++;
+  }
+
+  puts(failures ? "network_test: FALHOU" : "network_test: OK");
+  return failures ? 1 : 0;
+}